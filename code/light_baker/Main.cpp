@@ -0,0 +1,464 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+/*
+Standalone light baker. Loads a map and its materials from a game directory (e.g. an extracted baseq3), bakes the lightmaps without creating a window, and writes them out.
+
+The renderer is compiled in, with this file standing in for the engine: the interface namespace is implemented here instead of in Interface_ioq3.cpp.
+*/
+#include "../renderer_bgfx/Precompiled.h"
+#pragma hdrstop
+
+#include <bx/file.h>
+
+namespace renderer {
+
+struct cvar_t
+{
+	std::string name;
+	std::string string;
+	float value;
+	int integer;
+	bool modified;
+};
+
+namespace tool {
+
+static bx::FilePath s_gamePath;
+static bx::FilePath s_outputPath;
+static std::vector<std::unique_ptr<cvar_t>> s_cvars;
+
+/// Set if writing any output file failed.
+static bool s_writeFailed = false;
+
+/// All clusters visible. Only used for culling, which doesn't matter here.
+static std::array<uint8_t, 8192> s_allVisible;
+
+static cvar_t *FindCvar(const char *name)
+{
+	for (std::unique_ptr<cvar_t> &cvar : s_cvars)
+	{
+		if (!util::Stricmp(cvar->name.c_str(), name))
+			return cvar.get();
+	}
+
+	return nullptr;
+}
+
+static void SetCvar(cvar_t *cvar, const char *value)
+{
+	cvar->string = value;
+	cvar->value = (float)atof(value);
+	cvar->integer = atoi(value);
+	cvar->modified = true;
+}
+
+static bx::FilePath GamePath(const char *filename)
+{
+	bx::FilePath path(s_gamePath);
+	path.join(filename);
+	return path;
+}
+
+} // namespace tool
+
+void ConsoleVariable::checkRange(float minValue, float maxValue, bool shouldBeIntegral)
+{
+}
+
+void ConsoleVariable::clearModified()
+{
+	cvar->modified = false;
+}
+
+bool ConsoleVariable::getBool() const
+{
+	return cvar->integer != 0;
+}
+
+const char *ConsoleVariable::getString() const
+{
+	return cvar->string.c_str();
+}
+
+float ConsoleVariable::getFloat() const
+{
+	return cvar->value;
+}
+
+int ConsoleVariable::getInt() const
+{
+	return cvar->integer;
+}
+
+bool ConsoleVariable::isModified() const
+{
+	return cvar->modified;
+}
+
+void ConsoleVariable::setDescription(const char *description)
+{
+}
+
+namespace interface
+{
+	void CIN_UploadCinematic(int handle)
+	{
+	}
+
+	int CIN_PlayCinematic(const char *arg0, int xpos, int ypos, int width, int height)
+	{
+		return -1;
+	}
+
+	void CIN_RunCinematic(int handle)
+	{
+	}
+
+	void CL_WriteAVIVideoFrame(const uint8_t *buffer, int size)
+	{
+	}
+
+	void Cmd_Add(const char *name, void(*cmd)(void))
+	{
+	}
+
+	void Cmd_Remove(const char *name)
+	{
+	}
+
+	int Cmd_Argc()
+	{
+		return 0;
+	}
+
+	const char *Cmd_Argv(int i)
+	{
+		return "";
+	}
+
+	const uint8_t *CM_ClusterPVS(int cluster)
+	{
+		return tool::s_allVisible.data();
+	}
+
+	ConsoleVariable Cvar_Get(const char *name, const char *value, int flags)
+	{
+		ConsoleVariable cvar;
+		cvar.cvar = tool::FindCvar(name);
+
+		if (!cvar.cvar)
+		{
+			tool::s_cvars.push_back(std::make_unique<cvar_t>());
+			cvar.cvar = tool::s_cvars.back().get();
+			cvar.cvar->name = name;
+			tool::SetCvar(cvar.cvar, value);
+		}
+
+		return cvar;
+	}
+
+	int Cvar_GetInteger(const char *name)
+	{
+		cvar_t *cvar = tool::FindCvar(name);
+		return cvar ? cvar->integer : 0;
+	}
+
+	void Cvar_Set(const char *name, const char *value)
+	{
+		cvar_t *cvar = tool::FindCvar(name);
+
+		if (cvar)
+			tool::SetCvar(cvar, value);
+		else
+			Cvar_Get(name, value, 0);
+	}
+
+	static void Error(const char *format, va_list args)
+	{
+		char text[4096];
+		util::Vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		fprintf(stderr, "Error: %s\n", text);
+		exit(1);
+	}
+
+	void Error(const char *format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		Error(format, args);
+	}
+
+	void FatalError(const char *format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		Error(format, args);
+	}
+
+	long FS_ReadFile(const char *name, uint8_t **buf)
+	{
+		bx::FileReader reader;
+		bx::Error err;
+
+		if (!bx::open(&reader, tool::GamePath(name), &err))
+			return -1;
+
+		const int64_t size = bx::getSize(&reader);
+
+		if (buf)
+		{
+			*buf = (uint8_t *)malloc(size + 1);
+			bx::read(&reader, *buf, (int32_t)size, &err);
+			(*buf)[size] = 0; // Text files are expected to be null terminated.
+		}
+
+		bx::close(&reader);
+		return (long)size;
+	}
+
+	void FS_FreeReadFile(uint8_t *buf)
+	{
+		free(buf);
+	}
+
+	bool FS_FileExists(const char *filename)
+	{
+		bx::FileInfo info;
+		return bx::stat(info, tool::GamePath(filename)) && info.type == bx::FileType::File;
+	}
+
+	char **FS_ListFiles(const char *name, const char *extension, int *numFilesFound)
+	{
+		std::vector<std::string> filenames;
+		bx::DirectoryReader reader;
+		bx::Error err;
+
+		if (bx::open(&reader, tool::GamePath(name), &err))
+		{
+			bx::FileInfo info;
+
+			while (bx::read(&reader, info, &err) == sizeof(info))
+			{
+				if (info.type != bx::FileType::File)
+					continue;
+
+				const char *filename = info.filePath.getCPtr();
+
+				if (extension && util::Stricmp(util::GetExtension(filename), extension[0] == '.' ? extension + 1 : extension))
+					continue;
+
+				filenames.push_back(filename);
+			}
+
+			bx::close(&reader);
+		}
+
+		// Null terminated list, the same as the engine.
+		auto list = (char **)malloc((filenames.size() + 1) * sizeof(char *));
+
+		for (size_t i = 0; i < filenames.size(); i++)
+		{
+			list[i] = (char *)malloc(filenames[i].length() + 1);
+			strcpy(list[i], filenames[i].c_str());
+		}
+
+		list[filenames.size()] = nullptr;
+		*numFilesFound = (int)filenames.size();
+		return list;
+	}
+
+	void FS_FreeListFiles(char **fileList)
+	{
+		if (!fileList)
+			return;
+
+		for (char **filename = fileList; *filename; filename++)
+			free(*filename);
+
+		free(fileList);
+	}
+
+	void FS_WriteFile(const char *filename, const uint8_t *buffer, size_t size)
+	{
+		bx::FilePath path(tool::s_outputPath);
+		path.join(filename);
+		bx::makeAll(path.getPath());
+		bx::FileWriter writer;
+		bx::Error err;
+
+		if (!bx::open(&writer, path, false, &err))
+		{
+			PrintWarningf("Error writing %s\n", path.getCPtr());
+			tool::s_writeFailed = true;
+			return;
+		}
+
+		bx::write(&writer, buffer, (int32_t)size, &err);
+		bx::close(&writer);
+
+		if (!err.isOk())
+		{
+			PrintWarningf("Error writing %s\n", path.getCPtr());
+			tool::s_writeFailed = true;
+		}
+	}
+
+	int GetTime()
+	{
+		return (int)SDL_GetTicks();
+	}
+
+	void *Hunk_Alloc(int size)
+	{
+		return calloc(1, size);
+	}
+
+	void IN_Init(void *windowData)
+	{
+	}
+
+	void IN_Shutdown()
+	{
+	}
+
+	static void Print(FILE *stream, const char *format, va_list args)
+	{
+		char text[4096];
+		util::Vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		fputs(text, stream);
+	}
+
+	void Printf(const char *format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		Print(stdout, format, args);
+	}
+
+	void PrintDeveloperf(const char *format, ...)
+	{
+	}
+
+	void PrintWarningf(const char *format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		Print(stderr, format, args);
+	}
+}
+
+} // namespace renderer
+
+using namespace renderer;
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: light_baker [options] <game directory> <map>\n"
+		"   e.g. light_baker baseq3 q3dm1\n"
+		"Options:\n"
+		"   -areaLightCutoff <n>  Area lights that can contribute less than this to a luxel are only sampled some of the time. 0 samples all of them. Defaults to 1.\n"
+		"   -output <directory>   Where to write maps/<map>.lightmaps. Defaults to the game directory.\n"
+		"   -samples <n>          Jitter samples per luxel, 1-16. Defaults to 1.\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *gameDirectory = nullptr;
+	const char *outputDirectory = nullptr;
+	const char *mapName = nullptr;
+	int nSamples = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!util::Stricmp(argv[i], "-areaLightCutoff") && i + 1 < argc)
+		{
+			interface::Cvar_Set("r_bakeAreaLightCutoff", argv[++i]);
+		}
+		else if (!util::Stricmp(argv[i], "-output") && i + 1 < argc)
+		{
+			outputDirectory = argv[++i];
+		}
+		else if (!util::Stricmp(argv[i], "-samples") && i + 1 < argc)
+		{
+			nSamples = atoi(argv[++i]);
+		}
+		else if (argv[i][0] == '-')
+		{
+			PrintUsage();
+			return 1;
+		}
+		else if (!gameDirectory)
+		{
+			gameDirectory = argv[i];
+		}
+		else if (!mapName)
+		{
+			mapName = argv[i];
+		}
+	}
+
+	if (!gameDirectory || !mapName)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	tool::s_gamePath.set(gameDirectory);
+	tool::s_outputPath.set(outputDirectory ? outputDirectory : gameDirectory);
+	tool::s_allVisible.fill(0xff);
+	char mapFilename[MAX_QPATH];
+	util::Sprintf(mapFilename, sizeof(mapFilename), "maps/%s.bsp", mapName);
+
+	if (!interface::FS_FileExists(mapFilename))
+	{
+		fprintf(stderr, "Error: %s not found in %s\n", mapFilename, gameDirectory);
+		return 1;
+	}
+
+	main::Initialize(true);
+	main::LoadWorld(mapFilename);
+
+	// Indirect light is always ray traced, there's no GPU to render hemicubes with.
+	light_baker::Start(nSamples, true);
+
+	if (!light_baker::IsRunning())
+	{
+		main::Shutdown(true);
+		return 1;
+	}
+
+	// Drive the light baker state machine the same way the renderer does once per frame. The noop backend makes frames cheap.
+	while (light_baker::IsRunning())
+	{
+		const uint32_t frameNo = bgfx::frame();
+		light_baker::Update(frameNo);
+		SDL_Delay(10);
+	}
+
+	// Anything but a finished bake is a failure: an error, embree failing, or being cancelled.
+	const bool succeeded = light_baker::Succeeded() && !tool::s_writeFailed;
+	main::Shutdown(true);
+	return succeeded ? 0 : 1;
+}
@@ -507,6 +507,16 @@ public:
 		return (&x)[index];
 	}
 
+	bool operator==(const vec4 &v) const
+	{
+		return x == v.x && y == v.y && z == v.z && w == v.w;
+	}
+
+	bool operator!=(const vec4 &v) const
+	{
+		return !(*this == v);
+	}
+
 	vec4 operator*(float value) const
 	{
 		return vec4(x * value, y * value, z * value, w * value);
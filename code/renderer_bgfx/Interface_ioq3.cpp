@@ -528,6 +528,11 @@ namespace interface
 		ri.CIN_RunCinematic(handle);
 	}
 
+	void CL_WriteAVIVideoFrame(const uint8_t *buffer, int size)
+	{
+		ri.CL_WriteAVIVideoFrame(buffer, size);
+	}
+
 	void Cmd_Add(const char *name, void(*cmd)(void))
 	{
 		ri.Cmd_AddCommand(name, cmd);
@@ -951,6 +956,8 @@ static qboolean RE_inPVS(const vec3_t p1, const vec3_t p2)
 
 static void RE_TakeVideoFrame(int h, int w, byte* captureBuffer, byte *encodeBuffer, qboolean motionJpeg)
 {
+	// The renderer captures and encodes frames itself, so the engine's buffers aren't needed.
+	main::TakeVideoFrame(motionJpeg == qtrue);
 }
 
 } // namespace renderer
@@ -185,6 +185,7 @@ namespace interface
 	void CIN_UploadCinematic(int handle);
 	int CIN_PlayCinematic(const char *arg0, int xpos, int ypos, int width, int height);
 	void CIN_RunCinematic(int handle);
+	void CL_WriteAVIVideoFrame(const uint8_t *buffer, int size);
 	void Cmd_Add(const char *name, void(*cmd)(void));
 	void Cmd_Remove(const char *name);
 	int Cmd_Argc();
@@ -668,6 +668,11 @@ namespace interface
 		ri.CIN_RunCinematic(handle);
 	}
 
+	void CL_WriteAVIVideoFrame(const uint8_t *buffer, int size)
+	{
+		ri.CL_WriteAVIVideoFrame(buffer, size);
+	}
+
 	void Cmd_Add(const char *name, void(*cmd)(void))
 	{
 		ri.Cmd_AddCommand(name, cmd);
@@ -1150,6 +1155,8 @@ static qboolean RE_GetEntityToken(char *buffer, int size)
 
 static void RE_TakeVideoFrame(int h, int w, byte* captureBuffer, byte *encodeBuffer, qboolean motionJpeg)
 {
+	// The renderer captures and encodes frames itself, so the engine's buffers aren't needed.
+	main::TakeVideoFrame(motionJpeg == qtrue);
 }
 
 #if (defined _MSC_VER)
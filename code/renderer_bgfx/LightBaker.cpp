@@ -47,6 +47,9 @@ std::unique_ptr<LightBaker> s_lightBaker;
 std::unique_ptr<LightBakerPersistent> s_lightBakerPersistent;
 std::vector<AreaLight> s_areaLights;
 
+/// The status the last bake stopped with. Kept after s_lightBaker is destroyed, so the caller can tell if it succeeded.
+static LightBaker::Status s_finalStatus = LightBaker::Status::NotStarted;
+
 static void lmImageDilate(const float *image, float *outImage, int w, int h, int c)
 {
 	assert(c > 0 && c <= 4);
@@ -151,12 +154,45 @@ static void EncodeLightmaps()
 		for (int i = 0; i < lightmapSize.x * lightmapSize.y; i++)
 		{
 			// Colors are floats, but in 0-255+ range.
-			lightmap.encodedPassColor[i] = vec4b(vec4(util::OverbrightenColor(lightmap.passColor[i] / 255.0f), 1));
-			lightmap.encodedAccumulatedColor[i] = vec4b(vec4(util::OverbrightenColor(lightmap.accumulatedColor[i] / 255.0f), 1));
+			lightmap.encodedPassColor[i] = world::EncodeLightmapColor(lightmap.passColor[i] / 255.0f);
+			lightmap.encodedAccumulatedColor[i] = world::EncodeLightmapColor(lightmap.accumulatedColor[i] / 255.0f);
 		}
 	}
 }
 
+/// Write the lightmaps to maps/[map name].lightmaps. world::Load uses them instead of the BSP lightmaps from then on.
+static void WriteLightmaps()
+{
+	const vec2i lightmapSize = world::GetLightmapSize();
+	const size_t nLuxels = lightmapSize.x * lightmapSize.y;
+	const size_t lightmapsSize = s_lightBaker->lightmaps.size() * nLuxels * sizeof(uint32_t);
+	std::vector<uint8_t> fileData(sizeof(world::BakedLightmapsHeader) + lightmapsSize + s_lightBaker->lightGridData.size());
+	auto header = (world::BakedLightmapsHeader *)fileData.data();
+	header->ident = LittleLong(BAKED_LIGHTMAPS_IDENT);
+	header->version = LittleLong(BAKED_LIGHTMAPS_VERSION);
+	header->bspChecksum = LittleLong(world::s_world->checksum);
+	header->nLightmaps = LittleLong((int)s_lightBaker->lightmaps.size());
+	header->width = LittleLong(lightmapSize.x);
+	header->height = LittleLong(lightmapSize.y);
+	header->lightGridSize = LittleLong((int)s_lightBaker->lightGridData.size());
+	auto luxels = (uint32_t *)(fileData.data() + sizeof(world::BakedLightmapsHeader));
+
+	// Store the accumulated color rather than the encoded color. Overbrightening is applied on load, same as BSP lightmaps.
+	for (const Lightmap &lightmap : s_lightBaker->lightmaps)
+	{
+		for (size_t i = 0; i < nLuxels; i++)
+			*(luxels++) = LittleLong(util::EncodeRGB9E5(lightmap.accumulatedColor[i] / 255.0f));
+	}
+
+	if (!s_lightBaker->lightGridData.empty())
+		memcpy(fileData.data() + sizeof(world::BakedLightmapsHeader) + lightmapsSize, s_lightBaker->lightGridData.data(), s_lightBaker->lightGridData.size());
+
+	char filename[MAX_QPATH];
+	util::Sprintf(filename, sizeof(filename), "maps/%s.lightmaps", world::s_world->baseName);
+	interface::FS_WriteFile(filename, fileData.data(), fileData.size());
+	interface::Printf("Wrote %s\n", filename);
+}
+
 /*
 ================================================================================
 LIGHT BAKER THREAD AND INTERFACE
@@ -194,7 +230,12 @@ static int Thread(void *data)
 	for (Lightmap &lightmap : s_lightBaker->lightmaps)
 	{
 		lightmap.duplicateBits.resize(lightmapSize.x * lightmapSize.y / 8);
+		lightmap.interpolatedBits.resize(lightmapSize.x * lightmapSize.y / 8);
 		lightmap.passColor.resize(lightmapSize.x * lightmapSize.y);
+
+		if (s_lightBaker->cpuIndirect)
+			lightmap.previousPassColor.resize(lightmapSize.x * lightmapSize.y);
+
 		lightmap.accumulatedColor.resize(lightmapSize.x * lightmapSize.y);
 		lightmap.encodedPassColor.resize(lightmapSize.x * lightmapSize.y);
 		lightmap.encodedAccumulatedColor.resize(lightmapSize.x * lightmapSize.y);
@@ -235,9 +276,15 @@ static int Thread(void *data)
 	if (!ThreadUpdateLightmaps())
 		return 1;
 
-	// Ready for indirect lighting, which happens in the main thread. Wait until it finishes.
+	// Ready for indirect lighting. Hemicubes are rendered in the main thread, wait until it finishes. Ray tracing on the CPU happens in this thread.
 	for (int i = 0; i < s_lightBaker->nIndirectBounces; i++)
 	{
+		if (s_lightBaker->cpuIndirect)
+		{
+			for (Lightmap &lightmap : s_lightBaker->lightmaps)
+				lightmap.previousPassColor = lightmap.passColor;
+		}
+
 		ClearPassColor();
 
 #ifdef DEBUG_LIGHTMAP_INTERPOLATION
@@ -247,17 +294,25 @@ static int Thread(void *data)
 		}
 #endif
 
-		SetStatus(LightBaker::Status::BakingIndirectLight_Started);
-
-		for (;;)
+		if (s_lightBaker->cpuIndirect)
 		{
-			// Check for cancelling.
-			if (GetStatus() == LightBaker::Status::Cancelled)
+			if (!BakeIndirectLightCpu())
 				return 1;
-			else if (GetStatus() == LightBaker::Status::BakingIndirectLight_Finished)
-				break;
+		}
+		else
+		{
+			SetStatus(LightBaker::Status::BakingIndirectLight_Started);
 
-			SDL_Delay(50);
+			for (;;)
+			{
+				// Check for cancelling.
+				if (GetStatus() == LightBaker::Status::Cancelled)
+					return 1;
+				else if (GetStatus() == LightBaker::Status::BakingIndirectLight_Finished)
+					break;
+
+				SDL_Delay(50);
+			}
 		}
 
 		AccumulatePassColor();
@@ -276,17 +331,27 @@ static int Thread(void *data)
 			return 1;
 	}
 
+	// Entities are lit by the light grid, which doesn't match the lightmaps anymore.
+	if (!BakeLightGrid())
+		return 1;
+
 	SetStatus(LightBaker::Status::Finished);
 	return 0;
 }
 
-void Start(int nSamples)
+bool IsRunning()
+{
+	return s_lightBaker.get() != nullptr;
+}
+
+void Start(int nSamples, bool cpuIndirect)
 {
 	if (s_lightBaker.get() || !world::IsLoaded())
 		return;
 
 	s_lightBaker = std::make_unique<LightBaker>();
 	s_lightBakerPersistent = std::make_unique<LightBakerPersistent>();
+	s_finalStatus = LightBaker::Status::Error;
 
 	if (!InitializeEmbree())
 	{
@@ -295,7 +360,13 @@ void Start(int nSamples)
 	}
 
 	LoadAreaLightTextures();
+	s_lightBaker->cpuIndirect = cpuIndirect;
+
+	if (cpuIndirect)
+		LoadSurfaceAlbedos();
+
 	s_lightBaker->nSamples = math::Clamped(nSamples, 1, (int)LightBaker::maxSamples);
+	s_lightBaker->areaLightCutoff = std::max(0.0f, g_cvars.bakeAreaLightCutoff.getFloat());
 	s_lightBaker->startTime = bx::getHPCounter();
 	s_lightBaker->mutex = SDL_CreateMutex();
 
@@ -333,10 +404,16 @@ void Stop()
 		SDL_WaitThread(s_lightBaker->thread, NULL);
 	}
 
+	s_finalStatus = GetStatus();
 	ShutdownEmbree();
 	s_lightBaker.reset();
 }
 
+bool Succeeded()
+{
+	return s_finalStatus == LightBaker::Status::Finished;
+}
+
 void Shutdown()
 {
 	Stop();
@@ -384,6 +461,113 @@ void SetStatus(LightBaker::Status status, int progress)
 	}
 }
 
+/// Shared by the ParallelFor worker threads.
+struct ParallelForJob
+{
+	const std::function<void(int item)> *func;
+	int nItems;
+	int tileSize;
+
+	/// The first item of the next tile to be claimed.
+	SDL_atomic_t nextItem;
+
+	SDL_atomic_t nFinishedItems;
+
+	/// Set by the light baker thread to stop the workers early.
+	SDL_atomic_t cancelled;
+};
+
+static int ParallelForWorkerThread(void *data)
+{
+	auto job = (ParallelForJob *)data;
+
+	for (;;)
+	{
+		if (SDL_AtomicGet(&job->cancelled))
+			break;
+
+		// Claim the next tile.
+		const int firstItem = SDL_AtomicAdd(&job->nextItem, job->tileSize);
+
+		if (firstItem >= job->nItems)
+			break;
+
+		const int lastItem = std::min(firstItem + job->tileSize, job->nItems);
+
+		for (int i = firstItem; i < lastItem; i++)
+			(*job->func)(i);
+
+		SDL_AtomicAdd(&job->nFinishedItems, lastItem - firstItem);
+	}
+
+	return 0;
+}
+
+bool ParallelFor(int nItems, int tileSize, LightBaker::Status status, int progressStart, int progressEnd, const char *threadName, const std::function<void(int item)> &func)
+{
+	if (nItems <= 0)
+		return true;
+
+	ParallelForJob job;
+	job.func = &func;
+	job.nItems = nItems;
+	job.tileSize = tileSize;
+	SDL_AtomicSet(&job.nextItem, 0);
+	SDL_AtomicSet(&job.nFinishedItems, 0);
+	SDL_AtomicSet(&job.cancelled, 0);
+	std::vector<SDL_Thread *> threads;
+	const int nThreads = std::max(1, SDL_GetCPUCount());
+
+	for (int i = 0; i < nThreads; i++)
+	{
+		SDL_Thread *thread = SDL_CreateThread(ParallelForWorkerThread, threadName, &job);
+
+		if (!thread)
+		{
+			interface::PrintWarningf("Creating light baker thread %s failed. Reason: \"%s\"", threadName, SDL_GetError());
+			break;
+		}
+
+		threads.push_back(thread);
+	}
+
+	// Do all the work on this thread if no worker threads could be created.
+	if (threads.empty())
+		ParallelForWorkerThread(&job);
+
+	// Update progress until the workers have finished.
+	int progress = -1;
+	bool cancelled = false;
+
+	while (!threads.empty() && SDL_AtomicGet(&job.nFinishedItems) < nItems)
+	{
+		// Check for cancelling.
+		if (GetStatus() == LightBaker::Status::Cancelled)
+		{
+			SDL_AtomicSet(&job.cancelled, 1);
+			cancelled = true;
+			break;
+		}
+
+		const int newProgress = progressStart + int(SDL_AtomicGet(&job.nFinishedItems) / (float)nItems * (progressEnd - progressStart));
+
+		if (newProgress != progress)
+		{
+			progress = newProgress;
+			SetStatus(status, progress);
+		}
+
+		SDL_Delay(50);
+	}
+
+	for (SDL_Thread *thread : threads)
+	{
+		SDL_WaitThread(thread, nullptr);
+	}
+
+	return !cancelled;
+}
+
 static float ToSeconds(int64_t t)
 {
 	return t * (1.0f / (float)bx::getHPFrequency());
@@ -411,6 +595,10 @@ void Update(uint32_t frameNo)
 	{
 		main::DebugPrint("Baking direct lighting... %d", progress);
 	}
+	else if (status == LightBaker::Status::BakingLightGrid)
+	{
+		main::DebugPrint("Baking light grid... %d", progress);
+	}
 	else if (status == LightBaker::Status::BakingIndirectLight_Started)
 	{
 		InitializeIndirectLight();
@@ -427,7 +615,8 @@ void Update(uint32_t frameNo)
 	{
 		main::DebugPrint("Baking indirect lighting... %d", progress);
 
-		if (!BakeIndirectLight(frameNo))
+		// Ray traced indirect light is baked entirely in the light baker thread.
+		if (!s_lightBaker->cpuIndirect && !BakeIndirectLight(frameNo))
 		{
 			if (s_lightBaker->currentIndirectBounce == s_lightBaker->nIndirectBounces - 1)
 			{
@@ -449,12 +638,12 @@ void Update(uint32_t frameNo)
 			{
 				const Lightmap &lightmap = s_lightBaker->lightmaps[i];
 				Texture *texture = world::GetLightmap(i);
-				texture->update(bgfx::makeRef(lightmap.encodedAccumulatedColor.data(), uint32_t(lightmap.encodedAccumulatedColor.size() * sizeof(vec4b))), 0, 0, lightmapSize.x, lightmapSize.y);
+				texture->update(bgfx::makeRef(lightmap.encodedAccumulatedColor.data(), uint32_t(lightmap.encodedAccumulatedColor.size() * sizeof(uint32_t))), 0, 0, lightmapSize.x, lightmapSize.y);
 
 				if (!s_lightBaker->hemicubeLightmaps.empty())
 				{
 					texture = s_lightBaker->hemicubeLightmaps[i];
-					texture->update(bgfx::makeRef(lightmap.encodedPassColor.data(), uint32_t(lightmap.encodedPassColor.size() * sizeof(vec4b))), 0, 0, lightmapSize.x, lightmapSize.y);
+					texture->update(bgfx::makeRef(lightmap.encodedPassColor.data(), uint32_t(lightmap.encodedPassColor.size() * sizeof(uint32_t))), 0, 0, lightmapSize.x, lightmapSize.y);
 				}
 			}
 
@@ -474,12 +663,27 @@ void Update(uint32_t frameNo)
 		interface::Printf("      %0.2f seconds for rasterization\n", ToSeconds(s_lightBaker->rasterizationTime));
 		interface::Printf("      %0.2f seconds for direct lighting\n", ToSeconds(s_lightBaker->directBakeTime));
 		interface::Printf("      %0.2f seconds for indirect lighting\n", ToSeconds(s_lightBaker->indirectBakeTime));
+		interface::Printf("      %0.2f seconds for the light grid\n", ToSeconds(s_lightBaker->lightGridBakeTime));
 		interface::Printf("   %d luxels\n", s_lightBaker->totalLuxels);
 		interface::Printf("   %0.2f ms elapsed per luxel\n", (bx::getHPCounter() - s_lightBaker->startTime) * (1000.0f / (float)bx::getHPFrequency()) / s_lightBaker->totalLuxels);
 		interface::Printf("   %d hemicube batches\n", s_lightBaker->nHemicubeBatchesProcessed);
-		interface::Printf("   %d interpolated luxels\n", s_lightBaker->nInterpolatedLuxels);
-		interface::Printf("   %d area lights\n", (int)s_areaLights.size());
+		interface::Printf("   %d indirect luxels baked, %d interpolated\n", s_lightBaker->nIndirectLuxelsBaked, s_lightBaker->nInterpolatedLuxels);
+
+		// Every baked luxel is one hemicube, or nIndirectRays rays on the CPU.
+		if (s_lightBaker->nIndirectLuxelsBaked > 0)
+			interface::Printf("   %0.2fx fewer %s than baking every luxel\n", (s_lightBaker->nIndirectLuxelsBaked + s_lightBaker->nInterpolatedLuxels) / (double)s_lightBaker->nIndirectLuxelsBaked, s_lightBaker->cpuIndirect ? "rays" : "hemicubes");
+
+		if (s_lightBaker->nInterpolationErrorSamples > 0)
+			interface::Printf("   %0.2f%% mean interpolation error (%d luxels checked)\n", s_lightBaker->interpolationErrorSum / std::max(s_lightBaker->interpolationReferenceSum, 1.0) * 100.0, s_lightBaker->nInterpolationErrorSamples);
+
+		interface::Printf("   %d area lights, %d samples, %0.1f samples evaluated per luxel (cutoff %g)\n", (int)s_areaLights.size(), s_lightBaker->nAreaLightSamples, s_lightBaker->nAreaLightSamplesEvaluated / (double)std::max(1, s_lightBaker->totalLuxels), s_lightBaker->areaLightCutoff);
 		interface::Printf("   %d entity lights\n", (int)s_lightBaker->lights.size());
+		interface::Printf("   %d light grid points\n", int(s_lightBaker->lightGridData.size() / 8));
+
+		if (!s_lightBaker->lightGridData.empty())
+			world::SetLightGridData(s_lightBaker->lightGridData.data(), s_lightBaker->lightGridData.size());
+
+		WriteLightmaps();
 		Stop();
 	}
 	else if (status == LightBaker::Status::Error)
@@ -67,6 +67,7 @@ struct AreaLightSample
 	vec3 position;
 	vec2 texCoord;
 	float photons;
+	float area;
 	Winding winding;
 };
 
@@ -79,6 +80,35 @@ struct AreaLight
 	std::vector<AreaLightSample> samples;
 };
 
+/// @brief Node of a bounding volume hierarchy over every area light sample.
+/// @remarks Luxels use it to skip groups of samples that can't contribute a significant amount of light. See BakeAreaLights.
+struct AreaLightNode
+{
+	/// @brief Bounds of the sample windings.
+	Bounds bounds;
+
+	/// @brief Sum of photons * area of the samples.
+	float power;
+
+	/// @brief Sum of photons of the samples.
+	float photons;
+
+	/// @brief True if any of the samples are from two-sided materials.
+	bool twoSided;
+
+	/// @brief The children are firstChild and firstChild + 1. 0 if this is a leaf.
+	uint32_t firstChild;
+
+	/// @brief Range of LightBaker::areaLightNodeSamples. Leaves only.
+	uint32_t firstSample, nSamples;
+};
+
+struct AreaLightSampleRef
+{
+	uint32_t light; // Index into s_areaLights.
+	uint32_t sample; // Index into AreaLight::samples.
+};
+
 struct FaceFlags
 {
 	enum
@@ -90,6 +120,11 @@ struct FaceFlags
 struct Luxel
 {
 	bool sentinel; // True if finished rasterization.
+
+	/// @brief True if finished an interpolation pass. No other fields are set.
+	/// @remarks The next pass interpolates from the luxels rasterized so far, so their colors must be written to Lightmap::passColor before continuing.
+	bool endOfPass;
+
 	int lightmapIndex;
 	vec3 position;
 	vec3 normal;
@@ -97,32 +132,80 @@ struct Luxel
 	int offset; // Offset into Lightmap::color.
 };
 
+/// @brief Deterministic per-luxel random numbers, so the result doesn't depend on which worker thread bakes a luxel.
+struct LuxelRandom
+{
+	uint32_t state;
+
+	LuxelRandom(const Luxel &luxel)
+	{
+		const vec2i lightmapSize = world::GetLightmapSize();
+		state = uint32_t(luxel.offset + luxel.lightmapIndex * lightmapSize.x * lightmapSize.y) * 747796405u + 2891336453u;
+	}
+
+	LuxelRandom(uint32_t seed) : state(seed * 747796405u + 2891336453u) {}
+
+	/// @return A float in the range [0, 1).
+	float next()
+	{
+		// xorshift32
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
 struct Lightmap
 {
 	/// @brief Avoid rasterizing the same luxel with different primitives.
 	std::vector<uint8_t> duplicateBits;
 
+	/// @brief Luxels that were interpolated from their neighbors instead of being rasterized, since the last call to InitializeRasterization.
+	std::vector<uint8_t> interpolatedBits;
+
 	/// @brief Color data for this pass (direct or an indirect bounce).
 	std::vector<vec3> passColor;
 
+	/// @brief Color data of the previous pass. Sampled by rays when baking indirect light on the CPU.
+	std::vector<vec3> previousPassColor;
+
 	/// @brief Accumulated color data of all passes.
 	std::vector<vec3> accumulatedColor;
 
-	/// @brief Pass color data encoded to RGBM.
-	std::vector<vec4b> encodedPassColor;
+	/// @brief Pass color data encoded to the lightmap texture format. See world::EncodeLightmapColor.
+	std::vector<uint32_t> encodedPassColor;
 
-	/// @brief Accumulated color data encoded to RGBM.
-	std::vector<vec4b> encodedAccumulatedColor;
+	/// @brief Accumulated color data encoded to the lightmap texture format.
+	std::vector<uint32_t> encodedAccumulatedColor;
 
 #ifdef DEBUG_LIGHTMAP_INTERPOLATION
 	std::vector<uint8_t> interpolationDebug; // width * height * 3
 #endif
 };
 
+/// @brief Average diffuse texture color of a material, used to tint indirect light bounced off surfaces with that material.
+struct SurfaceAlbedo
+{
+	const Material *material;
+	vec3 color;
+};
+
+/// @brief Where a ray hitting an embree triangle should read the lightmap when baking indirect light on the CPU.
+struct TriangleLightmapInfo
+{
+	/// @remarks -1 if the triangle isn't lightmapped.
+	int lightmapIndex;
+
+	vec2 texCoords[3];
+	vec3 albedo;
+};
+
 struct HemicubeLocation
 {
 	Lightmap *lightmap;
 	int luxelOffset;
+	bool measureError; ///< The luxel was interpolated. Compare the hemicube with its color instead of writing it.
 };
 
 struct LightBaker
@@ -140,6 +223,7 @@ struct LightBaker
 		BakingIndirectLight_Started,
 		BakingIndirectLight_Running,
 		BakingIndirectLight_Finished,
+		BakingLightGrid,
 		TextureUpdateWaiting,
 		TextureUpdateFinished,
 		Finished,
@@ -155,18 +239,29 @@ struct LightBaker
 	//std::vector<LightBaker::AreaLight> areaLights;
 	std::vector<uint8_t> areaLightVisData;
 	int areaLightClusterBytes;
+	std::vector<AreaLightNode> areaLightNodes; // The root is the first node.
+	std::vector<AreaLightSampleRef> areaLightNodeSamples;
+	int nAreaLightSamples = 0;
+	int64_t nAreaLightSamplesEvaluated = 0;
+
+	/// @brief Area light BVH nodes that can contribute less than this much light to a luxel (0-255 color range) are only evaluated some of the time, proportional to how much light they can contribute.
+	/// @remarks Set from r_bakeAreaLightCutoff. 0 evaluates every sample.
+	float areaLightCutoff;
 
 	// entity lights (point and spot)
 	vec3 ambientLight;
 	std::vector<StaticLight> lights;
 
+	/// Same layout as the BSP light grid lump, before overbrightening. Swapped into the world when baking has finished.
+	std::vector<uint8_t> lightGridData;
+
 	// jitter/multisampling
 	int nSamples;
 	static const int maxSamples = 16;
 	std::array<vec3, maxSamples> dirJitter, posJitter;
 
 	// profiling
-	int64_t startTime, rasterizationTime, directBakeTime, indirectBakeStartTime, indirectBakeTime;
+	int64_t startTime, rasterizationTime, directBakeTime, indirectBakeStartTime, indirectBakeTime, lightGridBakeTime;
 
 	uint32_t textureUpdateFrameNo = 0; // lightmap textures were updated this frame
 	int totalLuxels; // calculated when rasterizing direct light (since it doesn't use interpolation)
@@ -181,6 +276,14 @@ struct LightBaker
 	RTCScene embreeScene = nullptr;
 	std::vector<uint8_t> faceFlags;
 
+	/// @remarks Indexed by embree primitive ID. Only used if cpuIndirect is true.
+	std::vector<TriangleLightmapInfo> triangleLightmapInfo;
+
+	// indirect light on the CPU (ray traced, doesn't need a renderer backend)
+	bool cpuIndirect = false;
+	static const int nIndirectRays = 128;
+	std::vector<SurfaceAlbedo> surfaceAlbedos;
+
 	// hemicube / indirect light
 	const int hemicubeFaceSize = 64;
 	const vec2i hemicubeSize = vec2i(hemicubeFaceSize * 3, hemicubeFaceSize);
@@ -205,6 +308,21 @@ struct LightBaker
 	const int nIndirectBounces = 1;
 	int currentIndirectBounce = 0;
 	int nInterpolatedLuxels = 0;
+	int nIndirectLuxelsBaked = 0; // hemicubes rendered or luxels ray traced
+
+	// Interpolation error, measured against a subset of the interpolated luxels baked again: ray traced on the CPU, or with hemicubes.
+	double interpolationErrorSum = 0;
+	double interpolationReferenceSum = 0;
+	int nInterpolationErrorSamples = 0;
+
+	// Hemicubes are rendered for interpolationErrorLuxels after every pass has been rasterized.
+	bool measuringInterpolationError;
+	std::vector<Luxel> interpolationErrorLuxels;
+	size_t nextInterpolationErrorLuxel;
+
+	// Indirect light is only baked for a sparse grid of luxels (every 2^interpolationPasses) at first. Each pass after that halves the spacing, interpolating luxels unless their neighbors differ by more than the threshold.
+	const int nInterpolationPasses = 2;
+	const float interpolationThreshold = 0.01f;
 
 	/// @brief Lightmaps to use when rendering hemicubes.
 	/// @remarks The result from the previous pass (direct or indirect bounce) only, not accumulated with all previous passes.
@@ -240,8 +358,8 @@ struct LightBakerPersistent
 
 	/// @remarks Only x and y used.
 	Uniform_vec4 hemicubeWeightsTextureSizeUniform = "u_HemicubeWeightsTextureSize";
-	Uniform_int hemicubeAtlasSampler = "u_HemicubeAtlas";
-	Uniform_int hemicubeWeightsSampler = "u_HemicubeWeights";
+	Uniform_sampler hemicubeAtlasSampler = "u_HemicubeAtlas";
+	Uniform_sampler hemicubeWeightsSampler = "u_HemicubeWeights";
 };
 
 extern std::unique_ptr<LightBaker> s_lightBaker;
@@ -250,14 +368,22 @@ extern std::vector<AreaLight> s_areaLights;
 
 bool InitializeEmbree();
 void ShutdownEmbree();
+void SetupRay(RTCRay *ray, vec3 org, vec3 dir, float length);
+void OccludedStream(RTCRay *rays, size_t nRays);
+void IntersectStream(RTCRay *rays, size_t nRays, RTCIntersectFlags flags = RTC_INTERSECT_COHERENT);
+const char *FindMaterialDiffuseTexture(const Material &material);
 void LoadAreaLightTextures();
 bool InitializeDirectLight();
 bool BakeDirectLight();
+bool BakeLightGrid();
 
 void InitializeIndirectLight();
 bool BakeIndirectLight(uint32_t frameNo);
+void LoadSurfaceAlbedos();
+bool BakeIndirectLightCpu();
 
 void InitializeRasterization(int interpolationPasses, float interpolationThreshold);
+bool RasterizeLuxels(std::vector<Luxel> *luxels);
 Luxel RasterizeLuxel();
 int GetNumRasterizedTriangles();
 
@@ -265,6 +391,11 @@ bool IsSurfaceLightmapped(const world::Surface &surface);
 LightBaker::Status GetStatus(int *progress = nullptr);
 void SetStatus(LightBaker::Status status, int progress = 0);
 
+/// @brief Call func for every item in [0, nItems) on worker threads, which claim tileSize items at a time.
+/// @remarks Called from the light baker thread. Blocks until every item is done, reporting progress with status scaled from progressStart to progressEnd.
+/// @return false if cancelled.
+bool ParallelFor(int nItems, int tileSize, LightBaker::Status status, int progressStart, int progressEnd, const char *threadName, const std::function<void(int item)> &func);
+
 } // namespace light_baker
 } // namespace renderer
 #endif // USE_LIGHT_BAKER
@@ -88,8 +88,8 @@ extern "C"
 	typedef void* (*EmbreeMapBuffer)(RTCScene scene, unsigned geomID, RTCBufferType type);
 	typedef void (*EmbreeUnmapBuffer)(RTCScene scene, unsigned geomID, RTCBufferType type);
 	typedef void (*EmbreeCommit)(RTCScene scene);
-	typedef void (*EmbreeOccluded)(RTCScene scene, RTCRay& ray);
-	typedef void (*EmbreeIntersect)(RTCScene scene, RTCRay& ray);
+	typedef void (*EmbreeOccluded1M)(RTCScene scene, const RTCIntersectContext *context, RTCRay *rays, const size_t M, const size_t stride);
+	typedef void (*EmbreeIntersect1M)(RTCScene scene, const RTCIntersectContext *context, RTCRay *rays, const size_t M, const size_t stride);
 
 	static EmbreeNewDevice embreeNewDevice = nullptr;
 	static EmbreeDeleteDevice embreeDeleteDevice = nullptr;
@@ -100,8 +100,8 @@ extern "C"
 	static EmbreeMapBuffer embreeMapBuffer = nullptr;
 	static EmbreeUnmapBuffer embreeUnmapBuffer = nullptr;
 	static EmbreeCommit embreeCommit = nullptr;
-	static EmbreeOccluded embreeOccluded = nullptr;
-	static EmbreeIntersect embreeIntersect = nullptr;
+	static EmbreeOccluded1M embreeOccluded1M = nullptr;
+	static EmbreeIntersect1M embreeIntersect1M = nullptr;
 }
 
 #define EMBREE_FUNCTION(func, type, name) func = (type)SDL_LoadFunction(s_lightBaker->embreeLibrary, name); if (!func) { SDL_UnloadObject(s_lightBaker->embreeLibrary); interface::PrintWarningf("Error loading Embree function %s\n", name); return false; }
@@ -125,8 +125,8 @@ bool InitializeEmbree()
 	EMBREE_FUNCTION(embreeMapBuffer, EmbreeMapBuffer, "rtcMapBuffer");
 	EMBREE_FUNCTION(embreeUnmapBuffer, EmbreeUnmapBuffer, "rtcUnmapBuffer");
 	EMBREE_FUNCTION(embreeCommit, EmbreeCommit, "rtcCommit");
-	EMBREE_FUNCTION(embreeOccluded, EmbreeOccluded, "rtcOccluded");
-	EMBREE_FUNCTION(embreeIntersect, EmbreeIntersect, "rtcIntersect");
+	EMBREE_FUNCTION(embreeOccluded1M, EmbreeOccluded1M, "rtcOccluded1M");
+	EMBREE_FUNCTION(embreeIntersect1M, EmbreeIntersect1M, "rtcIntersect1M");
 	return true;
 }
 
@@ -178,7 +178,7 @@ static bool CreateEmbreeGeometry(int nVertices, int nTriangles)
 	// Indices are 32-bit. The World representation uses 16-bit indices, with multiple vertex buffers on large maps that don't fit into one. Combine those here.
 	s_lightBaker->embreeDevice = embreeNewDevice(nullptr);
 	CHECK_EMBREE_ERROR(embreeNewDevice)
-	s_lightBaker->embreeScene = embreeDeviceNewScene(s_lightBaker->embreeDevice, RTC_SCENE_STATIC, RTC_INTERSECT1);
+	s_lightBaker->embreeScene = embreeDeviceNewScene(s_lightBaker->embreeDevice, RTC_SCENE_STATIC, RTC_INTERSECT_STREAM);
 	CHECK_EMBREE_ERROR(embreeDeviceNewScene)
 	unsigned int embreeMesh = embreeNewTriangleMesh(s_lightBaker->embreeScene, RTC_GEOMETRY_STATIC, nTriangles, nVertices, 1);
 	CHECK_EMBREE_ERROR(embreeNewTriangleMesh);
@@ -206,6 +206,9 @@ static bool CreateEmbreeGeometry(int nVertices, int nTriangles)
 	size_t faceIndex = 0;
 	s_lightBaker->faceFlags.resize(nTriangles);
 
+	if (s_lightBaker->cpuIndirect)
+		s_lightBaker->triangleLightmapInfo.resize(nTriangles);
+
 	for (int si = 0; si < world::GetNumSurfaces(0); si++)
 	{
 		const world::Surface &surface = world::GetSurface(0, si);
@@ -219,11 +222,39 @@ static bool CreateEmbreeGeometry(int nVertices, int nTriangles)
 		for (int i = 0; i < (int)surface.bufferIndex; i++)
 			indexOffset += (uint32_t)world::GetVertexBuffer(i).size();
 
+		vec3 albedo(1, 1, 1);
+
+		if (s_lightBaker->cpuIndirect)
+		{
+			for (const SurfaceAlbedo &sa : s_lightBaker->surfaceAlbedos)
+			{
+				if (sa.material == surface.material)
+				{
+					albedo = sa.color;
+					break;
+				}
+			}
+		}
+
 		for (size_t i = 0; i < surface.indices.size(); i += 3)
 		{
 			if (surface.material->isSky || (surface.flags & SURF_SKY))
 				s_lightBaker->faceFlags[faceIndex] |= FaceFlags::Sky;
 
+			if (s_lightBaker->cpuIndirect)
+			{
+				TriangleLightmapInfo &info = s_lightBaker->triangleLightmapInfo[faceIndex];
+				info.lightmapIndex = IsSurfaceLightmapped(surface) ? surface.material->lightmapIndex : -1;
+				info.albedo = albedo;
+				const std::vector<Vertex> &vertices = world::GetVertexBuffer((int)surface.bufferIndex);
+
+				for (int j = 0; j < 3; j++)
+				{
+					const vec4 &texCoord = vertices[surface.indices[i + j]].texCoord;
+					info.texCoords[j] = vec2(texCoord.z, texCoord.w);
+				}
+			}
+
 			triangles[faceIndex].indices[0] = indexOffset + surface.indices[i + 0];
 			triangles[faceIndex].indices[1] = indexOffset + surface.indices[i + 1];
 			triangles[faceIndex].indices[2] = indexOffset + surface.indices[i + 2];
@@ -365,13 +396,57 @@ static void CreateEntityLights()
 	}
 }
 
+void SetupRay(RTCRay *ray, vec3 org, vec3 dir, float length)
+{
+	ray->org[0] = org.x;
+	ray->org[1] = org.y;
+	ray->org[2] = org.z;
+	ray->tnear = 0;
+	ray->tfar = length;
+	ray->dir[0] = dir.x;
+	ray->dir[1] = dir.y;
+	ray->dir[2] = dir.z;
+	ray->geomID = RTC_INVALID_GEOMETRY_ID;
+	ray->primID = RTC_INVALID_GEOMETRY_ID;
+	ray->mask = -1;
+	ray->time = 0;
+}
+
+/// Trace a batch of shadow rays as a single ray stream. Occluded rays have their geomID set.
+/// @remarks The rays in a batch all start at the same luxel, so they are traced as coherent.
+void OccludedStream(RTCRay *rays, size_t nRays)
+{
+	if (nRays == 0)
+		return;
+
+	RTCIntersectContext context;
+	context.flags = RTC_INTERSECT_COHERENT;
+	context.userRayExt = nullptr;
+	embreeOccluded1M(s_lightBaker->embreeScene, &context, rays, nRays, sizeof(RTCRay));
+}
+
+void IntersectStream(RTCRay *rays, size_t nRays, RTCIntersectFlags flags)
+{
+	if (nRays == 0)
+		return;
+
+	RTCIntersectContext context;
+	context.flags = flags;
+	context.userRayExt = nullptr;
+	embreeIntersect1M(s_lightBaker->embreeScene, &context, rays, nRays, sizeof(RTCRay));
+}
+
 static vec3 BakeEntityLights(vec3 samplePosition, vec3 sampleNormal)
 {
+	const vec3 org(samplePosition + sampleNormal * 0.1f);
 	vec3 accumulatedLight;
 
 	for (StaticLight &light : s_lightBaker->lights)
 	{
-		float totalAttenuation = 0;
+		// Gather the jitter samples that survive attenuation, then trace them together.
+		RTCRay rays[LightBaker::maxSamples];
+		float attenuations[LightBaker::maxSamples];
+		size_t nRays = 0;
 
 		for (int si = 0; si < s_lightBaker->nSamples; si++)
 		{
@@ -436,27 +511,20 @@ static vec3 BakeEntityLights(vec3 samplePosition, vec3 sampleNormal)
 				}
 			}
 
-			RTCRay ray;
-			const vec3 org(samplePosition + sampleNormal * 0.1f);
-			ray.org[0] = org.x;
-			ray.org[1] = org.y;
-			ray.org[2] = org.z;
-			ray.tnear = 0;
-			ray.tfar = distance;
-			ray.dir[0] = dir.x;
-			ray.dir[1] = dir.y;
-			ray.dir[2] = dir.z;
-			ray.geomID = RTC_INVALID_GEOMETRY_ID;
-			ray.primID = RTC_INVALID_GEOMETRY_ID;
-			ray.mask = -1;
-			ray.time = 0;
-
-			embreeOccluded(s_lightBaker->embreeScene, ray);
-
-			if (ray.geomID != RTC_INVALID_GEOMETRY_ID)
+			SetupRay(&rays[nRays], org, dir, distance);
+			attenuations[nRays] = attenuation;
+			nRays++;
+		}
+
+		OccludedStream(rays, nRays);
+		float totalAttenuation = 0;
+
+		for (size_t ri = 0; ri < nRays; ri++)
+		{
+			if (rays[ri].geomID != RTC_INVALID_GEOMETRY_ID)
 				continue; // hit
 
-			totalAttenuation += attenuation * (1.0f / s_lightBaker->nSamples);
+			totalAttenuation += attenuations[ri] * (1.0f / s_lightBaker->nSamples);
 		}
 					
 		if (totalAttenuation > 0)
@@ -472,6 +540,25 @@ AREA LIGHTS
 ================================================================================
 */
 
+const char *FindMaterialDiffuseTexture(const Material &material)
+{
+	// Grab the first valid texture for now.
+	for (size_t i = 0; i < Material::maxStages; i++)
+	{
+		const MaterialStage &stage = material.stages[i];
+
+		if (stage.active)
+		{
+			const char *texture = stage.bundles[MaterialTextureBundleIndex::DiffuseMap].textures[0]->getName();
+
+			if (texture[0] != '*') // Ignore special textures, e.g. lightmaps.
+				return texture;
+		}
+	}
+
+	return nullptr;
+}
+
 void LoadAreaLightTextures()
 {
 	// Load area light surface textures into main memory.
@@ -500,24 +587,7 @@ void LoadAreaLightTextures()
 			if (texture)
 				continue; // In cache.
 
-			// Grab the first valid texture for now.
-			const char *filename = nullptr;
-
-			for (size_t i = 0; i < Material::maxStages; i++)
-			{
-				const MaterialStage &stage = surface.material->stages[i];
-
-				if (stage.active)
-				{
-					const char *texture = stage.bundles[MaterialTextureBundleIndex::DiffuseMap].textures[0]->getName();
-
-					if (texture[0] != '*') // Ignore special textures, e.g. lightmaps.
-					{
-						filename = texture;
-						break;
-					}
-				}
-			}
+			const char *filename = FindMaterialDiffuseTexture(*surface.material);
 
 			if (!filename)
 			{
@@ -560,6 +630,82 @@ static const AreaLightTexture *FindAreaLightTexture(const Material *material)
 	return nullptr;
 }
 
+/// Area light BVH leaves have at most this many samples.
+static const size_t s_maxAreaLightSamplesPerLeaf = 4;
+
+static const AreaLightSample &GetAreaLightSample(AreaLightSampleRef ref)
+{
+	return s_areaLights[ref.light].samples[ref.sample];
+}
+
+static void BuildAreaLightNode(uint32_t nodeIndex, uint32_t firstSample, uint32_t nSamples)
+{
+	AreaLightNode node;
+	node.bounds.setupForAddingPoints();
+	node.power = node.photons = 0;
+	node.twoSided = false;
+	node.firstChild = 0;
+	node.firstSample = firstSample;
+	node.nSamples = nSamples;
+	Bounds centroidBounds;
+	centroidBounds.setupForAddingPoints();
+
+	for (uint32_t i = firstSample; i < firstSample + nSamples; i++)
+	{
+		const AreaLightSampleRef ref = s_lightBaker->areaLightNodeSamples[i];
+		const AreaLightSample &sample = GetAreaLightSample(ref);
+		node.bounds.addPoints(sample.winding.p, sample.winding.numpoints);
+		node.power += sample.photons * sample.area;
+		node.photons += sample.photons;
+		node.twoSided |= s_areaLights[ref.light].texture->material->cullType == MaterialCullType::TwoSided;
+		centroidBounds.addPoint(sample.position);
+	}
+
+	if (nSamples > s_maxAreaLightSamplesPerLeaf)
+	{
+		// Median split on the longest axis.
+		const vec3 size(centroidBounds.toSize());
+		const int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+		auto first = s_lightBaker->areaLightNodeSamples.begin() + firstSample;
+		const uint32_t nLeftSamples = nSamples / 2;
+
+		std::nth_element(first, first + nLeftSamples, first + nSamples, [axis](AreaLightSampleRef a, AreaLightSampleRef b)
+		{
+			return GetAreaLightSample(a).position[axis] < GetAreaLightSample(b).position[axis];
+		});
+
+		node.firstChild = (uint32_t)s_lightBaker->areaLightNodes.size();
+		s_lightBaker->areaLightNodes.resize(s_lightBaker->areaLightNodes.size() + 2);
+		BuildAreaLightNode(node.firstChild, firstSample, nLeftSamples);
+		BuildAreaLightNode(node.firstChild + 1, firstSample + nLeftSamples, nSamples - nLeftSamples);
+	}
+
+	s_lightBaker->areaLightNodes[nodeIndex] = node;
+}
+
+static void CreateAreaLightBvh()
+{
+	s_lightBaker->areaLightNodes.clear();
+	s_lightBaker->areaLightNodeSamples.clear();
+
+	for (size_t i = 0; i < s_areaLights.size(); i++)
+	{
+		for (size_t j = 0; j < s_areaLights[i].samples.size(); j++)
+		{
+			AreaLightSampleRef ref;
+			ref.light = (uint32_t)i;
+			ref.sample = (uint32_t)j;
+			s_lightBaker->areaLightNodeSamples.push_back(ref);
+		}
+	}
+
+	if (s_lightBaker->areaLightNodeSamples.empty())
+		return;
+
+	s_lightBaker->areaLightNodes.resize(1);
+	BuildAreaLightNode(0, 0, (uint32_t)s_lightBaker->areaLightNodeSamples.size());
+}
+
 static void CreateAreaLights()
 {
 	// Calculate normalized/average colors.
@@ -645,11 +791,12 @@ static void CreateAreaLights()
 
 				AreaLightSample sample;
 				sample.position = (v[0]->pos + v[1]->pos + v[2]->pos) / 3.0f;
-				const vec3 normal((v[0]->getNormal() + v[1]->getNormal() + v[2]->getNormal()) / 3.0f);
+				const vec3 normal((v[0]->normal + v[1]->normal + v[2]->normal) / 3.0f);
 				sample.position += normal * 0.1f; // push out a little
-				sample.texCoord = (v[0]->getTexCoord().xy() + v[1]->getTexCoord().xy() + v[2]->getTexCoord().xy()) / 3.0f;
+				sample.texCoord = (v[0]->texCoord.xy() + v[1]->texCoord.xy() + v[2]->texCoord.xy()) / 3.0f;
 				//sample.photons = surface.material->surfaceLight * area * areaScale;
 				sample.photons = surface.material->surfaceLight * s_lightBaker->formFactorValueScale * s_lightBaker->areaScale;
+				sample.area = area * 0.5f;
 				sample.winding.numpoints = 3;
 				sample.winding.p[0] = v[0]->pos;
 				sample.winding.p[1] = v[1]->pos;
@@ -657,12 +804,15 @@ static void CreateAreaLights()
 				light.samples.push_back(std::move(sample));
 			}
 
+			s_lightBaker->nAreaLightSamples += (int)light.samples.size();
 			s_areaLights.push_back(std::move(light));
 		}
 	}
 
+	CreateAreaLightBvh();
+
 	// Use the world PVS - leaf cluster to leaf cluster visibility - to precompute leaf cluster to area light visibility.
-	if (!s_areaLights.empty() || !world::s_world->visData)
+	if (s_areaLights.empty() || !world::s_world->visData)
 		return;
 
 	s_lightBaker->areaLightClusterBytes = (int)std::ceil(s_areaLights.size() / 8.0f); // Need 1 bit per area light.
@@ -762,69 +912,161 @@ static float PointToPolygonFormFactor(vec3 point, vec3 normal, const Winding &w)
 	return total;
 }
 
-static vec3 BakeAreaLights(vec3 samplePosition, vec3 sampleNormal)
+/// Area light samples are traced in batches of up to this many rays.
+static const size_t s_maxAreaLightRays = 64;
+
+/// @brief Upper bound on the light an area light BVH node's samples can contribute to a point, ignoring occlusion.
+static float CalculateAreaLightNodeBound(const AreaLightNode &node, vec3 position, vec3 normal)
+{
+	// Nothing reaches the point if the node is entirely behind it, unless it has two-sided samples.
+	if (!node.twoSided)
+	{
+		const vec3 center(node.bounds.midpoint());
+		const vec3 halfSize(node.bounds.toSize() * 0.5f);
+		const float maxDot = vec3::dotProduct(normal, center - position) + fabs(normal.x) * halfSize.x + fabs(normal.y) * halfSize.y + fabs(normal.z) * halfSize.z;
+
+		if (maxDot <= 0)
+			return 0;
+	}
+
+	float distanceSquared = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		const float d = std::max(node.bounds.min[i] - position[i], std::max(0.0f, position[i] - node.bounds.max[i]));
+		distanceSquared += d * d;
+	}
+
+	// A polygon's form factor is area * cos / (pi distance^2) for small polygons, and can reach 1 when the polygon covers the hemisphere.
+	const float maxPower = node.photons;
+
+	if (distanceSquared <= 0)
+		return maxPower;
+
+	return std::min(node.power / ((float)M_PI * distanceSquared), maxPower);
+}
+
+struct AreaLightRays
+{
+	RTCRay rays[s_maxAreaLightRays];
+	AreaLightSampleRef samples[s_maxAreaLightRays];
+	float weights[s_maxAreaLightRays];
+	size_t nRays = 0;
+};
+
+static void TraceAreaLightRays(AreaLightRays *rays, vec3 samplePosition, vec3 sampleNormal, vec3 *accumulatedLight)
 {
+	// Faster to trace the rays before PTPFF.
+	OccludedStream(rays->rays, rays->nRays);
+
+	for (size_t ri = 0; ri < rays->nRays; ri++)
+	{
+		if (rays->rays[ri].geomID != RTC_INVALID_GEOMETRY_ID)
+			continue; // hit
+
+		const AreaLight &areaLight = s_areaLights[rays->samples[ri].light];
+		const AreaLightSample &areaLightSample = GetAreaLightSample(rays->samples[ri]);
+		float factor = PointToPolygonFormFactor(samplePosition, sampleNormal, areaLightSample.winding);
+
+		if (areaLight.texture->material->cullType == MaterialCullType::TwoSided)
+			factor = fabs(factor);
+
+		if (factor <= 0)
+			continue;
+
+		*accumulatedLight += areaLight.texture->normalizedColor.rgb() * areaLightSample.photons * factor * rays->weights[ri];
+	}
+
+	rays->nRays = 0;
+}
+
+/// @param nSamplesEvaluated Incremented by the number of area light samples that rays were traced to.
+static vec3 BakeAreaLights(vec3 samplePosition, vec3 sampleNormal, LuxelRandom *random, int *nSamplesEvaluated)
+{
+	if (s_lightBaker->areaLightNodes.empty())
+		return vec3::empty;
+
 	world::Node *sampleLeaf = world::LeafFromPosition(samplePosition);
+	const uint8_t *pvs = nullptr;
+
+	// Skip PVS check if outside map or there's no vis data.
+	if (sampleLeaf->cluster != -1 && !s_lightBaker->areaLightVisData.empty())
+		pvs = &s_lightBaker->areaLightVisData[sampleLeaf->cluster * s_lightBaker->areaLightClusterBytes];
+
+	const vec3 org(samplePosition + sampleNormal * 0.1f);
+	AreaLightRays rays;
 	vec3 accumulatedLight;
 
-	for (size_t i = 0; i < s_areaLights.size(); i++)
+	// Walk the BVH. Weights compensate for nodes skipped by russian roulette, so the expected result is the same as evaluating every sample.
+	struct StackEntry
+	{
+		uint32_t node;
+		float weight;
+	};
+
+	StackEntry stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 1.0f };
+
+	while (stackSize > 0)
 	{
-		// Skip PVS check if outside map or there's no vis data.
-		if (sampleLeaf->cluster != -1 && !s_lightBaker->areaLightVisData.empty())
+		StackEntry entry = stack[--stackSize];
+		const AreaLightNode &node = s_lightBaker->areaLightNodes[entry.node];
+		const float bound = CalculateAreaLightNodeBound(node, samplePosition, sampleNormal) * entry.weight;
+
+		if (bound <= 0)
+			continue;
+
+		if (bound < s_lightBaker->areaLightCutoff)
 		{
-			const uint8_t *pvs = &s_lightBaker->areaLightVisData[sampleLeaf->cluster * s_lightBaker->areaLightClusterBytes];
+			const float probability = bound / s_lightBaker->areaLightCutoff;
 
-			if (!(pvs[i >> 3] & (1 << (i & 7))))
+			if (random->next() >= probability)
 				continue;
+
+			entry.weight /= probability;
 		}
 
-		const AreaLight &areaLight = s_areaLights[i];
+		if (node.firstChild != 0)
+		{
+			assert(stackSize + 2 <= (int)BX_COUNTOF(stack));
+			stack[stackSize++] = { node.firstChild, entry.weight };
+			stack[stackSize++] = { node.firstChild + 1, entry.weight };
+			continue;
+		}
 
-		for (const AreaLightSample &areaLightSample : areaLight.samples)
+		for (uint32_t i = node.firstSample; i < node.firstSample + node.nSamples; i++)
 		{
+			const AreaLightSampleRef ref = s_lightBaker->areaLightNodeSamples[i];
+
+			if (pvs && !(pvs[ref.light >> 3] & (1 << (ref.light & 7))))
+				continue;
+
+			const AreaLightSample &areaLightSample = GetAreaLightSample(ref);
 			vec3 dir(areaLightSample.position - samplePosition);
 			const float distance = dir.normalize();
 
 			// Check if light is behind the sample point.
 			// Ignore two-sided surfaces.
-			float angle = vec3::dotProduct(sampleNormal, dir);
-							
-			if (areaLight.texture->material->cullType != MaterialCullType::TwoSided && angle <= 0)
-				continue;
+			const float angle = vec3::dotProduct(sampleNormal, dir);
 
-			// Faster to trace the ray before PTPFF.
-			RTCRay ray;
-			const vec3 org(samplePosition + sampleNormal * 0.1f);
-			ray.org[0] = org.x;
-			ray.org[1] = org.y;
-			ray.org[2] = org.z;
-			ray.tnear = 0;
-			ray.tfar = distance * 0.9f; // FIXME: should check for exact hit instead?
-			ray.dir[0] = dir.x;
-			ray.dir[1] = dir.y;
-			ray.dir[2] = dir.z;
-			ray.geomID = RTC_INVALID_GEOMETRY_ID;
-			ray.primID = RTC_INVALID_GEOMETRY_ID;
-			ray.mask = -1;
-			ray.time = 0;
-
-			embreeOccluded(s_lightBaker->embreeScene, ray);
-
-			if (ray.geomID != RTC_INVALID_GEOMETRY_ID)
-				continue; // hit
-
-			float factor = PointToPolygonFormFactor(samplePosition, sampleNormal, areaLightSample.winding);
-
-			if (areaLight.texture->material->cullType == MaterialCullType::TwoSided)
-				factor = fabs(factor);
-
-			if (factor <= 0)
+			if (s_areaLights[ref.light].texture->material->cullType != MaterialCullType::TwoSided && angle <= 0)
 				continue;
 
-			accumulatedLight += areaLight.texture->normalizedColor.rgb() * areaLightSample.photons * factor;
+			SetupRay(&rays.rays[rays.nRays], org, dir, distance * 0.9f); // FIXME: should check for exact hit instead?
+			rays.samples[rays.nRays] = ref;
+			rays.weights[rays.nRays] = entry.weight;
+			rays.nRays++;
+			(*nSamplesEvaluated)++;
+
+			if (rays.nRays == s_maxAreaLightRays)
+				TraceAreaLightRays(&rays, samplePosition, sampleNormal, &accumulatedLight);
 		}
 	}
 
+	if (rays.nRays > 0)
+		TraceAreaLightRays(&rays, samplePosition, sampleNormal, &accumulatedLight);
+
 	return accumulatedLight;
 }
 
@@ -883,82 +1125,211 @@ bool InitializeDirectLight()
 	return true;
 }
 
+static vec3 BakeSunLight(const SunLight &sunLight, float maxRayLength, vec3 samplePosition, vec3 sampleNormal)
+{
+	const vec3 org(samplePosition + sampleNormal * 0.1f); // push out from the surface a little
+	RTCRay rays[LightBaker::maxSamples];
+	float attenuations[LightBaker::maxSamples];
+	size_t nRays = 0;
+
+	for (int si = 0; si < s_lightBaker->nSamples; si++)
+	{
+		const vec3 dir(sunLight.direction + s_lightBaker->dirJitter[si]); // Jitter light direction.
+		const float attenuation = vec3::dotProduct(sampleNormal, dir) * (1.0f / s_lightBaker->nSamples);
+
+		if (attenuation < 0)
+			continue;
+
+		SetupRay(&rays[nRays], org, dir, maxRayLength);
+		attenuations[nRays] = attenuation;
+		nRays++;
+	}
+
+	// A full intersection is needed here, not just an occlusion test: the sun is only visible if the closest hit is a sky face.
+	IntersectStream(rays, nRays);
+	float totalAttenuation = 0;
+
+	for (size_t ri = 0; ri < nRays; ri++)
+	{
+		if (rays[ri].geomID != RTC_INVALID_GEOMETRY_ID && (s_lightBaker->faceFlags[rays[ri].primID] & FaceFlags::Sky))
+		{
+			totalAttenuation += attenuations[ri];
+		}
+	}
+
+	if (totalAttenuation > 0)
+		return sunLight.light * totalAttenuation * 255.0;
+
+	return vec3::empty;
+}
+
+/// Luxels are handed out to the worker threads in tiles of this size.
+static const int s_directLightTileSize = 256;
+
 bool BakeDirectLight()
 {
-	int progress = 0;
 	int64_t startTime = bx::getHPCounter();
-	const SunLight &sunLight = main::GetSunLight();
-	const float maxRayLength = world::GetBounds().toRadius() * 2; // World bounding sphere circumference.
+
+	// Rasterize all the luxels up front so they can be shaded in parallel.
+	std::vector<Luxel> luxels;
 	InitializeRasterization(0, 0);
-	s_lightBaker->totalLuxels = 0;
+	RasterizeLuxels(&luxels);
+	s_lightBaker->totalLuxels = (int)luxels.size();
 
-	for (;;)
+	if (luxels.empty())
 	{
-		Luxel luxel = RasterizeLuxel();
+		s_lightBaker->directBakeTime = bx::getHPCounter() - startTime;
+		return true;
+	}
 
-		if (luxel.sentinel)
-			break;
+	const SunLight sunLight = main::GetSunLight();
+	const float maxRayLength = world::GetBounds().toRadius() * 2; // World bounding sphere circumference.
+	SDL_atomic_t nAreaLightSamplesEvaluated;
+	SDL_AtomicSet(&nAreaLightSamplesEvaluated, 0);
 
-		s_lightBaker->totalLuxels++;
-		Lightmap &lightmap = s_lightBaker->lightmaps[luxel.lightmapIndex];
-		vec3 &luxelColor = lightmap.passColor[luxel.offset];
+	// Embree scenes are thread safe for ray queries.
+	const bool finished = ParallelFor((int)luxels.size(), s_directLightTileSize, LightBaker::Status::BakingDirectLight, 0, 100, "LightBakerDirect", [&](int i)
+	{
+		// Each luxel is only rasterized once, so threads never write to the same color.
+		const Luxel &luxel = luxels[i];
+		LuxelRandom random(luxel);
+		int nSamples = 0;
+		vec3 &luxelColor = s_lightBaker->lightmaps[luxel.lightmapIndex].passColor[luxel.offset];
 		luxelColor = s_lightBaker->ambientLight;
-		luxelColor += BakeAreaLights(luxel.position, luxel.normal);
+		luxelColor += BakeAreaLights(luxel.position, luxel.normal, &random, &nSamples);
 		luxelColor += BakeEntityLights(luxel.position, luxel.normal);
+		luxelColor += BakeSunLight(sunLight, maxRayLength, luxel.position, luxel.normal);
+		SDL_AtomicAdd(&nAreaLightSamplesEvaluated, nSamples);
+	});
 
-#if 1
-		// Sunlight.
-		float totalAttenuation = 0;
+	if (!finished)
+		return false;
 
-		for (int si = 0; si < s_lightBaker->nSamples; si++)
-		{
-			const vec3 dir(sunLight.direction + s_lightBaker->dirJitter[si]); // Jitter light direction.
-			const float attenuation = vec3::dotProduct(luxel.normal, dir) * (1.0f / s_lightBaker->nSamples);
+	s_lightBaker->nAreaLightSamplesEvaluated = SDL_AtomicGet(&nAreaLightSamplesEvaluated);
+	s_lightBaker->directBakeTime = bx::getHPCounter() - startTime;
+	return true;
+}
 
-			if (attenuation < 0)
-				continue;
+/*
+================================================================================
+LIGHT GRID
+================================================================================
+*/
 
-			RTCRay ray;
-			const vec3 org(luxel.position + luxel.normal * 0.1f); // push out from the surface a little
-			ray.org[0] = org.x;
-			ray.org[1] = org.y;
-			ray.org[2] = org.z;
-			ray.tnear = 0;
-			ray.tfar = maxRayLength;
-			ray.dir[0] = dir.x;
-			ray.dir[1] = dir.y;
-			ray.dir[2] = dir.z;
-			ray.geomID = RTC_INVALID_GEOMETRY_ID;
-			ray.primID = RTC_INVALID_GEOMETRY_ID;
-			ray.mask = -1;
-			ray.time = 0;
-			embreeIntersect(s_lightBaker->embreeScene, ray);
-
-			if (ray.geomID != RTC_INVALID_GEOMETRY_ID && (s_lightBaker->faceFlags[ray.primID] & FaceFlags::Sky))
-			{
-				totalAttenuation += attenuation;
-			}
-		}
+/// Scale the color into byte range, normalizing by the largest channel instead of saturating to white.
+static void ColorToBytes(vec3 color, uint8_t *bytes)
+{
+	const float max = std::max(color.r, std::max(color.g, color.b));
 
-		if (totalAttenuation > 0)
-			luxelColor += sunLight.light * totalAttenuation * 255.0;
-#endif
+	if (max > 255.0f)
+		color *= 255.0f / max;
 
-		// Update progress.
-		const int newProgress = int(GetNumRasterizedTriangles() / (float)s_lightBaker->totalLightmappedTriangles * 100.0f);
+	for (int i = 0; i < 3; i++)
+		bytes[i] = (uint8_t)math::Clamped(color[i], 0.0f, 255.0f);
+}
 
-		if (newProgress != progress)
-		{
-			// Check for cancelling.
-			if (GetStatus() == LightBaker::Status::Cancelled)
-				return false;
+/// Same encoding as q3map2.
+static void NormalToLatLong(vec3 normal, uint8_t *bytes)
+{
+	if (normal.x == 0 && normal.y == 0)
+	{
+		bytes[0] = normal.z > 0 ? 0 : 128;
+		bytes[1] = 0;
+	}
+	else
+	{
+		bytes[0] = uint8_t(int(RAD2DEG(acosf(normal.z)) * (255.0f / 360.0f)) & 0xff); // longitude
+		bytes[1] = uint8_t(int(RAD2DEG(atan2f(normal.y, normal.x)) * (255.0f / 360.0f)) & 0xff); // latitude
+	}
+}
 
-			progress = newProgress;
-			SetStatus(LightBaker::Status::BakingDirectLight, progress);
-		}
+/// @brief Bake one light grid point to the BSP format: ambient RGB, directed RGB, direction latitude/longitude.
+/// @remarks Entities are shaded with ambient + directed * max(0, dot(normal, direction)). That's fitted to the direct light arriving at a surface facing each of the six axis directions.
+static void BakeLightGridPoint(vec3 position, const SunLight &sunLight, float maxRayLength, LuxelRandom *random, int *nAreaLightSamplesEvaluated, uint8_t *data)
+{
+	// Points in solid are ignored by world::SampleLightGrid.
+	if (world::LeafFromPosition(position)->cluster == -1)
+	{
+		memset(data, 0, 8);
+		return;
 	}
 
-	s_lightBaker->directBakeTime = bx::getHPCounter() - startTime;
+	static const vec3 axisNormals[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	vec3 light[6];
+
+	for (int i = 0; i < 6; i++)
+	{
+		light[i] = BakeAreaLights(position, axisNormals[i], random, nAreaLightSamplesEvaluated);
+		light[i] += BakeEntityLights(position, axisNormals[i]);
+		light[i] += BakeSunLight(sunLight, maxRayLength, position, axisNormals[i]);
+	}
+
+	// Directional light is the only thing that differs between opposite normals. Each axis difference is the directed color scaled by that component of the direction.
+	vec3 difference[3];
+	vec3 direction;
+
+	for (int i = 0; i < 3; i++)
+	{
+		difference[i] = light[i * 2] - light[i * 2 + 1];
+		direction[i] = difference[i].r * 0.299f + difference[i].g * 0.587f + difference[i].b * 0.114f;
+	}
+
+	vec3 directed, ambient;
+
+	if (direction.normalize() > 0.001f)
+	{
+		for (int i = 0; i < 3; i++)
+			directed[i] = sqrtf(difference[0][i] * difference[0][i] + difference[1][i] * difference[1][i] + difference[2][i] * difference[2][i]);
+	}
+	else
+	{
+		direction = vec3(0, 0, 1);
+	}
+
+	// Whatever is left over on each pair of opposite normals is ambient.
+	for (int i = 0; i < 3; i++)
+		ambient += (light[i * 2] + light[i * 2 + 1] - directed * fabs(direction[i])) * 0.5f;
+
+	ambient = ambient / 3.0f + s_lightBaker->ambientLight;
+
+	for (int i = 0; i < 3; i++)
+		ambient[i] = std::max(0.0f, ambient[i]);
+
+	ColorToBytes(ambient, &data[0]);
+	ColorToBytes(directed, &data[3]);
+	NormalToLatLong(direction, &data[6]);
+}
+
+/// Grid points are handed out to the worker threads in rows of this many points.
+static const int s_lightGridTileSize = 64;
+
+bool BakeLightGrid()
+{
+	int64_t startTime = bx::getHPCounter();
+	SetStatus(LightBaker::Status::BakingLightGrid);
+	const vec3i &bounds = world::s_world->lightGridBounds;
+
+	const SunLight sunLight = main::GetSunLight();
+	const float maxRayLength = world::GetBounds().toRadius() * 2;
+	const int nPoints = bounds.x * bounds.y * bounds.z;
+	s_lightBaker->lightGridData.resize(std::max(0, nPoints) * 8);
+
+	// The area light sample count isn't reported for the light grid.
+	const bool finished = ParallelFor(nPoints, s_lightGridTileSize, LightBaker::Status::BakingLightGrid, 0, 100, "LightBakerGrid", [&](int i)
+	{
+		const int x = i % bounds.x;
+		const int y = (i / bounds.x) % bounds.y;
+		const int z = i / (bounds.x * bounds.y);
+		const vec3 position(world::s_world->lightGridOrigin + vec3(x * world::s_world->lightGridSize.x, y * world::s_world->lightGridSize.y, z * world::s_world->lightGridSize.z));
+		LuxelRandom random((uint32_t)i);
+		int nAreaLightSamplesEvaluated = 0;
+		BakeLightGridPoint(position, sunLight, maxRayLength, &random, &nAreaLightSamplesEvaluated, &s_lightBaker->lightGridData[i * 8]);
+	});
+
+	if (!finished)
+		return false;
+
+	s_lightBaker->lightGridBakeTime = bx::getHPCounter() - startTime;
 	return true;
 }
 	
@@ -37,6 +37,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #if defined(USE_LIGHT_BAKER)
 #include "LightBaker.h"
 #include "Main.h" // need to access main internals for hemicube integration
+#include "World.h"
 
 #include "stb_image_write.h"
 
@@ -51,6 +52,53 @@ static float lm_defaultWeights(float cos_theta, void *userdata)
 	return 1.0f;
 }
 
+/// Upper bound on the number of interpolated luxels baked again to measure the interpolation error.
+static const size_t s_maxInterpolationErrorSamples = 1024;
+
+/// @brief Pick an evenly spaced subset of the luxels that were interpolated, to be baked again.
+/// @remarks Rasterizes again, which clears the interpolated luxel bits.
+static void SampleInterpolatedLuxels(std::vector<Luxel> *luxels)
+{
+	assert(luxels);
+	std::vector<std::vector<uint8_t>> interpolatedBits;
+	bool anyInterpolated = false;
+
+	for (const Lightmap &lightmap : s_lightBaker->lightmaps)
+	{
+		interpolatedBits.push_back(lightmap.interpolatedBits);
+		anyInterpolated |= std::any_of(lightmap.interpolatedBits.begin(), lightmap.interpolatedBits.end(), [](uint8_t bits) { return bits != 0; });
+	}
+
+	if (!anyInterpolated)
+		return;
+
+	std::vector<Luxel> allLuxels, interpolatedLuxels;
+	InitializeRasterization(0, 0);
+	RasterizeLuxels(&allLuxels);
+
+	for (const Luxel &luxel : allLuxels)
+	{
+		if (interpolatedBits[luxel.lightmapIndex][luxel.offset / 8] & (1 << (luxel.offset % 8)))
+			interpolatedLuxels.push_back(luxel);
+	}
+
+	const size_t stride = std::max(size_t(1), interpolatedLuxels.size() / s_maxInterpolationErrorSamples);
+
+	for (size_t i = 0; i < interpolatedLuxels.size(); i += stride)
+		luxels->push_back(interpolatedLuxels[i]);
+}
+
+static void AddInterpolationErrorSample(const vec3 &interpolated, const vec3 &reference)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		s_lightBaker->interpolationErrorSum += fabs(interpolated[i] - reference[i]);
+		s_lightBaker->interpolationReferenceSum += reference[i];
+	}
+
+	s_lightBaker->nInterpolationErrorSamples++;
+}
+
 void InitializeIndirectLight()
 {
 	// Create framebuffers and textures to read from. Only done once (persistent).
@@ -58,12 +106,12 @@ void InitializeIndirectLight()
 	{
 		// Render directly into this. Ping-pong between this and the second hemicube FB when downsampling.
 		bgfx::TextureHandle hemicubeTextures[2];
-		hemicubeTextures[0] = bgfx::createTexture2D(s_lightBaker->hemicubeBatchSize.x, s_lightBaker->hemicubeBatchSize.y, false, 1, bgfx::TextureFormat::RGBA32F, BGFX_TEXTURE_RT | BGFX_TEXTURE_U_CLAMP | BGFX_TEXTURE_V_CLAMP);
+		hemicubeTextures[0] = bgfx::createTexture2D(s_lightBaker->hemicubeBatchSize.x, s_lightBaker->hemicubeBatchSize.y, false, 1, bgfx::TextureFormat::RGBA32F, BGFX_TEXTURE_RT | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP);
 		hemicubeTextures[1] = bgfx::createTexture2D(s_lightBaker->hemicubeBatchSize.x, s_lightBaker->hemicubeBatchSize.y, false, 1, bgfx::TextureFormat::D24S8, BGFX_TEXTURE_RT);
 		s_lightBakerPersistent->hemicubeFb[0].handle = bgfx::createFrameBuffer(2, hemicubeTextures, true);
 
 		// Downsampling.
-		s_lightBakerPersistent->hemicubeFb[1].handle = bgfx::createFrameBuffer(s_lightBaker->hemicubeDownsampleSize.x, s_lightBaker->hemicubeDownsampleSize.y, bgfx::TextureFormat::RGBA32F, BGFX_TEXTURE_RT | BGFX_TEXTURE_U_CLAMP | BGFX_TEXTURE_V_CLAMP);
+		s_lightBakerPersistent->hemicubeFb[1].handle = bgfx::createFrameBuffer(s_lightBaker->hemicubeDownsampleSize.x, s_lightBaker->hemicubeDownsampleSize.y, bgfx::TextureFormat::RGBA32F, BGFX_TEXTURE_RT | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP);
 
 		// Textures to read from.
 #ifdef DEBUG_HEMICUBE_RENDERING
@@ -138,8 +186,8 @@ void InitializeIndirectLight()
 			image.height = lightmapSize.y;
 			image.nComponents = 4;
 			image.dataSize = image.width * image.height * image.nComponents;
-			image.data = &s_lightBaker->lightmaps[i].encodedPassColor[0].x;
-			s_lightBaker->hemicubeLightmaps[i] = g_textureCache->create(util::VarArgs("*hemicube_lightmap%d", (int)i), image, TextureFlags::ClampToEdge | TextureFlags::Mutable);
+			image.data = (uint8_t *)s_lightBaker->lightmaps[i].encodedPassColor.data();
+			s_lightBaker->hemicubeLightmaps[i] = g_textureCache->create(util::VarArgs("*hemicube_lightmap%d", (int)i), image, TextureFlags::ClampToEdge | TextureFlags::Mutable, world::GetLightmapFormat());
 		}
 
 		// Misc. state.
@@ -157,7 +205,10 @@ void InitializeIndirectLight()
 	s_lightBaker->nHemicubeBatchesProcessed = 0;
 	s_lightBaker->finishedHemicubeBatch = false;
 	s_lightBaker->finishedBakingIndirect = false;
-	InitializeRasterization(2, 0.01f);
+	s_lightBaker->measuringInterpolationError = false;
+	s_lightBaker->interpolationErrorLuxels.clear();
+	s_lightBaker->nextInterpolationErrorLuxel = 0;
+	InitializeRasterization(s_lightBaker->nInterpolationPasses, s_lightBaker->interpolationThreshold);
 }
 
 static uint32_t AsyncReadTexture(bgfx::FrameBufferHandle source, bgfx::TextureHandle dest, void *destData, uint16_t width, uint16_t height)
@@ -186,7 +237,7 @@ static uint32_t IntegrateHemicubeBatch(void *integrationData)
 	bgfx::setTexture(0, s_lightBakerPersistent->hemicubeAtlasSampler.handle, bgfx::getTexture(s_lightBakerPersistent->hemicubeFb[fbRead].handle));
 	bgfx::setTexture(1, s_lightBakerPersistent->hemicubeWeightsSampler.handle, s_lightBaker->hemicubeWeightsTexture->getHandle());
 	s_lightBakerPersistent->hemicubeWeightsTextureSizeUniform.set(vec4((float)s_lightBaker->hemicubeSize.x, (float)s_lightBaker->hemicubeSize.y, 0, 0));
-	main::RenderScreenSpaceQuad("HemicubeWeightedDownsample", s_lightBakerPersistent->hemicubeFb[fbWrite], main::ShaderProgramId::HemicubeWeightedDownsample, BGFX_STATE_RGB_WRITE | BGFX_STATE_ALPHA_WRITE, BGFX_CLEAR_COLOR, main::s_main->isTextureOriginBottomLeft, Rect(0, 0, s_lightBaker->hemicubeDownsampleSize.x, s_lightBaker->hemicubeDownsampleSize.y));
+	main::RenderScreenSpaceQuad("HemicubeWeightedDownsample", s_lightBakerPersistent->hemicubeFb[fbWrite], main::ShaderProgramId::HemicubeWeightedDownsample, BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A, BGFX_CLEAR_COLOR, main::s_main->isTextureOriginBottomLeft, Rect(0, 0, s_lightBaker->hemicubeDownsampleSize.x, s_lightBaker->hemicubeDownsampleSize.y));
 
 #ifdef DEBUG_HEMICUBE_RENDERING
 	// Read weighted downsample for debugging.
@@ -204,13 +255,46 @@ static uint32_t IntegrateHemicubeBatch(void *integrationData)
 
 		outHemiSize /= 2;
 		bgfx::setTexture(0, s_lightBakerPersistent->hemicubeAtlasSampler.handle, bgfx::getTexture(s_lightBakerPersistent->hemicubeFb[fbRead].handle));
-		main::RenderScreenSpaceQuad("HemicubeDownsample", s_lightBakerPersistent->hemicubeFb[fbWrite], main::ShaderProgramId::HemicubeDownsample, BGFX_STATE_RGB_WRITE | BGFX_STATE_ALPHA_WRITE, BGFX_CLEAR_COLOR, main::s_main->isTextureOriginBottomLeft, Rect(0, 0, outHemiSize * s_lightBaker->nHemicubesInBatch.x, outHemiSize * s_lightBaker->nHemicubesInBatch.y));
+		main::RenderScreenSpaceQuad("HemicubeDownsample", s_lightBakerPersistent->hemicubeFb[fbWrite], main::ShaderProgramId::HemicubeDownsample, BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A, BGFX_CLEAR_COLOR, main::s_main->isTextureOriginBottomLeft, Rect(0, 0, outHemiSize * s_lightBaker->nHemicubesInBatch.x, outHemiSize * s_lightBaker->nHemicubesInBatch.y));
 	}
 
 	// Start async texture read of integrated data.
 	return AsyncReadTexture(s_lightBakerPersistent->hemicubeFb[fbWrite].handle, s_lightBakerPersistent->hemicubeIntegrationReadTexture, integrationData, s_lightBaker->nHemicubesInBatch.x, s_lightBaker->nHemicubesInBatch.y);
 }
 
+/// @brief The next luxel to render a hemicube for.
+/// @remarks Once every pass has been rasterized, hemicubes are rendered again for a subset of the interpolated luxels, to measure the interpolation error.
+static Luxel NextHemicubeLuxel(bool *measureError)
+{
+	assert(measureError);
+
+	if (!s_lightBaker->measuringInterpolationError)
+	{
+		const Luxel luxel = RasterizeLuxel();
+
+		if (!luxel.sentinel)
+		{
+			*measureError = false;
+			return luxel;
+		}
+
+		s_lightBaker->measuringInterpolationError = true;
+		SampleInterpolatedLuxels(&s_lightBaker->interpolationErrorLuxels);
+	}
+
+	*measureError = true;
+
+	if (s_lightBaker->nextInterpolationErrorLuxel >= s_lightBaker->interpolationErrorLuxels.size())
+	{
+		Luxel luxel;
+		luxel.sentinel = true;
+		luxel.endOfPass = false;
+		return luxel;
+	}
+
+	return s_lightBaker->interpolationErrorLuxels[s_lightBaker->nextInterpolationErrorLuxel++];
+}
+
 bool BakeIndirectLight(uint32_t frameNo)
 {
 	// Update frame timing and add to history.
@@ -251,14 +335,21 @@ bool BakeIndirectLight(uint32_t frameNo)
 	{
 		for (int i = 0; i < s_lightBaker->nHemicubesToRenderPerFrame; i++)
 		{
-			Luxel luxel = RasterizeLuxel();
+			bool measureError;
+			Luxel luxel = NextHemicubeLuxel(&measureError);
 
 			if (luxel.sentinel)
 			{
-				// Processed all lightmaps.
+				// Processed all lightmaps, and measured the interpolation error.
 				s_lightBaker->finishedHemicubeBatch = true;
 				s_lightBaker->finishedBakingIndirect = true;
 			}
+			else if (luxel.endOfPass)
+			{
+				// Read back the hemicubes rendered so far, the next pass may interpolate from them.
+				if (s_lightBaker->nHemicubesRenderedInBatch > 0)
+					s_lightBaker->finishedHemicubeBatch = true;
+			}
 			else
 			{
 				Lightmap &lightmap = s_lightBaker->lightmaps[luxel.lightmapIndex];
@@ -296,8 +387,12 @@ bool BakeIndirectLight(uint32_t frameNo)
 
 				s_lightBaker->hemicubeBatchLocations[s_lightBaker->nHemicubesRenderedInBatch].lightmap = &lightmap;
 				s_lightBaker->hemicubeBatchLocations[s_lightBaker->nHemicubesRenderedInBatch].luxelOffset = luxel.offset;
+				s_lightBaker->hemicubeBatchLocations[s_lightBaker->nHemicubesRenderedInBatch].measureError = measureError;
 				s_lightBaker->nHemicubesRenderedInBatch++;
 
+				if (!measureError)
+					s_lightBaker->nIndirectLuxelsBaked++;
+
 				if (s_lightBaker->nHemicubesRenderedInBatch >= s_lightBaker->nHemicubesInBatch.x * s_lightBaker->nHemicubesInBatch.y)
 				{
 					s_lightBaker->finishedHemicubeBatch = true;
@@ -321,16 +416,17 @@ bool BakeIndirectLight(uint32_t frameNo)
 	}
 	else if (frameNo >= s_lightBaker->hemicubeDataAvailableFrame)
 	{
-		// Async texture read is ready.
-		for (int y = 0; y < s_lightBaker->nHemicubesInBatch.y; y++)
+		// Async texture read is ready. Batches are only partially filled at the end of a rasterization pass.
+		for (int i = 0; i < s_lightBaker->nHemicubesRenderedInBatch; i++)
 		{
-			for (int x = 0; x < s_lightBaker->nHemicubesInBatch.x; x++)
-			{
-				const int offset = x + y * s_lightBaker->nHemicubesInBatch.x;
-				auto rgb = (const vec3 *)&s_lightBaker->hemicubeIntegrationData[offset * 4];
-				HemicubeLocation &hemicube = s_lightBaker->hemicubeBatchLocations[offset];
-				hemicube.lightmap->passColor[hemicube.luxelOffset] = *rgb * 255.0f * s_lightBaker->indirectLightScale;
-			}
+			auto rgb = (const vec3 *)&s_lightBaker->hemicubeIntegrationData[i * 4];
+			HemicubeLocation &hemicube = s_lightBaker->hemicubeBatchLocations[i];
+			const vec3 color = *rgb * 255.0f * s_lightBaker->indirectLightScale;
+
+			if (hemicube.measureError)
+				AddInterpolationErrorSample(hemicube.lightmap->passColor[hemicube.luxelOffset], color);
+			else
+				hemicube.lightmap->passColor[hemicube.luxelOffset] = color;
 		}
 
 #ifdef DEBUG_HEMICUBE_RENDERING
@@ -376,6 +472,199 @@ bool BakeIndirectLight(uint32_t frameNo)
 	return true;
 }
 
+/*
+================================================================================
+CPU INDIRECT LIGHT
+
+Path traced with embree against the previous pass's lightmap colors. Slower than rendering hemicubes, but runs on worker threads and doesn't need a GPU.
+================================================================================
+*/
+
+void LoadSurfaceAlbedos()
+{
+	// Need to do this on the main thread.
+	for (int si = 0; si < world::GetNumSurfaces(0); si++)
+	{
+		const world::Surface &surface = world::GetSurface(0, si);
+
+		if (!IsSurfaceLightmapped(surface))
+			continue;
+
+		// Check cache.
+		bool cached = false;
+
+		for (const SurfaceAlbedo &sa : s_lightBaker->surfaceAlbedos)
+		{
+			if (sa.material == surface.material)
+			{
+				cached = true;
+				break;
+			}
+		}
+
+		if (cached)
+			continue;
+
+		const char *filename = FindMaterialDiffuseTexture(*surface.material);
+
+		if (!filename)
+			continue;
+
+		Image image = LoadImage(filename);
+
+		if (!image.data)
+		{
+			interface::PrintWarningf("Error loading image %s from material %s\n", filename, surface.material->name);
+			continue;
+		}
+
+		// Average the image color.
+		vec3 sum;
+		const int nPixels = image.width * image.height;
+
+		for (int i = 0; i < nPixels; i++)
+		{
+			const uint8_t *pixel = &image.data[i * image.nComponents];
+
+			if (image.nComponents >= 3)
+				sum += vec3(pixel[0], pixel[1], pixel[2]);
+			else
+				sum += vec3(pixel[0], pixel[0], pixel[0]);
+		}
+
+		image.release(image.data, nullptr);
+		SurfaceAlbedo albedo;
+		albedo.material = surface.material;
+		albedo.color = sum * (1.0f / (nPixels * 255.0f));
+		s_lightBaker->surfaceAlbedos.push_back(albedo);
+	}
+}
+
+static vec3 SampleLightmap(const RTCRay &ray)
+{
+	if (ray.geomID == RTC_INVALID_GEOMETRY_ID || (s_lightBaker->faceFlags[ray.primID] & FaceFlags::Sky))
+		return vec3::empty;
+
+	const TriangleLightmapInfo &info = s_lightBaker->triangleLightmapInfo[ray.primID];
+
+	if (info.lightmapIndex < 0)
+		return vec3::empty;
+
+	// Barycentric interpolation of the lightmap texture coordinates.
+	const vec2 texCoord(info.texCoords[0] * (1.0f - ray.u - ray.v) + info.texCoords[1] * ray.u + info.texCoords[2] * ray.v);
+	const vec2i lightmapSize = world::GetLightmapSize();
+	const int x = math::Clamped(int(texCoord.x * lightmapSize.x), 0, lightmapSize.x - 1);
+	const int y = math::Clamped(int(texCoord.y * lightmapSize.y), 0, lightmapSize.y - 1);
+	const vec3 &color = s_lightBaker->lightmaps[info.lightmapIndex].previousPassColor[x + y * lightmapSize.x];
+	return vec3(color.r * info.albedo.r, color.g * info.albedo.g, color.b * info.albedo.b);
+}
+
+static vec3 BakeIndirectLuxel(const Luxel &luxel, float maxRayLength)
+{
+	// Same tangent frame as the hemicubes.
+	vec3 up(0, 0, 1);
+	const float dot = vec3::dotProduct(luxel.normal, up);
+
+	if (dot > 0.8f)
+		up = vec3(1, 0, 0);
+	else if (dot < -0.8f)
+		up = vec3(-1, 0, 0);
+
+	const vec3 tangent(vec3::crossProduct(luxel.normal, up).normal());
+	const vec3 bitangent(vec3::crossProduct(luxel.normal, tangent));
+
+	// Cosine weighted hemisphere directions. The average of the sampled colors is equivalent to the weighted hemicube integration.
+	RTCRay rays[LightBaker::nIndirectRays];
+	const int nRays = LightBaker::nIndirectRays;
+	const vec3 org(luxel.position + luxel.normal * 1.0f);
+	LuxelRandom random(luxel);
+
+	for (int i = 0; i < nRays; i++)
+	{
+		const float phi = 6.28318530718f * random.next();
+		const float r2 = random.next();
+		const float r = sqrtf(r2);
+		const vec3 dir(tangent * (r * cosf(phi)) + bitangent * (r * sinf(phi)) + luxel.normal * sqrtf(1.0f - r2));
+		SetupRay(&rays[i], org, dir, maxRayLength);
+	}
+
+	IntersectStream(rays, nRays, RTC_INTERSECT_INCOHERENT);
+	vec3 total;
+
+	for (int i = 0; i < nRays; i++)
+	{
+		total += SampleLightmap(rays[i]);
+	}
+
+	return total * (s_lightBaker->indirectLightScale / nRays);
+}
+
+/// Luxels are handed out to the worker threads in tiles of this size. Smaller than direct light tiles, since each luxel traces many more rays.
+static const int s_indirectLightTileSize = 64;
+
+/// @brief Bake luxels on worker threads, writing the results to Lightmap::passColor.
+/// @return false if cancelled.
+static bool BakeIndirectLuxelsCpu(const std::vector<Luxel> &luxels, float maxRayLength, int progressStart, int progressEnd)
+{
+	return ParallelFor((int)luxels.size(), s_indirectLightTileSize, LightBaker::Status::BakingIndirectLight_Running, progressStart, progressEnd, "LightBakerIndirect", [&](int i)
+	{
+		// Rays only read previousPassColor, so writing passColor here doesn't race with other threads.
+		const Luxel &luxel = luxels[i];
+		s_lightBaker->lightmaps[luxel.lightmapIndex].passColor[luxel.offset] = BakeIndirectLuxel(luxel, maxRayLength);
+	});
+}
+
+/// Ray trace a subset of the interpolated luxels, and compare the results with the interpolated colors.
+static void MeasureInterpolationError(float maxRayLength)
+{
+	std::vector<Luxel> luxels;
+	SampleInterpolatedLuxels(&luxels);
+
+	for (const Luxel &luxel : luxels)
+	{
+		AddInterpolationErrorSample(s_lightBaker->lightmaps[luxel.lightmapIndex].passColor[luxel.offset], BakeIndirectLuxel(luxel, maxRayLength));
+	}
+}
+
+bool BakeIndirectLightCpu()
+{
+	if (s_lightBaker->currentIndirectBounce == 0)
+		s_lightBaker->indirectBakeStartTime = bx::getHPCounter();
+
+	SetStatus(LightBaker::Status::BakingIndirectLight_Running);
+	const float maxRayLength = world::GetBounds().toRadius() * 2;
+	const int nInterpolatedLuxelsStart = s_lightBaker->nInterpolatedLuxels;
+	InitializeRasterization(s_lightBaker->nInterpolationPasses, s_lightBaker->interpolationThreshold);
+	std::vector<Luxel> luxels;
+
+	for (;;)
+	{
+		// Rasterize one pass. It has to be baked before rasterizing the next pass, which interpolates from it.
+		const int progressStart = int(GetNumRasterizedTriangles() / (float)s_lightBaker->totalLightmappedTriangles * 100.0f);
+		luxels.clear();
+
+		if (!RasterizeLuxels(&luxels))
+			break;
+
+		const int progressEnd = int(GetNumRasterizedTriangles() / (float)s_lightBaker->totalLightmappedTriangles * 100.0f);
+
+		if (!BakeIndirectLuxelsCpu(luxels, maxRayLength, progressStart, progressEnd))
+			return false;
+
+		s_lightBaker->nIndirectLuxelsBaked += (int)luxels.size();
+	}
+
+	if (s_lightBaker->nInterpolatedLuxels > nInterpolatedLuxelsStart)
+		MeasureInterpolationError(maxRayLength);
+
+	s_lightBaker->currentIndirectBounce++;
+
+	if (s_lightBaker->currentIndirectBounce == s_lightBaker->nIndirectBounces)
+		s_lightBaker->indirectBakeTime = bx::getHPCounter() - s_lightBaker->indirectBakeStartTime;
+
+	return true;
+}
+
 } // namespace light_baker
 } // namespace renderer
 #endif // USE_LIGHT_BAKER
@@ -37,6 +37,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #if defined(USE_LIGHT_BAKER)
 #include "LightBaker.h"
 #include "World.h"
+#include <bx/simd_t.h>
 
 namespace renderer {
 namespace light_baker {
@@ -202,7 +203,6 @@ struct lm_context
 	{
 		lm_vec3 position;
 		lm_vec3 direction;
-		lm_vec3 up;
 	} sample;
 
 	struct
@@ -211,6 +211,8 @@ struct lm_context
 		int height;
 		int channels;
 		float *data;
+		uint8_t *duplicateBits;
+		uint8_t *interpolatedBits;
 
 #ifdef DEBUG_LIGHTMAP_INTERPOLATION
 		uint8_t *debug;
@@ -218,16 +220,43 @@ struct lm_context
 	} lightmap;
 
 	float interpolationThreshold;
+	int nInterpolatedLuxels;
+};
+
+/// The output of rasterizing one lightmap for the current pass.
+struct LightmapRasterization
+{
+	/// Lightmapped surfaces using this lightmap, in the same order as the world.
+	std::vector<const world::Surface *> surfaces;
+
+	/// The number of luxels each surface rasterized this pass.
+	std::vector<size_t> surfaceLuxelCounts;
+
+	/// Grouped by surface, in the same order as surfaces.
+	std::vector<Luxel> luxels;
+	int nInterpolatedLuxels;
 };
 
 struct Rasterizer
 {
-	lm_context ctx;
-	bool startedSamplingTriangle;
-	int modelIndex;
-	int surfaceIndex;
-	size_t triangleIndex;
+	int pass;
+	int passCount;
+	float interpolationThreshold;
+	int nTriangles;
 	int nTrianglesRasterized;
+
+	/// Triangles only ever write to luxels of their own lightmap, so each lightmap can be rasterized on a different thread.
+	std::vector<LightmapRasterization> lightmaps;
+
+	/// All lightmapped surfaces, in world order. Luxels are handed out in this order.
+	std::vector<const world::Surface *> surfaces;
+
+	/// @brief The current pass, handed out one luxel at a time by RasterizeLuxel.
+	/// @remarks The luxels of the next pass aren't rasterized until these have been baked, since interpolation reads their colors.
+	std::vector<Luxel> passLuxels;
+
+	size_t nextPassLuxel;
+	bool returnedEndOfPass;
 };
 
 static Rasterizer s_rasterizer;
@@ -265,24 +294,6 @@ static unsigned int lm_passOffsetY(lm_context *ctx)
 	return passType != 0 ? halfStep : 0;
 }
 
-static lm_bool lm_hasConservativeTriangleRasterizerFinished(lm_context *ctx)
-{
-	return ctx->rasterizer.y >= ctx->rasterizer.maxy;
-}
-
-static void lm_moveToNextPotentialConservativeTriangleRasterizerPosition(lm_context *ctx)
-{
-	unsigned int step = lm_passStepSize(ctx);
-	ctx->rasterizer.x += step;
-	while (ctx->rasterizer.x >= ctx->rasterizer.maxx)
-	{
-		ctx->rasterizer.x = ctx->rasterizer.minx + lm_passOffsetX(ctx);
-		ctx->rasterizer.y += step;
-		if (lm_hasConservativeTriangleRasterizerFinished(ctx))
-			break;
-	}
-}
-
 static float *lm_getLightmapPixel(lm_context *ctx, int x, int y)
 {
 	assert(x >= 0 && x < ctx->lightmap.width && y >= 0 && y < ctx->lightmap.height);
@@ -297,15 +308,13 @@ static void lm_setLightmapPixel(lm_context *ctx, int x, int y, float *in)
 		*p++ = *in++;
 }
 
-static lm_bool lm_trySamplingConservativeTriangleRasterizerPosition(lm_context *ctx)
+// mayOverlap is false if the edge function test has already ruled out the luxel overlapping the triangle.
+// Interpolation doesn't depend on coverage, so it's still tried.
+static lm_bool lm_trySamplingConservativeTriangleRasterizerPosition(lm_context *ctx, lm_bool mayOverlap)
 {
-	if (lm_hasConservativeTriangleRasterizerFinished(ctx))
-		return LM_FALSE;
-
 	// Ignore duplicate sampling of the same luxel, e.g. triangles sharing an edge.
-	const int luxelOffset = ctx->rasterizer.x + ctx->rasterizer.y * world::GetLightmapSize().x;
-	const world::Surface &surface = world::GetSurface(s_rasterizer.modelIndex, s_rasterizer.surfaceIndex);
-	uint8_t &duplicateByte = s_lightBaker->lightmaps[surface.material->lightmapIndex].duplicateBits[luxelOffset / 8];
+	const int luxelOffset = ctx->rasterizer.x + ctx->rasterizer.y * ctx->lightmap.width;
+	uint8_t &duplicateByte = ctx->lightmap.duplicateBits[luxelOffset / 8];
 	const uint8_t duplicateBit = 1<<(luxelOffset % 8);
 
 	if ((duplicateByte & duplicateBit) != 0)
@@ -373,16 +382,20 @@ static lm_bool lm_trySamplingConservativeTriangleRasterizerPosition(lm_context *
 			{
 				lm_setLightmapPixel(ctx, ctx->rasterizer.x, ctx->rasterizer.y, avg);
 				duplicateByte |= duplicateBit;
+				ctx->lightmap.interpolatedBits[luxelOffset / 8] |= duplicateBit;
 #ifdef DEBUG_LIGHTMAP_INTERPOLATION
 				// set interpolated pixel to green in debug output
 				ctx->lightmap.debug[(ctx->rasterizer.y * ctx->lightmap.width + ctx->rasterizer.x) * 3 + 1] = 255;
 #endif
-				s_lightBaker->nInterpolatedLuxels++;
+				ctx->nInterpolatedLuxels++;
 				return LM_FALSE;
 			}
 		}
 	}
 
+	if (!mayOverlap)
+		return LM_FALSE;
+
 	// could not interpolate. must render a hemisphere:
 	lm_vec2 pixel[16];
 	pixel[0] = lm_v2i(ctx->rasterizer.x, ctx->rasterizer.y);
@@ -430,24 +443,7 @@ static lm_bool lm_trySamplingConservativeTriangleRasterizerPosition(lm_context *
 				lm_finite3(ctx->sample.direction) &&
 				lm_length3sq(ctx->sample.direction) > 0.5f) // don't allow 0.0f. should always be ~1.0f
 			{
-				// randomize rotation
-				lm_vec3 up = lm_v3(0.0f, 0.0f, 1.0f);
-				if (lm_absf(lm_dot3(up, ctx->sample.direction)) > 0.8f)
-					up = lm_v3(1.0f, 0.0f, 0.0f);
-				lm_vec3 side = lm_normalize3(lm_cross3(up, ctx->sample.direction));
-				up = lm_normalize3(lm_cross3(side, ctx->sample.direction));
-				int rx = ctx->rasterizer.x % 3;
-				int ry = ctx->rasterizer.y % 3;
-				const float pi = 3.14159265358979f; // no c++ M_PI?
-				const float baseAngle = 0.03f * pi;
-				const float baseAngles[3][3] = {
-					{ baseAngle, baseAngle + 1.0f / 3.0f, baseAngle + 2.0f / 3.0f },
-					{ baseAngle + 1.0f / 3.0f, baseAngle + 2.0f / 3.0f, baseAngle },
-					{ baseAngle + 2.0f / 3.0f, baseAngle, baseAngle + 1.0f / 3.0f }
-				};
-				float phi = 2.0f * pi * baseAngles[ry][rx] + 0.1f * ((float)rand() / (float)RAND_MAX);
-				ctx->sample.up = lm_normalize3(lm_add3(lm_scale3(side, cosf(phi)), lm_scale3(up, sinf(phi))));
-
+				// The hemicube rotation is randomized later, see CalculateLuxelUp.
 #ifdef DEBUG_LIGHTMAP_INTERPOLATION
 				// set sampled pixel to red in debug output
 				ctx->lightmap.debug[(ctx->rasterizer.y * ctx->lightmap.width + ctx->rasterizer.x) * 3 + 0] = 255;
@@ -460,58 +456,195 @@ static lm_bool lm_trySamplingConservativeTriangleRasterizerPosition(lm_context *
 	return LM_FALSE;
 }
 
-// returns true if a sampling position was found and
-// false if we finished rasterizing the current triangle
-static lm_bool lm_findFirstConservativeTriangleRasterizerPosition(lm_context *ctx)
+/// @brief Randomize the rotation of a luxel's hemicube.
+/// @remarks Uses rand(), so it must be called on one thread, for every luxel in world order. The result is then the same as rasterizing serially.
+static vec3 CalculateLuxelUp(const Luxel &luxel, int lightmapWidth)
 {
-	while (!lm_trySamplingConservativeTriangleRasterizerPosition(ctx))
-	{
-		lm_moveToNextPotentialConservativeTriangleRasterizerPosition(ctx);
-		if (lm_hasConservativeTriangleRasterizerFinished(ctx))
-			return LM_FALSE;
-	}
-	return LM_TRUE;
+	const lm_vec3 direction = lm_v3(-luxel.normal.x, -luxel.normal.y, -luxel.normal.z);
+	lm_vec3 up = lm_v3(0.0f, 0.0f, 1.0f);
+	if (lm_absf(lm_dot3(up, direction)) > 0.8f)
+		up = lm_v3(1.0f, 0.0f, 0.0f);
+	lm_vec3 side = lm_normalize3(lm_cross3(up, direction));
+	up = lm_normalize3(lm_cross3(side, direction));
+	int rx = (luxel.offset % lightmapWidth) % 3;
+	int ry = (luxel.offset / lightmapWidth) % 3;
+	const float pi = 3.14159265358979f; // no c++ M_PI?
+	const float baseAngle = 0.03f * pi;
+	const float baseAngles[3][3] = {
+		{ baseAngle, baseAngle + 1.0f / 3.0f, baseAngle + 2.0f / 3.0f },
+		{ baseAngle + 1.0f / 3.0f, baseAngle + 2.0f / 3.0f, baseAngle },
+		{ baseAngle + 2.0f / 3.0f, baseAngle, baseAngle + 1.0f / 3.0f }
+	};
+	float phi = 2.0f * pi * baseAngles[ry][rx] + 0.1f * ((float)rand() / (float)RAND_MAX);
+	const lm_vec3 result = lm_normalize3(lm_add3(lm_scale3(side, cosf(phi)), lm_scale3(up, sinf(phi))));
+	return vec3(&result.x);
 }
 
-static lm_bool lm_findNextConservativeTriangleRasterizerPosition(lm_context *ctx)
+/// @brief Rasterize every candidate luxel position of the current pass for one triangle.
+/// @remarks Candidates are visited in the same order as a scalar walk over the bounding box. Four at a time are tested against the triangle edge functions first, so the polygon clipping only runs on luxels that can overlap the triangle.
+static void RasterizeTriangle(lm_context *ctx, int lightmapIndex, std::vector<Luxel> *luxels)
 {
-	lm_moveToNextPotentialConservativeTriangleRasterizerPosition(ctx);
-	return lm_findFirstConservativeTriangleRasterizerPosition(ctx);
-}
+	lm_vec2 uvMin = lm_v2(FLT_MAX, FLT_MAX), uvMax = lm_v2(-FLT_MAX, -FLT_MAX);
 
-// If the current triangle isn't valid, increment until we find one that is.
-// Return false if there are no more triangles left.
-static bool CurrentOrNextValidTriangle()
-{
-	// Need to keep checking if we've moved to the next surface/model etc. until a valid triangle is found.
-	for (;;)
+	for (int i = 0; i < 3; i++)
+	{
+		uvMin = lm_min2(uvMin, ctx->triangle.uv[i]);
+		uvMax = lm_max2(uvMax, ctx->triangle.uv[i]);
+	}
+
+	// Calculate area of interest (on lightmap) for conservative rasterization.
+	lm_vec2 bbMin = lm_floor2(uvMin);
+	lm_vec2 bbMax = lm_ceil2(uvMax);
+	ctx->rasterizer.minx = lm_maxi((int)bbMin.x - 1, 0);
+	ctx->rasterizer.miny = lm_maxi((int)bbMin.y - 1, 0);
+	ctx->rasterizer.maxx = lm_mini((int)bbMax.x + 1, ctx->lightmap.width);
+	ctx->rasterizer.maxy = lm_mini((int)bbMax.y + 1, ctx->lightmap.height);
+	assert(ctx->rasterizer.minx < ctx->rasterizer.maxx && ctx->rasterizer.miny < ctx->rasterizer.maxy);
+	const int step = (int)lm_passStepSize(ctx);
+	const int startx = ctx->rasterizer.minx + (int)lm_passOffsetX(ctx);
+	const int starty = ctx->rasterizer.miny + (int)lm_passOffsetY(ctx);
+
+	// Edge functions relative to the bounding box corner, oriented so the inside of the triangle is positive. Each is offset to the corner of a luxel furthest inside that edge, plus a margin for floating point error, so a luxel is only ruled out if it's clearly outside.
+	const lm_vec2 origin = lm_v2i(ctx->rasterizer.minx, ctx->rasterizer.miny);
+	const lm_vec2 uv[3] = { lm_sub2(ctx->triangle.uv[0], origin), lm_sub2(ctx->triangle.uv[1], origin), lm_sub2(ctx->triangle.uv[2], origin) };
+	const float area = lm_cross2(lm_sub2(uv[1], uv[0]), lm_sub2(uv[2], uv[0]));
+	const float maxEdgeLengthSq = lm_maxf(lm_length2sq(lm_sub2(uv[1], uv[0])), lm_maxf(lm_length2sq(lm_sub2(uv[2], uv[1])), lm_length2sq(lm_sub2(uv[0], uv[2]))));
+
+	// lm_convexClip gets the winding of nearly degenerate triangles wrong and accepts luxels nowhere near them. Leave those to it entirely, so the result is the same either way.
+	const lm_bool useEdgeFunctions = lm_finite(area) && lm_absf(area) > maxEdgeLengthSq * 1e-3f;
+	float edgeA[3], edgeB[3], edgeC[3];
+
+	for (int i = 0; i < 3; i++)
+	{
+		const lm_vec2 &v0 = uv[i];
+		const lm_vec2 &v1 = uv[(i + 1) % 3];
+		const float sign = area < 0.0f ? -1.0f : 1.0f;
+		edgeA[i] = (v0.y - v1.y) * sign;
+		edgeB[i] = (v1.x - v0.x) * sign;
+		edgeC[i] = -(edgeA[i] * v0.x + edgeB[i] * v0.y) + lm_maxf(edgeA[i], 0.0f) + lm_maxf(edgeB[i], 0.0f) + (lm_absf(edgeA[i]) + lm_absf(edgeB[i])) * 0.01f;
+	}
+
+	const bx::simd128_t laneOffsets = bx::simd_ld<bx::simd128_t>(0.0f, (float)step, 2.0f * step, 3.0f * step);
+	const bx::simd128_t zero = bx::simd_zero<bx::simd128_t>();
+
+	for (int y = starty; y < ctx->rasterizer.maxy; y += step)
 	{
-		if (s_rasterizer.modelIndex >= world::GetNumModels())
-			return false; // No triangles left.
+		bx::simd128_t rowC[3];
 
-		if (s_rasterizer.surfaceIndex >= world::GetNumSurfaces(s_rasterizer.modelIndex))
+		for (int i = 0; i < 3; i++)
+			rowC[i] = bx::simd_splat<bx::simd128_t>(edgeB[i] * (y - ctx->rasterizer.miny) + edgeC[i]);
+
+		for (int x = startx; x < ctx->rasterizer.maxx; x += step * 4)
 		{
-			// Finished with this model's surfaces. Move to the next model.
-			s_rasterizer.surfaceIndex = 0;
-			s_rasterizer.modelIndex++;
-			continue;
+			BX_ALIGN_DECL_16(uint32_t mayOverlap[4]) = { UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX };
+
+			if (useEdgeFunctions)
+			{
+				const bx::simd128_t xs = bx::simd_add(bx::simd_splat<bx::simd128_t>(float(x - ctx->rasterizer.minx)), laneOffsets);
+				bx::simd128_t inside = bx::simd_cmpge(bx::simd_madd(xs, bx::simd_splat<bx::simd128_t>(edgeA[0]), rowC[0]), zero);
+				inside = bx::simd_and(inside, bx::simd_cmpge(bx::simd_madd(xs, bx::simd_splat<bx::simd128_t>(edgeA[1]), rowC[1]), zero));
+				inside = bx::simd_and(inside, bx::simd_cmpge(bx::simd_madd(xs, bx::simd_splat<bx::simd128_t>(edgeA[2]), rowC[2]), zero));
+
+				// Nothing to interpolate on the first pass, so there's nothing else to do if the whole group is outside.
+				if (ctx->pass == 0 && !bx::simd_test_any_xyzw(inside))
+					continue;
+
+				bx::simd_st(mayOverlap, inside);
+			}
+
+			for (int lane = 0; lane < 4; lane++)
+			{
+				ctx->rasterizer.x = x + lane * step;
+				ctx->rasterizer.y = y;
+
+				if (ctx->rasterizer.x >= ctx->rasterizer.maxx)
+					break;
+
+				if (!lm_trySamplingConservativeTriangleRasterizerPosition(ctx, mayOverlap[lane] != 0))
+					continue;
+
+				Luxel luxel;
+				luxel.sentinel = false;
+				luxel.endOfPass = false;
+				luxel.lightmapIndex = lightmapIndex;
+				luxel.position = vec3(&ctx->sample.position.x);
+				luxel.normal = -vec3(&ctx->sample.direction.x);
+				luxel.offset = ctx->rasterizer.x + ctx->rasterizer.y * ctx->lightmap.width;
+				luxels->push_back(luxel);
+			}
 		}
-		
-		const world::Surface &surface = world::GetSurface(s_rasterizer.modelIndex, s_rasterizer.surfaceIndex);
+	}
+}
+
+static void RasterizeLightmap(int lightmapIndex)
+{
+	LightmapRasterization &rasterization = s_rasterizer.lightmaps[lightmapIndex];
+	Lightmap &lightmap = s_lightBaker->lightmaps[lightmapIndex];
+	const vec2i lightmapSize = world::GetLightmapSize();
+	lm_context ctx;
+	ctx.pass = s_rasterizer.pass;
+	ctx.passCount = s_rasterizer.passCount;
+	ctx.interpolationThreshold = s_rasterizer.interpolationThreshold;
+	ctx.nInterpolatedLuxels = 0;
+	ctx.lightmap.width = lightmapSize.x;
+	ctx.lightmap.height = lightmapSize.y;
+	ctx.lightmap.channels = 3;
+	ctx.lightmap.data = &lightmap.passColor.data()[0].x;
+	ctx.lightmap.duplicateBits = lightmap.duplicateBits.data();
+	ctx.lightmap.interpolatedBits = lightmap.interpolatedBits.data();
+#ifdef DEBUG_LIGHTMAP_INTERPOLATION
+	ctx.lightmap.debug = lightmap.interpolationDebug.data();
+#endif
+	rasterization.luxels.clear();
+	rasterization.surfaceLuxelCounts.clear();
+
+	for (const world::Surface *surface : rasterization.surfaces)
+	{
+		const size_t firstLuxel = rasterization.luxels.size();
+		const std::vector<Vertex> &vertices = world::GetVertexBuffer((int)surface->bufferIndex);
 
-		if (!IsSurfaceLightmapped(surface) || s_rasterizer.triangleIndex >= surface.indices.size() / 3)
+		for (size_t i = 0; i < surface->indices.size() / 3; i++)
 		{
-			// Surface is invalid, or we're finished with the surface's triangles. Move to the next surface.
-			s_rasterizer.triangleIndex = 0;
-			s_rasterizer.surfaceIndex++;
-			continue;
+			for (int j = 0; j < 3; j++)
+			{
+				const Vertex &v = vertices[surface->indices[i * 3 + j]];
+				ctx.triangle.p[j].x = v.pos.x;
+				ctx.triangle.p[j].y = v.pos.y;
+				ctx.triangle.p[j].z = v.pos.z;
+				ctx.triangle.uv[j].x = v.texCoord.z * lightmapSize.x;
+				ctx.triangle.uv[j].y = v.texCoord.w * lightmapSize.y;
+			}
+
+			RasterizeTriangle(&ctx, lightmapIndex, &rasterization.luxels);
 		}
 
-		// Valid triangle.
-		break;
+		rasterization.surfaceLuxelCounts.push_back(rasterization.luxels.size() - firstLuxel);
 	}
 
-	return true;
+	rasterization.nInterpolatedLuxels = ctx.nInterpolatedLuxels;
+}
+
+struct RasterizationJob
+{
+	/// The next lightmap to be claimed by a worker thread.
+	SDL_atomic_t nextLightmap;
+};
+
+static int RasterizationWorkerThread(void *data)
+{
+	auto job = (RasterizationJob *)data;
+
+	for (;;)
+	{
+		const int lightmapIndex = SDL_AtomicAdd(&job->nextLightmap, 1);
+
+		if (lightmapIndex >= (int)s_rasterizer.lightmaps.size())
+			break;
+
+		RasterizeLightmap(lightmapIndex);
+	}
+
+	return 0;
 }
 
 void InitializeRasterization(int interpolationPasses, float interpolationThreshold)
@@ -519,133 +652,142 @@ void InitializeRasterization(int interpolationPasses, float interpolationThresho
 	assert(interpolationPasses >= 0 && interpolationPasses <= 8);
 	assert(interpolationThreshold >= 0.0f);
 
-	s_rasterizer.ctx.pass = 0;
-	s_rasterizer.ctx.passCount = 1 + 3 * interpolationPasses;
-	s_rasterizer.ctx.interpolationThreshold = interpolationThreshold * 255;
-	s_rasterizer.startedSamplingTriangle = false;
-	s_rasterizer.modelIndex = 0;
-	s_rasterizer.surfaceIndex = 0;
-	s_rasterizer.triangleIndex = 0;
+	s_rasterizer.pass = 0;
+	s_rasterizer.passCount = 1 + 3 * interpolationPasses;
+	s_rasterizer.interpolationThreshold = interpolationThreshold * 255;
+	s_rasterizer.nTriangles = 0;
 	s_rasterizer.nTrianglesRasterized = 0;
+	s_rasterizer.lightmaps.clear();
+	s_rasterizer.lightmaps.resize(s_lightBaker->lightmaps.size());
+	s_rasterizer.surfaces.clear();
+	s_rasterizer.passLuxels.clear();
+	s_rasterizer.nextPassLuxel = 0;
+	s_rasterizer.returnedEndOfPass = false;
 
 	for (Lightmap &lightmap : s_lightBaker->lightmaps)
 	{
 		memset(lightmap.duplicateBits.data(), 0, lightmap.duplicateBits.size());
+		memset(lightmap.interpolatedBits.data(), 0, lightmap.interpolatedBits.size());
 	}
 
-	// Move to the first valid triangle.
-	CurrentOrNextValidTriangle();
+	// Sort surfaces by lightmap. The first triangle to rasterize a luxel takes it, so the world order is kept within each lightmap.
+	for (int i = 0; i < world::GetNumModels(); i++)
+	{
+		for (int j = 0; j < world::GetNumSurfaces(i); j++)
+		{
+			const world::Surface &surface = world::GetSurface(i, j);
+
+			if (!IsSurfaceLightmapped(surface))
+				continue;
+
+			s_rasterizer.lightmaps[surface.material->lightmapIndex].surfaces.push_back(&surface);
+			s_rasterizer.surfaces.push_back(&surface);
+			s_rasterizer.nTriangles += int(surface.indices.size() / 3);
+		}
+	}
 }
 
-Luxel RasterizeLuxel()
+bool RasterizeLuxels(std::vector<Luxel> *luxels)
 {
-	lm_context &ctx = s_rasterizer.ctx;
-	Luxel luxel;
-	luxel.sentinel = false;
+	if (s_rasterizer.pass >= s_rasterizer.passCount)
+		return false;
 
-	// Need to keep iterating until we have a valid luxel, or have finished rasterization.
-	for (;;)
+	RasterizationJob job;
+	SDL_AtomicSet(&job.nextLightmap, 0);
+	std::vector<SDL_Thread *> threads;
+	const int nThreads = std::min(SDL_GetCPUCount(), (int)s_rasterizer.lightmaps.size());
+
+	// Not worth starting threads for a single lightmap.
+	for (int i = 0; i < nThreads && nThreads > 1; i++)
 	{
-		if (!CurrentOrNextValidTriangle())
+		SDL_Thread *thread = SDL_CreateThread(RasterizationWorkerThread, "LightBakerRasterize", &job);
+
+		if (!thread)
 		{
-			// Finished all models/surfaces/triangles. Do the next pass.
-			ctx.pass++;
+			interface::PrintWarningf("Creating light baker rasterization thread failed. Reason: \"%s\"", SDL_GetError());
+			break;
+		}
 
-			if (ctx.pass >= ctx.passCount)
-			{
-				luxel.sentinel = true;
-				break;
-			}
+		threads.push_back(thread);
+	}
 
-			s_rasterizer.startedSamplingTriangle = false;
-			s_rasterizer.modelIndex = 0;
-			s_rasterizer.surfaceIndex = 0;
-			s_rasterizer.triangleIndex = 0;
+	// Finishes any lightmaps the worker threads haven't claimed, or all of them if there aren't any workers.
+	RasterizationWorkerThread(&job);
 
-			if (!CurrentOrNextValidTriangle())
-			{
-				// Should only happen if there's no lightmapped surfaces.
-				luxel.sentinel = true;
-				break;
-			}
-		}
+	for (SDL_Thread *thread : threads)
+	{
+		SDL_WaitThread(thread, nullptr);
+	}
+
+	// Hand out the luxels in world order, and randomize their hemicube rotation in that order. rand() then returns the same sequence as when rasterizing serially, so the result doesn't change.
+	const int lightmapWidth = world::GetLightmapSize().x;
+	std::vector<size_t> nextSurface(s_rasterizer.lightmaps.size(), 0);
+	std::vector<size_t> nextLuxel(s_rasterizer.lightmaps.size(), 0);
 
-		const world::Surface &surface = world::GetSurface(s_rasterizer.modelIndex, s_rasterizer.surfaceIndex);
-		lm_bool gotSample;
+	for (const world::Surface *surface : s_rasterizer.surfaces)
+	{
+		const int lightmapIndex = surface->material->lightmapIndex;
+		const LightmapRasterization &rasterization = s_rasterizer.lightmaps[lightmapIndex];
+		const size_t nLuxels = rasterization.surfaceLuxelCounts[nextSurface[lightmapIndex]++];
 
-		if (!s_rasterizer.startedSamplingTriangle)
+		for (size_t i = 0; i < nLuxels; i++)
 		{
-			// Setup rasterizer for this triangle.
-			const vec2i lightmapSize = world::GetLightmapSize();
-			const std::vector<Vertex> &vertices = world::GetVertexBuffer((int)surface.bufferIndex);
-			lm_vec2 uvMin = lm_v2(FLT_MAX, FLT_MAX), uvMax = lm_v2(-FLT_MAX, -FLT_MAX);
+			Luxel luxel = rasterization.luxels[nextLuxel[lightmapIndex]++];
+			luxel.up = CalculateLuxelUp(luxel, lightmapWidth);
+			luxels->push_back(luxel);
+		}
+	}
 
-			for (int i = 0; i < 3; i++)
-			{
-				const Vertex &v = vertices[surface.indices[s_rasterizer.triangleIndex * 3 + i]];
-				ctx.triangle.p[i].x = v.pos.x;
-				ctx.triangle.p[i].y = v.pos.y;
-				ctx.triangle.p[i].z = v.pos.z;
-				const vec4 texCoord = v.getTexCoord();
-				ctx.triangle.uv[i].x = texCoord.z * lightmapSize.x;
-				ctx.triangle.uv[i].y = texCoord.w * lightmapSize.y;
-
-				// update bounds on lightmap
-				uvMin = lm_min2(uvMin, ctx.triangle.uv[i]);
-				uvMax = lm_max2(uvMax, ctx.triangle.uv[i]);
-			}
+	for (const LightmapRasterization &rasterization : s_rasterizer.lightmaps)
+	{
+		s_lightBaker->nInterpolatedLuxels += rasterization.nInterpolatedLuxels;
+	}
 
-			// Calculate area of interest (on lightmap) for conservative rasterization.
-			lm_vec2 bbMin = lm_floor2(uvMin);
-			lm_vec2 bbMax = lm_ceil2(uvMax);
-			ctx.rasterizer.minx = ctx.rasterizer.x = lm_maxi((int)bbMin.x - 1, 0);
-			ctx.rasterizer.miny = ctx.rasterizer.y = lm_maxi((int)bbMin.y - 1, 0);
-			ctx.rasterizer.maxx = lm_mini((int)bbMax.x + 1, lightmapSize.x);
-			ctx.rasterizer.maxy = lm_mini((int)bbMax.y + 1, lightmapSize.y);
-			assert(ctx.rasterizer.minx < ctx.rasterizer.maxx && ctx.rasterizer.miny < ctx.rasterizer.maxy);
-			ctx.rasterizer.x = ctx.rasterizer.minx + lm_passOffsetX(&ctx);
-			ctx.rasterizer.y = ctx.rasterizer.miny + lm_passOffsetY(&ctx);
-
-			ctx.lightmap.width = lightmapSize.x;
-			ctx.lightmap.height = lightmapSize.y;
-			ctx.lightmap.channels = 3;
-			ctx.lightmap.data = &s_lightBaker->lightmaps[surface.material->lightmapIndex].passColor.data()[0].x;
-#ifdef DEBUG_LIGHTMAP_INTERPOLATION
-			ctx.lightmap.debug = s_lightBaker->lightmaps[surface.material->lightmapIndex].interpolationDebug.data();
-#endif
+	s_rasterizer.pass++;
+	s_rasterizer.nTrianglesRasterized += s_rasterizer.nTriangles;
+	return true;
+}
 
-			gotSample = lm_findFirstConservativeTriangleRasterizerPosition(&s_rasterizer.ctx);
-			s_rasterizer.startedSamplingTriangle = true;
-		}
-		else
-		{
-			gotSample = lm_findNextConservativeTriangleRasterizerPosition(&s_rasterizer.ctx);
-		}
+Luxel RasterizeLuxel()
+{
+	Luxel luxel;
+	luxel.sentinel = false;
+	luxel.endOfPass = false;
 
-		if (gotSample)
+	while (s_rasterizer.nextPassLuxel >= s_rasterizer.passLuxels.size())
+	{
+		if (s_rasterizer.pass >= s_rasterizer.passCount)
 		{
-			luxel.lightmapIndex = surface.material->lightmapIndex;
-			luxel.position = vec3(&ctx.sample.position.x);
-			luxel.normal = -vec3(&ctx.sample.direction.x);
-			luxel.up = vec3(&ctx.sample.up.x);
-			luxel.offset = ctx.rasterizer.x + ctx.rasterizer.y * world::GetLightmapSize().x;
-			break;
+			luxel.sentinel = true;
+			return luxel;
 		}
-		else
+
+		// Let the caller catch up before interpolating from the previous pass's luxels.
+		if (s_rasterizer.pass > 0 && !s_rasterizer.returnedEndOfPass)
 		{
-			// No more samples. Move to the next triangle.
-			s_rasterizer.triangleIndex++;
-			s_rasterizer.nTrianglesRasterized++;
-			s_rasterizer.startedSamplingTriangle = false;
+			s_rasterizer.returnedEndOfPass = true;
+			luxel.endOfPass = true;
+			return luxel;
 		}
+
+		s_rasterizer.passLuxels.clear();
+		s_rasterizer.nextPassLuxel = 0;
+		s_rasterizer.returnedEndOfPass = false;
+		RasterizeLuxels(&s_rasterizer.passLuxels);
 	}
 
-	return luxel;
+	return s_rasterizer.passLuxels[s_rasterizer.nextPassLuxel++];
 }
 
 int GetNumRasterizedTriangles()
 {
-	return s_rasterizer.nTrianglesRasterized / s_rasterizer.ctx.passCount;
+	int nTriangles = s_rasterizer.nTrianglesRasterized;
+
+	// Count the part of the current pass that RasterizeLuxel hasn't handed out yet as not rasterized.
+	if (!s_rasterizer.passLuxels.empty())
+		nTriangles -= int(s_rasterizer.nTriangles * (1.0f - s_rasterizer.nextPassLuxel / (float)s_rasterizer.passLuxels.size()));
+
+	return nTriangles / s_rasterizer.passCount;
 }
 
 } // namespace light_baker
@@ -25,6 +25,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include <bx/simd_t.h>
+
 #include "Main.h"
 
 namespace renderer {
@@ -149,82 +151,447 @@ static void ImageWriteCallbackConst(void *context, const void *data, int size)
 	ImageWriteCallback(context, (void *)data, size);
 }
 
-void BgfxCallback::screenShot(const char* _filePath, uint32_t _width, uint32_t _height, uint32_t _pitch, const void* _data, uint32_t _size, bool _yflip)
+ImageEncoder s_imageEncoder;
+
+/// @brief Convert a row of BGRA pixels to opaque RGBA, four pixels at a time.
+static void SwizzleBgraRow(const uint8_t *in, uint8_t *out, uint32_t width)
 {
-	const int nComponents = 4;
-	const bool silent = _filePath[0] == 'y';
-	_filePath++;
-	const char *extension = util::GetExtension(_filePath);
-	const bool writeAsPng = !util::Stricmp(extension, "png");
-	const uint32_t outputPitch = writeAsPng ? _pitch : _width * nComponents; // PNG can use any pitch, others can't.
+	const bx::simd128_t mask0f0f = bx::simd_isplat(0x00ff00ff);
+	const bx::simd128_t maskf0f0 = bx::simd_isplat(0xff00ff00);
+	const bx::simd128_t alpha = bx::simd_isplat(0xff000000);
+	uint32_t x = 0;
+
+	for (; x + 4 <= width; x += 4)
+	{
+		bx::simd128_t bgra;
+		memcpy(&bgra, &in[x * 4], sizeof(bgra));
+		const bx::simd128_t rb = bx::simd_and(bx::simd_or(bx::simd_srl(bgra, 16), bx::simd_sll(bgra, 16)), mask0f0f);
+		const bx::simd128_t rgba = bx::simd_or(bx::simd_or(bx::simd_and(bgra, maskf0f0), rb), alpha);
+		memcpy(&out[x * 4], &rgba, sizeof(rgba));
+	}
+
+	for (; x < width; x++)
+	{
+		out[x * 4 + 0] = in[x * 4 + 2];
+		out[x * 4 + 1] = in[x * 4 + 1];
+		out[x * 4 + 2] = in[x * 4 + 0];
+		out[x * 4 + 3] = 255;
+	}
+}
+
+ImageEncoder::ImageEncoder()
+{
+	// Created here rather than with the worker thread, because both the main and render threads use them before anything is queued.
+	encodedImagesMutex_ = SDL_CreateMutex();
+	encodedVideoFramesCond_ = SDL_CreateCond();
+	SDL_AtomicSet(&videoCaptureStartFrame_, 0);
+}
+
+ImageEncoder::~ImageEncoder()
+{
+	stop();
+	SDL_DestroyCond(encodedVideoFramesCond_);
+	SDL_DestroyMutex(encodedImagesMutex_);
+}
+
+void ImageEncoder::queueScreenshot(const char *filePath, bool silent, uint32_t width, uint32_t height, uint32_t pitch, const void *data, bool yflip)
+{
+	const char *extension = util::GetExtension(filePath);
+	Format format = Format::Tga;
+
+	if (!util::Stricmp(extension, "png"))
+		format = Format::Png;
+	else if (!util::Stricmp(extension, "jpg"))
+		format = Format::Jpg;
+
+	QueuedImage *image = beginQueue(format, width, height, pitch, data, yflip);
+	image->quality = g_cvars.screenshotJpegQuality.getInt();
+	image->filePath = filePath;
+	image->silent = silent;
+	endQueue();
+}
+
+void ImageEncoder::queueVideoFrame(uint32_t frameNo, uint32_t width, uint32_t height, uint32_t pitch, const void *data, bool yflip)
+{
+	QueuedImage *image = beginQueue(SDL_AtomicGet(&videoMotionJpeg_) ? Format::VideoMotionJpeg : Format::VideoUncompressed, width, height, pitch, data, yflip);
+	image->frameNo = frameNo;
+	image->quality = SDL_AtomicGet(&videoJpegQuality_);
+	image->filePath.clear();
+	image->silent = true;
+	SDL_LockMutex(encodedImagesMutex_);
+	lastQueuedVideoFrame_ = frameNo;
+	SDL_CondBroadcast(encodedVideoFramesCond_);
+	SDL_UnlockMutex(encodedImagesMutex_);
+	endQueue();
+}
+
+void ImageEncoder::skipVideoFrame(uint32_t frameNo)
+{
+	// Queued without any data, so the worker passes it on in order as a failed encode.
+	queueVideoFrame(frameNo, 0, 0, 0, nullptr, false);
+}
+
+uint32_t ImageEncoder::getVideoCaptureStartFrame()
+{
+	return (uint32_t)SDL_AtomicGet(&videoCaptureStartFrame_);
+}
+
+void ImageEncoder::startVideoCapture(uint32_t frameNo)
+{
+	SDL_AtomicSet(&videoCaptureStartFrame_, (int)frameNo);
+}
+
+void ImageEncoder::requestVideoFrame(uint32_t frameNo)
+{
+	requestedVideoFrames_.push_back(frameNo);
+}
+
+void ImageEncoder::setVideoEncoding(bool motionJpeg, int jpegQuality)
+{
+	SDL_AtomicSet(&videoMotionJpeg_, motionJpeg ? 1 : 0);
+	SDL_AtomicSet(&videoJpegQuality_, math::Clamped(jpegQuality, 1, 100));
+}
+
+void ImageEncoder::stop()
+{
+	if (!thread_)
+		return;
+
+	waitForWorker();
+	SDL_AtomicSet(&quit_, 1);
+	SDL_SemPost(pendingImages_);
+	SDL_WaitThread(thread_, nullptr);
+	thread_ = nullptr;
+	SDL_DestroySemaphore(freeImages_);
+	SDL_DestroySemaphore(pendingImages_);
+	freeImages_ = pendingImages_ = nullptr;
+
+	for (QueuedImage &image : queuedImages_)
+		std::vector<uint8_t>().swap(image.data);
+}
+
+void ImageEncoder::waitForWorker()
+{
+	if (!thread_)
+		return;
+
+	// Every buffer is free once the worker has encoded everything queued so far.
+	for (size_t i = 0; i < nQueuedImages; i++)
+		SDL_SemWait(freeImages_);
+
+	for (size_t i = 0; i < nQueuedImages; i++)
+		SDL_SemPost(freeImages_);
+}
+
+void ImageEncoder::write(uint32_t frameNo)
+{
+	// If the frame that was just submitted wasn't requested, recording has stopped. Pass everything that's left to the engine before it closes the video.
+	if (!requestedVideoFrames_.empty() && requestedVideoFrames_.back() < frameNo)
+	{
+		flush();
+		return;
+	}
+
+	if (frameNo >= videoFrameLatency)
+		writeVideoFrames(frameNo - videoFrameLatency, 0);
+
+	writeScreenshots();
+}
+
+void ImageEncoder::flush()
+{
+	writeVideoFrames(UINT32_MAX, videoFrameTimeoutMs);
+	waitForWorker();
+	writeScreenshots();
 
-	// Convert from BGRA to RGBA, and flip y if needed.
-	const size_t requiredSize = outputPitch * _height;
+	// Anything captured that wasn't requested is dropped. The next recording doesn't repeat this one's last frame.
+	SDL_LockMutex(encodedImagesMutex_);
 
-	if (screenShotDataBuffer_.size() < requiredSize)
+	for (EncodedImage &image : encodedVideoFrames_)
+		freeEncodedImages_.push_back(std::move(image));
+
+	SDL_UnlockMutex(encodedImagesMutex_);
+	encodedVideoFrames_.clear();
+	lastVideoFrame_.clear();
+}
+
+void ImageEncoder::writeScreenshots()
+{
+	SDL_LockMutex(encodedImagesMutex_);
+	std::swap(encodedImages_, writingImages_);
+	SDL_UnlockMutex(encodedImagesMutex_);
+
+	if (writingImages_.empty())
+		return;
+
+	for (EncodedImage &image : writingImages_)
 	{
-		screenShotDataBuffer_.resize(requiredSize);
+		if (image.data.empty())
+		{
+			interface::Printf("Screenshot: error writing %s file\n", util::GetExtension(image.filePath.c_str()));
+			continue;
+		}
+
+		interface::FS_WriteFile(image.filePath.c_str(), image.data.data(), image.data.size());
+
+		if (!image.silent)
+			interface::Printf("Wrote %s\n", image.filePath.c_str());
 	}
 
-	for (uint32_t y = 0; y < _height; y++)
+	SDL_LockMutex(encodedImagesMutex_);
+
+	for (EncodedImage &image : writingImages_)
+		freeEncodedImages_.push_back(std::move(image));
+
+	SDL_UnlockMutex(encodedImagesMutex_);
+	writingImages_.clear();
+}
+
+void ImageEncoder::writeVideoFrames(uint32_t lastFrameNo, Uint32 timeoutMs)
+{
+	size_t nWritten = 0;
+
+	for (; nWritten < requestedVideoFrames_.size() && requestedVideoFrames_[nWritten] <= lastFrameNo; nWritten++)
 	{
-		for (uint32_t x = 0; x < _width; x++)
+		const uint32_t frameNo = requestedVideoFrames_[nWritten];
+		SDL_LockMutex(encodedImagesMutex_);
+
+		// The worker encodes frames in the order they were captured. Wait for it if it has this frame.
+		// If bgfx hasn't captured the frame, only wait when flushing, and give up on the rest once one times out.
+		while (lastEncodedVideoFrame_ < (int64_t)frameNo)
 		{
-			auto colorIn = &((const uint8_t *)_data)[x * nComponents + (_yflip ? _height - 1 - y : y) * _pitch];
-			uint8_t *colorOut = &screenShotDataBuffer_[x * nComponents + y * outputPitch];
-			colorOut[0] = colorIn[2];
-			colorOut[1] = colorIn[1];
-			colorOut[2] = colorIn[0];
-			colorOut[3] = 255;
-
-			// Apply gamma correction.
-			if (g_hardwareGammaEnabled)
+			if (lastQueuedVideoFrame_ >= (int64_t)frameNo)
+			{
+				SDL_CondWait(encodedVideoFramesCond_, encodedImagesMutex_);
+			}
+			else if (timeoutMs == 0 || SDL_CondWaitTimeout(encodedVideoFramesCond_, encodedImagesMutex_, timeoutMs) == SDL_MUTEX_TIMEDOUT)
+			{
+				timeoutMs = 0;
+				break;
+			}
+		}
+
+		// Take this frame, and drop any older ones that weren't requested.
+		for (size_t i = 0; i < encodedVideoFrames_.size();)
+		{
+			EncodedImage &image = encodedVideoFrames_[i];
+
+			if (image.frameNo > frameNo)
 			{
-				colorOut[0] = g_gammaTable[colorOut[0]];
-				colorOut[1] = g_gammaTable[colorOut[1]];
-				colorOut[2] = g_gammaTable[colorOut[2]];
+				i++;
+				continue;
 			}
+
+			if (image.frameNo == frameNo && !image.data.empty())
+				std::swap(lastVideoFrame_, image.data);
+
+			freeEncodedImages_.push_back(std::move(image));
+			encodedVideoFrames_.erase(encodedVideoFrames_.begin() + i);
 		}
+
+		SDL_UnlockMutex(encodedImagesMutex_);
+
+		// Exactly one frame per request, so the recording keeps its timing. A frame that wasn't captured, or failed to encode, repeats the last one.
+		if (!lastVideoFrame_.empty())
+			interface::CL_WriteAVIVideoFrame(lastVideoFrame_.data(), (int)lastVideoFrame_.size());
 	}
 
-	// Write to file buffer.
-	ImageWriteBuffer buffer;
-	buffer.data = &screenShotFileBuffer_;
-	buffer.bytesWritten = 0;
+	requestedVideoFrames_.erase(requestedVideoFrames_.begin(), requestedVideoFrames_.begin() + nWritten);
+}
+
+int ImageEncoder::WorkerThread(void *data)
+{
+	auto encoder = (ImageEncoder *)data;
 
-	if (writeAsPng)
+	for (;;)
 	{
-		if (!stbi_write_png_to_func(ImageWriteCallback, &buffer, _width, _height, nComponents, screenShotDataBuffer_.data(), (int)outputPitch))
+		SDL_SemWait(encoder->pendingImages_);
+
+		if (SDL_AtomicGet(&encoder->quit_))
+			break;
+
+		const QueuedImage &image = encoder->queuedImages_[encoder->nextEncodedImage_];
+		encoder->nextEncodedImage_ = (encoder->nextEncodedImage_ + 1) % nQueuedImages;
+		EncodedImage encoded;
+		SDL_LockMutex(encoder->encodedImagesMutex_);
+
+		if (!encoder->freeEncodedImages_.empty())
 		{
-			interface::Printf("Screenshot: error writing png file\n");
-			return;
+			encoded = std::move(encoder->freeEncodedImages_.back());
+			encoder->freeEncodedImages_.pop_back();
 		}
+
+		SDL_UnlockMutex(encoder->encodedImagesMutex_);
+		encoder->encode(image, &encoded);
+		SDL_LockMutex(encoder->encodedImagesMutex_);
+
+		if (image.format == Format::VideoMotionJpeg || image.format == Format::VideoUncompressed)
+		{
+			encoded.frameNo = image.frameNo;
+			encoder->lastEncodedVideoFrame_ = image.frameNo;
+			encoder->encodedVideoFrames_.push_back(std::move(encoded));
+			SDL_CondBroadcast(encoder->encodedVideoFramesCond_);
+		}
+		else
+		{
+			encoder->encodedImages_.push_back(std::move(encoded));
+		}
+
+		SDL_UnlockMutex(encoder->encodedImagesMutex_);
+		SDL_SemPost(encoder->freeImages_);
 	}
-	else if (!util::Stricmp(extension, "jpg"))
+
+	return 0;
+}
+
+ImageEncoder::QueuedImage *ImageEncoder::beginQueue(Format format, uint32_t width, uint32_t height, uint32_t pitch, const void *data, bool yflip)
+{
+	if (!thread_)
 	{
-		if (!stbi_write_jpg_to_func(ImageWriteCallback, &buffer, _width, _height, nComponents, screenShotDataBuffer_.data(), g_cvars.screenshotJpegQuality.getInt()))
+		freeImages_ = SDL_CreateSemaphore((Uint32)nQueuedImages);
+		pendingImages_ = SDL_CreateSemaphore(0);
+		SDL_AtomicSet(&quit_, 0);
+		thread_ = SDL_CreateThread(WorkerThread, "ImageEncoder", this);
+	}
+
+	SDL_SemWait(freeImages_);
+	QueuedImage &image = queuedImages_[nextQueuedImage_];
+	nextQueuedImage_ = (nextQueuedImage_ + 1) % nQueuedImages;
+	image.format = format;
+	image.width = width;
+	image.height = height;
+	image.pitch = pitch;
+	image.yflip = yflip;
+	image.data.resize(pitch * height);
+
+	if (!image.data.empty())
+		memcpy(image.data.data(), data, image.data.size());
+
+	return &image;
+}
+
+void ImageEncoder::endQueue()
+{
+	SDL_SemPost(pendingImages_);
+}
+
+void ImageEncoder::encode(const QueuedImage &image, EncodedImage *output)
+{
+	output->format = image.format;
+	output->filePath = image.filePath;
+	output->silent = image.silent;
+
+	// Nothing was captured, see skipVideoFrame.
+	if (image.data.empty())
+	{
+		output->data.clear();
+		return;
+	}
+
+	if (image.format == Format::VideoUncompressed)
+	{
+		// Bottom-up BGR, with rows padded to 4 bytes.
+		const uint32_t outputPitch = (image.width * 3 + 3) & ~3;
+		output->data.resize(outputPitch * image.height);
+
+		for (uint32_t y = 0; y < image.height; y++)
 		{
-			interface::Printf("Screenshot: error writing jpg file\n");
-			return;
+			const uint8_t *rowIn = &image.data[(image.yflip ? y : image.height - 1 - y) * image.pitch];
+			uint8_t *rowOut = &output->data[y * outputPitch];
+
+			for (uint32_t x = 0; x < image.width; x++)
+			{
+				rowOut[x * 3 + 0] = rowIn[x * 4 + 0];
+				rowOut[x * 3 + 1] = rowIn[x * 4 + 1];
+				rowOut[x * 3 + 2] = rowIn[x * 4 + 2];
+			}
+
+			memset(&rowOut[image.width * 3], 0, outputPitch - image.width * 3);
+
+			if (g_hardwareGammaEnabled)
+			{
+				for (uint32_t x = 0; x < image.width * 3; x++)
+					rowOut[x] = g_gammaTable[rowOut[x]];
+			}
 		}
+
+		return;
 	}
-	else
+
+	// Everything else is encoded by stb from top-down RGBA.
+	const int nComponents = 4;
+	const uint32_t outputPitch = image.width * nComponents;
+	pixels_.resize(outputPitch * image.height);
+
+	for (uint32_t y = 0; y < image.height; y++)
 	{
-		if (!stbi_write_tga_to_func(ImageWriteCallback, &buffer, _width, _height, nComponents, screenShotDataBuffer_.data()))
+		uint8_t *rowOut = &pixels_[y * outputPitch];
+		SwizzleBgraRow(&image.data[(image.yflip ? image.height - 1 - y : y) * image.pitch], rowOut, image.width);
+
+		if (g_hardwareGammaEnabled)
 		{
-			interface::Printf("Screenshot: error writing tga file\n");
-			return;
+			for (uint32_t x = 0; x < image.width; x++)
+			{
+				rowOut[x * 4 + 0] = g_gammaTable[rowOut[x * 4 + 0]];
+				rowOut[x * 4 + 1] = g_gammaTable[rowOut[x * 4 + 1]];
+				rowOut[x * 4 + 2] = g_gammaTable[rowOut[x * 4 + 2]];
+			}
 		}
 	}
 
-	// Write file buffer to file.
-	if (buffer.bytesWritten > 0)
+	ImageWriteBuffer buffer;
+	buffer.data = &output->data;
+	buffer.bytesWritten = 0;
+	int result;
+
+	if (image.format == Format::Png)
 	{
-		interface::FS_WriteFile(_filePath, buffer.data->data(), buffer.bytesWritten);
+		result = stbi_write_png_to_func(ImageWriteCallback, &buffer, image.width, image.height, nComponents, pixels_.data(), (int)outputPitch);
 	}
+	else if (image.format == Format::Tga)
+	{
+		result = stbi_write_tga_to_func(ImageWriteCallback, &buffer, image.width, image.height, nComponents, pixels_.data());
+	}
+	else
+	{
+		result = stbi_write_jpg_to_func(ImageWriteCallback, &buffer, image.width, image.height, nComponents, pixels_.data(), image.quality);
+	}
+
+	output->data.resize(result ? buffer.bytesWritten : 0);
+}
+
+void BgfxCallback::screenShot(const char* _filePath, uint32_t _width, uint32_t _height, uint32_t _pitch, const void* _data, uint32_t _size, bool _yflip)
+{
+	const bool silent = _filePath[0] == 'y';
+	s_imageEncoder.queueScreenshot(_filePath + 1, silent, _width, _height, _pitch, _data, _yflip);
+}
 
-	if (!silent)
-		interface::Printf("Wrote %s\n", _filePath);
+void BgfxCallback::captureBegin(uint32_t _width, uint32_t _height, uint32_t _pitch, bgfx::TextureFormat::Enum _format, bool _yflip)
+{
+	// All the backends capture the back buffer as BGRA8.
+	captureSupported_ = _format == bgfx::TextureFormat::BGRA8;
+	captureWidth_ = _width;
+	captureHeight_ = _height;
+	capturePitch_ = _pitch;
+	captureYflip_ = _yflip;
+
+	// bgfx captures every frame from the one that enabled capture, see TakeVideoFrame.
+	captureFrameNo_ = s_imageEncoder.getVideoCaptureStartFrame();
+}
+
+void BgfxCallback::captureEnd()
+{
+	captureSupported_ = false;
+}
+
+void BgfxCallback::captureFrame(const void* _data, uint32_t _size)
+{
+	if (captureSupported_ && _size >= capturePitch_ * captureHeight_)
+		s_imageEncoder.queueVideoFrame(captureFrameNo_, captureWidth_, captureHeight_, capturePitch_, _data, captureYflip_);
+	else
+		s_imageEncoder.skipVideoFrame(captureFrameNo_);
+
+	captureFrameNo_++;
 }
 
 void AddDynamicLightToScene(const DynamicLight &light)
@@ -271,6 +638,11 @@ bool AreExtraDynamicLightsEnabled()
 	return s_main->extraDynamicLightsEnabled;
 }
 
+bool AreWorldTextureArraysEnabled()
+{
+	return s_main->worldTextureArraysEnabled;
+}
+
 #define NOISE_PERM(a) s_main->noisePerm[(a) & (s_main->noiseSize - 1)]
 #define NOISE_TABLE(x, y, z, t) s_main->noiseTable[NOISE_PERM(x + NOISE_PERM(y + NOISE_PERM(z + NOISE_PERM(t))))]
 #define NOISE_LERP( a, b, w ) ( ( a ) * ( 1.0f - ( w ) ) + ( b ) * ( w ) )
@@ -332,6 +704,8 @@ DebugDraw DebugDrawFromString(const char *s)
 		return DebugDraw::Shadow;
 	else if (util::Stricmp(s, "smaa") == 0)
 		return DebugDraw::SMAA;
+	else if (util::Stricmp(s, "velocity") == 0)
+		return DebugDraw::Velocity;
 
 	return DebugDraw::None;
 }
@@ -420,6 +794,192 @@ static float Font_ReadFloat(const uint8_t *data, int *offset)
 	return *((float *)temp);
 }
 
+static void ReleaseFontAtlasImage(void *data, void *userData)
+{
+	free(data);
+}
+
+/// @brief Copy the glyphs of a font, which are usually spread over several page images, into a single atlas and point every glyph at it.
+/// @remarks Strings then use one material, so consecutive glyphs batch into a single stretchpic draw call instead of one per page change. Fonts with scripted page materials are left alone.
+static void CreateFontAtlas(fontInfo_t *font, int pointSize)
+{
+	struct Page
+	{
+		const char *name;
+		Image image;
+	};
+
+	std::vector<Page> pages;
+	std::array<int, GLYPHS_PER_FONT> glyphPages;
+	glyphPages.fill(-1);
+	bool valid = true;
+
+	for (int i = GLYPH_START; i <= GLYPH_END && valid; i++)
+	{
+		const glyphInfo_t &glyph = font->glyphs[i];
+
+		if (!glyph.glyph || glyph.imageWidth <= 0 || glyph.imageHeight <= 0)
+			continue;
+
+		for (size_t j = 0; j < pages.size(); j++)
+		{
+			if (!util::Stricmp(pages[j].name, glyph.shaderName))
+			{
+				glyphPages[i] = (int)j;
+				break;
+			}
+		}
+
+		if (glyphPages[i] != -1)
+			continue;
+
+		// Only plain images can be packed, the material may do something else with the page.
+		const Material *material = s_main->materialCache->getMaterial(glyph.glyph);
+		const Texture *texture = material->stages[0].bundles[MaterialTextureBundleIndex::DiffuseMap].textures[0];
+
+		if (material->stages[1].active || !texture || util::Stricmp(texture->getName(), glyph.shaderName))
+		{
+			valid = false;
+			break;
+		}
+
+		Page page;
+		page.name = glyph.shaderName;
+		page.image = LoadImage(glyph.shaderName);
+
+		if (!page.image.data || page.image.nComponents < 3)
+		{
+			if (page.image.release)
+				page.image.release(page.image.data, nullptr);
+
+			valid = false;
+			break;
+		}
+
+		glyphPages[i] = (int)pages.size();
+		pages.push_back(page);
+	}
+
+	// Nothing to gain from a single page.
+	if (valid && pages.size() > 1)
+	{
+		// Shelf pack the glyph rectangles in code point order, with a transparent border so bilinear filtering doesn't bleed neighbours in.
+		const int padding = 1;
+		int atlasWidth = 0;
+
+		for (const Page &page : pages)
+			atlasWidth = std::max(atlasWidth, page.image.width);
+
+		struct Placement
+		{
+			int sourceX, sourceY;
+			int x, y;
+			int width, height;
+		};
+
+		std::array<Placement, GLYPHS_PER_FONT> placements;
+		int x = padding, y = padding, shelfHeight = 0;
+
+		for (int i = GLYPH_START; i <= GLYPH_END && valid; i++)
+		{
+			if (glyphPages[i] == -1)
+				continue;
+
+			const glyphInfo_t &glyph = font->glyphs[i];
+			const Image &image = pages[glyphPages[i]].image;
+			Placement &p = placements[i];
+			p.sourceX = std::max(0, (int)(glyph.s * image.width + 0.5f));
+			p.sourceY = std::max(0, (int)(glyph.t * image.height + 0.5f));
+			p.width = std::min((int)((glyph.s2 - glyph.s) * image.width + 0.5f), image.width - p.sourceX);
+			p.height = std::min((int)((glyph.t2 - glyph.t) * image.height + 0.5f), image.height - p.sourceY);
+
+			if (p.width <= 0 || p.height <= 0 || p.width + padding * 2 > atlasWidth)
+			{
+				valid = false;
+				break;
+			}
+
+			if (x + p.width + padding > atlasWidth)
+			{
+				x = padding;
+				y += shelfHeight + padding;
+				shelfHeight = 0;
+			}
+
+			p.x = x;
+			p.y = y;
+			x += p.width + padding;
+			shelfHeight = std::max(shelfHeight, p.height);
+		}
+
+		if (valid)
+		{
+			int atlasHeight = 1;
+
+			while (atlasHeight < y + shelfHeight + padding)
+				atlasHeight <<= 1;
+
+			Image atlas;
+			atlas.width = atlasWidth;
+			atlas.height = atlasHeight;
+			atlas.nComponents = 4;
+			atlas.dataSize = atlas.width * atlas.height * atlas.nComponents;
+			atlas.data = (uint8_t *)calloc(1, atlas.dataSize);
+			atlas.release = ReleaseFontAtlasImage;
+
+			for (int i = GLYPH_START; i <= GLYPH_END; i++)
+			{
+				if (glyphPages[i] == -1)
+					continue;
+
+				const Image &image = pages[glyphPages[i]].image;
+				const Placement &p = placements[i];
+
+				for (int py = 0; py < p.height; py++)
+				{
+					for (int px = 0; px < p.width; px++)
+					{
+						const uint8_t *src = &image.data[((p.sourceY + py) * image.width + p.sourceX + px) * image.nComponents];
+						uint8_t *dest = &atlas.data[((p.y + py) * atlas.width + p.x + px) * atlas.nComponents];
+						dest[0] = src[0];
+						dest[1] = src[1];
+						dest[2] = src[2];
+						dest[3] = image.nComponents == 4 ? src[3] : 255;
+					}
+				}
+			}
+
+			char atlasName[MAX_QPATH];
+			util::Sprintf(atlasName, sizeof(atlasName), "*fontAtlas_%i", pointSize);
+			g_textureCache->create(atlasName, atlas, TextureFlags::ClampToEdge);
+			const Material *material = s_main->materialCache->findMaterial(atlasName, MaterialLightmapId::StretchPic, false);
+
+			for (int i = GLYPH_START; i <= GLYPH_END; i++)
+			{
+				if (glyphPages[i] == -1)
+					continue;
+
+				glyphInfo_t &glyph = font->glyphs[i];
+				const Placement &p = placements[i];
+				glyph.s = p.x / (float)atlas.width;
+				glyph.t = p.y / (float)atlas.height;
+				glyph.s2 = (p.x + p.width) / (float)atlas.width;
+				glyph.t2 = (p.y + p.height) / (float)atlas.height;
+				glyph.glyph = material->index;
+				util::Strncpyz(glyph.shaderName, atlasName, sizeof(glyph.shaderName));
+			}
+
+			interface::PrintDeveloperf("Packed %d font pages into %dx%d atlas %s\n", (int)pages.size(), atlas.width, atlas.height, atlasName);
+		}
+	}
+
+	for (Page &page : pages)
+	{
+		if (page.image.release)
+			page.image.release(page.image.data, nullptr);
+	}
+}
+
 void RegisterFont(const char *fontName, int pointSize, fontInfo_t *font)
 {
 	if (!fontName)
@@ -485,6 +1045,8 @@ void RegisterFont(const char *fontName, int pointSize, fontInfo_t *font)
 		font->glyphs[i].glyph = m->defaultShader ? 0 : m->index;
 	}
 
+	CreateFontAtlas(font, pointSize);
+
 	memcpy(&s_main->fonts[s_main->nFonts++], font, sizeof(fontInfo_t));
 	interface::FS_FreeReadFile(data);
 }
@@ -530,22 +1092,40 @@ void SetWindowGamma()
 	window::SetGamma(g_gammaTable, g_gammaTable, g_gammaTable);
 }
 
-void UploadCinematic(int w, int h, int cols, int rows, const uint8_t *data, int client, bool dirty)
+void TakeVideoFrame(bool motionJpeg)
 {
-	Texture *scratch = g_textureCache->getScratch(size_t(client));
-	
-	if (cols != scratch->getWidth() || rows != scratch->getHeight())
+	s_imageEncoder.setVideoEncoding(motionJpeg, g_cvars.aviMotionJpegQuality.getInt());
+	s_imageEncoder.requestVideoFrame(s_main->frameNo);
+	s_main->videoFrameRequested = true;
+
+	if (!s_main->videoCaptureEnabled)
 	{
-		scratch->resize(cols, rows);
-		dirty = true;
+		// bgfx captures every frame until the flag is cleared, starting with this one. The reset is applied to the frame it's submitted with.
+		s_imageEncoder.startVideoCapture(s_main->frameNo);
+		bgfx::reset(window::GetWidth(), window::GetHeight(), s_main->resetFlags | BGFX_RESET_CAPTURE);
+		s_main->videoCaptureEnabled = true;
 	}
+}
 
-	if (dirty)
+void UpdateVideoCapture()
+{
+	// The engine requests a video frame before rendering each frame it's recording. If this frame wasn't requested, recording has stopped.
+	if (s_main->videoCaptureEnabled && !s_main->videoFrameRequested)
 	{
-		const bgfx::Memory *mem = bgfx::alloc(cols * rows * 4);
-		memcpy(mem->data, data, mem->size);
-		scratch->update(mem, 0, 0, cols, rows);
+		bgfx::reset(window::GetWidth(), window::GetHeight(), s_main->resetFlags);
+		s_main->videoCaptureEnabled = false;
 	}
+
+	s_main->videoFrameRequested = false;
+}
+
+void UploadCinematic(int w, int h, int cols, int rows, const uint8_t *data, int client, bool dirty)
+{
+	Texture *scratch = g_textureCache->getScratch(size_t(client));
+
+	// Any size is fine. Scratch textures are clamped and have a single mip, so bgfx handles non-power-of-two sizes.
+	if (dirty || cols != scratch->getWidth() || rows != scratch->getHeight())
+		scratch->updateStreaming(data, cols, rows, s_main->frameNo);
 }
 
 } // namespace main
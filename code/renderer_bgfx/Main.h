@@ -37,7 +37,138 @@ enum class AntiAliasing
 	MSAA4x,
 	MSAA8x,
 	MSAA16x,
-	SMAA
+	SMAA,
+	TAA
+};
+
+/// @brief Converts and encodes screenshots and video frames (the video command and cl_avidemo) on a worker thread.
+/// @remarks bgfx calls back on the render thread, which only copies images into a small ring of buffers, blocking if the worker falls too far behind. Encoded images are handed to the engine on the main thread, in the order they were queued, since the engine isn't thread safe.
+class ImageEncoder
+{
+public:
+	ImageEncoder();
+	~ImageEncoder();
+
+	/// @brief Queue a screenshot. The file format is chosen from the file extension.
+	void queueScreenshot(const char *filePath, bool silent, uint32_t width, uint32_t height, uint32_t pitch, const void *data, bool yflip);
+
+	/// @brief Queue a video frame, encoded as set by setVideoEncoding.
+	/// @param frameNo The number of the frame that was captured, see startVideoCapture.
+	void queueVideoFrame(uint32_t frameNo, uint32_t width, uint32_t height, uint32_t pitch, const void *data, bool yflip);
+
+	/// @brief Called instead of queueVideoFrame when bgfx captured a frame that can't be encoded. The frame is written as if encoding failed.
+	void skipVideoFrame(uint32_t frameNo);
+
+	/// @brief The number of the first frame bgfx will capture, set by startVideoCapture.
+	/// @remarks Render thread.
+	uint32_t getVideoCaptureStartFrame();
+
+	/// @brief Record that bgfx starts capturing with the frame being submitted.
+	/// @remarks Main thread only.
+	void startVideoCapture(uint32_t frameNo);
+
+	/// @brief Record that the engine wants a video frame for the frame being submitted. It gets exactly one, videoFrameLatency frames later.
+	/// @remarks Main thread only.
+	void requestVideoFrame(uint32_t frameNo);
+
+	/// @brief Set how video frames queued after this are encoded.
+	void setVideoEncoding(bool motionJpeg, int jpegQuality);
+
+	/// @brief Stop the worker thread, after it has encoded everything that was queued.
+	void stop();
+
+	/// @brief Wait for the worker thread to encode everything that was queued.
+	void waitForWorker();
+
+	/// @brief Write encoded screenshots to file, and pass encoded video frames to the engine.
+	/// @param frameNo The number of the frame that was just submitted.
+	/// @remarks Main thread only. Doesn't wait for the worker, unless a video frame that is due was captured and is still being encoded. If frameNo wasn't requested, recording has stopped, and everything is flushed.
+	void write(uint32_t frameNo);
+
+	/// @brief Wait for everything that was requested or queued, then write it.
+	/// @remarks Main thread only.
+	void flush();
+
+private:
+	enum class Format
+	{
+		Jpg,
+		Png,
+		Tga,
+		VideoMotionJpeg,
+		VideoUncompressed
+	};
+
+	struct QueuedImage
+	{
+		Format format;
+		uint32_t frameNo; ///< Video frames only.
+		int quality;
+		std::string filePath;
+		bool silent;
+		uint32_t width, height, pitch;
+		bool yflip;
+		std::vector<uint8_t> data; ///< BGRA8
+	};
+
+	struct EncodedImage
+	{
+		Format format;
+		uint32_t frameNo; ///< Video frames only.
+		std::string filePath;
+		bool silent;
+		std::vector<uint8_t> data; ///< Empty if encoding failed.
+	};
+
+	static int WorkerThread(void *data);
+	void writeScreenshots();
+	void writeVideoFrames(uint32_t lastFrameNo, Uint32 timeoutMs);
+	QueuedImage *beginQueue(Format format, uint32_t width, uint32_t height, uint32_t pitch, const void *data, bool yflip);
+	void endQueue();
+	void encode(const QueuedImage &image, EncodedImage *output);
+
+	static const size_t nQueuedImages = 3;
+	std::array<QueuedImage, nQueuedImages> queuedImages_;
+	size_t nextQueuedImage_ = 0;
+	size_t nextEncodedImage_ = 0;
+	SDL_sem *freeImages_ = nullptr;
+	SDL_sem *pendingImages_ = nullptr;
+	SDL_Thread *thread_ = nullptr;
+	SDL_atomic_t quit_;
+	SDL_atomic_t videoMotionJpeg_;
+	SDL_atomic_t videoJpegQuality_;
+
+	/// @brief Worker thread scratch memory for converted images.
+	std::vector<uint8_t> pixels_;
+
+	/// @name Video frame requests
+	/// @remarks Main thread only, except videoCaptureStartFrame_.
+	/// @{
+
+	/// @brief A requested video frame is passed to the engine this many frames after it was submitted.
+	/// @remarks bgfx has captured a frame once the frame after the next one is submitted, and the worker has had a frame to encode it.
+	static const uint32_t videoFrameLatency = 2;
+
+	/// @brief How long flush waits for a requested frame that bgfx hasn't captured, e.g. because the backend can't.
+	static const Uint32 videoFrameTimeoutMs = 1000;
+
+	SDL_atomic_t videoCaptureStartFrame_;
+	std::vector<uint32_t> requestedVideoFrames_; ///< Frame numbers, oldest first.
+	std::vector<uint8_t> lastVideoFrame_; ///< Repeated for a requested frame that wasn't captured or failed to encode.
+	/// @}
+
+	/// @name Encoded images
+	/// @remarks Guarded by encodedImagesMutex_, except writingImages_, which is main thread only. Buffers are recycled through freeEncodedImages_.
+	/// @{
+	SDL_mutex *encodedImagesMutex_ = nullptr;
+	SDL_cond *encodedVideoFramesCond_ = nullptr; ///< Broadcast when a video frame is queued or encoded.
+	std::vector<EncodedImage> encodedImages_;
+	std::vector<EncodedImage> encodedVideoFrames_;
+	std::vector<EncodedImage> freeEncodedImages_;
+	std::vector<EncodedImage> writingImages_;
+	int64_t lastQueuedVideoFrame_ = -1;
+	int64_t lastEncodedVideoFrame_ = -1;
+	/// @}
 };
 
 struct BgfxCallback : bgfx::CallbackI
@@ -51,13 +182,21 @@ struct BgfxCallback : bgfx::CallbackI
 	bool cacheRead(uint64_t _id, void* _data, uint32_t _size) override { return false; }
 	void cacheWrite(uint64_t _id, const void* _data, uint32_t _size) override {};
 	void screenShot(const char* _filePath, uint32_t _width, uint32_t _height, uint32_t _pitch, const void* _data, uint32_t _size, bool _yflip) override;
-	void captureBegin(uint32_t _width, uint32_t _height, uint32_t _pitch, bgfx::TextureFormat::Enum _format, bool _yflip) override {};
-	void captureEnd() override {};
-	void captureFrame(const void* _data, uint32_t _size) override {};
+	void captureBegin(uint32_t _width, uint32_t _height, uint32_t _pitch, bgfx::TextureFormat::Enum _format, bool _yflip) override;
+	void captureEnd() override;
+	void captureFrame(const void* _data, uint32_t _size) override;
 
 private:
-	std::vector<uint8_t> screenShotDataBuffer_;
-	std::vector<uint8_t> screenShotFileBuffer_;
+	/// @name Video capture
+	/// @remarks Render thread only.
+	/// @{
+	bool captureSupported_ = false;
+	uint32_t captureWidth_ = 0;
+	uint32_t captureHeight_ = 0;
+	uint32_t capturePitch_ = 0;
+	bool captureYflip_ = false;
+	uint32_t captureFrameNo_ = 0; ///< The number of the next frame bgfx captures.
+	/// @}
 };
 
 enum class DebugDraw
@@ -69,7 +208,8 @@ enum class DebugDraw
 	Lightmap,
 	Reflection,
 	Shadow,
-	SMAA
+	SMAA,
+	Velocity
 };
 
 struct DepthShaderProgramVariant
@@ -78,7 +218,8 @@ struct DepthShaderProgramVariant
 	{
 		None       = 0,
 		AlphaTest  = 1 << 0,
-		Num        = 1 << 1
+		Velocity   = 1 << 1,
+		Num        = 1 << 2
 	};
 };
 
@@ -99,6 +240,28 @@ struct GenericShaderProgramVariant
 	};
 };
 
+struct SMAANeighborhoodBlendingShaderProgramVariant
+{
+	enum
+	{
+		None  = 0,
+		Bloom = 1 << 0,
+		Num   = 1 << 1
+	};
+};
+
+/// @remarks Sync with generated TextureArrayFragmentShaderVariant.
+struct TextureArrayShaderProgramVariant
+{
+	enum
+	{
+		None          = 0,
+		DynamicLights = 1 << 0,
+		SunLight      = 1 << 1,
+		Num           = 1 << 2
+	};
+};
+
 struct TextureVariationShaderProgramVariant
 {
 	enum
@@ -114,26 +277,57 @@ struct ShaderProgramId
 	enum Enum
 	{
 		Bloom,
+		BloomDownsample,
+		BloomUpsample,
 		Color,
 		Depth,
 		Fog = Depth + DepthShaderProgramVariant::Num,
-		GaussianBlur,
 		Generic,
 		HemicubeDownsample = Generic + GenericShaderProgramVariant::Num,
 		HemicubeWeightedDownsample,
 		SMAABlendingWeightCalculation,
 		SMAAEdgeDetection,
 		SMAANeighborhoodBlending,
+		TAA = SMAANeighborhoodBlending + SMAANeighborhoodBlendingShaderProgramVariant::Num,
 		Texture,
-		TextureColor,
+		TextureArray,
+		TextureColor = TextureArray + TextureArrayShaderProgramVariant::Num,
 		TextureDebug,
 		TextureVariation,
 		Num = TextureVariation + TextureVariationShaderProgramVariant::Num
 	};
 };
 
+/// @brief What a view is used for, to group frame stats.
+struct ViewPass
+{
+	enum Enum
+	{
+		Other,
+		Shadow,
+		Depth,
+		Scene,
+		PostProcess,
+		Overlay,
+		Num
+	};
+};
+
 struct Main
 {
+	/// @name Bloom
+	/// @{
+	struct BloomPass
+	{
+		const char *name;
+		size_t level;
+		bgfx::ViewId viewId;
+	};
+
+	/// @brief Last frame's bloom passes, for finding their GPU times in the bgfx view stats.
+	std::vector<BloomPass> bloomPasses;
+	/// @}
+
 	/// @name Camera
 	/// @{
 	DrawCallList drawCalls;
@@ -146,6 +340,20 @@ struct Main
 
 	/// @}
 
+	/// @name Dynamic resolution
+	/// @{
+
+	/// @brief The scene framebuffers are this fraction of the window size.
+	float sceneScale = 1.0f;
+
+	/// @brief Smoothed GPU frame time in milliseconds.
+	float gpuFrameTime = 0;
+
+	/// @brief Frames to wait before changing the scale again, so the GPU frame time reflects the last change.
+	int sceneScaleCooldown = 0;
+
+	/// @}
+
 	/// @name Fonts
 	/// @{
 	static const int maxFonts = 6;
@@ -169,17 +377,60 @@ struct Main
 
 	/// @}
 
+	/// @name Frame stats
+	/// @{
+	struct FrameStatsPass
+	{
+		uint32_t nDrawCalls = 0;
+		uint32_t nTriangles = 0;
+
+		/// @brief Draw calls that use a different shader program to the last one in the same pass.
+		uint32_t nProgramChanges = 0;
+
+		/// @brief Milliseconds.
+		float gpuTime = 0;
+	};
+
+	struct FrameStatsSample
+	{
+		uint32_t frameNo;
+
+		/// @brief Milliseconds.
+		float cpuTime, gpuTime;
+
+		std::array<FrameStatsPass, ViewPass::Num> passes;
+	};
+
+	/// @brief The pass of each view. Views are allocated in the same order every frame, so this also identifies the views in bgfx's stats for the last rendered frame.
+	std::vector<ViewPass::Enum> viewPasses;
+
+	/// @brief Counters for the frame being submitted.
+	std::array<FrameStatsPass, ViewPass::Num> frameStatsPasses;
+
+	std::array<bgfx::ProgramHandle, ViewPass::Num> frameStatsLastPrograms;
+
+	/// @brief Ring buffer of recent frames, only recorded when r_frameStats is set.
+	std::array<FrameStatsSample, 1000> frameStatsSamples;
+
+	size_t nFrameStatsSamples = 0;
+	size_t nextFrameStatsSample = 0;
+	/// @}
+
 	/// @name Framebuffers
 	/// @{
 	static const FrameBuffer defaultFb;
 	FrameBuffer depthFb;
 	FrameBuffer reflectionFb;
 	FrameBuffer sceneFb;
+
+	/// @remarks False when nothing needs to read the scene back, so the camera renders straight to the backbuffer.
+	bool sceneFbEnabled = false;
+
 	FrameBuffer sceneTempFb;
 	uint8_t sceneBloomAttachment;
 	uint8_t sceneDepthAttachment;
-	static const size_t nBloomFrameBuffers = 2;
-	FrameBuffer bloomFb[nBloomFrameBuffers];
+	static const size_t nBloomLevels = 3;
+	FrameBuffer bloomFb[nBloomLevels];
 	/// @}
 
 	/// @name Noise
@@ -223,6 +474,8 @@ struct Main
 	std::array<Shader, FragmentShaderId::Num> fragmentShaders;
 	std::array<Shader, VertexShaderId::Num> vertexShaders;
 	std::array<ShaderProgram, (int)ShaderProgramId::Num> shaderPrograms;
+	std::array<Shader, ComputeShaderId::Num> computeShaders;
+	std::array<ShaderProgram, ComputeShaderId::Num> computeShaderPrograms;
 	/// @}
 
 	/// @name Shadows
@@ -244,10 +497,56 @@ struct Main
 	bgfx::TextureHandle smaaSearchTex = BGFX_INVALID_HANDLE;
 	/// @}
 
+	/// @name TAA
+	/// @{
+
+	/// @brief Ping-ponged. The resolve reads last frame's history and writes this frame's, which is then the scene color for the rest of post-processing.
+	FrameBuffer taaHistoryFb[2];
+
+	/// @brief The history framebuffer written this frame.
+	size_t taaHistoryIndex = 0;
+
+	/// @brief False after a camera cut or the history being recreated.
+	bool taaHistoryValid = false;
+
+	/// @brief The main camera's view projection matrix without jitter.
+	mat4 taaViewProj;
+
+	mat4 taaPreviousViewProj;
+	vec3 taaPreviousCameraPosition;
+
+	struct TaaEntity
+	{
+		qhandle_t handle;
+		int flags;
+		vec3 position;
+		mat4 modelMatrix;
+	};
+
+	/// @brief Last frame's model entities, matched to this frame's by model and position, since entities don't persist between frames.
+	std::vector<TaaEntity> taaPreviousEntities;
+
+	/// @brief Last frame's model matrix for each scene entity, or the current one if there's no match.
+	std::vector<mat4> taaEntityPreviousModelMatrices;
+
+	/// @}
+
 	/// @name Stretchpic
+	/// @remarks Recorded for the whole frame and submitted at the end of it from a single transient buffer.
 	/// @{
+
+	/// @brief A run of consecutive stretchpics with the same material and view.
+	/// @remarks Indices are relative to firstVertex.
+	struct StretchPicCommand
+	{
+		Material *material;
+		bgfx::ViewId viewId;
+		uint32_t firstVertex, nVertices;
+		uint32_t firstIndex, nIndices;
+	};
+
 	vec4 stretchPicColor;
-	Material *stretchPicMaterial = nullptr;
+	std::vector<StretchPicCommand> stretchPicCommands;
 	bgfx::ViewId stretchPicViewId = UINT8_MAX;
 	std::vector<Vertex> stretchPicVertices;
 	std::vector<uint16_t> stretchPicIndices;
@@ -261,10 +560,18 @@ struct Main
 	std::unique_ptr<Uniforms_MaterialStage> matStageUniforms;
 	/// @}
 
+	/// @name Video capture
+	/// @{
+	bool videoCaptureEnabled = false;
+	bool videoFrameRequested = false;
+	/// @}
+
 	/// @name Derived from console variables
 	/// @{
 	AntiAliasing aa;
+	bool bloomComputeEnabled;
 	bool bloomEnabled;
+	bool dynamicResolutionEnabled;
 	bool extraDynamicLightsEnabled;
 	bool fastPathEnabled;
 	bool lerpTextureAnimationEnabled;
@@ -272,6 +579,7 @@ struct Main
 	bool softSpritesEnabled;
 	bool sunLightEnabled;
 	bool waterReflectionsEnabled;
+	bool worldTextureArraysEnabled;
 	/// @}
 	
 	bool captureFrame = false;
@@ -281,19 +589,26 @@ struct Main
 	float halfTexelOffset = 0;
 	bool isTextureOriginBottomLeft = false;
 	vec2 lastCameraDepthRange; // for debug drawing
+	uint32_t resetFlags = 0;
 	SunLight sunLight;
 
 	/// Convert from our coordinate system (looking down X) to OpenGL's coordinate system (looking down -Z)
 	static const mat4 toOpenGlMatrix;
 };
 
+extern ImageEncoder s_imageEncoder;
 extern std::unique_ptr<Main> s_main;
 
+void CreateSceneFrameBuffers();
+void DumpFrameStats(const char *filename);
 DebugDraw DebugDrawFromString(const char *s);
 bool IsMsaa(AntiAliasing aa);
 bgfx::ViewId PushView(const FrameBuffer &frameBuffer, uint16_t clearFlags, const mat4 &viewMatrix, const mat4 &projectionMatrix, Rect rect, int flags = 0);
+void PrintFrameStats();
+void RecordFrameStats();
 void RenderScreenSpaceQuad(const char *viewName, const FrameBuffer &frameBuffer, ShaderProgramId::Enum program, uint64_t state, uint16_t clearFlags = BGFX_CLEAR_NONE, bool originBottomLeft = false, Rect rect = Rect());
 void SetWindowGamma();
+void UpdateVideoCapture();
 
 } // namespace main
 } // namespace renderer
@@ -77,12 +77,41 @@ bgfx::ViewId PushView(const FrameBuffer &frameBuffer, uint16_t clearFlags, const
 #ifdef _DEBUG
 	bgfx::setViewName(viewId, "");
 #endif
+	s_main->viewPasses[viewId] = ViewPass::Other;
 	return viewId;
 }
 
+/// @brief bgfx::submit, counting the draw call in the frame stats of the view's pass.
+static void Submit(bgfx::ViewId viewId, ShaderProgramId::Enum program, uint32_t nIndices)
+{
+	const ViewPass::Enum viewPass = s_main->viewPasses[viewId];
+	Main::FrameStatsPass &pass = s_main->frameStatsPasses[viewPass];
+	const bgfx::ProgramHandle handle = s_main->shaderPrograms[program].handle;
+	pass.nDrawCalls++;
+	pass.nTriangles += nIndices / 3;
+
+	if (handle.idx != s_main->frameStatsLastPrograms[viewPass].idx)
+	{
+		pass.nProgramChanges++;
+		s_main->frameStatsLastPrograms[viewPass] = handle;
+	}
+
+	bgfx::submit(viewId, handle);
+}
+
+/// @brief Pack per-draw state into Uniforms::drawParams and set it with a single uniform update.
+static void SetDrawParams(vec4 depthRange, bool depthRangeEnabled, bool fogEnabled, bool bloomEnabled, bool bloomWrite)
+{
+	vec4 params[DRAW_NUM_PARAMS];
+	params[DRAW_DEPTH_RANGE] = depthRange;
+	params[DRAW_FLAGS] = vec4(depthRangeEnabled ? 1.0f : 0.0f, fogEnabled ? 1.0f : 0.0f, bloomEnabled ? 1.0f : 0.0f, bloomEnabled && bloomWrite ? 1.0f : 0.0f);
+	s_main->uniforms->drawParams.set(params, DRAW_NUM_PARAMS);
+}
+
+/// @brief Submit the stretchpics recorded this frame. Each command was recorded with the view that was current at the time, so ordering with 3D scenes and cinematics is preserved.
 static void FlushStretchPics()
 {
-	if (!s_main->stretchPicIndices.empty())
+	if (!s_main->stretchPicCommands.empty())
 	{
 		bgfx::TransientVertexBuffer tvb;
 		bgfx::TransientIndexBuffer tib;
@@ -100,37 +129,35 @@ static void FlushStretchPics()
 			s_main->uniforms->renderMode.set(vec4::empty);
 			s_main->uniforms->dynamicLight_Num_Intensity.set(vec4::empty);
 			s_main->matUniforms->nDeforms.set(vec4(0, 0, 0, 0));
-			s_main->matUniforms->time.set(vec4(s_main->stretchPicMaterial->setTime(s_main->floatTime), 0, 0, 0));
+			SetDrawParams(vec4::empty, false, false, false, false);
 
-			if (s_main->stretchPicViewId == UINT8_MAX)
+			for (const Main::StretchPicCommand &command : s_main->stretchPicCommands)
 			{
-				s_main->stretchPicViewId = PushView(s_main->defaultFb, BGFX_CLEAR_NONE, mat4::identity, mat4::orthographicProjection(0, (float)window::GetWidth(), 0, (float)window::GetHeight(), -1, 1), Rect(0, 0, window::GetWidth(), window::GetHeight()), PushViewFlags::Sequential);
-#ifdef _DEBUG
-				bgfx::setViewName(s_main->stretchPicViewId, "StretchPic");
-#endif
-			}
+				s_main->matUniforms->time.set(vec4(command.material->setTime(s_main->floatTime), 0, 0, 0));
 
-			for (const MaterialStage &stage : s_main->stretchPicMaterial->stages)
-			{
-				if (!stage.active)
-					continue;
+				for (const MaterialStage &stage : command.material->stages)
+				{
+					if (!stage.active)
+						continue;
 
-				stage.setShaderUniforms(s_main->matStageUniforms.get());
-				stage.setTextureSamplers(s_main->matStageUniforms.get());
-				uint64_t state = BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A | stage.getState();
+					stage.setShaderUniforms(s_main->matStageUniforms.get());
+					stage.setTextureSamplers(s_main->matStageUniforms.get());
+					uint64_t state = BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A | stage.getState();
 
-				// Depth testing and writing should always be off for 2D drawing.
-				state &= ~BGFX_STATE_DEPTH_TEST_MASK;
-				state &= ~BGFX_STATE_WRITE_Z;
+					// Depth testing and writing should always be off for 2D drawing.
+					state &= ~BGFX_STATE_DEPTH_TEST_MASK;
+					state &= ~BGFX_STATE_WRITE_Z;
 
-				bgfx::setState(state);
-				bgfx::setVertexBuffer(0, &tvb);
-				bgfx::setIndexBuffer(&tib);
-				bgfx::submit(s_main->stretchPicViewId, s_main->shaderPrograms[ShaderProgramId::Generic].handle);
+					bgfx::setState(state);
+					bgfx::setVertexBuffer(0, &tvb, command.firstVertex, command.nVertices);
+					bgfx::setIndexBuffer(&tib, command.firstIndex, command.nIndices);
+					Submit(command.viewId, ShaderProgramId::Generic, command.nIndices);
+				}
 			}
 		}
 	}
 
+	s_main->stretchPicCommands.clear();
 	s_main->stretchPicVertices.clear();
 	s_main->stretchPicIndices.clear();
 }
@@ -154,18 +181,37 @@ void DrawStretchPicGradient(float x, float y, float w, float h, float s1, float
 {
 	Material *mat = s_main->materialCache->getMaterial(materialIndex);
 
-	if (s_main->stretchPicMaterial != mat)
+	// 3D scenes and cinematics reset the view, so anything drawn after them is in a later view.
+	if (s_main->stretchPicViewId == UINT8_MAX)
 	{
-		FlushStretchPics();
-		s_main->stretchPicMaterial = mat;
+		s_main->stretchPicViewId = PushView(s_main->defaultFb, BGFX_CLEAR_NONE, mat4::identity, mat4::orthographicProjection(0, (float)window::GetWidth(), 0, (float)window::GetHeight(), -1, 1), Rect(0, 0, window::GetWidth(), window::GetHeight()), PushViewFlags::Sequential);
+#ifdef _DEBUG
+		bgfx::setViewName(s_main->stretchPicViewId, "StretchPic");
+#endif
+		s_main->viewPasses[s_main->stretchPicViewId] = ViewPass::Overlay;
+	}
+
+	// Extend the last command if it has the same material and view. Indices are 16-bit, so start a new one when that runs out.
+	Main::StretchPicCommand *command = s_main->stretchPicCommands.empty() ? nullptr : &s_main->stretchPicCommands.back();
+
+	if (!command || command->material != mat || command->viewId != s_main->stretchPicViewId || command->nVertices + 4 > UINT16_MAX + 1)
+	{
+		Main::StretchPicCommand newCommand;
+		newCommand.material = mat;
+		newCommand.viewId = s_main->stretchPicViewId;
+		newCommand.firstVertex = (uint32_t)s_main->stretchPicVertices.size();
+		newCommand.nVertices = 0;
+		newCommand.firstIndex = (uint32_t)s_main->stretchPicIndices.size();
+		newCommand.nIndices = 0;
+		s_main->stretchPicCommands.push_back(newCommand);
+		command = &s_main->stretchPicCommands.back();
 	}
 
-	auto firstVertex = (const uint16_t)s_main->stretchPicVertices.size();
-	size_t firstIndex = s_main->stretchPicIndices.size();
-	s_main->stretchPicVertices.resize(s_main->stretchPicVertices.size() + 4);
-	s_main->stretchPicIndices.resize(s_main->stretchPicIndices.size() + 6);
-	Vertex *v = &s_main->stretchPicVertices[firstVertex];
-	uint16_t *i = &s_main->stretchPicIndices[firstIndex];
+	const auto firstVertex = (uint16_t)command->nVertices;
+	Vertex *v = &*s_main->stretchPicVertices.insert(s_main->stretchPicVertices.end(), 4, Vertex());
+	uint16_t *i = &*s_main->stretchPicIndices.insert(s_main->stretchPicIndices.end(), 6, 0);
+	command->nVertices += 4;
+	command->nIndices += 6;
 	v[0].pos = vec3(x, y, 0);
 	v[1].pos = vec3(x + w, y, 0);
 	v[2].pos = vec3(x + w, y + h, 0);
@@ -182,11 +228,6 @@ void DrawStretchPicGradient(float x, float y, float w, float h, float s1, float
 
 void DrawStretchRaw(int x, int y, int w, int h, int cols, int rows, const uint8_t *data, int client, bool dirty)
 {
-	if (!math::IsPowerOfTwo(cols) || !math::IsPowerOfTwo(rows))
-	{
-		interface::Error("Draw_StretchRaw: size not a power of 2: %i by %i", cols, rows);
-	}
-
 	bgfx::TransientVertexBuffer tvb;
 	bgfx::TransientIndexBuffer tib;
 
@@ -196,7 +237,6 @@ void DrawStretchRaw(int x, int y, int w, int h, int cols, int rows, const uint8_
 		return;
 	}
 
-	FlushStretchPics();
 	s_main->stretchPicViewId = UINT8_MAX;
 	UploadCinematic(w, h, cols, rows, data, client, dirty);
 	auto vertices = (Vertex *)tvb.data;
@@ -225,7 +265,8 @@ void DrawStretchRaw(int x, int y, int w, int h, int cols, int rows, const uint8_
 #ifdef _DEBUG
 	bgfx::setViewName(viewId, "StretchRaw");
 #endif
-	bgfx::submit(viewId, s_main->shaderPrograms[ShaderProgramId::TextureColor].handle);
+	s_main->viewPasses[viewId] = ViewPass::Overlay;
+	Submit(viewId, ShaderProgramId::TextureColor, 6);
 }
 
 // From bgfx screenSpaceQuad.
@@ -283,13 +324,15 @@ void RenderScreenSpaceQuad(const char *viewName, const FrameBuffer &frameBuffer,
 #else
 	BX_UNUSED(viewName);
 #endif
-	bgfx::submit(viewId, s_main->shaderPrograms[program].handle);
+	s_main->viewPasses[viewId] = ViewPass::PostProcess;
+	Submit(viewId, program, nVerts);
 }
 
 static void Blit(const char *viewName, bgfx::TextureHandle source, bgfx::TextureHandle dest)
 {
 	const bgfx::ViewId viewId = PushView(s_main->defaultFb, BGFX_CLEAR_NONE, mat4::identity, mat4::identity, Rect());
 	bgfx::blit(viewId, dest, 0, 0, source);
+	s_main->viewPasses[viewId] = ViewPass::PostProcess;
 #ifdef _DEBUG
 	bgfx::setViewName(viewId, viewName);
 #else
@@ -795,11 +838,9 @@ static void RenderToStencil(const bgfx::ViewId viewId)
 	for (DrawCall &dc : s_main->drawCalls)
 	{
 		Material *mat = dc.material->remappedShader ? dc.material->remappedShader : dc.material;
-		s_main->uniforms->depthRangeEnabled.set(vec4::empty);
-		s_main->uniforms->depthRange.set(vec4::empty);
+		SetDrawParams(vec4::empty, false, false, false, false);
 		s_main->matUniforms->time.set(vec4(mat->setTime(s_main->floatTime), 0, 0, 0));
-		mat->setDeformUniforms(s_main->matUniforms.get());
-		s_main->matStageUniforms->alphaTest.set(vec4::empty);
+		mat->setDeformUniforms(s_main->matUniforms.get(), s_main->sceneRotation);
 		SetDrawCallGeometry(dc);
 		bgfx::setTransform(dc.modelMatrix.get());
 		uint64_t state = BGFX_STATE_WRITE_RGB | BGFX_STATE_DEPTH_TEST_LESS | BGFX_STATE_WRITE_Z;
@@ -812,7 +853,7 @@ static void RenderToStencil(const bgfx::ViewId viewId)
 
 		bgfx::setState(state);
 		bgfx::setStencil(stencilWrite);
-		bgfx::submit(viewId, s_main->shaderPrograms[ShaderProgramId::Depth].handle);
+		Submit(viewId, ShaderProgramId::Depth, dc.ib.nIndices);
 	}
 }
 
@@ -830,6 +871,31 @@ static vec2 CalculateDepthRange(VisibilityId visId, vec3 position)
 	return vec2(zMin, zMax);
 }
 
+/// @brief Offset the projection by a different subpixel amount each frame, so TAA can accumulate samples over several frames.
+static void ApplyTaaJitter(mat4 *projectionMatrix, Rect rect)
+{
+	// Halton (2, 3) sequence.
+	static const vec2 samples[] =
+	{
+		{ 1/2.0f, 1/3.0f },
+		{ 1/4.0f, 2/3.0f },
+		{ 3/4.0f, 1/9.0f },
+		{ 1/8.0f, 4/9.0f },
+		{ 5/8.0f, 7/9.0f },
+		{ 3/8.0f, 2/9.0f },
+		{ 7/8.0f, 5/9.0f },
+		{ 1/16.0f, 8/9.0f }
+	};
+
+	const vec2 &sample = samples[s_main->frameNo % BX_COUNTOF(samples)];
+
+	// Pixels to NDC. Scale by w so the offset is constant after the perspective divide.
+	const float x = (sample.x - 0.5f) * 2.0f / rect.w;
+	const float y = (sample.y - 0.5f) * 2.0f / rect.h;
+	(*projectionMatrix)[8] += x * (*projectionMatrix)[11];
+	(*projectionMatrix)[9] += y * (*projectionMatrix)[11];
+}
+
 static void RenderCamera(const RenderCameraArgs &args)
 {
 	const float polygonDepthOffset = -0.001f;
@@ -850,10 +916,21 @@ static void RenderCamera(const RenderCameraArgs &args)
 
 	// Setup camera transform.
 	const mat4 viewMatrix = s_main->toOpenGlMatrix * mat4::view(args.position, args.rotation);
-	const mat4 projectionMatrix = args.customProjectionMatrix ? *args.customProjectionMatrix : mat4::perspectiveProjection(args.fov.x, args.fov.y, depthRange.x, depthRange.y);
+	mat4 projectionMatrix = args.customProjectionMatrix ? *args.customProjectionMatrix : mat4::perspectiveProjection(args.fov.x, args.fov.y, depthRange.x, depthRange.y);
 	const mat4 vpMatrix(projectionMatrix * viewMatrix);
 	const Frustum cameraFrustum(vpMatrix);
 
+	// Culling and velocity use the projection without jitter.
+	if (s_main->aa == AntiAliasing::TAA && s_main->isWorldCamera && !isProbe)
+	{
+		if (args.visId == VisibilityId::Main)
+		{
+			s_main->taaViewProj = vpMatrix;
+		}
+
+		ApplyTaaJitter(&projectionMatrix, args.rect);
+	}
+
 	// The main camera can have a single portal camera and a single reflection camera. No deep recursion.
 	if (args.visId == VisibilityId::Main)
 	{
@@ -876,6 +953,7 @@ static void RenderCamera(const RenderCameraArgs &args)
 #ifdef _DEBUG
 				bgfx::setViewName(viewId, "ReflectionStencilMask");
 #endif
+				s_main->viewPasses[viewId] = ViewPass::Scene;
 				RenderToStencil(viewId);
 
 				// Render to the scene frame buffer with stencil testing.
@@ -911,10 +989,11 @@ static void RenderCamera(const RenderCameraArgs &args)
 			s_main->drawCalls.clear();
 			world::RenderPortal(args.visId, &s_main->drawCalls);
 			assert(!s_main->drawCalls.empty());
-			const bgfx::ViewId viewId = PushView(s_main->fastPathEnabled ? s_main->defaultFb : s_main->sceneFb, BGFX_CLEAR_DEPTH | BGFX_CLEAR_STENCIL, viewMatrix, projectionMatrix, args.rect);
+			const bgfx::ViewId viewId = PushView(s_main->sceneFbEnabled ? s_main->sceneFb : s_main->defaultFb, BGFX_CLEAR_DEPTH | BGFX_CLEAR_STENCIL, viewMatrix, projectionMatrix, args.rect);
 #ifdef _DEBUG
 			bgfx::setViewName(viewId, "PortalStencilMask");
 #endif
+			s_main->viewPasses[viewId] = ViewPass::Scene;
 			RenderToStencil(viewId);
 
 			// Render the portal camera with stencil testing.
@@ -948,7 +1027,7 @@ static void RenderCamera(const RenderCameraArgs &args)
 			}
 		}
 
-		world::Render(args.visId, &s_main->drawCalls, s_main->sceneRotation);
+		world::Render(args.visId, &s_main->drawCalls);
 	}
 
 	for (Entity &entity : s_main->sceneEntities)
@@ -1006,6 +1085,7 @@ static void RenderCamera(const RenderCameraArgs &args)
 #ifdef _DEBUG
 		bgfx::setViewName(viewId, "ShadowMap");
 #endif
+		s_main->viewPasses[viewId] = ViewPass::Shadow;
 
 		for (DrawCall &dc : s_main->drawCalls)
 		{
@@ -1021,12 +1101,12 @@ static void RenderCamera(const RenderCameraArgs &args)
 
 			s_main->currentEntity = dc.entity;
 			s_main->matUniforms->time.set(vec4(mat->setTime(s_main->floatTime), 0, 0, 0));
-			s_main->uniforms->depthRangeEnabled.set(vec4::empty);
-			mat->setDeformUniforms(s_main->matUniforms.get());
+			SetDrawParams(vec4::empty, false, false, false, false);
+			mat->setDeformUniforms(s_main->matUniforms.get(), s_main->sceneRotation);
 			SetDrawCallGeometry(dc);
 			bgfx::setTransform(dc.modelMatrix.get());
 			bgfx::setState(BGFX_STATE_DEPTH_TEST_LEQUAL | BGFX_STATE_WRITE_Z/* | BGFX_STATE_CULL_CW*/);
-			bgfx::submit(viewId, s_main->shaderPrograms[ShaderProgramId::Depth].handle);
+			Submit(viewId, ShaderProgramId::Depth, dc.ib.nIndices);
 			s_main->currentEntity = nullptr;
 		}
 
@@ -1036,13 +1116,21 @@ static void RenderCamera(const RenderCameraArgs &args)
 		s_main->uniforms->sunLightDir.set(vec4(-s_main->sunLight.direction, 0));
 	}
 
-	// Render depth for soft sprites. MSAA is always off.
-	if (s_main->softSpritesEnabled && s_main->isWorldCamera && !isProbe)
+	// Render depth for soft sprites, and velocity for TAA. MSAA is always off.
+	if ((s_main->softSpritesEnabled || s_main->aa == AntiAliasing::TAA) && s_main->isWorldCamera && !isProbe)
 	{
-		const bgfx::ViewId viewId = PushView(s_main->depthFb, BGFX_CLEAR_DEPTH, viewMatrix, projectionMatrix, args.rect);
+		// Only the main camera writes velocity. Other cameras render here first and are overwritten.
+		const bool writeVelocity = s_main->aa == AntiAliasing::TAA && args.visId == VisibilityId::Main;
+		const bgfx::ViewId viewId = PushView(s_main->depthFb, BGFX_CLEAR_DEPTH | (writeVelocity ? BGFX_CLEAR_COLOR : 0), viewMatrix, projectionMatrix, args.rect);
 #ifdef _DEBUG
 		bgfx::setViewName(viewId, "Depth");
 #endif
+		s_main->viewPasses[viewId] = ViewPass::Depth;
+
+		if (writeVelocity)
+		{
+			s_main->uniforms->taaViewProj.set(s_main->taaViewProj);
+		}
 
 		for (DrawCall &dc : s_main->drawCalls)
 		{
@@ -1059,17 +1147,8 @@ static void RenderCamera(const RenderCameraArgs &args)
 			s_main->currentEntity = dc.entity;
 			s_main->matUniforms->time.set(vec4(mat->setTime(s_main->floatTime), 0, 0, 0));
 
-			if (dc.zOffset > 0 || dc.zScale > 0)
-			{
-				s_main->uniforms->depthRangeEnabled.set(vec4(1, 0, 0, 0));
-				s_main->uniforms->depthRange.set(vec4(dc.zOffset, dc.zScale, depthRange.x, depthRange.y));
-			}
-			else
-			{
-				s_main->uniforms->depthRangeEnabled.set(vec4::empty);
-			}
-
-			mat->setDeformUniforms(s_main->matUniforms.get());
+			SetDrawParams(vec4(dc.zOffset, dc.zScale, depthRange.x, depthRange.y), dc.zOffset > 0 || dc.zScale > 0, false, false, false);
+			mat->setDeformUniforms(s_main->matUniforms.get(), s_main->sceneRotation);
 
 			// See if any of the stages use alpha testing.
 			const MaterialStage *alphaTestStage = nullptr;
@@ -1094,13 +1173,23 @@ static void RenderCamera(const RenderCameraArgs &args)
 
 			if (alphaTestStage)
 			{
-				alphaTestStage->setShaderUniforms(s_main->matStageUniforms.get(), MaterialStageSetUniformsFlags::TexGen);
+				alphaTestStage->setShaderUniforms(s_main->matStageUniforms.get());
 				bgfx::setTexture(0, s_main->uniforms->textureSampler.handle, alphaTestStage->bundles[0].textures[0]->getHandle());
 				shaderVariant |= DepthShaderProgramVariant::AlphaTest;
 			}
-			else
+
+			if (writeVelocity)
 			{
-				s_main->matStageUniforms->alphaTest.set(vec4::empty);
+				mat4 previousModelMatrix = dc.modelMatrix;
+
+				if (dc.entity && dc.entity->type == EntityType::Model && dc.entity >= s_main->sceneEntities.data() && dc.entity < s_main->sceneEntities.data() + s_main->taaEntityPreviousModelMatrices.size())
+				{
+					previousModelMatrix = s_main->taaEntityPreviousModelMatrices[dc.entity - s_main->sceneEntities.data()];
+				}
+
+				s_main->uniforms->taaPreviousModelViewProj.set(s_main->taaPreviousViewProj * previousModelMatrix);
+				shaderVariant |= DepthShaderProgramVariant::Velocity;
+				state |= BGFX_STATE_WRITE_R | BGFX_STATE_WRITE_G;
 			}
 
 			bgfx::setState(state);
@@ -1110,7 +1199,7 @@ static void RenderCamera(const RenderCameraArgs &args)
 				bgfx::setStencil(stencilTest);
 			}
 
-			bgfx::submit(viewId, s_main->shaderPrograms[ShaderProgramId::Depth + shaderVariant].handle);
+			Submit(viewId, ShaderProgramId::Enum(ShaderProgramId::Depth + shaderVariant), dc.ib.nIndices);
 			s_main->currentEntity = nullptr;
 		}
 	}
@@ -1124,13 +1213,15 @@ static void RenderCamera(const RenderCameraArgs &args)
 #ifdef _DEBUG
 		bgfx::setViewName(mainViewId, "Probe");
 #endif
+		s_main->viewPasses[mainViewId] = ViewPass::Scene;
 	}
 	else if (s_main->isWorldCamera)
 	{
-		mainViewId = PushView(s_main->fastPathEnabled ? s_main->defaultFb : s_main->sceneFb, BGFX_CLEAR_DEPTH, viewMatrix, projectionMatrix, args.rect, PushViewFlags::Sequential);
+		mainViewId = PushView(s_main->sceneFbEnabled ? s_main->sceneFb : s_main->defaultFb, BGFX_CLEAR_DEPTH, viewMatrix, projectionMatrix, args.rect, PushViewFlags::Sequential);
 #ifdef _DEBUG
 		bgfx::setViewName(mainViewId, "Scene");
 #endif
+		s_main->viewPasses[mainViewId] = ViewPass::Scene;
 	}
 	else
 	{
@@ -1138,6 +1229,7 @@ static void RenderCamera(const RenderCameraArgs &args)
 #ifdef _DEBUG
 		bgfx::setViewName(mainViewId, "HudScene");
 #endif
+		s_main->viewPasses[mainViewId] = ViewPass::Scene;
 	}
 
 	if (!s_main->drawCalls.empty())
@@ -1166,24 +1258,14 @@ static void RenderCamera(const RenderCameraArgs &args)
 		// Special case for skybox.
 		if (dc.flags & DrawCallFlags::Skybox)
 		{
-			if (s_main->bloomEnabled)
-			{
-				s_main->uniforms->bloom_Enabled_Write_Scale.set(vec4(1, 0, 0, 0));
-			}
-			else
-			{
-				s_main->uniforms->bloom_Enabled_Write_Scale.set(vec4::empty);
-			}
-
-			s_main->uniforms->depthRangeEnabled.set(vec4(1, 0, 0, 0));
-			s_main->uniforms->depthRange.set(vec4(dc.zOffset, dc.zScale, depthRange.x, depthRange.y));
+			SetDrawParams(vec4(dc.zOffset, dc.zScale, depthRange.x, depthRange.y), true, false, s_main->bloomEnabled, false);
 			s_main->uniforms->dynamicLight_Num_Intensity.set(vec4::empty);
 			s_main->matUniforms->nDeforms.set(vec4(0, 0, 0, 0));
-			s_main->matStageUniforms->alphaTest.set(vec4::empty);
-			s_main->matStageUniforms->baseColor.set(vec4::white);
-			s_main->matStageUniforms->generators.set(vec4::empty);
-			s_main->matStageUniforms->lightType.set(vec4::empty);
-			s_main->matStageUniforms->vertexColor.set(vec4::black);
+
+			// Identity generators, white base color and no vertex color.
+			vec4 stageParams[STAGE_NUM_PARAMS];
+			stageParams[STAGE_BASE_COLOR] = vec4::white;
+			s_main->matStageUniforms->params.set(stageParams, STAGE_NUM_PARAMS);
 			const int sky_texorder[6] = { 0, 2, 1, 3, 4, 5 };
 			bgfx::setTexture(TextureUnit::Diffuse, s_main->matStageUniforms->diffuseSampler.handle, mat->sky.outerbox[sky_texorder[dc.skyboxSide]]->getHandle());
 #ifdef _DEBUG
@@ -1204,7 +1286,7 @@ static void RenderCamera(const RenderCameraArgs &args)
 				bgfx::setStencil(stencilTest);
 			}
 
-			bgfx::submit(mainViewId, s_main->shaderPrograms[ShaderProgramId::Generic].handle);
+			Submit(mainViewId, ShaderProgramId::Generic, dc.ib.nIndices);
 			continue;
 		}
 
@@ -1227,18 +1309,11 @@ static void RenderCamera(const RenderCameraArgs &args)
 			s_main->uniforms->dynamicLight_Num_Intensity.set(vec4::empty);
 		}
 
-		if (mat->polygonOffset)
-		{
-			s_main->uniforms->depthRange.set(vec4(polygonDepthOffset, 1, depthRange.x, depthRange.y));
-		}
-		else
-		{
-			s_main->uniforms->depthRange.set(vec4(dc.zOffset, dc.zScale, depthRange.x, depthRange.y));
-		}
+		const vec4 dcDepthRange = mat->polygonOffset ? vec4(polygonDepthOffset, 1, depthRange.x, depthRange.y) : vec4(dc.zOffset, dc.zScale, depthRange.x, depthRange.y);
 
 		s_main->uniforms->viewOrigin.set(args.position);
 		s_main->uniforms->viewUp.set(args.rotation[2]);
-		mat->setDeformUniforms(s_main->matUniforms.get());
+		mat->setDeformUniforms(s_main->matUniforms.get(), s_main->sceneRotation);
 		const vec3 localViewPosition = s_main->currentEntity ? s_main->currentEntity->localViewPosition : args.position;
 		s_main->uniforms->localViewOrigin.set(localViewPosition);
 
@@ -1265,34 +1340,8 @@ static void RenderCamera(const RenderCameraArgs &args)
 			if (!stage.active)
 				continue;
 
-			if (s_main->bloomEnabled)
-			{
-				s_main->uniforms->bloom_Enabled_Write_Scale.set(vec4(1, stage.bloom ? 1.0f : 0.0f, 0, 0));
-			}
-			else
-			{
-				s_main->uniforms->bloom_Enabled_Write_Scale.set(vec4::empty);
-			}
-
-			if (mat->polygonOffset || dc.zOffset > 0 || dc.zScale > 0)
-			{
-				s_main->uniforms->depthRangeEnabled.set(vec4(1, 0, 0, 0));
-			}
-			else
-			{
-				s_main->uniforms->depthRangeEnabled.set(vec4::empty);
-			}
-
-			if (!dc.material->noFog && dc.fogIndex >= 0 && stage.adjustColorsForFog != MaterialAdjustColorsForFog::None)
-			{
-				s_main->uniforms->fogEnabled.set(vec4(1, 0, 0, 0));
-				s_main->matStageUniforms->fogColorMask.set(stage.getFogColorMask());
-			}
-			else
-			{
-				s_main->uniforms->fogEnabled.set(vec4::empty);
-			}
-
+			const bool fogEnabled = !dc.material->noFog && dc.fogIndex >= 0 && stage.adjustColorsForFog != MaterialAdjustColorsForFog::None;
+			SetDrawParams(dcDepthRange, mat->polygonOffset || dc.zOffset > 0 || dc.zScale > 0, fogEnabled, s_main->bloomEnabled, stage.bloom);
 			stage.setShaderUniforms(s_main->matStageUniforms.get());
 			stage.setTextureSamplers(s_main->matStageUniforms.get());
 			SetDrawCallGeometry(dc);
@@ -1347,7 +1396,21 @@ static void RenderCamera(const RenderCameraArgs &args)
 				bgfx::setStencil(stencilTest);
 			}
 
-			if (!s_main->fastPathEnabled && g_cvars.textureVariation.getBool() && stage.textureVariation)
+			if (bgfx::isValid(dc.textureArray) && mat == dc.material)
+			{
+				// Remapped materials aren't merged, so only use the texture array if this is the original material.
+				bgfx::setTexture(TextureUnit::Diffuse, s_main->matStageUniforms->diffuseSampler.handle, dc.textureArray);
+				int textureArrayVariant = TextureArrayShaderProgramVariant::None;
+
+				if (shaderVariant & GenericShaderProgramVariant::DynamicLights)
+					textureArrayVariant |= TextureArrayShaderProgramVariant::DynamicLights;
+
+				if (shaderVariant & GenericShaderProgramVariant::SunLight)
+					textureArrayVariant |= TextureArrayShaderProgramVariant::SunLight;
+
+				Submit(mainViewId, ShaderProgramId::Enum(ShaderProgramId::TextureArray + textureArrayVariant), dc.ib.nIndices);
+			}
+			else if (!s_main->fastPathEnabled && g_cvars.textureVariation.getBool() && stage.textureVariation)
 			{
 				if (shaderVariant & GenericShaderProgramVariant::SunLight)
 				{
@@ -1359,11 +1422,11 @@ static void RenderCamera(const RenderCameraArgs &args)
 				}
 
 				//bgfx::setTexture(TextureUnit::Noise, s_main->uniforms->noiseSampler.handle, g_textureCache->getNoise()->getHandle());
-				bgfx::submit(mainViewId, s_main->shaderPrograms[ShaderProgramId::TextureVariation + shaderVariant].handle);
+				Submit(mainViewId, ShaderProgramId::Enum(ShaderProgramId::TextureVariation + shaderVariant), dc.ib.nIndices);
 			}
 			else
 			{
-				bgfx::submit(mainViewId, s_main->shaderPrograms[ShaderProgramId::Generic + shaderVariant].handle);
+				Submit(mainViewId, ShaderProgramId::Enum(ShaderProgramId::Generic + shaderVariant), dc.ib.nIndices);
 			}
 		}
 
@@ -1381,24 +1444,7 @@ static void RenderCamera(const RenderCameraArgs &args)
 		// Do fog pass.
 		if (doFogPass)
 		{
-			if (s_main->bloomEnabled)
-			{
-				s_main->uniforms->bloom_Enabled_Write_Scale.set(vec4(1, 0, 0, 0));
-			}
-			else
-			{
-				s_main->uniforms->bloom_Enabled_Write_Scale.set(vec4::empty);
-			}
-
-			if (dc.zOffset > 0 || dc.zScale > 0)
-			{
-				s_main->uniforms->depthRangeEnabled.set(vec4(1, 0, 0, 0));
-			}
-			else
-			{
-				s_main->uniforms->depthRangeEnabled.set(vec4::empty);
-			}
-
+			SetDrawParams(dcDepthRange, dc.zOffset > 0 || dc.zScale > 0, false, s_main->bloomEnabled, false);
 			s_main->matStageUniforms->color.set(fogColor);
 			SetDrawCallGeometry(dc);
 			bgfx::setTransform(dc.modelMatrix.get());
@@ -1423,7 +1469,7 @@ static void RenderCamera(const RenderCameraArgs &args)
 				bgfx::setStencil(stencilTest);
 			}
 
-			bgfx::submit(mainViewId, s_main->shaderPrograms[ShaderProgramId::Fog].handle);
+			Submit(mainViewId, ShaderProgramId::Fog, dc.ib.nIndices);
 		}
 
 		s_main->currentEntity = nullptr;
@@ -1505,9 +1551,185 @@ static void RenderCamera(const RenderCameraArgs &args)
 	}
 }
 
+/// @brief Scale a rect in window coordinates to the scene framebuffers, which are smaller than the window when dynamic resolution has lowered the scene scale.
+static Rect ToSceneRect(Rect rect)
+{
+	if (s_main->sceneScale == 1.0f)
+		return rect;
+
+	const float scale = s_main->sceneScale;
+	return Rect(int(rect.x * scale), int(rect.y * scale), std::max(1, int(rect.w * scale)), std::max(1, int(rect.h * scale)));
+}
+
+/// @brief Match this frame's model entities to last frame's, so velocity can use their previous model matrices.
+static void MatchTaaEntities()
+{
+	s_main->taaEntityPreviousModelMatrices.resize(s_main->sceneEntities.size());
+
+	for (size_t i = 0; i < s_main->sceneEntities.size(); i++)
+	{
+		const Entity &entity = s_main->sceneEntities[i];
+		mat4 &previousModelMatrix = s_main->taaEntityPreviousModelMatrices[i];
+		previousModelMatrix = mat4::transform(entity.rotation, entity.position);
+
+		if (entity.type != EntityType::Model)
+			continue;
+
+		// Closest entity with the same model, within a distance nothing should move in a frame.
+		float bestDistance = 64.0f;
+
+		for (const Main::TaaEntity &previous : s_main->taaPreviousEntities)
+		{
+			if (previous.handle != entity.handle || previous.flags != entity.flags)
+				continue;
+
+			const float distance = vec3::distance(previous.position, entity.position);
+
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				previousModelMatrix = previous.modelMatrix;
+			}
+		}
+	}
+}
+
+static void StoreTaaHistory(vec3 cameraPosition)
+{
+	s_main->taaPreviousEntities.clear();
+
+	for (const Entity &entity : s_main->sceneEntities)
+	{
+		if (entity.type == EntityType::Model)
+		{
+			s_main->taaPreviousEntities.push_back({ entity.handle, entity.flags, entity.position, mat4::transform(entity.rotation, entity.position) });
+		}
+	}
+
+	s_main->taaPreviousViewProj = s_main->taaViewProj;
+	s_main->taaPreviousCameraPosition = cameraPosition;
+	s_main->taaHistoryIndex = (s_main->taaHistoryIndex + 1) % BX_COUNTOF(s_main->taaHistoryFb);
+	s_main->taaHistoryValid = true;
+}
+
+/// @brief Blend the jittered scene with last frame's reprojected history, writing this frame's history.
+static void RenderTaa()
+{
+	const size_t previousIndex = (s_main->taaHistoryIndex + 1) % BX_COUNTOF(s_main->taaHistoryFb);
+	s_main->uniforms->taaParams.set(vec4(0.9f, s_main->isTextureOriginBottomLeft ? 0.5f : -0.5f, s_main->taaHistoryValid ? 1.0f : 0.0f, 0));
+	bgfx::setTexture(0, s_main->uniforms->textureSampler.handle, bgfx::getTexture(s_main->sceneFb.handle));
+	bgfx::setTexture(1, s_main->uniforms->taaHistorySampler.handle, bgfx::getTexture(s_main->taaHistoryFb[previousIndex].handle));
+	bgfx::setTexture(2, s_main->uniforms->taaVelocitySampler.handle, bgfx::getTexture(s_main->depthFb.handle, 1));
+	RenderScreenSpaceQuad("TAA", s_main->taaHistoryFb[s_main->taaHistoryIndex], ShaderProgramId::TAA, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_NONE, s_main->isTextureOriginBottomLeft, ToSceneRect(Rect(0, 0, window::GetWidth(), window::GetHeight())));
+}
+
+/// @brief The scene color read by the final post-processing pass.
+static bgfx::TextureHandle GetSceneColorTexture()
+{
+	if (s_main->aa == AntiAliasing::TAA)
+		return bgfx::getTexture(s_main->taaHistoryFb[s_main->taaHistoryIndex].handle);
+
+	return bgfx::getTexture(s_main->sceneFb.handle);
+}
+
+static void PrintBloomTimings()
+{
+	// View stats are from the last frame bgfx rendered. View IDs are allocated in the same order every frame, so last frame's bloom passes will have the same IDs.
+	const bgfx::Stats *stats = bgfx::getStats();
+
+	for (const Main::BloomPass &pass : s_main->bloomPasses)
+	{
+		for (uint16_t i = 0; i < stats->numViews; i++)
+		{
+			const bgfx::ViewStats &view = stats->viewStats[i];
+
+			if (view.view == pass.viewId)
+			{
+				DebugPrint("%s %d: %.3fms", pass.name, (int)pass.level, view.gpuTimeElapsed * 1000.0 / stats->gpuTimerFreq);
+				break;
+			}
+		}
+	}
+}
+
+/// @brief The size of a texture in the bloom downsample chain. Matches the bgfx backbuffer ratio it was created with.
+static vec2 GetBloomLevelSize(size_t level)
+{
+	const int divisor = 4 << level;
+	return vec2((float)std::max(1, window::GetWidth() / divisor), (float)std::max(1, window::GetHeight() / divisor));
+}
+
+static void RenderBloomPass(const char *name, bool upsample, bgfx::TextureHandle source, vec2 sourceSize, size_t level)
+{
+	const vec2 outputSize = GetBloomLevelSize(level);
+
+	// Downsampling samples the corners of the neighbouring source texels. Upsampling samples closer, at half that distance.
+	const float offset = upsample ? 0.5f : 1.0f;
+	s_main->uniforms->bloomFilter.set(vec4(offset / sourceSize.x, offset / sourceSize.y, outputSize.x, outputSize.y));
+	bgfx::setTexture(0, s_main->uniforms->textureSampler.handle, source);
+
+	if (s_main->bloomComputeEnabled)
+	{
+		const bgfx::ViewId viewId = PushView(s_main->defaultFb, BGFX_CLEAR_NONE, mat4::identity, mat4::identity, Rect());
+		bgfx::setImage(1, bgfx::getTexture(s_main->bloomFb[level].handle), 0, bgfx::Access::Write, bgfx::TextureFormat::RGBA8);
+		const ComputeShaderId::Enum program = upsample ? ComputeShaderId::BloomUpsample : ComputeShaderId::BloomDownsample;
+		bgfx::dispatch(viewId, s_main->computeShaderPrograms[program].handle, ((uint32_t)outputSize.x + 7) / 8, ((uint32_t)outputSize.y + 7) / 8);
+		s_main->viewPasses[viewId] = ViewPass::PostProcess;
+#ifdef _DEBUG
+		bgfx::setViewName(viewId, name);
+#endif
+	}
+	else
+	{
+		RenderScreenSpaceQuad(name, s_main->bloomFb[level], upsample ? ShaderProgramId::BloomUpsample : ShaderProgramId::BloomDownsample, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_NONE, s_main->isTextureOriginBottomLeft, Rect(0, 0, (int)outputSize.x, (int)outputSize.y));
+	}
+
+	s_main->bloomPasses.push_back({ name, level, bgfx::ViewId(s_main->firstFreeViewId - 1) });
+}
+
+static void RenderBloom()
+{
+	if (g_cvars.bloomTimings.getBool())
+		PrintBloomTimings();
+
+	s_main->bloomPasses.clear();
+
+	// OpenGL resolves multisampled bloom into a temp texture.
+	const bool msaaResolve = bgfx::getRendererType() == bgfx::RendererType::OpenGL && IsMsaa(s_main->aa);
+
+	if (msaaResolve)
+	{
+		Blit("BloomMsaaResolve", bgfx::getTexture(s_main->sceneFb.handle, s_main->sceneBloomAttachment), bgfx::getTexture(s_main->sceneTempFb.handle));
+	}
+
+	// Dual filter blur. Downsample to quarter size, then down the chain. Upsample back up to quarter size, overwriting each level on the way.
+	const Rect sceneRect = ToSceneRect(Rect(0, 0, window::GetWidth(), window::GetHeight()));
+	RenderBloomPass("BloomDownsample", false, msaaResolve ? bgfx::getTexture(s_main->sceneTempFb.handle) : bgfx::getTexture(s_main->sceneFb.handle, s_main->sceneBloomAttachment), vec2((float)sceneRect.w, (float)sceneRect.h), 0);
+
+	for (size_t i = 1; i < s_main->nBloomLevels; i++)
+	{
+		RenderBloomPass("BloomDownsample", false, bgfx::getTexture(s_main->bloomFb[i - 1].handle), GetBloomLevelSize(i - 1), i);
+	}
+
+	for (size_t i = s_main->nBloomLevels - 1; i > 0; i--)
+	{
+		RenderBloomPass("BloomUpsample", true, bgfx::getTexture(s_main->bloomFb[i].handle), GetBloomLevelSize(i), i - 1);
+	}
+
+	s_main->uniforms->bloomScale.set(vec4(g_cvars.bloomScale.getFloat(), 0, 0, 0));
+
+	// SMAA neighborhood blending applies bloom as it writes to the backbuffer. Otherwise apply it here.
+	if (s_main->aa != AntiAliasing::SMAA)
+	{
+		bgfx::setTexture(0, s_main->uniforms->textureSampler.handle, GetSceneColorTexture());
+		bgfx::setTexture(1, s_main->uniforms->bloomSampler.handle, bgfx::getTexture(s_main->bloomFb[0].handle));
+		RenderScreenSpaceQuad("BloomApply", s_main->defaultFb, ShaderProgramId::Bloom, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_NONE, s_main->isTextureOriginBottomLeft);
+		s_main->bloomPasses.push_back({ "BloomApply", 0, bgfx::ViewId(s_main->firstFreeViewId - 1) });
+	}
+}
+
 void RenderScene(const SceneDefinition &scene)
 {
-	FlushStretchPics();
 	s_main->stretchPicViewId = UINT8_MAX;
 	s_main->time = scene.time;
 	s_main->floatTime = s_main->time * 0.001f;
@@ -1542,6 +1764,12 @@ void RenderScene(const SceneDefinition &scene)
 		const bool isWorldScene = (scene.flags & SceneDefinitionFlags::World) != 0;
 		assert(!isWorldScene || (isWorldScene && world::IsLoaded()));
 
+		// World scenes render to the scene framebuffers, which dynamic resolution may have scaled down.
+		if (isWorldScene)
+		{
+			rect = ToSceneRect(rect);
+		}
+
 		// Need to do this here because AddEntityToScene doesn't know if this is a world scene.
 		for (const Entity &entity : s_main->sceneEntities)
 		{
@@ -1554,6 +1782,17 @@ void RenderScene(const SceneDefinition &scene)
 			s_main->dlightManager->updateTextures(s_main->frameNo);
 		}
 
+		if (isWorldScene && s_main->aa == AntiAliasing::TAA)
+		{
+			// Teleporting or respawning, the history is of somewhere else.
+			if (vec3::distance(scene.position, s_main->taaPreviousCameraPosition) > 128.0f)
+			{
+				s_main->taaHistoryValid = false;
+			}
+
+			MatchTaaEntities();
+		}
+
 		// Render camera(s).
 		s_main->sceneRotation = scene.rotation;
 
@@ -1588,77 +1827,57 @@ void RenderScene(const SceneDefinition &scene)
 
 		if (isWorldScene)
 		{
-			if (s_main->bloomEnabled)
+			if (s_main->aa == AntiAliasing::TAA)
 			{
-				// OpenGL resolves multisampled bloom into a temp texture.
-				const bool msaaResolve = bgfx::getRendererType() == bgfx::RendererType::OpenGL && IsMsaa(s_main->aa);
-
-				if (msaaResolve)
-				{
-					Blit("BloomMsaaResolve", bgfx::getTexture(s_main->sceneFb.handle, s_main->sceneBloomAttachment), bgfx::getTexture(s_main->sceneTempFb.handle));
-				}
-
-				// Render to quarter size framebuffer.
-				const Rect bloomRect(0, 0, window::GetWidth() / 4, window::GetHeight() / 4);
-				bgfx::setTexture(0, s_main->uniforms->textureSampler.handle, msaaResolve ? bgfx::getTexture(s_main->sceneTempFb.handle) : bgfx::getTexture(s_main->sceneFb.handle, s_main->sceneBloomAttachment));
-				RenderScreenSpaceQuad("BloomCopy", s_main->bloomFb[0], ShaderProgramId::Texture, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_NONE, s_main->isTextureOriginBottomLeft, bloomRect);
-
-				// Ping-pong guassian blur in quarter size framebuffers
-				for (int i = 0; i < 2; i++)
-				{
-					s_main->uniforms->guassianBlurDirection.set(i == 0 ? vec4(1, 0, 0, 0) : vec4(0, 1, 0, 0));
-					bgfx::setTexture(0, s_main->uniforms->textureSampler.handle, bgfx::getTexture(s_main->bloomFb[i].handle));
-					RenderScreenSpaceQuad("BloomBlur", s_main->bloomFb[!i], ShaderProgramId::GaussianBlur, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_NONE, s_main->isTextureOriginBottomLeft, bloomRect);
-				}
+				RenderTaa();
+			}
 
-				// Apply bloom. If using SMAA, we need to read color, so blit into the original bloom texture which is no longer used.
-				s_main->uniforms->bloom_Enabled_Write_Scale.set(vec4(1, 0, g_cvars.bloomScale.getFloat(), 0));
-				bgfx::setTexture(0, s_main->uniforms->textureSampler.handle, bgfx::getTexture(s_main->sceneFb.handle));
-				bgfx::setTexture(1, s_main->uniforms->bloomSampler.handle, bgfx::getTexture(s_main->bloomFb[0].handle));
-				RenderScreenSpaceQuad("BloomApply", s_main->aa == AntiAliasing::SMAA ? s_main->sceneTempFb : s_main->defaultFb, ShaderProgramId::Bloom, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_NONE, s_main->isTextureOriginBottomLeft);
+			if (s_main->bloomEnabled)
+			{
+				RenderBloom();
 			}
 
 			if (s_main->aa == AntiAliasing::SMAA)
 			{
 				s_main->uniforms->smaaMetrics.set(vec4(1.0f / rect.w, 1.0f / rect.h, (float)rect.w, (float)rect.h));
 
-				// Edge detection.
-				if (s_main->bloomEnabled)
-				{
-					bgfx::setTexture(0, s_main->uniforms->smaaColorSampler.handle, bgfx::getTexture(s_main->sceneTempFb.handle));
-				}
-				else
-				{
-					bgfx::setTexture(0, s_main->uniforms->smaaColorSampler.handle, bgfx::getTexture(s_main->sceneFb.handle));
-				}
+				// Edge detection and blending weights are at scene resolution. Neighborhood blending upscales to the window.
+				const Rect smaaRect = ToSceneRect(Rect(0, 0, window::GetWidth(), window::GetHeight()));
 
-				RenderScreenSpaceQuad("SMAAEdgeDetection", s_main->smaaEdgesFb, ShaderProgramId::SMAAEdgeDetection, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_COLOR, s_main->isTextureOriginBottomLeft);
+				// Edge detection. Runs on the scene color before bloom, bloom is too soft to add edges.
+				bgfx::setTexture(0, s_main->uniforms->smaaColorSampler.handle, bgfx::getTexture(s_main->sceneFb.handle));
+				RenderScreenSpaceQuad("SMAAEdgeDetection", s_main->smaaEdgesFb, ShaderProgramId::SMAAEdgeDetection, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_COLOR, s_main->isTextureOriginBottomLeft, smaaRect);
 
 				// Blending weight calculation.
 				bgfx::setTexture(0, s_main->uniforms->smaaEdgesSampler.handle, bgfx::getTexture(s_main->smaaEdgesFb.handle));
 				bgfx::setTexture(1, s_main->uniforms->smaaAreaSampler.handle, s_main->smaaAreaTex);
 				bgfx::setTexture(2, s_main->uniforms->smaaSearchSampler.handle, s_main->smaaSearchTex);
-				RenderScreenSpaceQuad("SMAABlendingWeightCalculation", s_main->smaaBlendFb, ShaderProgramId::SMAABlendingWeightCalculation, BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A, BGFX_CLEAR_COLOR, s_main->isTextureOriginBottomLeft);
+				RenderScreenSpaceQuad("SMAABlendingWeightCalculation", s_main->smaaBlendFb, ShaderProgramId::SMAABlendingWeightCalculation, BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A, BGFX_CLEAR_COLOR, s_main->isTextureOriginBottomLeft, smaaRect);
+
+				// Neighborhood blending, compositing bloom if enabled.
+				int programVariant = SMAANeighborhoodBlendingShaderProgramVariant::None;
+				bgfx::setTexture(0, s_main->uniforms->smaaColorSampler.handle, bgfx::getTexture(s_main->sceneFb.handle));
+				bgfx::setTexture(1, s_main->uniforms->smaaBlendSampler.handle, bgfx::getTexture(s_main->smaaBlendFb.handle));
 
-				// Neighborhood blending.
 				if (s_main->bloomEnabled)
 				{
-					bgfx::setTexture(0, s_main->uniforms->smaaColorSampler.handle, bgfx::getTexture(s_main->sceneTempFb.handle));
-				}
-				else
-				{
-					bgfx::setTexture(0, s_main->uniforms->smaaColorSampler.handle, bgfx::getTexture(s_main->sceneFb.handle));
+					bgfx::setTexture(2, s_main->uniforms->bloomSampler.handle, bgfx::getTexture(s_main->bloomFb[0].handle));
+					programVariant |= SMAANeighborhoodBlendingShaderProgramVariant::Bloom;
 				}
 
-				bgfx::setTexture(1, s_main->uniforms->smaaBlendSampler.handle, bgfx::getTexture(s_main->smaaBlendFb.handle));
-				RenderScreenSpaceQuad("SMAANeighborhoodBlending", s_main->defaultFb, ShaderProgramId::SMAANeighborhoodBlending, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_NONE, s_main->isTextureOriginBottomLeft);
+				RenderScreenSpaceQuad("SMAANeighborhoodBlending", s_main->defaultFb, ShaderProgramId::Enum(ShaderProgramId::SMAANeighborhoodBlending + programVariant), BGFX_STATE_WRITE_RGB, BGFX_CLEAR_NONE, s_main->isTextureOriginBottomLeft);
 			}
-			else if (!s_main->bloomEnabled && !s_main->fastPathEnabled)
+			else if (!s_main->bloomEnabled && s_main->sceneFbEnabled)
 			{
-				// Render scene to backbuffer.
-				bgfx::setTexture(0, s_main->uniforms->textureSampler.handle, bgfx::getTexture(s_main->sceneFb.handle));
+				// Render scene to backbuffer, upscaling it if dynamic resolution is enabled. Otherwise only needed for TAA and water reflections, everything else renders straight to the backbuffer.
+				bgfx::setTexture(0, s_main->uniforms->textureSampler.handle, GetSceneColorTexture());
 				RenderScreenSpaceQuad("RenderToBackbuffer", s_main->defaultFb, ShaderProgramId::Texture, BGFX_STATE_WRITE_RGB, BGFX_CLEAR_NONE, s_main->isTextureOriginBottomLeft);
 			}
+
+			if (s_main->aa == AntiAliasing::TAA)
+			{
+				StoreTaaHistory(scene.position);
+			}
 		}
 	}
 
@@ -1742,6 +1961,57 @@ void RenderHemicube(const FrameBuffer &frameBuffer, vec3 position, const vec3 fo
 	}
 }
 
+/// @brief Change the scene scale to keep the GPU frame time within the target frame rate.
+static void UpdateDynamicResolution()
+{
+	if (!s_main->dynamicResolutionEnabled || !world::IsLoaded())
+		return;
+
+	// Stats are from the last frame bgfx rendered.
+	const bgfx::Stats *stats = bgfx::getStats();
+
+	if (stats->gpuTimerFreq == 0 || stats->gpuTimeEnd <= stats->gpuTimeBegin)
+		return;
+
+	const float frameTime = float((stats->gpuTimeEnd - stats->gpuTimeBegin) * 1000.0 / stats->gpuTimerFreq);
+	s_main->gpuFrameTime = s_main->gpuFrameTime == 0 ? frameTime : math::Lerp(s_main->gpuFrameTime, frameTime, 0.1f);
+
+	if (s_main->sceneScaleCooldown > 0)
+	{
+		s_main->sceneScaleCooldown--;
+		return;
+	}
+
+	// Quantize the scale so the framebuffers aren't recreated for tiny changes.
+	const float scaleStep = 0.05f;
+	const int minSteps = (int)ceilf(math::Clamped(g_cvars.dynamicResolutionMinScale.getFloat(), 0.25f, 1.0f) / scaleStep);
+	const int maxSteps = (int)(1.0f / scaleStep + 0.5f);
+	const int currentSteps = (int)(s_main->sceneScale / scaleStep + 0.5f);
+	const float targetFrameTime = 1000.0f / std::max(1, g_cvars.dynamicResolutionFps.getInt());
+	int steps = currentSteps;
+
+	if (s_main->gpuFrameTime > targetFrameTime)
+	{
+		// GPU time is roughly proportional to the number of pixels, so scale each axis by the square root. Always drop at least one step.
+		const float scale = s_main->sceneScale * sqrtf(targetFrameTime / s_main->gpuFrameTime);
+		steps = std::min(currentSteps - 1, (int)(scale / scaleStep));
+	}
+	else if (s_main->gpuFrameTime < targetFrameTime * 0.8f)
+	{
+		// Creep back up a step at a time, with some headroom so it doesn't oscillate around the target.
+		steps = currentSteps + 1;
+	}
+
+	steps = math::Clamped(steps, minSteps, maxSteps);
+
+	if (steps == currentSteps)
+		return;
+
+	s_main->sceneScale = steps * scaleStep;
+	s_main->sceneScaleCooldown = 30;
+	CreateSceneFrameBuffers();
+}
+
 void EndFrame()
 {
 	FlushStretchPics();
@@ -1769,12 +2039,14 @@ void EndFrame()
 			RenderDebugDraw(bgfx::getTexture(s_main->sceneFb.handle, s_main->sceneBloomAttachment));
 		}
 
-		RenderDebugDraw(bgfx::getTexture(s_main->bloomFb[0].handle), 0, 1);
-		RenderDebugDraw(bgfx::getTexture(s_main->bloomFb[1].handle), 0, 2);
+		for (size_t i = 0; i < s_main->nBloomLevels; i++)
+		{
+			RenderDebugDraw(bgfx::getTexture(s_main->bloomFb[i].handle), 0, int(i + 1));
+		}
 	}
 	else if (s_main->debugDraw == DebugDraw::Depth && s_main->softSpritesEnabled)
 	{
-		s_main->uniforms->depthRange.set(vec4(0, 0, s_main->lastCameraDepthRange.x, s_main->lastCameraDepthRange.y));
+		SetDrawParams(vec4(0, 0, s_main->lastCameraDepthRange.x, s_main->lastCameraDepthRange.y), false, false, false, false);
 		s_main->uniforms->textureDebug.set(vec4(TEXTURE_DEBUG_LINEAR_DEPTH, 0, 0, 0));
 		RenderDebugDraw(bgfx::getTexture(s_main->depthFb.handle), 0, 0, ShaderProgramId::TextureDebug);
 	}
@@ -1805,6 +2077,11 @@ void EndFrame()
 		s_main->uniforms->textureDebug.set(vec4(TEXTURE_DEBUG_R, 0, 0, 0));
 		RenderDebugDraw(bgfx::getTexture(s_main->shadowMapFb.handle), 0, 0, ShaderProgramId::TextureDebug);
 	}
+	else if (s_main->debugDraw == DebugDraw::Velocity && s_main->aa == AntiAliasing::TAA)
+	{
+		s_main->uniforms->textureDebug.set(vec4(TEXTURE_DEBUG_VELOCITY, 0, 0, 0));
+		RenderDebugDraw(bgfx::getTexture(s_main->depthFb.handle, 1), 0, 0, ShaderProgramId::TextureDebug);
+	}
 
 #ifdef USE_PROFILER
 	PROFILE_END // Frame
@@ -1812,18 +2089,27 @@ void EndFrame()
 	profiler::BeginFrame(s_main->frameNo + 1);
 	PROFILE_BEGIN(Frame)
 #endif
+	PrintFrameStats();
 
 	uint32_t debug = 0;
 
 	if (g_cvars.bgfx_stats.getBool())
 		debug |= BGFX_DEBUG_STATS;
 
+	if ((g_cvars.bloomTimings.getBool() && s_main->bloomEnabled) || g_cvars.frameStats.getInt() != 0)
+		debug |= BGFX_DEBUG_PROFILER;
+
 	if (s_main->debugTextThisFrame)
 		debug |= BGFX_DEBUG_TEXT;
 
 	bgfx::setDebug(debug);
+	UpdateVideoCapture();
+	const uint32_t submittedFrameNo = s_main->frameNo;
 	s_main->frameNo = bgfx::frame(s_main->captureFrame);
 	s_main->captureFrame = false;
+	s_imageEncoder.write(submittedFrameNo);
+	RecordFrameStats();
+	UpdateDynamicResolution();
 
 	if (g_cvars.debugDraw.isModified())
 	{
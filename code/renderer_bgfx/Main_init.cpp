@@ -48,6 +48,7 @@ static const std::array<const BackendMap, 5> s_backendMaps =
 
 void ConsoleVariables::initialize()
 {
+	aviMotionJpegQuality = interface::Cvar_Get("r_aviMotionJpegQuality", "90", ConsoleVariableFlags::Archive);
 	backend = interface::Cvar_Get("r_backend", "", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Latch);
 
 	{
@@ -77,8 +78,12 @@ void ConsoleVariables::initialize()
 		#undef FORMAT
 	}
 
+	bakeAreaLightCutoff = interface::Cvar_Get("r_bakeAreaLightCutoff", "1", 0);
+	bakeAreaLightCutoff.setDescription("Light baker: area lights that can contribute less than this (0-255 color range) to a luxel are only sampled some of the time. 0 samples every area light, for comparing bake times and results.");
 	bgfx_stats = interface::Cvar_Get("r_bgfx_stats", "0", ConsoleVariableFlags::Cheat);
 	bloomScale = interface::Cvar_Get("r_bloomScale", "1.0", ConsoleVariableFlags::Archive);
+	bloomTimings = interface::Cvar_Get("r_bloomTimings", "0", 0);
+	bloomTimings.setDescription("Show the GPU time of each bloom pass.");
 	debug = interface::Cvar_Get("r_debug", "", 0);
 	debugDraw = interface::Cvar_Get("r_debugDraw", "", 0);
 	debugDraw.setDescription(
@@ -89,10 +94,23 @@ void ConsoleVariables::initialize()
 		"lightmap   Lightmaps\n"
 		"reflection Planar reflection\n"
 		"shadow     Shadows\n"
-		"smaa       SMAA edges and weights\n");
+		"smaa       SMAA edges and weights\n"
+		"velocity   TAA velocity\n");
 	debugDrawSize = interface::Cvar_Get("r_debugDrawSize", "256", ConsoleVariableFlags::Archive);
 	dynamicLightIntensity = interface::Cvar_Get("r_dynamicLightIntensity", "1", ConsoleVariableFlags::Archive);
 	dynamicLightScale = interface::Cvar_Get("r_dynamicLightScale", "0.7", ConsoleVariableFlags::Archive);
+	dynamicResolutionFps = interface::Cvar_Get("r_dynamicResolutionFps", "125", ConsoleVariableFlags::Archive);
+	dynamicResolutionFps.setDescription("The frame rate dynamic resolution tries to hold.");
+	dynamicResolutionMinScale = interface::Cvar_Get("r_dynamicResolutionMinScale", "0.5", ConsoleVariableFlags::Archive);
+	dynamicResolutionMinScale.setDescription("The lowest fraction of the window size dynamic resolution will render the scene at.");
+	frameStats = interface::Cvar_Get("r_frameStats", "0", 0);
+	frameStats.setDescription(
+		"Record frame time percentiles and per-pass GPU time, draw call, triangle and shader program change counts.\n"
+		"1 Record and show\n"
+		"2 Record only, for r_dumpFrameStats\n");
+	hdrLightmaps = interface::Cvar_Get("r_hdrLightmaps", "0", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Latch);
+	hdrLightmaps.setDescription("Store lightmaps as RGB9E5 instead of RGBA8, so overbright light isn't normalized away.");
+	lodCurveError = interface::Cvar_Get("r_lodCurveError", "250", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Cheat);
 	picmip = interface::Cvar_Get("r_picmip", "0", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Latch);
 	picmip.checkRange(0, 16, true);
 	railWidth = interface::Cvar_Get("r_railWidth", "16", ConsoleVariableFlags::Archive);
@@ -137,6 +155,8 @@ static AntiAliasing AntiAliasingFromString(const char *s)
 		return AntiAliasing::MSAA16x;
 	else if (util::Stricmp(s, "smaa") == 0)
 		return AntiAliasing::SMAA;
+	else if (util::Stricmp(s, "taa") == 0)
+		return AntiAliasing::TAA;
 
 	return AntiAliasing::None;
 }
@@ -208,7 +228,42 @@ static void Cmd_BakeLights()
 		nSamples = atoi(interface::Cmd_Argv(1));
 	}
 
-	light_baker::Start(nSamples);
+	if (interface::Cmd_Argc() > 3 || nSamples < 1)
+	{
+		interface::Printf("usage: r_bakeLights [samples] [cpu|gpu]\n");
+		return;
+	}
+
+	// Hemicubes need a GPU. Ray trace indirect light on the CPU if asked to, or if there's nothing to render with.
+	const bool noGpu = bgfx::getRendererType() == bgfx::RendererType::Noop;
+	bool cpuIndirect = noGpu;
+
+	if (interface::Cmd_Argc() > 2)
+	{
+		const char *indirect = interface::Cmd_Argv(2);
+
+		if (!util::Stricmp(indirect, "cpu"))
+		{
+			cpuIndirect = true;
+		}
+		else if (!util::Stricmp(indirect, "gpu"))
+		{
+			if (noGpu)
+			{
+				interface::Printf("Can't bake indirect light on the GPU with the noop renderer. Use cpu instead.\n");
+				return;
+			}
+
+			cpuIndirect = false;
+		}
+		else
+		{
+			interface::Printf("usage: r_bakeLights [samples] [cpu|gpu]\n");
+			return;
+		}
+	}
+
+	light_baker::Start(nSamples, cpuIndirect);
 }
 #endif
 
@@ -217,6 +272,11 @@ static void Cmd_CaptureFrame()
 	s_main->captureFrame = true;
 }
 
+static void Cmd_DumpFrameStats()
+{
+	DumpFrameStats(interface::Cmd_Argc() > 1 ? interface::Cmd_Argv(1) : "framestats.csv");
+}
+
 static void Cmd_PickMaterial()
 {
 	if (world::IsLoaded())
@@ -252,7 +312,8 @@ struct ShaderProgramIdMap
 	VertexShaderId::Enum vert;
 };
 
-void Initialize()
+/// @param headless Don't create a window, and use the noop backend. For tools that need the world and materials loaded, but don't draw anything.
+void Initialize(bool headless)
 {
 	s_main = std::make_unique<Main>();
 	g_cvars.initialize();
@@ -263,10 +324,13 @@ void Initialize()
 		"msaa4x    MSAA 4x\n"
 		"msaa8x    MSAA 8x\n"
 		"msaa16x   MSAA 16x\n"
-		"smaa      SMAA 1x\n");
+		"smaa      SMAA 1x\n"
+		"taa       TAA\n");
 	s_main->aa = AntiAliasingFromString(aa.getString());
 	ConsoleVariable bloom = interface::Cvar_Get("r_bloom", "1", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Latch);
 	s_main->bloomEnabled = bloom.getBool();
+	ConsoleVariable dynamicResolution = interface::Cvar_Get("r_dynamicResolution", "0", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Latch);
+	s_main->dynamicResolutionEnabled = dynamicResolution.getBool();
 	ConsoleVariable extraDynamicLights = interface::Cvar_Get("r_extraDynamicLights", "1", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Latch);
 	s_main->extraDynamicLightsEnabled = extraDynamicLights.getBool();
 	ConsoleVariable fastPath = interface::Cvar_Get("r_fastPath", "0", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Latch);
@@ -281,24 +345,32 @@ void Initialize()
 	s_main->sunLightEnabled = sunLight.getBool();
 	ConsoleVariable waterReflections = interface::Cvar_Get("r_waterReflections", "0", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Latch);
 	s_main->waterReflectionsEnabled = waterReflections.getBool();
+	ConsoleVariable worldTextureArrays = interface::Cvar_Get("r_worldTextureArrays", "0", ConsoleVariableFlags::Archive | ConsoleVariableFlags::Latch);
+	s_main->worldTextureArraysEnabled = worldTextureArrays.getBool();
+
+	if (headless)
+		s_main->fastPathEnabled = true;
 
 	if (s_main->fastPathEnabled)
 	{
 		// Fast path disables all the fancy features without messing with their cvars.
 		s_main->aa = AntiAliasing::None;
 		s_main->bloomEnabled = false;
+		s_main->dynamicResolutionEnabled = false;
 		s_main->extraDynamicLightsEnabled = false;
 		s_main->lerpTextureAnimationEnabled = false;
 		s_main->maxAnisotropyEnabled = false;
 		s_main->softSpritesEnabled = false;
 		s_main->sunLightEnabled = false;
 		s_main->waterReflectionsEnabled = false;
+		s_main->worldTextureArraysEnabled = false;
 	}
 
 #if defined(USE_LIGHT_BAKER)
 	interface::Cmd_Add("r_bakeLights", Cmd_BakeLights);
 #endif
 	interface::Cmd_Add("r_captureFrame", Cmd_CaptureFrame);
+	interface::Cmd_Add("r_dumpFrameStats", Cmd_DumpFrameStats);
 	interface::Cmd_Add("r_pickMaterial", Cmd_PickMaterial);
 	interface::Cmd_Add("r_printMaterials", Cmd_PrintMaterials);
 	interface::Cmd_Add("screenshot", Cmd_Screenshot);
@@ -341,32 +413,40 @@ void Initialize()
 	// Create a window if we don't have one.
 	if (window::GetWidth() == 0)
 	{
-		window::Initialize();
-		g_hardwareGammaEnabled = window::IsFullscreen() && !g_cvars.ignoreHardwareGamma.getBool();
-		SetWindowGamma();
-
-		// Get the selected backend, and make sure it's actually supported.
-		bgfx::RendererType::Enum supportedBackends[bgfx::RendererType::Count];
-		const uint8_t nSupportedBackends = bgfx::getSupportedRenderers(bgfx::RendererType::Count, supportedBackends);
 		bgfx::RendererType::Enum selectedBackend = bgfx::RendererType::Count;
 
-		for (const BackendMap &map : s_backendMaps)
+		if (headless)
 		{
-			uint8_t j;
+			selectedBackend = bgfx::RendererType::Noop;
+		}
+		else
+		{
+			window::Initialize();
+			g_hardwareGammaEnabled = window::IsFullscreen() && !g_cvars.ignoreHardwareGamma.getBool();
+			SetWindowGamma();
 
-			for (j = 0; j < nSupportedBackends; j++)
+			// Get the selected backend, and make sure it's actually supported.
+			bgfx::RendererType::Enum supportedBackends[bgfx::RendererType::Count];
+			const uint8_t nSupportedBackends = bgfx::getSupportedRenderers(bgfx::RendererType::Count, supportedBackends);
+
+			for (const BackendMap &map : s_backendMaps)
 			{
-				if (map.type == supportedBackends[j])
-					break;
-			}
+				uint8_t j;
 
-			if (j == nSupportedBackends)
-				continue; // Not supported.
+				for (j = 0; j < nSupportedBackends; j++)
+				{
+					if (map.type == supportedBackends[j])
+						break;
+				}
 
-			if (!util::Stricmp(g_cvars.backend.getString(), map.id))
-			{
-				selectedBackend = map.type;
-				break;
+				if (j == nSupportedBackends)
+					continue; // Not supported.
+
+				if (!util::Stricmp(g_cvars.backend.getString(), map.id))
+				{
+					selectedBackend = map.type;
+					break;
+				}
 			}
 		}
 		
@@ -385,19 +465,17 @@ void Initialize()
 		interface::Printf("   texture read back %ssupported\n", (bgfx::getCaps()->supported & BGFX_CAPS_TEXTURE_READ_BACK) == 0 ? "NOT " : "");
 	}
 
-	uint32_t resetFlags = 0;
-
 	if (IsMsaa(s_main->aa))
 	{
-		resetFlags |= (1 + (int)s_main->aa - (int)AntiAliasing::MSAA2x) << BGFX_RESET_MSAA_SHIFT;
+		s_main->resetFlags |= (1 + (int)s_main->aa - (int)AntiAliasing::MSAA2x) << BGFX_RESET_MSAA_SHIFT;
 	}
 
 	if (s_main->maxAnisotropyEnabled)
 	{
-		resetFlags |= BGFX_RESET_MAXANISOTROPY;
+		s_main->resetFlags |= BGFX_RESET_MAXANISOTROPY;
 	}
 
-	bgfx::reset(window::GetWidth(), window::GetHeight(), resetFlags);
+	bgfx::reset(window::GetWidth(), window::GetHeight(), s_main->resetFlags);
 	const bgfx::Caps *caps = bgfx::getCaps();
 
 	if (caps->limits.maxFBAttachments < 2)
@@ -415,6 +493,18 @@ void Initialize()
 		interface::Error("R16U texture format not supported");
 	}
 
+	s_main->viewPasses.resize(caps->limits.maxViews, ViewPass::Other);
+	s_main->frameStatsLastPrograms.fill(BGFX_INVALID_HANDLE);
+
+	if (s_main->worldTextureArraysEnabled && (caps->supported & BGFX_CAPS_TEXTURE_2D_ARRAY) == 0)
+	{
+		interface::PrintWarningf("Texture arrays not supported, disabling world texture arrays\n");
+		s_main->worldTextureArraysEnabled = false;
+	}
+
+	// Bloom falls back to fragment shaders if the downsample chain can't be written by compute shaders.
+	s_main->bloomComputeEnabled = s_main->bloomEnabled && (caps->supported & BGFX_CAPS_COMPUTE) != 0 && (caps->formats[bgfx::TextureFormat::RGBA8] & BGFX_CAPS_FORMAT_TEXTURE_IMAGE) != 0;
+
 	s_main->debugDraw = DebugDrawFromString(g_cvars.debugDraw.getString());
 	s_main->halfTexelOffset = caps->rendererType == bgfx::RendererType::Direct3D9 ? 0.5f : 0;
 	s_main->isTextureOriginBottomLeft = caps->rendererType == bgfx::RendererType::OpenGL || caps->rendererType == bgfx::RendererType::OpenGLES;
@@ -431,18 +521,25 @@ void Initialize()
 	g_modelCache = s_main->modelCache.get();
 	s_main->dlightManager = std::make_unique<DynamicLightManager>();
 
+	// There are no shader binaries for the noop backend, and nothing is drawn anyway.
+	if (caps->rendererType == bgfx::RendererType::Noop)
+		return;
+
 	// Get shader ID to shader source string mappings.
+	std::array<ShaderSourceMem, ComputeShaderId::Num> computeMem;
 	std::array<ShaderSourceMem, FragmentShaderId::Num> fragMem;
 	std::array<ShaderSourceMem, VertexShaderId::Num> vertMem;
 
 	if (caps->rendererType == bgfx::RendererType::OpenGL)
 	{
+		computeMem = GetComputeShaderSourceMap_gl();
 		fragMem = GetFragmentShaderSourceMap_gl();
 		vertMem = GetVertexShaderSourceMap_gl();
 	}
 #ifdef WIN32
 	else if (caps->rendererType == bgfx::RendererType::Direct3D11)
 	{
+		computeMem = GetComputeShaderSourceMap_d3d11();
 		fragMem = GetFragmentShaderSourceMap_d3d11();
 		vertMem = GetVertexShaderSourceMap_d3d11();
 	}
@@ -451,17 +548,19 @@ void Initialize()
 	// Map shader programs to their vertex and fragment shaders.
 	std::array<ShaderProgramIdMap, ShaderProgramId::Num> programMap;
 	programMap[ShaderProgramId::Bloom] = { FragmentShaderId::Bloom, VertexShaderId::Texture };
+	programMap[ShaderProgramId::BloomDownsample] = { FragmentShaderId::BloomDownsample, VertexShaderId::Texture };
+	programMap[ShaderProgramId::BloomUpsample] = { FragmentShaderId::BloomUpsample, VertexShaderId::Texture };
 	programMap[ShaderProgramId::Color] = { FragmentShaderId::Color, VertexShaderId::Color };
-	programMap[ShaderProgramId::Depth] = { FragmentShaderId::Depth, VertexShaderId::Depth };
 
-	programMap[ShaderProgramId::Depth + DepthShaderProgramVariant::AlphaTest] =
+	// Sync with DepthShaderProgramVariant.
+	for (int i = 0; i < DepthShaderProgramVariant::Num; i++)
 	{
-		FragmentShaderId::Depth_AlphaTest,
-		VertexShaderId::Depth_AlphaTest
-	};
+		ShaderProgramIdMap &pm = programMap[ShaderProgramId::Depth + i];
+		pm.frag = FragmentShaderId::Enum(FragmentShaderId::Depth + i);
+		pm.vert = VertexShaderId::Enum(VertexShaderId::Depth + i);
+	}
 
 	programMap[ShaderProgramId::Fog] = { FragmentShaderId::Fog, VertexShaderId::Fog };
-	programMap[ShaderProgramId::GaussianBlur] = { FragmentShaderId::GaussianBlur, VertexShaderId::Texture };
 
 	// Sync with GenericShaderProgramVariant.
 	for (int i = 0; i < GenericFragmentShaderVariant::Num; i++)
@@ -480,7 +579,27 @@ void Initialize()
 	programMap[ShaderProgramId::SMAABlendingWeightCalculation] = { FragmentShaderId::SMAABlendingWeightCalculation, VertexShaderId::SMAABlendingWeightCalculation };
 	programMap[ShaderProgramId::SMAAEdgeDetection] = { FragmentShaderId::SMAAEdgeDetection, VertexShaderId::SMAAEdgeDetection };
 	programMap[ShaderProgramId::SMAANeighborhoodBlending] = { FragmentShaderId::SMAANeighborhoodBlending, VertexShaderId::SMAANeighborhoodBlending };
+	programMap[ShaderProgramId::SMAANeighborhoodBlending + SMAANeighborhoodBlendingShaderProgramVariant::Bloom] =
+	{
+		FragmentShaderId::SMAANeighborhoodBlending_Bloom,
+		VertexShaderId::SMAANeighborhoodBlending
+	};
+
+	programMap[ShaderProgramId::TAA] = { FragmentShaderId::TAA, VertexShaderId::Texture };
 	programMap[ShaderProgramId::Texture] = { FragmentShaderId::Texture, VertexShaderId::Texture };
+
+	// Sync with TextureArrayShaderProgramVariant.
+	for (int i = 0; i < TextureArrayFragmentShaderVariant::Num; i++)
+	{
+		ShaderProgramIdMap &pm = programMap[ShaderProgramId::TextureArray + i];
+		pm.frag = FragmentShaderId::Enum(FragmentShaderId::TextureArray + i);
+
+		if (i & TextureArrayFragmentShaderVariant::SunLight)
+			pm.vert = VertexShaderId::Generic_SunLightTextureArray;
+		else
+			pm.vert = VertexShaderId::Generic_TextureArray;
+	}
+
 	programMap[ShaderProgramId::TextureColor] = { FragmentShaderId::TextureColor, VertexShaderId::Texture };
 	programMap[ShaderProgramId::TextureDebug] = { FragmentShaderId::TextureDebug, VertexShaderId::Texture };
 	programMap[ShaderProgramId::TextureVariation] = { FragmentShaderId::TextureVariation, VertexShaderId::Generic };
@@ -496,10 +615,20 @@ void Initialize()
 		const ShaderProgramIdMap &pm = programMap[i];
 
 		// Don't create shader programs that won't be used.
-		if (s_main->aa != AntiAliasing::SMAA && (i == ShaderProgramId::SMAABlendingWeightCalculation || i == ShaderProgramId::SMAAEdgeDetection || i == ShaderProgramId::SMAANeighborhoodBlending))
+		if (s_main->aa != AntiAliasing::SMAA && (i == ShaderProgramId::SMAABlendingWeightCalculation || i == ShaderProgramId::SMAAEdgeDetection || (i >= (int)ShaderProgramId::SMAANeighborhoodBlending && i < int(ShaderProgramId::SMAANeighborhoodBlending + SMAANeighborhoodBlendingShaderProgramVariant::Num))))
+			continue;
+
+		// SMAA neighborhood blending applies bloom when both are enabled.
+		if ((!s_main->bloomEnabled || s_main->aa == AntiAliasing::SMAA) && i == ShaderProgramId::Bloom)
+			continue;
+
+		if (!s_main->bloomEnabled && i == int(ShaderProgramId::SMAANeighborhoodBlending + SMAANeighborhoodBlendingShaderProgramVariant::Bloom))
+			continue;
+
+		if ((!s_main->bloomEnabled || s_main->bloomComputeEnabled) && (i == ShaderProgramId::BloomDownsample || i == ShaderProgramId::BloomUpsample))
 			continue;
 
-		if (!s_main->bloomEnabled && (i == ShaderProgramId::Bloom || i == ShaderProgramId::GaussianBlur))
+		if (s_main->aa != AntiAliasing::TAA && (i == ShaderProgramId::TAA || (i >= (int)ShaderProgramId::Depth && i < int(ShaderProgramId::Depth + DepthShaderProgramVariant::Num) && ((i - (int)ShaderProgramId::Depth) & DepthShaderProgramVariant::Velocity))))
 			continue;
 
 		if (i >= (int)ShaderProgramId::Generic && i <= int(ShaderProgramId::Generic + GenericShaderProgramVariant::Num))
@@ -513,6 +642,15 @@ void Initialize()
 				continue;
 		}
 
+		if (i >= (int)ShaderProgramId::TextureArray && i < int(ShaderProgramId::TextureArray + TextureArrayShaderProgramVariant::Num))
+		{
+			if (!s_main->worldTextureArraysEnabled)
+				continue;
+
+			if (!s_main->sunLightEnabled && ((i - (int)ShaderProgramId::TextureArray) & TextureArrayShaderProgramVariant::SunLight))
+				continue;
+		}
+
 		Shader &fragment = s_main->fragmentShaders[pm.frag];
 
 		if (!bgfx::isValid(fragment.handle))
@@ -546,63 +684,157 @@ void Initialize()
 		if (!bgfx::isValid(s_main->shaderPrograms[i].handle))
 			interface::Error("Error creating shader program");
 	}
-}
 
-void LoadWorld(const char *name)
-{
-	if (world::IsLoaded())
+	// Create compute shader programs. Only bloom uses them.
+	if (s_main->bloomComputeEnabled)
 	{
-		interface::Error("ERROR: attempted to redundantly load world map");
+		for (int i = 0; i < ComputeShaderId::Num; i++)
+		{
+			Shader &compute = s_main->computeShaders[i];
+			compute.handle = bgfx::createShader(bgfx::makeRef(computeMem[i].mem, (uint32_t)computeMem[i].size));
+
+			if (!bgfx::isValid(compute.handle))
+				interface::Error("Error creating compute shader");
+
+#ifdef _DEBUG
+			bgfx::setName(compute.handle, s_computeShaderNames[i]);
+#endif
+			s_main->computeShaderPrograms[i].handle = bgfx::createProgram(compute.handle);
+
+			if (!bgfx::isValid(s_main->computeShaderPrograms[i].handle))
+				interface::Error("Error creating compute shader program");
+		}
 	}
+}
 
-	// Create frame buffers first.
-	uint64_t aaFlags = 0;
+static uint64_t GetMsaaTextureFlags()
+{
+	if (!IsMsaa(s_main->aa))
+		return 0;
 
-	if (IsMsaa(s_main->aa))
+	return (1 + (uint64_t)s_main->aa - (uint64_t)AntiAliasing::MSAA2x) << BGFX_TEXTURE_RT_MSAA_SHIFT;
+}
+
+/// @brief Create a texture the size of the scene. Without dynamic resolution, bgfx keeps it the same size as the backbuffer.
+static bgfx::TextureHandle CreateSceneTexture(bgfx::TextureFormat::Enum format, uint64_t flags)
+{
+	if (!s_main->dynamicResolutionEnabled)
+		return bgfx::createTexture2D(bgfx::BackbufferRatio::Equal, false, 1, format, flags);
+
+	const uint16_t width = (uint16_t)std::max(1, int(window::GetWidth() * s_main->sceneScale));
+	const uint16_t height = (uint16_t)std::max(1, int(window::GetHeight() * s_main->sceneScale));
+	return bgfx::createTexture2D(width, height, false, 1, format, flags);
+}
+
+static void DestroyFrameBuffer(FrameBuffer *frameBuffer)
+{
+	if (bgfx::isValid(frameBuffer->handle))
 	{
-		aaFlags |= (1 + (uint64_t)s_main->aa - (uint64_t)AntiAliasing::MSAA2x) << BGFX_TEXTURE_RT_MSAA_SHIFT;
+		bgfx::destroy(frameBuffer->handle);
+		frameBuffer->handle.idx = bgfx::kInvalidHandle;
 	}
+}
 
+void CreateSceneFrameBuffers()
+{
+	// Dynamic resolution calls this again whenever the scene scale changes.
+	DestroyFrameBuffer(&s_main->depthFb);
+	DestroyFrameBuffer(&s_main->sceneFb);
+	DestroyFrameBuffer(&s_main->sceneTempFb);
+	DestroyFrameBuffer(&s_main->smaaBlendFb);
+	DestroyFrameBuffer(&s_main->smaaEdgesFb);
+	DestroyFrameBuffer(&s_main->taaHistoryFb[0]);
+	DestroyFrameBuffer(&s_main->taaHistoryFb[1]);
+	const uint64_t aaFlags = GetMsaaTextureFlags();
 	const uint64_t rtClampFlags = BGFX_TEXTURE_RT | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP;
 
-	if (s_main->softSpritesEnabled)
+	if (s_main->aa == AntiAliasing::TAA)
 	{
-		s_main->depthFb.handle = bgfx::createFrameBuffer(bgfx::BackbufferRatio::Equal, bgfx::TextureFormat::D24S8);
+		// TAA writes velocity in the depth pass. Depth stays the first attachment for soft sprites.
+		bgfx::TextureHandle depthTextures[2];
+		depthTextures[0] = CreateSceneTexture(bgfx::TextureFormat::D24S8, rtClampFlags);
+		depthTextures[1] = CreateSceneTexture(bgfx::TextureFormat::RG16F, rtClampFlags | BGFX_SAMPLER_POINT);
+		s_main->depthFb.handle = bgfx::createFrameBuffer(2, depthTextures, true);
+
+		for (size_t i = 0; i < 2; i++)
+		{
+			bgfx::TextureHandle historyTexture = CreateSceneTexture(bgfx::TextureFormat::BGRA8, rtClampFlags);
+			s_main->taaHistoryFb[i].handle = bgfx::createFrameBuffer(1, &historyTexture, true);
+		}
+
+		s_main->taaHistoryValid = false;
+	}
+	else if (s_main->softSpritesEnabled)
+	{
+		bgfx::TextureHandle depthTexture = CreateSceneTexture(bgfx::TextureFormat::D24S8, rtClampFlags);
+		s_main->depthFb.handle = bgfx::createFrameBuffer(1, &depthTexture, true);
 	}
 
 	if (s_main->bloomEnabled)
 	{
 		bgfx::TextureHandle sceneTextures[3];
-		sceneTextures[0] = bgfx::createTexture2D(bgfx::BackbufferRatio::Equal, false, 1, bgfx::TextureFormat::BGRA8, rtClampFlags | aaFlags);
-		sceneTextures[1] = bgfx::createTexture2D(bgfx::BackbufferRatio::Equal, false, 1, bgfx::TextureFormat::BGRA8, rtClampFlags | aaFlags);
-		sceneTextures[2] = bgfx::createTexture2D(bgfx::BackbufferRatio::Equal, false, 1, bgfx::TextureFormat::D24S8, BGFX_TEXTURE_RT | aaFlags);
+		sceneTextures[0] = CreateSceneTexture(bgfx::TextureFormat::BGRA8, rtClampFlags | aaFlags);
+		sceneTextures[1] = CreateSceneTexture(bgfx::TextureFormat::BGRA8, rtClampFlags | aaFlags);
+		sceneTextures[2] = CreateSceneTexture(bgfx::TextureFormat::D24S8, BGFX_TEXTURE_RT | aaFlags);
 		s_main->sceneFb.handle = bgfx::createFrameBuffer(3, sceneTextures, true);
 		s_main->sceneBloomAttachment = 1;
 		s_main->sceneDepthAttachment = 2;
+		s_main->sceneFbEnabled = true;
 
-		// Bloom needs a temp BGRA8 destination for SMAA. GL needs it for MSAA resolve.
-		if (s_main->aa == AntiAliasing::SMAA || (bgfx::getRendererType() == bgfx::RendererType::OpenGL && IsMsaa(s_main->aa)))
-		{
-			s_main->sceneTempFb.handle = bgfx::createFrameBuffer(bgfx::BackbufferRatio::Equal, bgfx::TextureFormat::BGRA8, rtClampFlags);
-		}
-
-		for (size_t i = 0; i < s_main->nBloomFrameBuffers; i++)
+		// GL needs a temp texture to resolve multisampled bloom into.
+		if (bgfx::getRendererType() == bgfx::RendererType::OpenGL && IsMsaa(s_main->aa))
 		{
-			s_main->bloomFb[i].handle = bgfx::createFrameBuffer(bgfx::BackbufferRatio::Quarter, bgfx::TextureFormat::BGRA8, rtClampFlags);
+			bgfx::TextureHandle tempTexture = CreateSceneTexture(bgfx::TextureFormat::BGRA8, rtClampFlags);
+			s_main->sceneTempFb.handle = bgfx::createFrameBuffer(1, &tempTexture, true);
 		}
 	}
-	else if (!s_main->fastPathEnabled)
+	else if (s_main->aa == AntiAliasing::SMAA || s_main->aa == AntiAliasing::TAA || s_main->waterReflectionsEnabled || s_main->dynamicResolutionEnabled)
 	{
+		// SMAA and TAA read the scene color. Water reflections render into the scene and copy it out. Dynamic resolution upscales it. Otherwise the scene goes straight to the backbuffer, which is multisampled if MSAA is enabled.
 		bgfx::TextureHandle sceneTextures[2];
-		sceneTextures[0] = bgfx::createTexture2D(bgfx::BackbufferRatio::Equal, false, 1, bgfx::TextureFormat::BGRA8, rtClampFlags | aaFlags);
-		sceneTextures[1] = bgfx::createTexture2D(bgfx::BackbufferRatio::Equal, false, 1, bgfx::TextureFormat::D24S8, BGFX_TEXTURE_RT | aaFlags);
+		sceneTextures[0] = CreateSceneTexture(bgfx::TextureFormat::BGRA8, rtClampFlags | aaFlags);
+		sceneTextures[1] = CreateSceneTexture(bgfx::TextureFormat::D24S8, BGFX_TEXTURE_RT | aaFlags);
 		s_main->sceneFb.handle = bgfx::createFrameBuffer(2, sceneTextures, true);
 		s_main->sceneDepthAttachment = 1;
+		s_main->sceneFbEnabled = true;
+	}
+
+	if (s_main->aa == AntiAliasing::SMAA)
+	{
+		bgfx::TextureHandle blendTexture = CreateSceneTexture(bgfx::TextureFormat::BGRA8, rtClampFlags);
+		s_main->smaaBlendFb.handle = bgfx::createFrameBuffer(1, &blendTexture, true);
+		bgfx::TextureHandle edgesTexture = CreateSceneTexture(bgfx::TextureFormat::RG8, rtClampFlags);
+		s_main->smaaEdgesFb.handle = bgfx::createFrameBuffer(1, &edgesTexture, true);
+	}
+}
+
+void LoadWorld(const char *name)
+{
+	if (world::IsLoaded())
+	{
+		interface::Error("ERROR: attempted to redundantly load world map");
+	}
+
+	// Create frame buffers first.
+	CreateSceneFrameBuffers();
+	const uint64_t rtClampFlags = BGFX_TEXTURE_RT | BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP;
+
+	if (s_main->bloomEnabled)
+	{
+		// The downsample chain: quarter, eighth and sixteenth size.
+		const uint64_t bloomFlags = rtClampFlags | (s_main->bloomComputeEnabled ? BGFX_TEXTURE_COMPUTE_WRITE : 0);
+
+		for (size_t i = 0; i < s_main->nBloomLevels; i++)
+		{
+			const auto ratio = bgfx::BackbufferRatio::Enum(bgfx::BackbufferRatio::Quarter + i);
+			s_main->bloomFb[i].handle = bgfx::createFrameBuffer(ratio, bgfx::TextureFormat::RGBA8, bloomFlags);
+		}
 	}
 
 	if (s_main->waterReflectionsEnabled)
 	{
-		bgfx::TextureHandle reflectionTexture = bgfx::createTexture2D(bgfx::BackbufferRatio::Equal, false, 1, bgfx::TextureFormat::BGRA8, rtClampFlags | aaFlags);
+		// Stays the size of the window with dynamic resolution, materials sample it in normalized screen coordinates.
+		bgfx::TextureHandle reflectionTexture = bgfx::createTexture2D(bgfx::BackbufferRatio::Equal, false, 1, bgfx::TextureFormat::BGRA8, rtClampFlags | GetMsaaTextureFlags());
 		s_main->reflectionFb.handle = bgfx::createFrameBuffer(1, &reflectionTexture); // Don't destroy the texture, that will be done by the texture cache.
 
 		// Register the reflection texture so it can accessed by materials.
@@ -611,8 +843,6 @@ void LoadWorld(const char *name)
 
 	if (s_main->aa == AntiAliasing::SMAA)
 	{
-		s_main->smaaBlendFb.handle = bgfx::createFrameBuffer(bgfx::BackbufferRatio::Equal, bgfx::TextureFormat::BGRA8, rtClampFlags);
-		s_main->smaaEdgesFb.handle = bgfx::createFrameBuffer(bgfx::BackbufferRatio::Equal, bgfx::TextureFormat::RG8, rtClampFlags);
 		s_main->smaaAreaTex = bgfx::createTexture2D(AREATEX_WIDTH, AREATEX_HEIGHT, false, 1, bgfx::TextureFormat::RG8, BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP, bgfx::makeRef(areaTexBytes, AREATEX_SIZE));
 		s_main->smaaSearchTex = bgfx::createTexture2D(SEARCHTEX_WIDTH, SEARCHTEX_HEIGHT, false, 1, bgfx::TextureFormat::R8, BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP, bgfx::makeRef(searchTexBytes, SEARCHTEX_SIZE));
 	}
@@ -636,6 +866,7 @@ void Shutdown(bool destroyWindow)
 #endif
 	world::Unload();
 	interface::Cmd_Remove("r_captureFrame");
+	interface::Cmd_Remove("r_dumpFrameStats");
 	interface::Cmd_Remove("r_pickMaterial");
 	interface::Cmd_Remove("r_printMaterials");
 	interface::Cmd_Remove("screenshot");
@@ -661,6 +892,10 @@ void Shutdown(bool destroyWindow)
 	if (destroyWindow)
 	{
 		bgfx::shutdown();
+
+		// Write anything bgfx captured before shutting down.
+		s_imageEncoder.flush();
+		s_imageEncoder.stop();
 		window::Shutdown();
 	}
 }
@@ -0,0 +1,168 @@
+/*
+===========================================================================
+Copyright (C) 1999-2005 Id Software, Inc.
+
+This file is part of Quake III Arena source code.
+
+Quake III Arena source code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the License,
+or (at your option) any later version.
+
+Quake III Arena source code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Quake III Arena source code; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+===========================================================================
+*/
+#include "Precompiled.h"
+#pragma hdrstop
+
+#include "Main.h"
+
+namespace renderer {
+namespace main {
+
+static const char *s_viewPassNames[ViewPass::Num] =
+{
+	"other",
+	"shadow",
+	"depth",
+	"scene",
+	"post",
+	"overlay"
+};
+
+struct FrameTimePercentiles
+{
+	float p50, p95, p99;
+};
+
+static FrameTimePercentiles CalculatePercentiles(std::vector<float> *times)
+{
+	FrameTimePercentiles result = {};
+
+	if (times->empty())
+		return result;
+
+	// Nearest rank.
+	std::sort(times->begin(), times->end());
+	auto percentile = [times](float p) { return (*times)[std::min(times->size() - 1, (size_t)(p * times->size()))]; };
+	result.p50 = percentile(0.5f);
+	result.p95 = percentile(0.95f);
+	result.p99 = percentile(0.99f);
+	return result;
+}
+
+/// @brief Visit the recorded samples from oldest to newest.
+template<typename Func>
+static void ForEachFrameStatsSample(Func func)
+{
+	const size_t first = (s_main->nextFrameStatsSample + s_main->frameStatsSamples.size() - s_main->nFrameStatsSamples) % s_main->frameStatsSamples.size();
+
+	for (size_t i = 0; i < s_main->nFrameStatsSamples; i++)
+		func(s_main->frameStatsSamples[(first + i) % s_main->frameStatsSamples.size()]);
+}
+
+static void CalculatePercentiles(FrameTimePercentiles *cpu, FrameTimePercentiles *gpu)
+{
+	std::vector<float> cpuTimes, gpuTimes;
+	cpuTimes.reserve(s_main->nFrameStatsSamples);
+	gpuTimes.reserve(s_main->nFrameStatsSamples);
+
+	ForEachFrameStatsSample([&](const Main::FrameStatsSample &sample)
+	{
+		cpuTimes.push_back(sample.cpuTime);
+		gpuTimes.push_back(sample.gpuTime);
+	});
+
+	*cpu = CalculatePercentiles(&cpuTimes);
+	*gpu = CalculatePercentiles(&gpuTimes);
+}
+
+void DumpFrameStats(const char *filename)
+{
+	if (!s_main->nFrameStatsSamples)
+	{
+		interface::Printf("No frame stats recorded. Set r_frameStats first.\n");
+		return;
+	}
+
+	std::string csv = "frame,cpu_ms,gpu_ms";
+
+	for (size_t i = 0; i < ViewPass::Num; i++)
+		csv += util::VarArgs(",%s_gpu_ms,%s_draws,%s_triangles,%s_program_changes", s_viewPassNames[i], s_viewPassNames[i], s_viewPassNames[i], s_viewPassNames[i]);
+
+	csv += "\n";
+
+	ForEachFrameStatsSample([&csv](const Main::FrameStatsSample &sample)
+	{
+		csv += util::VarArgs("%u,%.3f,%.3f", sample.frameNo, sample.cpuTime, sample.gpuTime);
+
+		for (const Main::FrameStatsPass &pass : sample.passes)
+			csv += util::VarArgs(",%.3f,%u,%u,%u", pass.gpuTime, pass.nDrawCalls, pass.nTriangles, pass.nProgramChanges);
+
+		csv += "\n";
+	});
+
+	interface::FS_WriteFile(filename, (const uint8_t *)csv.c_str(), csv.length());
+	FrameTimePercentiles cpu, gpu;
+	CalculatePercentiles(&cpu, &gpu);
+	interface::Printf("Wrote %d frames to %s\n", (int)s_main->nFrameStatsSamples, filename);
+	interface::Printf("CPU ms p50:%.2f p95:%.2f p99:%.2f\n", cpu.p50, cpu.p95, cpu.p99);
+	interface::Printf("GPU ms p50:%.2f p95:%.2f p99:%.2f\n", gpu.p50, gpu.p95, gpu.p99);
+}
+
+void PrintFrameStats()
+{
+	if (g_cvars.frameStats.getInt() != 1 || !s_main->nFrameStatsSamples)
+		return;
+
+	FrameTimePercentiles cpu, gpu;
+	CalculatePercentiles(&cpu, &gpu);
+	DebugPrint("CPU ms p50:%.2f p95:%.2f p99:%.2f", cpu.p50, cpu.p95, cpu.p99);
+	DebugPrint("GPU ms p50:%.2f p95:%.2f p99:%.2f", gpu.p50, gpu.p95, gpu.p99);
+	const size_t last = (s_main->nextFrameStatsSample + s_main->frameStatsSamples.size() - 1) % s_main->frameStatsSamples.size();
+	const Main::FrameStatsSample &sample = s_main->frameStatsSamples[last];
+
+	for (size_t i = 0; i < ViewPass::Num; i++)
+	{
+		const Main::FrameStatsPass &pass = sample.passes[i];
+		DebugPrint("%s: %.2fms draws:%u tris:%u programs:%u", s_viewPassNames[i], pass.gpuTime, pass.nDrawCalls, pass.nTriangles, pass.nProgramChanges);
+	}
+}
+
+void RecordFrameStats()
+{
+	if (g_cvars.frameStats.getInt() != 0)
+	{
+		// The counters are for the frame just submitted, the timings for the last frame bgfx rendered, which is a frame behind when the render thread is used.
+		const bgfx::Stats *stats = bgfx::getStats();
+		Main::FrameStatsSample &sample = s_main->frameStatsSamples[s_main->nextFrameStatsSample];
+		sample.frameNo = s_main->frameNo;
+		const double toCpuMs = stats->cpuTimerFreq ? 1000.0 / stats->cpuTimerFreq : 0;
+		const double toGpuMs = stats->gpuTimerFreq ? 1000.0 / stats->gpuTimerFreq : 0;
+		sample.cpuTime = float(stats->cpuTimeFrame * toCpuMs);
+		sample.gpuTime = float((stats->gpuTimeEnd - stats->gpuTimeBegin) * toGpuMs);
+		sample.passes = s_main->frameStatsPasses;
+
+		for (uint16_t i = 0; i < stats->numViews; i++)
+		{
+			const bgfx::ViewStats &view = stats->viewStats[i];
+			sample.passes[s_main->viewPasses[view.view]].gpuTime += float(view.gpuTimeElapsed * toGpuMs);
+		}
+
+		s_main->nextFrameStatsSample = (s_main->nextFrameStatsSample + 1) % s_main->frameStatsSamples.size();
+		s_main->nFrameStatsSamples = std::min(s_main->nFrameStatsSamples + 1, s_main->frameStatsSamples.size());
+	}
+
+	s_main->frameStatsPasses.fill(Main::FrameStatsPass());
+	s_main->frameStatsLastPrograms.fill(BGFX_INVALID_HANDLE);
+}
+
+} // namespace main
+} // namespace renderer
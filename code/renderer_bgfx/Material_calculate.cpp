@@ -91,62 +91,9 @@ uint64_t MaterialStage::getState() const
 	return state;
 }
 
-void MaterialStage::setShaderUniforms(Uniforms_MaterialStage *uniforms, int flags) const
+void MaterialStage::setShaderUniforms(Uniforms_MaterialStage *uniforms) const
 {
-	uniforms->alphaTest.set((float)alphaTest);
-
-	if (shouldLerpTextureAnimation())
-	{
-		float fraction;
-		calculateTextureAnimation(nullptr, nullptr, &fraction);
-		uniforms->animation_Enabled_Fraction.set(vec4(1, fraction, 0, 0));
-	}
-	else
-	{
-		uniforms->animation_Enabled_Fraction.set(vec4::empty);
-	}
-
-	uniforms->lightType.set(vec4((float)light, 0, 0, 0));
-	uniforms->normalScale.set(normalScale);
-	uniforms->specularScale.set(specularScale);
-
-	if (flags & (MaterialStageSetUniformsFlags::ColorGen | MaterialStageSetUniformsFlags::TexGen))
-	{
-		vec4 generators;
-		generators[Uniforms_MaterialStage::Generators::TexCoord] = (float)bundles[0].tcGen;
-		generators[Uniforms_MaterialStage::Generators::Color] = (float)rgbGen;
-		generators[Uniforms_MaterialStage::Generators::Alpha] = (float)alphaGen;
-		uniforms->generators.set(generators);
-	}
-
-	if (flags & MaterialStageSetUniformsFlags::ColorGen)
-	{
-		// rgbGen and alphaGen
-		vec4 baseColor, vertexColor;
-		calculateColors(&baseColor, &vertexColor);
-		uniforms->baseColor.set(util::ToLinear(baseColor));
-		uniforms->vertexColor.set(util::ToLinear(vertexColor));
-
-		if (alphaGen == MaterialAlphaGen::Portal)
-		{
-			uniforms->portalRange.set(material->portalRange);
-		}
-	}
-
-	if (flags & MaterialStageSetUniformsFlags::TexGen)
-	{
-		// tcGen and tcMod
-		vec4 texMatrix, texOffTurb;
-		calculateTexMods(&texMatrix, &texOffTurb);
-		uniforms->diffuseTextureMatrix.set(texMatrix);
-		uniforms->diffuseTextureOffsetTurbulent.set(texOffTurb);
-
-		if (bundles[0].tcGen == MaterialTexCoordGen::Vector)
-		{
-			uniforms->tcGenVector0.set(bundles[0].tcGenVectors[0]);
-			uniforms->tcGenVector1.set(bundles[0].tcGenVectors[1]);
-		}
-	}
+	uniforms->params.set(evaluateUniforms().params, STAGE_NUM_PARAMS);
 }
 
 void MaterialStage::setTextureSamplers(Uniforms_MaterialStage *uniforms) const
@@ -574,6 +521,79 @@ void MaterialStage::calculateColors(vec4 *baseColor, vec4 *vertColor) const
 	}
 }
 
+bool MaterialStage::dependsOnEntity() const
+{
+	if (rgbGen == MaterialColorGen::Entity || rgbGen == MaterialColorGen::OneMinusEntity)
+		return true;
+
+	if (alphaGen == MaterialAlphaGen::Entity || alphaGen == MaterialAlphaGen::OneMinusEntity)
+		return true;
+
+	const MaterialTextureBundle &bundle = bundles[0];
+
+	for (int tm = 0; tm < bundle.numTexMods; tm++)
+	{
+		if (bundle.texMods[tm].type == MaterialTexMod::EntityTranslate)
+			return true;
+	}
+
+	return false;
+}
+
+const MaterialStage::EvaluatedUniforms &MaterialStage::evaluateUniforms() const
+{
+	// Entity time is already folded into material time by Material::setTime, so only entity color and texcoord need to be part of the key.
+	const Entity *entity = dependsOnEntity() ? main::GetCurrentEntity() : nullptr;
+	EvaluatedUniforms &e = evaluated_;
+
+	if (e.valid && e.time == material->time_ && e.hasEntity == (entity != nullptr))
+	{
+		if (!entity || (e.entityColor == entity->materialColor && e.entityTexCoord == entity->materialTexCoord))
+			return e;
+	}
+
+	e.valid = true;
+	e.time = material->time_;
+	e.hasEntity = entity != nullptr;
+	e.entityColor = entity ? entity->materialColor : vec4::empty;
+	e.entityTexCoord = entity ? entity->materialTexCoord : vec2::empty;
+	vec4 *params = e.params;
+
+	vec4 &generators = params[STAGE_GENERATORS];
+	generators[GEN_TEXCOORD] = (float)bundles[0].tcGen;
+	generators[GEN_COLOR] = (float)rgbGen;
+	generators[GEN_ALPHA] = (float)alphaGen;
+	generators.w = (float)light;
+
+	// rgbGen and alphaGen
+	calculateColors(&params[STAGE_BASE_COLOR], &params[STAGE_VERTEX_COLOR]);
+	params[STAGE_BASE_COLOR] = util::ToLinear(params[STAGE_BASE_COLOR]);
+	params[STAGE_VERTEX_COLOR] = util::ToLinear(params[STAGE_VERTEX_COLOR]);
+
+	// tcMod
+	calculateTexMods(&params[STAGE_TEX_MATRIX], &params[STAGE_TEX_OFF_TURB]);
+
+	// tcGen vectors share their unused w with alpha test and portal range.
+	const bool tcGenVector = bundles[0].tcGen == MaterialTexCoordGen::Vector;
+	params[STAGE_TCGEN_VECTOR0] = vec4(tcGenVector ? bundles[0].tcGenVectors[0] : vec3::empty, (float)alphaTest);
+	params[STAGE_TCGEN_VECTOR1] = vec4(tcGenVector ? bundles[0].tcGenVectors[1] : vec3::empty, material->portalRange);
+
+	params[STAGE_FOG_COLOR_MASK] = getFogColorMask();
+
+	if (shouldLerpTextureAnimation())
+	{
+		float fraction;
+		calculateTextureAnimation(nullptr, nullptr, &fraction);
+		params[STAGE_ANIMATION] = vec4(1, fraction, 0, 0);
+	}
+	else
+	{
+		params[STAGE_ANIMATION] = vec4::empty;
+	}
+
+	return e;
+}
+
 float Material::setTime(float time)
 {
 	time_ = time - timeOffset;
@@ -586,71 +606,79 @@ float Material::setTime(float time)
 	return time_;
 }
 
-bool Material::hasAutoSpriteDeform() const
+MaterialDeform Material::getAutoSpriteDeform() const
 {
 	for (const MaterialDeformStage &ds : deforms)
 	{
 		if (ds.deformation == MaterialDeform::Autosprite || ds.deformation == MaterialDeform::Autosprite2)
-			return true;
+			return ds.deformation;
 	}
 
-	return false;
+	return MaterialDeform::None;
 }
 
-void Material::doAutoSpriteDeform(const mat3 &sceneRotation, Vertex *vertices, uint32_t nVertices, uint16_t *indices, uint32_t nIndices, float *softSpriteDepth) const
+bool Material::hasAutoSpriteDeform() const
 {
-	assert(vertices);
-	assert(indices);
-	assert(softSpriteDepth);
-	MaterialDeform deform = MaterialDeform::None;
+	return getAutoSpriteDeform() != MaterialDeform::None;
+}
 
-	for (const MaterialDeformStage &ds : deforms)
-	{
-		if (ds.deformation == MaterialDeform::Autosprite || ds.deformation == MaterialDeform::Autosprite2)
-		{
-			deform = ds.deformation;
-			break;
-		}
-	}
+void Material::setAutoSpriteIndices(uint16_t *indices, uint32_t nIndices) const
+{
+	assert(indices);
 
-	if (deform == MaterialDeform::None)
-	{
-		*softSpriteDepth = 0;
+	// Autosprite2 pivots the quads in place, so the existing winding is fine.
+	if (getAutoSpriteDeform() != MaterialDeform::Autosprite)
 		return;
-	}
 
 	if ((nIndices % 6) != 0)
 	{
 		interface::PrintWarningf("Autosprite material %s had odd index count %u\n", name, nIndices);
 	}
 
-	vec3 forward, leftDir, upDir;
-
-	if (main::GetCurrentEntity())
+	for (size_t firstIndex = 0; firstIndex + 6 <= nIndices; firstIndex += 6)
 	{
-		forward.x = vec3::dotProduct(sceneRotation[0], main::GetCurrentEntity()->rotation[0]);
-		forward.y = vec3::dotProduct(sceneRotation[0], main::GetCurrentEntity()->rotation[1]);
-		forward.z = vec3::dotProduct(sceneRotation[0], main::GetCurrentEntity()->rotation[2]);
-		leftDir.x = vec3::dotProduct(sceneRotation[1], main::GetCurrentEntity()->rotation[0]);
-		leftDir.y = vec3::dotProduct(sceneRotation[1], main::GetCurrentEntity()->rotation[1]);
-		leftDir.z = vec3::dotProduct(sceneRotation[1], main::GetCurrentEntity()->rotation[2]);
-		upDir.x = vec3::dotProduct(sceneRotation[2], main::GetCurrentEntity()->rotation[0]);
-		upDir.y = vec3::dotProduct(sceneRotation[2], main::GetCurrentEntity()->rotation[1]);
-		upDir.z = vec3::dotProduct(sceneRotation[2], main::GetCurrentEntity()->rotation[2]);
-	}
-	else
-	{
-		forward = sceneRotation[0];
-		leftDir = sceneRotation[1];
-		upDir = sceneRotation[2];
+		// Corners are ordered by vertex index, matching setAutoSpriteVertices.
+		std::array<uint16_t, 6> sorted;
+		memcpy(sorted.data(), &indices[firstIndex], sizeof(uint16_t) * sorted.size());
+		std::sort(sorted.begin(), sorted.end());
+		std::array<uint16_t, 4> vi;
+		size_t nCorners = 0;
+
+		for (size_t i = 0; i < sorted.size() && nCorners < vi.size(); i++)
+		{
+			if (i == 0 || sorted[i] != sorted[i - 1])
+				vi[nCorners++] = sorted[i];
+		}
+
+		if (nCorners != vi.size())
+			continue;
+
+		indices[firstIndex + 0] = vi[0];
+		indices[firstIndex + 1] = vi[1];
+		indices[firstIndex + 2] = vi[3];
+		indices[firstIndex + 3] = vi[3];
+		indices[firstIndex + 4] = vi[1];
+		indices[firstIndex + 5] = vi[2];
 	}
+}
+
+void Material::setAutoSpriteVertices(Vertex *vertices, const uint16_t *indices, uint32_t nIndices, float *softSpriteDepth) const
+{
+	assert(vertices);
+	assert(indices);
+	assert(softSpriteDepth);
+	const MaterialDeform deform = getAutoSpriteDeform();
+	*softSpriteDepth = 0;
+
+	if (deform == MaterialDeform::None)
+		return;
 
 	// Assuming the geometry is triangulated quads.
 	// Autosprite will rebuild them as forward facing sprites.
 	// Autosprite2 will pivot a rectangular quad along the center of its long axis.
+	// The camera dependent part is done by the vertex shader (see CalculateAutoSprite in Gen_Deform.sh). Here the quad data it needs is stored in the vertex position and normal.
 	for (size_t quadIndex = 0; quadIndex < nIndices / 6; quadIndex++)
 	{
-		//const size_t firstIndex = dc->ib.firstIndex + quadIndex * 6;
 		const size_t firstIndex = quadIndex * 6;
 
 		// Get the quad corner vertices and their indexes.
@@ -665,58 +693,24 @@ void Material::doAutoSpriteDeform(const mat3 &sceneRotation, Vertex *vertices, u
 		const float radius = (v[0]->pos - midpoint).length() * 0.707f; // / sqrt(2)
 
 		// Calculate soft sprite depth.
-		*softSpriteDepth = radius / 2;
+		*softSpriteDepth = std::max(*softSpriteDepth, radius / 2);
 
 		if (deform == MaterialDeform::Autosprite)
 		{
-			vec3 left(leftDir * radius);
-			vec3 up(upDir * radius);
-
-			if (main::IsCameraMirrored())
-				left = -left;
+			// Position is the midpoint, normal xy is the corner offset along the left and up axes.
+			for (size_t i = 0; i < v.size(); i++)
+				v[i]->pos = midpoint;
 
-			// Compensate for scale in the axes if necessary.
-			if (main::GetCurrentEntity() && main::GetCurrentEntity()->nonNormalizedAxes)
-			{
-				float axisLength = vec3(main::GetCurrentEntity()->rotation[0]).length();
-
-				if (!axisLength)
-				{
-					axisLength = 0;
-				}
-				else
-				{
-					axisLength = 1.0f / axisLength;
-				}
-
-				left *= axisLength;
-				up *= axisLength;
-			}
-
-			// Rebuild quad facing the main camera.
-			v[0]->pos = midpoint + left + up;
-			v[1]->pos = midpoint - left + up;
-			v[2]->pos = midpoint - left - up;
-			v[3]->pos = midpoint + left - up;
-
-			// Constant normal all the way around.
-			v[0]->normal = -sceneRotation[0];
-			v[1]->normal = -sceneRotation[0];
-			v[2]->normal = -sceneRotation[0];
-			v[3]->normal = -sceneRotation[0];
+			v[0]->normal = vec3(radius, radius, 0);
+			v[1]->normal = vec3(-radius, radius, 0);
+			v[2]->normal = vec3(-radius, -radius, 0);
+			v[3]->normal = vec3(radius, -radius, 0);
 
 			// Standard square texture coordinates.
 			v[0]->texCoord = vec4(0, 0, 0, 0);
 			v[1]->texCoord = vec4(1, 0, 1, 0);
 			v[2]->texCoord = vec4(1, 1, 1, 1);
 			v[3]->texCoord = vec4(0, 1, 0, 1);
-
-			indices[firstIndex + 0] = vi[0];
-			indices[firstIndex + 1] = vi[1];
-			indices[firstIndex + 2] = vi[3];
-			indices[firstIndex + 3] = vi[3];
-			indices[firstIndex + 4] = vi[1];
-			indices[firstIndex + 5] = vi[2];
 		}
 		else if (deform == MaterialDeform::Autosprite2)
 		{
@@ -760,13 +754,10 @@ void Material::doAutoSpriteDeform(const mat3 &sceneRotation, Vertex *vertices, u
 				midpoints[i] = (v[edgeVerts[nums[i]][0]]->pos + v[edgeVerts[nums[i]][1]]->pos) * 0.5f;
 			}
 
-			// Find the vector of the major axis.
-			const vec3 major(midpoints[1] - midpoints[0]);
-
-			// Cross this with the view direction to get minor axis.
-			const vec3 minor(vec3::crossProduct(major, forward).normal());
+			// Find the vector of the major axis. The vertex shader crosses this with the view direction to get the minor axis.
+			const vec3 major(vec3(midpoints[1] - midpoints[0]).normal());
 
-			// Re-project the points.
+			// Position is the edge midpoint, normal is the major axis scaled by the signed half length of the edge.
 			for (int i = 0; i < 2; i++)
 			{
 				// We need to see which direction this edge is used to determine direction of projection.
@@ -779,25 +770,17 @@ void Material::doAutoSpriteDeform(const mat3 &sceneRotation, Vertex *vertices, u
 				}
 
 				const float l = 0.5f * sqrt(lengths[i]);
-				vec3 *v1 = &v[edgeVerts[nums[i]][0]]->pos;
-				vec3 *v2 = &v[edgeVerts[nums[i]][1]]->pos;
-
-				if (j == 5)
-				{
-					*v1 = midpoints[i] + minor * l;
-					*v2 = midpoints[i] + minor * -l;
-				}
-				else
-				{
-					*v1 = midpoints[i] + minor * -l;
-					*v2 = midpoints[i] + minor * l;
-				}
+				Vertex *v1 = v[edgeVerts[nums[i]][0]];
+				Vertex *v2 = v[edgeVerts[nums[i]][1]];
+				v1->pos = v2->pos = midpoints[i];
+				v1->normal = major * (j == 5 ? l : -l);
+				v2->normal = major * (j == 5 ? -l : l);
 			}
 		}
 	}
 }
 
-void Material::setDeformUniforms(Uniforms_Material *uniforms) const
+void Material::setDeformUniforms(Uniforms_Material *uniforms, const mat3 &sceneRotation) const
 {
 	assert(uniforms);
 	vec4 moveDirs[maxDeforms];
@@ -805,6 +788,56 @@ void Material::setDeformUniforms(Uniforms_Material *uniforms) const
 	vec4 frequency_Phase_Spread[maxDeforms];
 	uint16_t nDeforms = 0;
 
+	// Autosprite goes first, other deforms are applied to the rebuilt quads.
+	const MaterialDeform autoSpriteDeform = getAutoSpriteDeform();
+
+	if (autoSpriteDeform != MaterialDeform::None)
+	{
+		const Entity *entity = main::GetCurrentEntity();
+		vec3 forward, leftDir, upDir;
+
+		if (entity)
+		{
+			forward.x = vec3::dotProduct(sceneRotation[0], entity->rotation[0]);
+			forward.y = vec3::dotProduct(sceneRotation[0], entity->rotation[1]);
+			forward.z = vec3::dotProduct(sceneRotation[0], entity->rotation[2]);
+			leftDir.x = vec3::dotProduct(sceneRotation[1], entity->rotation[0]);
+			leftDir.y = vec3::dotProduct(sceneRotation[1], entity->rotation[1]);
+			leftDir.z = vec3::dotProduct(sceneRotation[1], entity->rotation[2]);
+			upDir.x = vec3::dotProduct(sceneRotation[2], entity->rotation[0]);
+			upDir.y = vec3::dotProduct(sceneRotation[2], entity->rotation[1]);
+			upDir.z = vec3::dotProduct(sceneRotation[2], entity->rotation[2]);
+
+			// Compensate for scale in the axes if necessary.
+			if (entity->nonNormalizedAxes)
+			{
+				const float axisLength = vec3(entity->rotation[0]).length();
+
+				if (axisLength)
+				{
+					leftDir *= 1.0f / axisLength;
+					upDir *= 1.0f / axisLength;
+				}
+			}
+		}
+		else
+		{
+			forward = sceneRotation[0];
+			leftDir = sceneRotation[1];
+			upDir = sceneRotation[2];
+		}
+
+		if (main::IsCameraMirrored())
+			leftDir = -leftDir;
+
+		const vec4 axes[] = { vec4(forward, 0), vec4(leftDir, 0), vec4(upDir, 0) };
+		uniforms->autoSpriteAxes.set(axes, 3);
+		gen_Wave_Base_Amplitude[nDeforms] = vec4((float)autoSpriteDeform, 0, 0, 0);
+		frequency_Phase_Spread[nDeforms] = vec4::empty;
+		moveDirs[nDeforms] = vec4::empty;
+		nDeforms++;
+	}
+
 	for (const MaterialDeformStage &ds : deforms)
 	{
 		switch (ds.deformation)
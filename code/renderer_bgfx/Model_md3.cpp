@@ -327,7 +327,7 @@ private:
 		float radius;
 		std::vector<Transform> tags;
 
-		/// Vertex data in system memory. Used by animated models.
+		/// Vertex data in system memory. Used by animated models, and to rebuild surfaces drawn with a material that disagrees with Surface::isAutoSprite.
 		std::vector<Vertex> vertices;
 	};
 
@@ -339,6 +339,19 @@ private:
 		uint32_t nIndices;
 		uint32_t startVertex;
 		uint32_t nVertices;
+
+		/// The vertices store quad data for an autosprite deform, see Material::setAutoSpriteVertices.
+		bool isAutoSprite;
+
+		float softSpriteDepth;
+
+		/// @brief The surface indices as they are in the file, relative to startVertex.
+		/// @remarks Used to rebuild the surface when a skin or custom material disagrees with isAutoSprite.
+		std::vector<uint16_t> indices;
+
+		/// @brief The vertices of each frame before any autosprite quad data was stored in them.
+		/// @remarks Only set if isAutoSprite is true. nVertices per frame.
+		std::vector<Vertex> undeformedVertices;
 	};
 
 	struct TagName
@@ -346,16 +359,15 @@ private:
 		char name[MAX_QPATH];
 	};
 
+	bool buildSurface(const Surface &surface, const Material *mat, int frameIndex, int oldFrameIndex, float lerp, DrawCall *dc) const;
 	vec3 decodeNormal(short normal) const;
+	const Vertex *getUndeformedVertices(const Surface &surface, int frameIndex) const;
 	int getTag(const char *name, int frame, int startIndex, Transform *transform) const;
 
 	bool compressed_;
 
 	IndexBuffer indexBuffer_;
 
-	/// Need to keep a copy of the model indices in system memory for CPU deforms.
-	std::vector<uint16_t> indices_;
-
 	/// Static model vertex buffer.
 	VertexBuffer vertexBuffer_;
 
@@ -641,22 +653,26 @@ bool Model_md3::load(const ReadOnlyFile &file)
 		surface.nIndices = fs.nTriangles * 3;
 		auto fileIndices = (int *)(fs.offset + fs.trianglesOffset);
 
+		surface.indices.resize(surface.nIndices);
+
 		for (uint32_t j = 0; j < surface.nIndices; j++)
 		{
 			indices[startIndex + j] = startVertex + fileIndices[j];
+			surface.indices[j] = (uint16_t)fileIndices[j];
 		}
 
-		startIndex += surface.nIndices;
-		startVertex += fs.nVertices;
-	}
+		surface.startVertex = startVertex;
+		surface.nVertices = fs.nVertices;
+		surface.isAutoSprite = !surface.materials.empty() && surface.materials[0]->hasAutoSpriteDeform();
+		surface.softSpriteDepth = 0;
 
-	indexBuffer_.handle = bgfx::createIndexBuffer(indicesMem);
+		if (surface.isAutoSprite)
+		{
+			surface.materials[0]->setAutoSpriteIndices(&indices[startIndex], surface.nIndices);
+		}
 
-	// Keep a copy of indices in system memory for CPU deforms.
-	if (isAnimated)
-	{
-		indices_.resize(nIndices);
-		memcpy(indices_.data(), indices, sizeof(uint16_t) * nIndices);
+		startIndex += surface.nIndices;
+		startVertex += fs.nVertices;
 	}
 
 	// Vertices
@@ -688,9 +704,16 @@ bool Model_md3::load(const ReadOnlyFile &file)
 				v.setColor(vec4::white);
 			}
 
+			if (surface.isAutoSprite)
+			{
+				surface.undeformedVertices.assign(&vertices[startVertex], &vertices[startVertex + fs.nVertices]);
+				surface.materials[0]->setAutoSpriteVertices(vertices, &indices[surface.startIndex], surface.nIndices, &surface.softSpriteDepth);
+			}
+
 			startVertex += fs.nVertices;
 		}
 
+		memcpy(frames_[0].vertices.data(), vertices, sizeof(Vertex) * nVertices_);
 		vertexBuffer_.handle = bgfx::createVertexBuffer(verticesMem, Vertex::decl);
 	}
 	else
@@ -754,14 +777,21 @@ bool Model_md3::load(const ReadOnlyFile &file)
 						}
 					}
 				}
+
+				if (surface.isAutoSprite)
+				{
+					surface.undeformedVertices.insert(surface.undeformedVertices.end(), &frames_[j].vertices[startVertex], &frames_[j].vertices[startVertex + fs.nVertices]);
+					float softSpriteDepth;
+					surface.materials[0]->setAutoSpriteVertices(frames_[j].vertices.data(), &indices[surface.startIndex], surface.nIndices, &softSpriteDepth);
+					surface.softSpriteDepth = std::max(surface.softSpriteDepth, softSpriteDepth);
+				}
 			}
 
-			surface.startVertex = startVertex;
-			surface.nVertices = fs.nVertices;
 			startVertex += fs.nVertices;
 		}
 	}
 
+	indexBuffer_.handle = bgfx::createIndexBuffer(indicesMem);
 	return true;
 }
 
@@ -860,15 +890,22 @@ void Model_md3::render(const mat3 &sceneRotation, DrawCallList *drawCallList, En
 		vertices = (Vertex *)tvb.data;
 
 		// Lerp vertices.
-		for (size_t i = 0; i < nVertices_; i++)
+		for (const Surface &surface : surfaces_)
 		{
-			Vertex &fromVertex = frames_[oldFrameIndex].vertices[i];
-			Vertex &toVertex = frames_[frameIndex].vertices[i];
-			const float fraction = entity->lerp;
-			vertices[i].pos = vec3::lerp(fromVertex.pos, toVertex.pos, fraction);
-			vertices[i].normal = vec3::lerp(fromVertex.normal, toVertex.normal, fraction).normal();
-			vertices[i].texCoord = toVertex.texCoord;
-			vertices[i].color = toVertex.color;
+			for (size_t i = surface.startVertex; i < surface.startVertex + surface.nVertices; i++)
+			{
+				Vertex &fromVertex = frames_[oldFrameIndex].vertices[i];
+				Vertex &toVertex = frames_[frameIndex].vertices[i];
+				const float fraction = entity->lerp;
+				vertices[i].pos = vec3::lerp(fromVertex.pos, toVertex.pos, fraction);
+				vertices[i].normal = vec3::lerp(fromVertex.normal, toVertex.normal, fraction);
+				vertices[i].texCoord = toVertex.texCoord;
+				vertices[i].color = toVertex.color;
+
+				// Autosprite surfaces store quad corner offsets in the normal.
+				if (!surface.isAutoSprite)
+					vertices[i].normal.normalize();
+			}
 		}
 	}
 
@@ -920,52 +957,88 @@ void Model_md3::render(const mat3 &sceneRotation, DrawCallList *drawCallList, En
 			dc.zScale = 0.3f;
 		}
 
-		if (isAnimated)
+		if (mat->hasAutoSpriteDeform() != surface.isAutoSprite)
 		{
-			dc.vb.type = DrawCall::BufferType::Transient;
-			dc.vb.transientHandle = tvb;
-
-			// Handle CPU deforms.
-			if (isAnimated && mat->hasAutoSpriteDeform())
+			// Autosprite quad data is only stored in the vertices if the model's own material has an autosprite deform.
+			// Rebuild the surface for this material instead of dropping it.
+			if (!buildSurface(surface, mat, frameIndex, oldFrameIndex, entity->lerp, &dc))
+				continue;
+		}
+		else
+		{
+			if (isAnimated)
 			{
-				bgfx::TransientIndexBuffer tib;
-
-				if (bgfx::getAvailTransientIndexBuffer(surface.nIndices) < surface.nIndices)
-				{
-					WarnOnce(WarnOnceId::TransientBuffer);
-					continue;
-				}
-
-				bgfx::allocTransientIndexBuffer(&tib, surface.nIndices);
-				memcpy(tib.data, &indices_[surface.startIndex], sizeof(uint16_t) * surface.nIndices);
-				mat->doAutoSpriteDeform(sceneRotation, (Vertex *)tvb.data, nVertices_, (uint16_t *)tib.data, surface.nIndices, &dc.softSpriteDepth);
-				dc.ib.type = DrawCall::BufferType::Transient;
-				dc.ib.transientHandle = tib;
-				dc.ib.nIndices = surface.nIndices;
+				dc.vb.type = DrawCall::BufferType::Transient;
+				dc.vb.transientHandle = tvb;
 			}
 			else
 			{
-				dc.ib.type = DrawCall::BufferType::Static;
-				dc.ib.staticHandle = indexBuffer_.handle;
-				dc.ib.firstIndex = surface.startIndex;
-				dc.ib.nIndices = surface.nIndices;
+				dc.vb.type = DrawCall::BufferType::Static;
+				dc.vb.staticHandle = vertexBuffer_.handle;
 			}
-		}
-		else
-		{
-			dc.vb.type = DrawCall::BufferType::Static;
-			dc.vb.staticHandle = vertexBuffer_.handle;
+
 			dc.ib.type = DrawCall::BufferType::Static;
 			dc.ib.staticHandle = indexBuffer_.handle;
 			dc.ib.firstIndex = surface.startIndex;
 			dc.ib.nIndices = surface.nIndices;
+			dc.softSpriteDepth = surface.softSpriteDepth;
+			dc.vb.nVertices = nVertices_;
 		}
 
-		dc.vb.nVertices = nVertices_;
 		drawCallList->push_back(dc);
 	}
 }
 
+bool Model_md3::buildSurface(const Surface &surface, const Material *mat, int frameIndex, int oldFrameIndex, float lerp, DrawCall *dc) const
+{
+	assert(mat);
+	assert(dc);
+
+	if (bgfx::getAvailTransientVertexBuffer(surface.nVertices, Vertex::decl) < surface.nVertices || bgfx::getAvailTransientIndexBuffer(surface.nIndices) < surface.nIndices)
+	{
+		WarnOnce(WarnOnceId::TransientBuffer);
+		return false;
+	}
+
+	bgfx::TransientVertexBuffer tvb;
+	bgfx::TransientIndexBuffer tib;
+	bgfx::allocTransientVertexBuffer(&tvb, surface.nVertices, Vertex::decl);
+	bgfx::allocTransientIndexBuffer(&tib, surface.nIndices);
+	auto vertices = (Vertex *)tvb.data;
+	auto indices = (uint16_t *)tib.data;
+	const Vertex *fromVertices = getUndeformedVertices(surface, oldFrameIndex);
+	const Vertex *toVertices = getUndeformedVertices(surface, frameIndex);
+
+	for (uint32_t i = 0; i < surface.nVertices; i++)
+	{
+		vertices[i] = toVertices[i];
+
+		if (frameIndex != oldFrameIndex)
+		{
+			vertices[i].pos = vec3::lerp(fromVertices[i].pos, toVertices[i].pos, lerp);
+			vertices[i].normal = vec3::lerp(fromVertices[i].normal, toVertices[i].normal, lerp).normal();
+		}
+	}
+
+	memcpy(indices, surface.indices.data(), surface.nIndices * sizeof(uint16_t));
+	dc->softSpriteDepth = 0;
+
+	// If the material has an autosprite deform, store the quad data for it. Otherwise the surface is drawn undeformed.
+	if (mat->hasAutoSpriteDeform())
+	{
+		mat->setAutoSpriteIndices(indices, surface.nIndices);
+		mat->setAutoSpriteVertices(vertices, indices, surface.nIndices, &dc->softSpriteDepth);
+	}
+
+	dc->vb.type = DrawCall::BufferType::Transient;
+	dc->vb.transientHandle = tvb;
+	dc->vb.nVertices = surface.nVertices;
+	dc->ib.type = DrawCall::BufferType::Transient;
+	dc->ib.transientHandle = tib;
+	dc->ib.nIndices = surface.nIndices;
+	return true;
+}
+
 vec3 Model_md3::decodeNormal(short normal) const
 {
 	// decode X as cos( lat ) * sin( long )
@@ -982,6 +1055,14 @@ vec3 Model_md3::decodeNormal(short normal) const
 	return result;
 }
 
+const Vertex *Model_md3::getUndeformedVertices(const Surface &surface, int frameIndex) const
+{
+	if (surface.isAutoSprite)
+		return &surface.undeformedVertices[frameIndex * surface.nVertices];
+
+	return &frames_[frameIndex].vertices[surface.startVertex];
+}
+
 int Model_md3::getTag(const char *name, int frame, int startIndex, Transform *transform) const
 {
 	assert(transform);
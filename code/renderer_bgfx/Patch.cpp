@@ -397,6 +397,375 @@ Patch *R_CreateSurfaceGridMesh(int width, int height,
 	return grid;
 }
 
+/*
+=================
+Patch_InsertColumn
+
+Returns nullptr if the grid can't get any wider.
+=================
+*/
+static Patch *Patch_InsertColumn( Patch *grid, int column, int row, const vec3 &point, float loderror ) {
+	int i, j;
+	int width, height, oldwidth;
+	Vertex ctrl[MAX_GRID_SIZE][MAX_GRID_SIZE];
+	float errorTable[2][MAX_GRID_SIZE];
+	static uint16_t indexes[(MAX_GRID_SIZE-1)*(MAX_GRID_SIZE-1)*2*3];
+
+	oldwidth = 0;
+	width = grid->width + 1;
+	if (width > MAX_GRID_SIZE)
+		return nullptr;
+	height = grid->height;
+	for (i = 0; i < width; i++) {
+		if (i == column) {
+			//insert new column
+			for (j = 0; j < grid->height; j++) {
+				LerpDrawVert( &grid->verts[j * grid->width + i-1], &grid->verts[j * grid->width + i], &ctrl[j][i] );
+				if (j == row)
+					ctrl[j][i].pos = point;
+			}
+			errorTable[0][i] = loderror;
+			continue;
+		}
+		errorTable[0][i] = grid->widthLodError[oldwidth];
+		for (j = 0; j < grid->height; j++) {
+			ctrl[j][i] = grid->verts[j * grid->width + oldwidth];
+		}
+		oldwidth++;
+	}
+	for (j = 0; j < grid->height; j++) {
+		errorTable[1][j] = grid->heightLodError[j];
+	}
+	// calculate indexes and normals
+	const int numIndexes = MakeMeshIndexes( width, height, ctrl, indexes );
+	MakeMeshNormals( width, height, ctrl );
+
+	const vec3 lodOrigin = grid->lodOrigin;
+	const float lodRadius = grid->lodRadius;
+	// free the old grid
+	Patch_Free(grid);
+	// create a new grid
+	grid = R_CreateSurfaceGridMesh( width, height, ctrl, errorTable, numIndexes, indexes );
+	grid->lodRadius = lodRadius;
+	grid->lodOrigin = lodOrigin;
+	return grid;
+}
+
+/*
+=================
+Patch_InsertRow
+
+Returns nullptr if the grid can't get any taller.
+=================
+*/
+static Patch *Patch_InsertRow( Patch *grid, int row, int column, const vec3 &point, float loderror ) {
+	int i, j;
+	int width, height, oldheight;
+	Vertex ctrl[MAX_GRID_SIZE][MAX_GRID_SIZE];
+	float errorTable[2][MAX_GRID_SIZE];
+	static uint16_t indexes[(MAX_GRID_SIZE-1)*(MAX_GRID_SIZE-1)*2*3];
+
+	oldheight = 0;
+	width = grid->width;
+	height = grid->height + 1;
+	if (height > MAX_GRID_SIZE)
+		return nullptr;
+	for (i = 0; i < height; i++) {
+		if (i == row) {
+			//insert new row
+			for (j = 0; j < grid->width; j++) {
+				LerpDrawVert( &grid->verts[(i-1) * grid->width + j], &grid->verts[i * grid->width + j], &ctrl[i][j] );
+				if (j == column)
+					ctrl[i][j].pos = point;
+			}
+			errorTable[1][i] = loderror;
+			continue;
+		}
+		errorTable[1][i] = grid->heightLodError[oldheight];
+		for (j = 0; j < grid->width; j++) {
+			ctrl[i][j] = grid->verts[oldheight * grid->width + j];
+		}
+		oldheight++;
+	}
+	for (j = 0; j < grid->width; j++) {
+		errorTable[0][j] = grid->widthLodError[j];
+	}
+	// calculate indexes and normals
+	const int numIndexes = MakeMeshIndexes( width, height, ctrl, indexes );
+	MakeMeshNormals( width, height, ctrl );
+
+	const vec3 lodOrigin = grid->lodOrigin;
+	const float lodRadius = grid->lodRadius;
+	// free the old grid
+	Patch_Free(grid);
+	// create a new grid
+	grid = R_CreateSurfaceGridMesh( width, height, ctrl, errorTable, numIndexes, indexes );
+	grid->lodRadius = lodRadius;
+	grid->lodOrigin = lodOrigin;
+	return grid;
+}
+
+/*
+=================
+Patch edges
+
+The four outer rows and columns of a grid. Width edges run along the
+first and last rows and use widthLodError, height edges run along the
+first and last columns and use heightLodError.
+=================
+*/
+struct PatchEdge
+{
+	int first;
+	int stride;
+	int count;
+	bool isWidth;
+};
+
+static void GetPatchEdges( const Patch *grid, PatchEdge edges[4] ) {
+	edges[0] = { 0, 1, grid->width, true };
+	edges[1] = { (grid->height-1) * grid->width, 1, grid->width, true };
+	edges[2] = { 0, grid->width, grid->height, false };
+	edges[3] = { grid->width-1, grid->width, grid->height, false };
+}
+
+static const vec3 &PatchEdgePoint( const Patch *grid, const PatchEdge &edge, int i ) {
+	return grid->verts[edge.first + edge.stride * i].pos;
+}
+
+static float *PatchEdgeLodError( const Patch *grid, const PatchEdge &edge ) {
+	return edge.isWidth ? grid->widthLodError : grid->heightLodError;
+}
+
+static bool PatchPointsEqual( const vec3 &v1, const vec3 &v2, float epsilon ) {
+	return fabs(v1[0] - v2[0]) <= epsilon && fabs(v1[1] - v2[1]) <= epsilon && fabs(v1[2] - v2[2]) <= epsilon;
+}
+
+/*
+=================
+PatchEdgeHasMergedPoints
+
+True if two inner points of the edge are in the same place, e.g. a grid that folds back on itself.
+=================
+*/
+static bool PatchEdgeHasMergedPoints( const Patch *grid, const PatchEdge &edge ) {
+	for (int i = 1; i < edge.count-1; i++) {
+		for (int j = i + 1; j < edge.count-1; j++) {
+			if (PatchPointsEqual(PatchEdgePoint(grid, edge, i), PatchEdgePoint(grid, edge, j), 0.1f))
+				return true;
+		}
+	}
+	return false;
+}
+
+// grids in the same LOD group should have the exact same lod origin and radius
+static bool PatchesInSameLodGroup( const Patch *grid1, const Patch *grid2 ) {
+	return grid1->lodRadius == grid2->lodRadius && grid1->lodOrigin == grid2->lodOrigin;
+}
+
+/*
+=================
+Patch_FixSharedVertexLodError_r
+
+Points shared by the edges of two grids in the same LOD group get the same
+LOD error, so both grids drop them at the same distance.
+=================
+*/
+static void Patch_FixSharedVertexLodError_r( Patch **grids, int numGrids, int start, Patch *grid1 ) {
+	PatchEdge edges1[4], edges2[4];
+	GetPatchEdges(grid1, edges1);
+
+	for (int j = start; j < numGrids; j++) {
+		Patch *grid2 = grids[j];
+		// if the LOD errors are already fixed for this patch
+		if (grid2->lodFixed == 2)
+			continue;
+		if (!PatchesInSameLodGroup(grid1, grid2))
+			continue;
+		GetPatchEdges(grid2, edges2);
+		bool touch = false;
+		for (const PatchEdge &e1 : edges1) {
+			if (PatchEdgeHasMergedPoints(grid1, e1))
+				continue;
+			const float *error1 = PatchEdgeLodError(grid1, e1);
+			for (int k = 1; k < e1.count-1; k++) {
+				for (const PatchEdge &e2 : edges2) {
+					if (PatchEdgeHasMergedPoints(grid2, e2))
+						continue;
+					float *error2 = PatchEdgeLodError(grid2, e2);
+					for (int l = 1; l < e2.count-1; l++) {
+						if (!PatchPointsEqual(PatchEdgePoint(grid1, e1, k), PatchEdgePoint(grid2, e2, l), 0.1f))
+							continue;
+						// ok the points are equal and should have the same lod error
+						error2[l] = error1[k];
+						touch = true;
+					}
+				}
+			}
+		}
+		if (touch) {
+			grid2->lodFixed = 2;
+			Patch_FixSharedVertexLodError_r(grids, numGrids, start, grid2);
+		}
+	}
+}
+
+/*
+=================
+Patch_FixSharedVertexLodError
+=================
+*/
+void Patch_FixSharedVertexLodError( Patch **grids, int numGrids ) {
+	for (int i = 0; i < numGrids; i++) {
+		Patch *grid1 = grids[i];
+		if (grid1->lodFixed)
+			continue;
+		grid1->lodFixed = 2;
+		// recursively visit all the grids
+		Patch_FixSharedVertexLodError_r(grids, numGrids, i + 1, grid1);
+	}
+}
+
+/*
+=================
+Patch_StitchPatches
+
+Look for a point on an edge of grid1 that splits an edge segment of grid2
+in two, and insert a column or row into grid2 so the two edges have the
+same points at the highest LOD. Returns the new grid2 if one was inserted,
+otherwise nullptr.
+=================
+*/
+static Patch *Patch_StitchPatches( Patch *grid1, Patch *grid2 ) {
+	PatchEdge edges1[4], edges2[4];
+	GetPatchEdges(grid1, edges1);
+	GetPatchEdges(grid2, edges2);
+
+	for (const PatchEdge &e1 : edges1) {
+		if (PatchEdgeHasMergedPoints(grid1, e1))
+			continue;
+		const float *error1 = PatchEdgeLodError(grid1, e1);
+		// walk the edge in both directions, two segments at a time
+		for (int dir = 0; dir < 2; dir++) {
+			for (int k = 0; k < e1.count-2; k += 2) {
+				const int k0 = dir ? e1.count-1-k : k;
+				const int k1 = dir ? k0-1 : k0+1;
+				const int k2 = dir ? k0-2 : k0+2;
+				for (const PatchEdge &e2 : edges2) {
+					if ((e2.isWidth ? grid2->width : grid2->height) >= MAX_GRID_SIZE)
+						continue;
+					for (int l = 0; l < e2.count-1; l++) {
+						if (!PatchPointsEqual(PatchEdgePoint(grid1, e1, k0), PatchEdgePoint(grid2, e2, l), 0.1f))
+							continue;
+						if (!PatchPointsEqual(PatchEdgePoint(grid1, e1, k2), PatchEdgePoint(grid2, e2, l + 1), 0.1f))
+							continue;
+						// degenerate segment
+						if (PatchPointsEqual(PatchEdgePoint(grid2, e2, l), PatchEdgePoint(grid2, e2, l + 1), 0.01f))
+							continue;
+						Patch *newGrid;
+						if (e2.isWidth) {
+							// insert column into grid2 right after after column l
+							newGrid = Patch_InsertColumn(grid2, l+1, e2.first ? grid2->height-1 : 0, PatchEdgePoint(grid1, e1, k1), error1[k1]);
+						} else {
+							// insert row into grid2 right after after row l
+							newGrid = Patch_InsertRow(grid2, l+1, e2.first ? grid2->width-1 : 0, PatchEdgePoint(grid1, e1, k1), error1[k1]);
+						}
+						if (newGrid)
+							newGrid->lodStitched = 0;
+						return newGrid;
+					}
+				}
+			}
+		}
+	}
+	return nullptr;
+}
+
+/*
+=================
+Patch_StitchAll
+
+Grids in the same LOD group that share an edge can be subdivided differently,
+which leaves cracks between them even at the highest LOD. Returns the number
+of cracks that were stitched.
+=================
+*/
+int Patch_StitchAll( Patch **grids, int numGrids ) {
+	int numstitches = 0;
+	bool stitched;
+
+	do
+	{
+		stitched = false;
+		for (int i = 0; i < numGrids; i++) {
+			if (grids[i]->lodStitched)
+				continue;
+			grids[i]->lodStitched = 1;
+			stitched = true;
+			for (int j = 0; j < numGrids; j++) {
+				if (!PatchesInSameLodGroup(grids[i], grids[j]))
+					continue;
+				while (Patch *newGrid = Patch_StitchPatches(grids[i], grids[j])) {
+					grids[j] = newGrid;
+					numstitches++;
+				}
+			}
+		}
+	}
+	while (stitched);
+
+	return numstitches;
+}
+
+/*
+=================
+Patch_CreateLodIndexes
+
+Triangulate the grid using only the rows and columns with a LOD error no
+larger than lodError. The first and last row and column are always used.
+Returns the number of indexes written.
+=================
+*/
+int Patch_CreateLodIndexes( const Patch *grid, float lodError, uint16_t *indexes ) {
+	int widthTable[MAX_GRID_SIZE], heightTable[MAX_GRID_SIZE];
+	int lodWidth = 0, lodHeight = 0;
+
+	widthTable[lodWidth++] = 0;
+	for (int i = 1; i < grid->width-1; i++) {
+		if (grid->widthLodError[i] <= lodError)
+			widthTable[lodWidth++] = i;
+	}
+	widthTable[lodWidth++] = grid->width-1;
+
+	heightTable[lodHeight++] = 0;
+	for (int i = 1; i < grid->height-1; i++) {
+		if (grid->heightLodError[i] <= lodError)
+			heightTable[lodHeight++] = i;
+	}
+	heightTable[lodHeight++] = grid->height-1;
+
+	// same winding as MakeMeshIndexes
+	int numIndexes = 0;
+	for (int i = 0; i < lodHeight-1; i++) {
+		for (int j = 0; j < lodWidth-1; j++) {
+			const int v1 = heightTable[i] * grid->width + widthTable[j+1];
+			const int v2 = heightTable[i] * grid->width + widthTable[j];
+			const int v3 = heightTable[i+1] * grid->width + widthTable[j];
+			const int v4 = heightTable[i+1] * grid->width + widthTable[j+1];
+
+			indexes[numIndexes++] = v2;
+			indexes[numIndexes++] = v3;
+			indexes[numIndexes++] = v1;
+
+			indexes[numIndexes++] = v1;
+			indexes[numIndexes++] = v3;
+			indexes[numIndexes++] = v4;
+		}
+	}
+
+	return numIndexes;
+}
+
 /*
 =================
 Patch_Free
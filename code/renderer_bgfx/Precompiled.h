@@ -50,8 +50,10 @@ If you have questions concerning this license or the applicable additional terms
 
 #include <algorithm>
 #include <cmath>
+#include <functional>
 #include <map>
 #include <memory>
+#include <string>
 #include <vector>
 #include "float.h"
 
@@ -83,6 +85,7 @@ extern "C"
 #include "bgfx/platform.h"
 #include "bx/debug.h"
 #include "bx/math.h"
+#include "bx/pixelformat.h"
 #include "bx/string.h"
 #include "bx/timer.h"
 
@@ -117,14 +120,22 @@ struct ConsoleVariables
 {
 	void initialize();
 
+	ConsoleVariable aviMotionJpegQuality;
 	ConsoleVariable backend;
+	ConsoleVariable bakeAreaLightCutoff;
 	ConsoleVariable bgfx_stats;
 	ConsoleVariable bloomScale;
+	ConsoleVariable bloomTimings;
 	ConsoleVariable debug;
 	ConsoleVariable debugDraw;
 	ConsoleVariable debugDrawSize;
 	ConsoleVariable dynamicLightIntensity;
 	ConsoleVariable dynamicLightScale;
+	ConsoleVariable dynamicResolutionFps;
+	ConsoleVariable dynamicResolutionMinScale;
+	ConsoleVariable frameStats;
+	ConsoleVariable hdrLightmaps;
+	ConsoleVariable lodCurveError;
 	ConsoleVariable picmip;
 	ConsoleVariable railWidth;
 	ConsoleVariable railCoreWidth;
@@ -211,6 +222,10 @@ struct DrawCall
 	float softSpriteDepth = 0;
 	uint8_t sort = 0;
 	uint64_t state = BGFX_STATE_WRITE_RGB | BGFX_STATE_WRITE_A;
+
+	/// @brief World surfaces merged into a texture array. The diffuse layer is stored in Vertex::textureLayer.
+	bgfx::TextureHandle textureArray = BGFX_INVALID_HANDLE;
+
 	VertexBuffer vb;
 	float zOffset = 0.0f;
 	float zScale = 0.0f;
@@ -421,7 +436,9 @@ struct IndexBuffer
 #if defined(USE_LIGHT_BAKER)
 namespace light_baker
 {
-	void Start(int nSamples);
+	bool IsRunning();
+	void Start(int nSamples, bool cpuIndirect);
+	bool Succeeded(); // The last bake finished, rather than failing or being cancelled.
 	void Stop();
 	void Update(uint32_t frameNo);
 	void Shutdown();
@@ -435,6 +452,7 @@ namespace main
 	void AddPolyToScene(qhandle_t hShader, int nVerts, const polyVert_t *verts, int nPolys);
 	bool AreWaterReflectionsEnabled();
 	bool AreExtraDynamicLightsEnabled();
+	bool AreWorldTextureArraysEnabled();
 	float CalculateNoise(float x, float y, float z, float t);
 	void DebugPrint(const char *format, ...);
 	void DrawAxis(vec3 position);
@@ -446,7 +464,7 @@ namespace main
 	const Entity *GetCurrentEntity();
 	float GetFloatTime();
 	Transform GetMainCameraTransform();
-	void Initialize();
+	void Initialize(bool headless = false);
 	bool IsCameraMirrored();
 	bool IsLerpTextureAnimationEnabled();
 	bool IsMaxAnisotropyEnabled();
@@ -459,6 +477,7 @@ namespace main
 	const SunLight &GetSunLight();
 	void SetSunLight(const SunLight &sunLight); 
 	void Shutdown(bool destroyWindow);
+	void TakeVideoFrame(bool motionJpeg);
 	void UploadCinematic(int w, int h, int cols, int rows, const uint8_t *data, int client, bool dirty);
 }
 
@@ -525,8 +544,8 @@ enum class MaterialDeform
 	Bulge = DGEN_BULGE,
 	Move  = DGEN_MOVE,
 	Wave  = DGEN_WAVE,
-	Autosprite,
-	Autosprite2,
+	Autosprite = DGEN_AUTOSPRITE,
+	Autosprite2 = DGEN_AUTOSPRITE2,
 	Normals,
 	ProjectionShadow,
 	Text0,
@@ -778,16 +797,6 @@ struct MaterialTextureBundleIndex
 	};
 };
 
-struct MaterialStageSetUniformsFlags
-{
-	enum
-	{
-		ColorGen = 1<<0,
-		TexGen   = 1<<1,
-		All      = (1<<2) - 1
-	};
-};
-
 struct MaterialStage
 {
 	bool active = false;
@@ -830,7 +839,8 @@ struct MaterialStage
 
 	vec4 getFogColorMask() const;
 	uint64_t getState() const;
-	void setShaderUniforms(Uniforms_MaterialStage *uniforms, int flags = MaterialStageSetUniformsFlags::All) const;
+	/// @brief Pack this stage's state into Uniforms_MaterialStage::params and set it.
+	void setShaderUniforms(Uniforms_MaterialStage *uniforms) const;
 	void setTextureSamplers(Uniforms_MaterialStage *uniforms) const;
 
 private:
@@ -856,6 +866,36 @@ private:
 	void calculateColors(vec4 *baseColor, vec4 *vertColor) const;
 
 	/// @}
+
+	/// @name Evaluated uniforms
+	/// @{
+
+	/// Packed stage uniforms. The dynamic values are derived from the material time and, for entity rgbGen/alphaGen/tcMod, the current entity.
+	struct EvaluatedUniforms
+	{
+		bool valid = false;
+
+		/// @name Key
+		/// @{
+		float time;
+		bool hasEntity;
+		vec4 entityColor;
+		vec2 entityTexCoord;
+		/// @}
+
+		/// Indexed by STAGE_*, ready to be uploaded to Uniforms_MaterialStage::params.
+		vec4 params[STAGE_NUM_PARAMS];
+	};
+
+	/// Memoized by evaluateUniforms. A material is usually drawn many times with the same time, so most draw calls hit.
+	mutable EvaluatedUniforms evaluated_;
+
+	bool dependsOnEntity() const;
+
+	/// @brief Return the evaluated uniform values for the current material time and entity, recalculating them only if the key has changed.
+	const EvaluatedUniforms &evaluateUniforms() const;
+
+	/// @}
 };
 
 class Material
@@ -966,10 +1006,19 @@ public:
 	float setTime(float time);
 
 	bool hasAutoSpriteDeform() const;
-	void doAutoSpriteDeform(const mat3 &sceneRotation, Vertex *vertices, uint32_t nVertices, uint16_t *indices, uint32_t nIndices, float *softSpriteDepth) const;
-	void setDeformUniforms(Uniforms_Material *uniforms) const;
+
+	/// Rewrite autosprite quad indices so the quads the vertex shader rebuilds are wound consistently.
+	void setAutoSpriteIndices(uint16_t *indices, uint32_t nIndices) const;
+
+	/// Replace autosprite quad vertex positions and normals with the data the vertex shader needs to rebuild the quads facing the camera.
+	/// @remarks Indices should have been passed through setAutoSpriteIndices first.
+	void setAutoSpriteVertices(Vertex *vertices, const uint16_t *indices, uint32_t nIndices, float *softSpriteDepth) const;
+
+	void setDeformUniforms(Uniforms_Material *uniforms, const mat3 &sceneRotation) const;
 
 private:
+	MaterialDeform getAutoSpriteDeform() const;
+
 	float time_;
 
 	/// @}
@@ -1124,6 +1173,9 @@ struct Patch
 
 Patch *Patch_Subdivide(int width, int height, const Vertex *points);
 void Patch_Free(Patch *grid);
+void Patch_FixSharedVertexLodError(Patch **grids, int numGrids);
+int Patch_StitchAll(Patch **grids, int numGrids);
+int Patch_CreateLodIndexes(const Patch *grid, float lodError, uint16_t *indexes);
 
 #ifdef USE_PROFILER
 namespace profiler
@@ -1312,6 +1364,11 @@ class Texture
 public:
 	void resize(int width, int height);
 	void update(const bgfx::Memory *mem, int x, int y, int width, int height);
+
+	/// @brief Update a texture that gets a new image most frames, e.g. a cinematic. Resized to match if necessary.
+	/// @remarks Alternates between two textures so a frame never updates the one the previous frame sampled. The data is copied into a ring of persistent buffers that bgfx references, instead of a new allocation every frame.
+	void updateStreaming(const uint8_t *data, int width, int height, uint32_t frameNo);
+
 	int getFlags() const { return flags_; }
 	bgfx::TextureHandle getHandle() const { return handle_; }
 	const char *getName() const { return name_; }
@@ -1331,6 +1388,12 @@ private:
 	bgfx::TextureHandle handle_;
 	Texture *next_;
 
+	/// @name Streaming
+	/// @{
+	bgfx::TextureHandle streamingBackHandle_ = BGFX_INVALID_HANDLE;
+	std::vector<uint8_t> streamingBuffers_[BGFX_NUM_BUFFER_FRAMES];
+	/// @}
+
 	friend class TextureCache;
 };
 
@@ -1425,10 +1488,9 @@ struct Uniform_vec4
 
 struct Uniforms
 {
-	/// @remarks Only x used.
-	Uniform_vec4 depthRangeEnabled = "u_DepthRangeEnabled";
-	/// @remarks x is offset, y is scale, z is near z, w is far z.
-	Uniform_vec4 depthRange = "u_DepthRange";
+	/// @brief Per-draw state packed into one array.
+	/// @remarks Indexed by DRAW_*. See SharedDefines.sh for the layout.
+	Uniform_vec4 drawParams = { "u_DrawParams", DRAW_NUM_PARAMS };
 
 	/// @remarks Only x used.
 	Uniform_vec4 renderMode = "u_RenderMode";
@@ -1481,11 +1543,6 @@ struct Uniforms
 
 	/// @name Fog
 	/// @{
-
-	/// @brief Enable fog in the generic shader.
-	/// @remarks Only x used.
-	Uniform_vec4 fogEnabled = "u_FogEnabled";
-
 	Uniform_vec4 fogDistance = "u_FogDistance";
 	Uniform_vec4 fogDepth = "u_FogDepth";
 
@@ -1495,10 +1552,25 @@ struct Uniforms
 
 	/// @name Bloom
 	/// @{
-	Uniform_vec4 guassianBlurDirection = "u_GuassianBlurDirection";
 
-	/// @remarks w not used.
-	Uniform_vec4 bloom_Enabled_Write_Scale = "u_Bloom_Enabled_Write_Scale";
+	/// @remarks xy is the sample offset in UV units, zw the output size.
+	Uniform_vec4 bloomFilter = "u_BloomFilter";
+
+	/// @remarks Only x used.
+	Uniform_vec4 bloomScale = "u_BloomScale";
+	/// @}
+
+	/// @name TAA
+	/// @{
+
+	/// @brief The main camera's view projection matrix without jitter.
+	Uniform_mat4 taaViewProj = "u_TaaViewProj";
+
+	/// @brief Last frame's view projection matrix, without jitter, multiplied by last frame's model matrix.
+	Uniform_mat4 taaPreviousModelViewProj = "u_TaaPreviousModelViewProj";
+
+	/// @remarks x is the history weight, y converts velocity y to texture coordinates, z is 1 if the history is valid.
+	Uniform_vec4 taaParams = "u_TaaParams";
 	/// @}
 
 	/// @name Sun light
@@ -1523,6 +1595,8 @@ struct Uniforms
 	Uniform_sampler smaaAreaSampler = "u_SmaaAreaSampler";
 	Uniform_sampler smaaSearchSampler = "u_SmaaSearchSampler";
 	Uniform_sampler smaaBlendSampler = "u_SmaaBlendSampler";
+	Uniform_sampler taaHistorySampler = "u_TaaHistorySampler";
+	Uniform_sampler taaVelocitySampler = "u_TaaVelocitySampler";
 	/// @}
 };
 
@@ -1552,18 +1626,19 @@ struct Uniforms_Material
 	Uniform_vec4 deform_Gen_Wave_Base_Amplitude = { "u_Deform_Gen_Wave_Base_Amplitude", Material::maxDeforms };
 	Uniform_vec4 deform_Frequency_Phase_Spread = { "u_Deform_Frequency_Phase_Spread", Material::maxDeforms };
 
+	/// @brief Forward, left and up scene axes in entity space. Used to rebuild autosprite quads.
+	/// @remarks Only xyz used.
+	Uniform_vec4 autoSpriteAxes = { "u_AutoSpriteAxes", 3 };
+
 	/// @}
 };
 
 /// @brief Uniforms derived from material stage state.
 struct Uniforms_MaterialStage
 {
-	/// @remarks Only x used.
-	Uniform_vec4 alphaTest = "u_AlphaTest";
-
-	Uniform_vec4 animation_Enabled_Fraction = "u_Animation_Enabled_Fraction";
-
-	Uniform_vec4 fogColorMask = "u_FogColorMask";
+	/// @brief Stage state packed into one array: generators, colors, tcmod, tcgen, alpha test, portal range, fog color mask and texture animation.
+	/// @remarks Indexed by STAGE_*. See SharedDefines.sh for the layout.
+	Uniform_vec4 params = { "u_StageParams", STAGE_NUM_PARAMS };
 
 	/// @name Texture samplers
 	/// @{
@@ -1576,41 +1651,8 @@ struct Uniforms_MaterialStage
 	Uniform_sampler lightSampler = "u_LightSampler";
 	/// @}
 
+	/// @brief Used by the Fog and TextureColor shaders.
 	Uniform_vec4 color = "u_Color";
-	Uniform_vec4 baseColor = "u_BaseColor";
-	Uniform_vec4 vertexColor = "u_VertColor";
-	Uniform_vec4 normalScale = "u_NormalScale";
-	Uniform_vec4 specularScale = "u_SpecularScale";
-	Uniform_vec4 enableTextures = "u_EnableTextures";
-
-	/// @remarks x is the light type (MaterialLight).
-	Uniform_vec4 lightType = "u_LightType";
-
-	struct Generators
-	{
-		enum { Alpha = GEN_ALPHA, Color = GEN_COLOR, TexCoord = GEN_TEXCOORD };
-	};
-
-	Uniform_vec4 generators = "u_Generators";
-
-	/// @name tcmod
-	/// @{
-	Uniform_vec4 diffuseTextureMatrix = "u_DiffuseTexMatrix";
-	Uniform_vec4 diffuseTextureOffsetTurbulent = "u_DiffuseTexOffTurb";
-	/// @}
-
-	/// @name tcgen
-	/// @{
-	Uniform_vec4 tcGenVector0 = "u_TCGen0Vector0";
-	Uniform_vec4 tcGenVector1 = "u_TCGen0Vector1";
-	/// @}
-
-	/// @name rgbagen
-	/// @{
-
-	/// @remarks Only x used.
-	Uniform_vec4 portalRange = "u_PortalRange";
-	/// @}
 };
 
 namespace util
@@ -1683,12 +1725,17 @@ namespace util
 	vec3 ToLinear(vec3 color);
 	vec4 ToLinear(vec4 color);
 	vec4b EncodeRGBM(vec3 color);
+	uint32_t EncodeRGB9E5(vec3 color);
+	vec3 DecodeRGB9E5(uint32_t rgb9e5);
 }
 
 struct Vertex
 {
 	vec3 pos;
-	uint32_t padding;
+
+	/// @remarks Diffuse texture array layer. Only written for world surfaces merged into a texture array.
+	float textureLayer;
+
 	vec3 normal;
 	vec4b color; // Linear space.
 	vec4 texCoord;
@@ -1713,10 +1760,12 @@ struct Vertex
 		decl.add(bgfx::Attrib::Normal, 3, bgfx::AttribType::Float);
 		decl.add(bgfx::Attrib::Color0, 4, bgfx::AttribType::Uint8, true);
 		decl.add(bgfx::Attrib::TexCoord0, 4, bgfx::AttribType::Float);
+		decl.add(bgfx::Attrib::TexCoord1, 1, bgfx::AttribType::Float);
 		decl.m_stride = sizeof(Vertex);
 		decl.m_offset[bgfx::Attrib::Position] = offsetof(Vertex, pos);
 		decl.m_offset[bgfx::Attrib::Normal] = offsetof(Vertex, normal);
 		decl.m_offset[bgfx::Attrib::TexCoord0] = offsetof(Vertex, texCoord);
+		decl.m_offset[bgfx::Attrib::TexCoord1] = offsetof(Vertex, textureLayer);
 		decl.m_offset[bgfx::Attrib::Color0] = offsetof(Vertex, color);
 		decl.end();
 	}
@@ -1771,9 +1820,12 @@ namespace world
 	void Unload();
 	bool IsLoaded();
 	vec2i GetLightmapSize();
+	bgfx::TextureFormat::Enum GetLightmapFormat();
+	uint32_t EncodeLightmapColor(vec3 color);
 	int GetNumLightmaps();
 	Texture *GetLightmap(int index);
 	bool GetEntityToken(char *buffer, int size);
+	void SetLightGridData(const uint8_t *data, size_t size);
 	bool HasLightGrid();
 	void SampleLightGrid(vec3 position, vec3 *ambientLight, vec3 *directedLight, vec3 *lightDir);
 	bool InPvs(vec3 position);
@@ -1791,7 +1843,7 @@ namespace world
 	void RenderPortal(VisibilityId visId, DrawCallList *drawCallList);
 	void RenderReflective(VisibilityId visId, DrawCallList *drawCallList);
 	void UpdateVisibility(VisibilityId visId, vec3 cameraPosition, const uint8_t *areaMask);
-	void Render(VisibilityId visId, DrawCallList *drawCallList, const mat3 &sceneRotation);
+	void Render(VisibilityId visId, DrawCallList *drawCallList);
 	void PickMaterial();
 }
 
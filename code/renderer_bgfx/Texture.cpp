@@ -84,6 +84,38 @@ void Texture::update(const bgfx::Memory *mem, int x, int y, int width, int heigh
 	bgfx::updateTexture2D(handle_, 0, 0, x, y, width, height, mem);
 }
 
+void Texture::updateStreaming(const uint8_t *data, int width, int height, uint32_t frameNo)
+{
+	assert(format_ == bgfx::TextureFormat::RGBA8);
+
+	if (!bgfx::isValid(streamingBackHandle_) || width != width_ || height != height_)
+	{
+		// Created without data, so both are mutable.
+		bgfx::destroy(handle_);
+
+		if (bgfx::isValid(streamingBackHandle_))
+			bgfx::destroy(streamingBackHandle_);
+
+		width_ = width;
+		height_ = height;
+		nMips_ = 1;
+		handle_ = bgfx::createTexture2D(width_, height_, false, 1, format_, calculateBgfxFlags());
+		streamingBackHandle_ = bgfx::createTexture2D(width_, height_, false, 1, format_, calculateBgfxFlags());
+
+#ifdef _DEBUG
+		bgfx::setName(handle_, name_);
+		bgfx::setName(streamingBackHandle_, name_);
+#endif
+	}
+
+	// bgfx reads the data when the frame is rendered, which can be after the caller has overwritten it.
+	std::vector<uint8_t> &buffer = streamingBuffers_[frameNo % BGFX_NUM_BUFFER_FRAMES];
+	buffer.resize(width * height * 4);
+	memcpy(buffer.data(), data, buffer.size());
+	bgfx::updateTexture2D(streamingBackHandle_, 0, 0, 0, 0, width, height, bgfx::makeRef(buffer.data(), (uint32_t)buffer.size()));
+	std::swap(handle_, streamingBackHandle_);
+}
+
 uint32_t Texture::calculateBgfxFlags() const
 {
 	uint32_t bgfxFlags = BGFX_TEXTURE_NONE;
@@ -153,6 +185,9 @@ TextureCache::~TextureCache()
 	for (size_t i = 0; i < nTextures_; i++)
 	{
 		bgfx::destroy(textures_[i].handle_);
+
+		if (bgfx::isValid(textures_[i].streamingBackHandle_))
+			bgfx::destroy(textures_[i].streamingBackHandle_);
 	}
 }
 
@@ -656,5 +656,19 @@ vec4b EncodeRGBM(vec3 color)
 	return vec4b(result);
 }
 
+uint32_t EncodeRGB9E5(vec3 color)
+{
+	uint32_t result;
+	bx::packRgb9E5F(&result, &color.x);
+	return result;
+}
+
+vec3 DecodeRGB9E5(uint32_t rgb9e5)
+{
+	vec3 result;
+	bx::unpackRgb9E5F(&result.x, &rgb9e5);
+	return result;
+}
+
 } // namespace util
 } // namespace renderer
@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include "Precompiled.h"
 #pragma hdrstop
 #include "World.h"
+#include "bx/hash.h"
 
 namespace renderer {
 namespace world {
@@ -29,6 +30,14 @@ namespace world {
 std::unique_ptr<World> s_world;
 static const int MAX_VERTS_ON_POLY = 64;
 
+/// Patches closer than this to the camera always use full detail. Each level of detail after that starts at twice the distance of the previous one.
+static const float s_patchLodBaseDistance = 256.0f;
+
+static const int s_nPatchLodLevels = 5;
+
+/// The default r_lodCurveError. Patch LOD index data is created for this value, other values scale the camera distance instead.
+static const float s_defaultLodCurveError = 250.0f;
+
 static vec2 AtlasTexCoord(vec2 uv, int index, vec2i lightmapAtlasSize)
 {
 	const int tileX = index % lightmapAtlasSize.x;
@@ -39,22 +48,40 @@ static vec2 AtlasTexCoord(vec2 uv, int index, vec2i lightmapAtlasSize)
 	return result;
 }
 
+/// Surfaces merged into a texture array are batched with the texture array material instead of their own.
+static Material *GetBatchMaterial(const Surface &surface)
+{
+	if (surface.textureArrayIndex >= 0)
+		return s_world->textureArrays[surface.textureArrayIndex]->material;
+
+	return surface.material;
+}
+
 static bool SurfaceCompare(const Surface *s1, const Surface *s2)
 {
-	if (s1->material->index < s2->material->index)
+	const Material *m1 = GetBatchMaterial(*s1), *m2 = GetBatchMaterial(*s2);
+
+	if (m1->index < m2->index)
 	{
 		return true;
 	}
-	else if (s1->material->index == s2->material->index)
+	else if (m1->index == m2->index)
 	{
-		if (s1->fogIndex < s2->fogIndex)
+		if (s1->textureArrayIndex < s2->textureArrayIndex)
 		{
 			return true;
 		}
-		else if (s1->fogIndex == s2->fogIndex)
+		else if (s1->textureArrayIndex == s2->textureArrayIndex)
 		{
-			if (s1->bufferIndex < s2->bufferIndex)
+			if (s1->fogIndex < s2->fogIndex)
+			{
 				return true;
+			}
+			else if (s1->fogIndex == s2->fogIndex)
+			{
+				if (s1->bufferIndex < s2->bufferIndex)
+					return true;
+			}
 		}
 	}
 
@@ -136,6 +163,12 @@ public:
 			dc.fogIndex = surface.fogIndex;
 			dc.material = surface.material;
 			dc.modelMatrix = modelMatrix;
+
+			if (surface.textureArrayIndex >= 0)
+			{
+				dc.textureArray = s_world->textureArrays[surface.textureArrayIndex]->handle;
+			}
+
 			dc.vb.type = DrawCall::BufferType::Static;
 			dc.vb.staticHandle = s_world->vertexBuffers[surface.bufferIndex].handle;
 			dc.vb.nVertices = (uint32_t)s_world->vertices[surface.bufferIndex].size();
@@ -143,6 +176,7 @@ public:
 			dc.ib.staticHandle = indexBuffers_[surface.bufferIndex].handle;
 			dc.ib.firstIndex = surface.firstIndex;
 			dc.ib.nIndices = surface.nIndices;
+			dc.softSpriteDepth = surface.softSpriteDepth;
 			drawCallList->push_back(dc);
 		}
 	}
@@ -174,11 +208,13 @@ public:
 			const Surface *nextSurface = isLast ? nullptr : surfaces[i + 1];
 
 			// Create new batch on certain surface state changes.
-			if (!nextSurface || nextSurface->material != surface->material || nextSurface->fogIndex != surface->fogIndex || nextSurface->bufferIndex != surface->bufferIndex)
+			if (!nextSurface || GetBatchMaterial(*nextSurface) != GetBatchMaterial(*surface) || nextSurface->textureArrayIndex != surface->textureArrayIndex || nextSurface->fogIndex != surface->fogIndex || nextSurface->bufferIndex != surface->bufferIndex)
 			{
 				BatchedSurface bs;
 				bs.fogIndex = surface->fogIndex;
-				bs.material = surface->material;
+				bs.material = GetBatchMaterial(*surface);
+				bs.textureArrayIndex = surface->textureArrayIndex;
+				bs.softSpriteDepth = 0;
 
 				// Grab the indices for all surfaces in this batch.
 				bs.bufferIndex = surface->bufferIndex;
@@ -193,6 +229,7 @@ public:
 					indices.resize(indices.size() + s->indices.size());
 					memcpy(&indices[copyIndex], &s->indices[0], s->indices.size() * sizeof(uint16_t));
 					bs.nIndices += (uint32_t)s->indices.size();
+					bs.softSpriteDepth = std::max(bs.softSpriteDepth, s->softSpriteDepth);
 				}
 
 				batchedSurfaces_.push_back(bs);
@@ -221,6 +258,8 @@ private:
 		size_t bufferIndex;
 		uint32_t firstIndex;
 		uint32_t nIndices;
+		int textureArrayIndex;
+		float softSpriteDepth;
 	};
 
 	int index_;
@@ -301,12 +340,62 @@ static void ReleaseLightmapAtlasImage(void *data, void *userData)
 	free(data);
 }
 
-static void CreateBatchedSurfaces(const std::vector<Surface *> &surfaces, std::vector<BatchedSurface> *batchedSurfaces, std::vector<uint16_t> *batchedIndices, std::vector<Vertex> *cpuDeformVertices, std::vector<uint16_t> *cpuDeformIndices)
+/// Create index data for the reduced levels of detail of a patch.
+static void CreatePatchLodIndices(Surface *surface)
+{
+	assert(surface);
+	assert(surface->patch);
+	std::vector<uint16_t> indices(surface->patch->numIndexes); // Never more than full detail.
+
+	for (int i = 1; i < s_nPatchLodLevels; i++)
+	{
+		// Use the allowed error at the near end of the level's distance range.
+		const float distance = s_patchLodBaseDistance * float(1 << (i - 1));
+		const int nIndices = Patch_CreateLodIndexes(surface->patch, s_defaultLodCurveError / distance, indices.data());
+
+		// Indices are relative to the patch, make them absolute.
+		std::vector<uint16_t> lodIndices(nIndices);
+
+		for (int j = 0; j < nIndices; j++)
+		{
+			lodIndices[j] = uint16_t(surface->firstVertex + indices[j]);
+		}
+
+		surface->patchLodIndices.push_back(std::move(lodIndices));
+	}
+
+	// Drop trailing levels that don't remove any more rows or columns.
+	while (!surface->patchLodIndices.empty())
+	{
+		const size_t n = surface->patchLodIndices.size();
+		const size_t nPreviousIndices = n > 1 ? surface->patchLodIndices[n - 2].size() : surface->indices.size();
+
+		if (surface->patchLodIndices.back().size() < nPreviousIndices)
+			break;
+
+		surface->patchLodIndices.pop_back();
+	}
+}
+
+static int CalculatePatchLodLevel(const Surface &surface, vec3 position)
+{
+	if (surface.patchLodIndices.empty() || g_cvars.lodCurveError.getFloat() <= 0)
+		return 0;
+
+	// Patches in the same LOD group share the same origin and radius, so they all pick the same level and don't crack.
+	const float distance = ((surface.patch->lodOrigin - position).length() - surface.patch->lodRadius) * s_defaultLodCurveError / g_cvars.lodCurveError.getFloat();
+
+	if (distance < s_patchLodBaseDistance)
+		return 0;
+
+	const int level = 1 + (int)std::log2(distance / s_patchLodBaseDistance);
+	return std::min(level, (int)surface.patchLodIndices.size());
+}
+
+static void CreateBatchedSurfaces(const std::vector<Surface *> &surfaces, std::vector<BatchedSurface> *batchedSurfaces, std::vector<uint16_t> *batchedIndices)
 {
 	assert(batchedSurfaces);
 	assert(batchedIndices);
-	assert(cpuDeformVertices);
-	assert(cpuDeformIndices);
 
 	// Clear indices.
 	for (size_t i = 0; i < s_world->currentGeometryBuffer + 1; i++)
@@ -314,10 +403,6 @@ static void CreateBatchedSurfaces(const std::vector<Surface *> &surfaces, std::v
 		batchedIndices[i].clear();
 	}
 
-	// Clear CPU deform geometry.
-	cpuDeformIndices->clear();
-	cpuDeformVertices->clear();
-
 	// Create batched surfaces.
 	batchedSurfaces->clear();
 	size_t firstSurface = 0;
@@ -329,7 +414,7 @@ static void CreateBatchedSurfaces(const std::vector<Surface *> &surfaces, std::v
 		Surface *nextSurface = isLast ? nullptr : surfaces[i + 1];
 
 		// Create new batch on certain surface state changes.
-		if (!nextSurface || nextSurface->material != surface->material || nextSurface->fogIndex != surface->fogIndex || nextSurface->bufferIndex != surface->bufferIndex)
+		if (!nextSurface || GetBatchMaterial(*nextSurface) != GetBatchMaterial(*surface) || nextSurface->textureArrayIndex != surface->textureArrayIndex || nextSurface->fogIndex != surface->fogIndex || nextSurface->bufferIndex != surface->bufferIndex)
 		{
 			if (IgnoreSurface(*surface))
 			{
@@ -341,8 +426,9 @@ static void CreateBatchedSurfaces(const std::vector<Surface *> &surfaces, std::v
 			BatchedSurface bs;
 			bs.contentFlags = surface->contentFlags;
 			bs.fogIndex = surface->fogIndex;
-			bs.material = surface->material;
+			bs.material = GetBatchMaterial(*surface);
 			bs.surfaceFlags = surface->flags;
+			bs.textureArrayIndex = surface->textureArrayIndex;
 
 			// Merge all the surface bounds in the batch.
 			bs.bounds.setupForAddingPoints();
@@ -352,55 +438,22 @@ static void CreateBatchedSurfaces(const std::vector<Surface *> &surfaces, std::v
 				bs.bounds.addPoints(surfaces[j]->cullinfo.bounds);
 			}
 
-			if (bs.material->hasAutoSpriteDeform())
-			{
-				// Grab the geometry for all surfaces in this batch.
-				// It will be copied into a transient buffer and then deformed every Render() call.
-				bs.firstIndex = (uint32_t)cpuDeformIndices->size();
-				bs.nIndices = 0;
-				bs.firstVertex = (uint32_t)cpuDeformVertices->size();
-				bs.nVertices = 0;
-
-				for (size_t j = firstSurface; j <= i; j++)
-				{
-					Surface *s = surfaces[j];
-
-					// Make room in destination.
-					const size_t firstDestIndex = cpuDeformIndices->size();
-					cpuDeformIndices->resize(cpuDeformIndices->size() + s->indices.size());
-					const size_t firstDestVertex = cpuDeformVertices->size();
-					cpuDeformVertices->resize(cpuDeformVertices->size() + s->nVertices);
-
-					// Append geometry.
-					memcpy(&(*cpuDeformVertices)[firstDestVertex], &s_world->vertices[surface->bufferIndex][s->firstVertex], sizeof(Vertex) * s->nVertices);
-
-					for (size_t k = 0; k < s->indices.size(); k++)
-					{
-						// Make indices relative.
-						(*cpuDeformIndices)[firstDestIndex + k] = uint16_t(s->indices[k] - s->firstVertex + bs.nVertices);
-					}
+			// Grab the indices for all surfaces in this batch.
+			// They will be used directly by a dynamic index buffer.
+			bs.bufferIndex = surface->bufferIndex;
+			std::vector<uint16_t> &indices = batchedIndices[bs.bufferIndex];
+			bs.firstIndex = (uint32_t)indices.size();
+			bs.nIndices = 0;
 
-					bs.nVertices += s->nVertices;
-					bs.nIndices += (uint32_t)s->indices.size();
-				}
-			}
-			else
+			for (size_t j = firstSurface; j <= i; j++)
 			{
-				// Grab the indices for all surfaces in this batch.
-				// They will be used directly by a dynamic index buffer.
-				bs.bufferIndex = surface->bufferIndex;
-				std::vector<uint16_t> &indices = batchedIndices[bs.bufferIndex];
-				bs.firstIndex = (uint32_t)indices.size();
-				bs.nIndices = 0;
-
-				for (size_t j = firstSurface; j <= i; j++)
-				{
-					Surface *s = surfaces[j];
-					const size_t copyIndex = indices.size();
-					indices.resize(indices.size() + s->indices.size());
-					memcpy(&indices[copyIndex], &s->indices[0], s->indices.size() * sizeof(uint16_t));
-					bs.nIndices += (uint32_t)s->indices.size();
-				}
+				Surface *s = surfaces[j];
+				const std::vector<uint16_t> &surfaceIndices = s->patchLodLevel > 0 ? s->patchLodIndices[s->patchLodLevel - 1] : s->indices;
+				const size_t copyIndex = indices.size();
+				indices.resize(indices.size() + surfaceIndices.size());
+				memcpy(&indices[copyIndex], &surfaceIndices[0], surfaceIndices.size() * sizeof(uint16_t));
+				bs.nIndices += (uint32_t)surfaceIndices.size();
+				bs.softSpriteDepth = std::max(bs.softSpriteDepth, s->softSpriteDepth);
 			}
 
 			batchedSurfaces->push_back(bs);
@@ -438,6 +491,264 @@ static void CreateOrAppendSkySurface(std::vector<SkySurface> &skySurfaces, const
 	}
 }
 
+/// A material is simple enough to merge into a texture array if it's a single opaque lightmapped stage with a static diffuse texture and no state that varies per material at draw time.
+static bool IsTextureArrayCandidate(const Material &material)
+{
+	if (material.isSky || material.isPortal || material.reflective != MaterialReflective::None || material.polygonOffset || material.numDeforms > 0)
+		return false;
+
+	if (material.numUnfoggedPasses != 1 || material.sort != MaterialSort::Opaque || material.remappedShader)
+		return false;
+
+	const MaterialStage &stage = material.stages[0];
+
+	if (!stage.active || stage.light != MaterialLight::Map || stage.alphaTest != MaterialAlphaTest::None || stage.textureVariation)
+		return false;
+
+	if (stage.rgbGen != MaterialColorGen::Identity && stage.rgbGen != MaterialColorGen::IdentityLighting)
+		return false;
+
+	if (stage.alphaGen != MaterialAlphaGen::Identity && stage.alphaGen != MaterialAlphaGen::Skip)
+		return false;
+
+	const MaterialTextureBundle &diffuse = stage.bundles[MaterialTextureBundleIndex::DiffuseMap];
+
+	if (!diffuse.textures[0] || diffuse.numImageAnimations > 1 || diffuse.isVideoMap || diffuse.isLightmap || diffuse.numTexMods > 0)
+		return false;
+
+	if (diffuse.tcGen != MaterialTexCoordGen::None && diffuse.tcGen != MaterialTexCoordGen::Texture)
+		return false;
+
+	// Procedural textures (e.g. *white) can't be reloaded.
+	if (diffuse.textures[0]->getName()[0] == '*')
+		return false;
+
+	return stage.bundles[MaterialTextureBundleIndex::Lightmap].textures[0] != nullptr;
+}
+
+/// Materials can share a texture array if drawing one with the other's uniforms and state gives the same result.
+static bool AreTextureArrayCompatible(const Material &m1, const Material &m2)
+{
+	const MaterialStage &s1 = m1.stages[0], &s2 = m2.stages[0];
+	const Texture *t1 = s1.bundles[MaterialTextureBundleIndex::DiffuseMap].textures[0];
+	const Texture *t2 = s2.bundles[MaterialTextureBundleIndex::DiffuseMap].textures[0];
+
+	if (t1->getWidth() != t2->getWidth() || t1->getHeight() != t2->getHeight() || t1->getFlags() != t2->getFlags())
+		return false;
+
+	if (s1.bundles[MaterialTextureBundleIndex::Lightmap].textures[0] != s2.bundles[MaterialTextureBundleIndex::Lightmap].textures[0])
+		return false;
+
+	if (s1.bundles[MaterialTextureBundleIndex::DiffuseMap].tcGen != s2.bundles[MaterialTextureBundleIndex::DiffuseMap].tcGen)
+		return false;
+
+	if (s1.getState() != s2.getState() || s1.rgbGen != s2.rgbGen || s1.alphaGen != s2.alphaGen || s1.adjustColorsForFog != s2.adjustColorsForFog || s1.bloom != s2.bloom)
+		return false;
+
+	return m1.cullType == m2.cullType && m1.fogPass == m2.fogPass && m1.noFog == m2.noFog;
+}
+
+/// Merge the diffuse textures of simple world materials into texture arrays, writing the layer into the surface vertices.
+/// @remarks Must be called before the world vertex buffers are created.
+static void CreateTextureArrays()
+{
+	// Gather candidate materials used by world surfaces.
+	std::vector<Material *> candidates;
+
+	for (Surface &surface : s_world->surfaces)
+	{
+		if (!IgnoreSurface(surface) && IsTextureArrayCandidate(*surface.material))
+			candidates.push_back(surface.material);
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+	// Group compatible materials.
+	std::vector<std::vector<Material *>> groups;
+
+	for (Material *material : candidates)
+	{
+		bool grouped = false;
+
+		for (std::vector<Material *> &group : groups)
+		{
+			if (AreTextureArrayCompatible(*group[0], *material))
+			{
+				group.push_back(material);
+				grouped = true;
+				break;
+			}
+		}
+
+		if (!grouped)
+			groups.push_back({ material });
+	}
+
+	struct Assignment
+	{
+		int textureArrayIndex;
+		int layer;
+	};
+
+	std::map<const Material *, Assignment> assignments;
+	const size_t maxLayers = bgfx::getCaps()->limits.maxTextureLayers;
+	int nMergedMaterials = 0;
+
+	for (const std::vector<Material *> &group : groups)
+	{
+		for (size_t first = 0; first < group.size(); first += maxLayers)
+		{
+			const size_t nLayers = std::min(maxLayers, group.size() - first);
+
+			// Merging a single material doesn't save anything.
+			if (nLayers < 2)
+				continue;
+
+			// The texture data isn't kept after upload, so reload it.
+			const Texture *texture = group[first]->stages[0].bundles[MaterialTextureBundleIndex::DiffuseMap].textures[0];
+			int imageFlags = 0;
+
+			if (texture->getFlags() & (TextureFlags::Mipmap | TextureFlags::Picmip))
+				imageFlags |= CreateImageFlags::GenerateMipmaps;
+
+			if (texture->getFlags() & TextureFlags::Picmip)
+				imageFlags |= CreateImageFlags::Picmip;
+
+			std::vector<Image> images;
+			std::vector<Material *> layerMaterials;
+
+			for (size_t i = first; i < first + nLayers; i++)
+			{
+				const Texture *layerTexture = group[i]->stages[0].bundles[MaterialTextureBundleIndex::DiffuseMap].textures[0];
+				Image image = LoadImage(layerTexture->getName(), imageFlags);
+
+				if (!image.data)
+					continue;
+
+				if (image.width != texture->getWidth() || image.height != texture->getHeight() || (!images.empty() && image.dataSize != images[0].dataSize))
+				{
+					if (image.release)
+						image.release(image.data, nullptr);
+
+					continue;
+				}
+
+				images.push_back(image);
+				layerMaterials.push_back(group[i]);
+			}
+
+			if (images.size() >= 2)
+			{
+				// Array layout is all mips for each layer, which matches the image data layout.
+				const bgfx::Memory *mem = bgfx::alloc(uint32_t(images[0].dataSize * images.size()));
+
+				for (size_t i = 0; i < images.size(); i++)
+				{
+					memcpy(&mem->data[images[0].dataSize * i], images[i].data, images[0].dataSize);
+				}
+
+				uint64_t bgfxFlags = BGFX_TEXTURE_NONE;
+
+				if (texture->getFlags() & TextureFlags::ClampToEdge)
+					bgfxFlags |= BGFX_SAMPLER_U_CLAMP | BGFX_SAMPLER_V_CLAMP;
+
+				if (main::IsMaxAnisotropyEnabled())
+					bgfxFlags |= BGFX_SAMPLER_MIN_ANISOTROPIC | BGFX_SAMPLER_MAG_ANISOTROPIC;
+
+				auto textureArray = std::make_unique<TextureArray>();
+				textureArray->handle = bgfx::createTexture2D((uint16_t)texture->getWidth(), (uint16_t)texture->getHeight(), images[0].nMips > 1, (uint16_t)images.size(), bgfx::TextureFormat::RGBA8, bgfxFlags, mem);
+				textureArray->material = layerMaterials[0];
+
+#ifdef _DEBUG
+				bgfx::setName(textureArray->handle, util::VarArgs("*textureArray%d", (int)s_world->textureArrays.size()));
+#endif
+
+				for (size_t i = 0; i < layerMaterials.size(); i++)
+				{
+					assignments[layerMaterials[i]] = { (int)s_world->textureArrays.size(), (int)i };
+				}
+
+				s_world->textureArrays.push_back(std::move(textureArray));
+				nMergedMaterials += (int)layerMaterials.size();
+			}
+
+			for (Image &image : images)
+			{
+				if (image.release)
+					image.release(image.data, nullptr);
+			}
+		}
+	}
+
+	if (s_world->textureArrays.empty())
+		return;
+
+	// Write the layer into the vertices of surfaces using merged materials.
+	for (Surface &surface : s_world->surfaces)
+	{
+		if (IgnoreSurface(surface))
+			continue;
+
+		auto it = assignments.find(surface.material);
+
+		if (it == assignments.end())
+			continue;
+
+		surface.textureArrayIndex = it->second.textureArrayIndex;
+		Vertex *vertices = &s_world->vertices[surface.bufferIndex][surface.firstVertex];
+
+		for (uint32_t i = 0; i < surface.nVertices; i++)
+		{
+			vertices[i].textureLayer = (float)it->second.layer;
+		}
+	}
+
+	interface::Printf("Merged %d materials into %d texture array(s).\n", nMergedMaterials, (int)s_world->textureArrays.size());
+}
+
+/// @brief Open the lightmaps written by the light baker for the current map, if there are any and they match the BSP.
+/// @remarks Must be called after the lightmap atlas size is known.
+static std::unique_ptr<ReadOnlyFile> LoadBakedLightmaps()
+{
+	char filename[MAX_QPATH];
+	util::Sprintf(filename, sizeof(filename), "maps/%s.lightmaps", s_world->baseName);
+
+	if (!interface::FS_FileExists(filename))
+		return nullptr;
+
+	auto file = std::make_unique<ReadOnlyFile>(filename);
+
+	if (!file->isValid() || file->getLength() < sizeof(BakedLightmapsHeader))
+		return nullptr;
+
+	auto header = (const BakedLightmapsHeader *)file->getData();
+	const int width = s_world->lightmapAtlasSize.x * s_world->lightmapSize;
+	const int height = s_world->lightmapAtlasSize.y * s_world->lightmapSize;
+	const int nLightmaps = (int)s_world->lightmapAtlases.size();
+
+	if (LittleLong(header->ident) != BAKED_LIGHTMAPS_IDENT || LittleLong(header->version) != BAKED_LIGHTMAPS_VERSION)
+	{
+		interface::PrintWarningf("Ignoring %s: unsupported format\n", filename);
+		return nullptr;
+	}
+
+	if ((uint32_t)LittleLong(header->bspChecksum) != s_world->checksum)
+	{
+		interface::PrintWarningf("Ignoring %s: baked from a different version of %s\n", filename, s_world->name);
+		return nullptr;
+	}
+
+	if (LittleLong(header->nLightmaps) != nLightmaps || LittleLong(header->width) != width || LittleLong(header->height) != height || file->getLength() < sizeof(BakedLightmapsHeader) + nLightmaps * width * height * sizeof(uint32_t))
+	{
+		interface::PrintWarningf("Ignoring %s: lightmap dimensions don't match\n", filename);
+		return nullptr;
+	}
+
+	interface::Printf("Using baked lightmaps from %s.\n", filename);
+	return file;
+}
+
 void Load(const char *name)
 {
 	s_world = std::make_unique<World>();
@@ -454,6 +765,10 @@ void Load(const char *name)
 	}
 
 	const uint8_t *fileData = file.getData();
+	s_world->checksum = bx::hash<bx::HashCrc32>(fileData, (uint32_t)file.getLength());
+
+	// Opened when the lightmaps are loaded. Also holds the baked light grid.
+	std::unique_ptr<ReadOnlyFile> bakedFile;
 
 	// Header
 	auto header = (dheader_t *)fileData;
@@ -701,6 +1016,22 @@ void Load(const char *name)
 			// Pack lightmaps into atlas(es).
 			interface::Printf("Packing %d lightmaps into %d atlas(es) sized %dx%d.\n", (int)nLightmaps, (int)s_world->lightmapAtlases.size(), s_world->lightmapAtlasSize.x * s_world->lightmapSize, s_world->lightmapAtlasSize.y * s_world->lightmapSize);
 			size_t lightmapIndex = 0;
+			const uint32_t *bakedData = nullptr;
+			bakedFile = LoadBakedLightmaps();
+
+			if (bakedFile)
+				bakedData = (const uint32_t *)(bakedFile->getData() + sizeof(BakedLightmapsHeader));
+
+			// RGB9E5 keeps overbright light instead of normalizing it, at the same size as RGBA8.
+			s_world->lightmapFormat = bgfx::TextureFormat::RGBA8;
+
+			if (g_cvars.hdrLightmaps.getBool())
+			{
+				if (bgfx::getCaps()->formats[bgfx::TextureFormat::RGB9E5F] & BGFX_CAPS_FORMAT_TEXTURE_2D)
+					s_world->lightmapFormat = bgfx::TextureFormat::RGB9E5F;
+				else
+					interface::PrintWarningf("RGB9E5 textures not supported, using RGBA8 lightmaps\n");
+			}
 
 			for (size_t i = 0; i < s_world->lightmapAtlases.size(); i++)
 			{
@@ -711,11 +1042,25 @@ void Load(const char *name)
 				image.dataSize = image.width * image.height * image.nComponents;
 				image.data = (uint8_t *)malloc(image.dataSize);
 				image.release = ReleaseLightmapAtlasImage;
+
+				if (bakedData)
+				{
+					// Baked lightmaps are already atlased.
+					for (int j = 0; j < image.width * image.height; j++)
+					{
+						((uint32_t *)image.data)[j] = EncodeLightmapColor(util::DecodeRGB9E5(LittleLong(*bakedData)));
+						bakedData++;
+					}
+
+					s_world->lightmapAtlases[i] = g_textureCache->create(util::VarArgs("*lightmap%d", (int)i), image, TextureFlags::ClampToEdge | TextureFlags::Mutable, s_world->lightmapFormat);
+					continue;
+				}
+
 				int nAtlasedLightmaps = 0;
 
 				for (;;)
 				{
-					// Expand from 24bpp to 32bpp with overbright and RGBM encoding.
+					// Expand from 24bpp to 32bpp with overbright.
 					for (int y = 0; y < s_world->lightmapSize; y++)
 					{
 						for (int x = 0; x < s_world->lightmapSize; x++)
@@ -723,8 +1068,8 @@ void Load(const char *name)
 							const uint8_t *src = &srcData[(x + y * s_world->lightmapSize) * 3];
 							const int lightmapX = (nAtlasedLightmaps % s_world->nLightmapsPerAtlas) % s_world->lightmapAtlasSize.x;
 							const int lightmapY = (nAtlasedLightmaps % s_world->nLightmapsPerAtlas) / s_world->lightmapAtlasSize.x;
-							auto dest = (vec4b *)&image.data[((lightmapX * s_world->lightmapSize + x) + (lightmapY * s_world->lightmapSize + y) * (s_world->lightmapAtlasSize.x * s_world->lightmapSize)) * image.nComponents];
-							*dest = vec4b(vec4(util::OverbrightenColor(vec3::fromBytes(src)), 1));
+							auto dest = (uint32_t *)&image.data[((lightmapX * s_world->lightmapSize + x) + (lightmapY * s_world->lightmapSize + y) * (s_world->lightmapAtlasSize.x * s_world->lightmapSize)) * image.nComponents];
+							*dest = EncodeLightmapColor(vec3::fromBytes(src));
 						}
 					}
 
@@ -736,7 +1081,7 @@ void Load(const char *name)
 						break;
 				}
 
-				s_world->lightmapAtlases[i] = g_textureCache->create(util::VarArgs("*lightmap%d", (int)i), image, TextureFlags::ClampToEdge | TextureFlags::Mutable);
+				s_world->lightmapAtlases[i] = g_textureCache->create(util::VarArgs("*lightmap%d", (int)i), image, TextureFlags::ClampToEdge | TextureFlags::Mutable, s_world->lightmapFormat);
 			}
 		}
 	}
@@ -773,21 +1118,28 @@ void Load(const char *name)
 
 		const int numGridPoints = s_world->lightGridBounds[0] * s_world->lightGridBounds[1] * s_world->lightGridBounds[2];
 
-		if (lump.filelen != numGridPoints * 8)
+		// A baked light grid is stored after the baked lightmap atlases.
+		const uint8_t *bakedLightGrid = nullptr;
+
+		if (bakedFile && LittleLong(((const BakedLightmapsHeader *)bakedFile->getData())->lightGridSize) == numGridPoints * 8)
 		{
-			interface::PrintWarningf("WARNING: light grid mismatch\n");
+			const size_t lightmapsSize = s_world->lightmapAtlases.size() * s_world->lightmapAtlasSize.x * s_world->lightmapAtlasSize.y * s_world->lightmapSize * s_world->lightmapSize * sizeof(uint32_t);
+
+			if (bakedFile->getLength() >= sizeof(BakedLightmapsHeader) + lightmapsSize + numGridPoints * 8)
+				bakedLightGrid = bakedFile->getData() + sizeof(BakedLightmapsHeader) + lightmapsSize;
 		}
-		else
+
+		if (bakedLightGrid)
 		{
-			s_world->lightGridData.resize(lump.filelen);
-			memcpy(s_world->lightGridData.data(), &fileData[lump.fileofs], lump.filelen);
+			SetLightGridData(bakedLightGrid, numGridPoints * 8);
 		}
-
-		// deal with overbright bits
-		for (int i = 0; i < numGridPoints; i++)
+		else if (lump.filelen != numGridPoints * 8)
 		{
-			util::OverbrightenColor(&s_world->lightGridData[i*8], &s_world->lightGridData[i*8]);
-			util::OverbrightenColor(&s_world->lightGridData[i*8+3], &s_world->lightGridData[i*8+3]);
+			interface::PrintWarningf("WARNING: light grid mismatch\n");
+		}
+		else
+		{
+			SetLightGridData(&fileData[lump.fileofs], lump.filelen);
 		}
 	}
 
@@ -898,7 +1250,20 @@ void Load(const char *name)
 		{
 			s.type = SurfaceType::Patch;
 			s.patch = Patch_Subdivide(LittleLong(fs.patchWidth), LittleLong(fs.patchHeight), &vertices[LittleLong(fs.firstVert)]);
-			SetSurfaceGeometry(&s, s.patch->verts, s.patch->numVerts, s.patch->indexes, s.patch->numIndexes, lightmapIndex);
+
+			// Copy the level of detail origin, which is the center of the group of all curves that must subdivide the same to avoid cracking.
+			Bounds lodBounds;
+
+			for (int i = 0; i < 3; i++)
+			{
+				lodBounds.min[i] = LittleFloat(fs.lightmapVecs[0][i]);
+				lodBounds.max[i] = LittleFloat(fs.lightmapVecs[1][i]);
+			}
+
+			s.patch->lodOrigin = lodBounds.midpoint();
+			s.patch->lodRadius = (lodBounds.min - s.patch->lodOrigin).length();
+
+			// Geometry is set after all patches have been stitched.
 		}
 		else if (type == MST_FLARE)
 		{
@@ -906,6 +1271,59 @@ void Load(const char *name)
 		}
 	}
 
+	// Stitch cracks between patches in the same LOD group, and make sure points they share have the same LOD error.
+	{
+		std::vector<Patch *> patches;
+
+		for (Surface &surface : s_world->surfaces)
+		{
+			if (surface.type == SurfaceType::Patch)
+				patches.push_back(surface.patch);
+		}
+
+		if (!patches.empty())
+		{
+			const int nStitches = Patch_StitchAll(patches.data(), (int)patches.size());
+			Patch_FixSharedVertexLodError(patches.data(), (int)patches.size());
+			size_t patchIndex = 0;
+
+			for (size_t i = 0; i < s_world->surfaces.size(); i++)
+			{
+				Surface &s = s_world->surfaces[i];
+
+				if (s.type != SurfaceType::Patch)
+					continue;
+
+				s.patch = patches[patchIndex++];
+				SetSurfaceGeometry(&s, s.patch->verts, s.patch->numVerts, s.patch->indexes, s.patch->numIndexes, LittleLong(fileSurfaces[i].lightmapNum));
+				s.cullinfo.type = CullInfoType::Box;
+				s.cullinfo.bounds = s.patch->cullBounds;
+				CreatePatchLodIndices(&s);
+			}
+
+			interface::Printf("Stitched %d LOD cracks.\n", nStitches);
+		}
+	}
+
+	// Store the quad data autosprite deforms need in a copy of the vertices that is only used by the GPU. The camera facing quads are built by the vertex shader.
+	// The system memory vertices stay undeformed, since the light baker, decals and portal culling use their positions.
+	const bgfx::Memory *autoSpriteVertices[s_maxWorldGeometryBuffers] = {};
+
+	for (Surface &surface : s_world->surfaces)
+	{
+		if (IgnoreSurface(surface) || !surface.material->hasAutoSpriteDeform())
+			continue;
+
+		const std::vector<Vertex> &vertices = s_world->vertices[surface.bufferIndex];
+		const bgfx::Memory *&mem = autoSpriteVertices[surface.bufferIndex];
+
+		if (!mem)
+			mem = bgfx::copy(vertices.data(), uint32_t(vertices.size() * sizeof(Vertex)));
+
+		surface.material->setAutoSpriteIndices(surface.indices.data(), (uint32_t)surface.indices.size());
+		surface.material->setAutoSpriteVertices((Vertex *)mem->data, surface.indices.data(), (uint32_t)surface.indices.size(), &surface.softSpriteDepth);
+	}
+
 	// Create brush models.
 	for (size_t i = 1; i < s_world->modelDefs.size(); i++)
 	{
@@ -990,11 +1408,21 @@ void Load(const char *name)
 		}
 	}
 
+	if (main::AreWorldTextureArraysEnabled())
+	{
+		CreateTextureArrays();
+	}
+
 	// Initialize geometry buffers.
 	// Index buffer is initialized on first use, not here.
 	for (size_t i = 0; i < s_world->currentGeometryBuffer + 1; i++)
 	{
-		s_world->vertexBuffers[i].handle = bgfx::createVertexBuffer(bgfx::makeRef(&s_world->vertices[i][0], uint32_t(s_world->vertices[i].size() * sizeof(Vertex))), Vertex::decl);
+		const bgfx::Memory *mem = autoSpriteVertices[i];
+
+		if (!mem)
+			mem = bgfx::makeRef(&s_world->vertices[i][0], uint32_t(s_world->vertices[i].size() * sizeof(Vertex)));
+
+		s_world->vertexBuffers[i].handle = bgfx::createVertexBuffer(mem, Vertex::decl);
 	}
 
 	// Create batched surfaces for frustum culling.
@@ -1018,7 +1446,7 @@ void Load(const char *name)
 
 	std::sort(sortedSurfaces.begin(), sortedSurfaces.end(), SurfaceCompare);
 	std::vector<uint16_t> batchedIndices[s_maxWorldGeometryBuffers];
-	CreateBatchedSurfaces(sortedSurfaces, &s_world->batchedSurfaces, batchedIndices, &s_world->cpuDeformVertices, &s_world->cpuDeformIndices);
+	CreateBatchedSurfaces(sortedSurfaces, &s_world->batchedSurfaces, batchedIndices);
 
 	for (size_t i = 0; i < s_world->currentGeometryBuffer + 1; i++)
 	{
@@ -1155,6 +1583,22 @@ vec2i GetLightmapSize()
 	return vec2i(s_world->lightmapAtlasSize.x * s_world->lightmapSize, s_world->lightmapAtlasSize.y * s_world->lightmapSize);
 }
 
+bgfx::TextureFormat::Enum GetLightmapFormat()
+{
+	return s_world->lightmapFormat;
+}
+
+uint32_t EncodeLightmapColor(vec3 color)
+{
+	if (s_world->lightmapFormat == bgfx::TextureFormat::RGB9E5F)
+		return util::EncodeRGB9E5(color * g_overbrightFactor);
+
+	const vec4b rgba(vec4(util::OverbrightenColor(color), 1));
+	uint32_t result;
+	memcpy(&result, &rgba, sizeof(result));
+	return result;
+}
+
 int GetNumLightmaps()
 {
 	return (int)s_world->lightmapAtlases.size();
@@ -1205,6 +1649,19 @@ bool GetEntityToken(char *buffer, int size)
 	return true;
 }
 
+void SetLightGridData(const uint8_t *data, size_t size)
+{
+	s_world->lightGridData.resize(size);
+	memcpy(s_world->lightGridData.data(), data, size);
+
+	// deal with overbright bits
+	for (size_t i = 0; i < size / 8; i++)
+	{
+		util::OverbrightenColor(&s_world->lightGridData[i*8], &s_world->lightGridData[i*8]);
+		util::OverbrightenColor(&s_world->lightGridData[i*8+3], &s_world->lightGridData[i*8+3]);
+	}
+}
+
 bool HasLightGrid()
 {
 	return !s_world->lightGridData.empty();
@@ -1986,6 +2443,36 @@ void RenderReflective(VisibilityId visId, DrawCallList *drawCallList)
 	}
 }
 
+/// Batch the visible surfaces and update the dynamic index buffers.
+/// @remarks Surface::patchLodLevel must be set for all visible patches.
+static void UpdatePvsBatchedSurfaces(Visibility *vis)
+{
+	assert(vis);
+	CreateBatchedSurfaces(vis->surfaces, &vis->batchedSurfaces, vis->indices);
+
+	// Update dynamic index buffers.
+	for (size_t i = 0; i < s_world->currentGeometryBuffer + 1; i++)
+	{
+		DynamicIndexBuffer &ib = vis->indexBuffers[i];
+		std::vector<uint16_t> &indices = vis->indices[i];
+
+		if (indices.empty())
+			continue;
+
+		const bgfx::Memory *mem = bgfx::copy(indices.data(), uint32_t(indices.size() * sizeof(uint16_t)));
+
+		// Buffer is created on first use.
+		if (!bgfx::isValid(ib.handle))
+		{
+			ib.handle = bgfx::createDynamicIndexBuffer(mem, BGFX_BUFFER_ALLOW_RESIZE);
+		}
+		else				
+		{
+			bgfx::update(ib.handle, 0, mem);
+		}
+	}
+}
+
 static void UpdatePvsVisibility(VisibilityId visId, vec3 cameraPosition, const uint8_t *areaMask)
 {
 	assert(areaMask);
@@ -1998,13 +2485,38 @@ static void UpdatePvsVisibility(VisibilityId visId, vec3 cameraPosition, const u
 	// Build a list of visible surfaces.
 	// Don't need to refresh visible surfaces if the camera cluster or the area bitmask haven't changed.
 	if (vis.lastCameraLeaf != nullptr && vis.lastCameraLeaf->cluster == cameraLeaf->cluster && std::equal(areaMask, areaMask + MAX_MAP_AREA_BYTES, vis.lastAreaMask))
+	{
+		// Visible surfaces are the same, but the batched indices need to be refreshed if any visible patch level of detail has changed.
+		bool patchLodChanged = false;
+
+		for (size_t i = 0; i < vis.lodPatchSurfaces.size(); i++)
+		{
+			Surface *surface = vis.lodPatchSurfaces[i];
+			surface->patchLodLevel = CalculatePatchLodLevel(*surface, cameraPosition);
+
+			if (surface->patchLodLevel != vis.lodPatchLevels[i])
+				patchLodChanged = true;
+		}
+
+		if (!patchLodChanged)
+			return;
+
+		for (size_t i = 0; i < vis.lodPatchSurfaces.size(); i++)
+		{
+			vis.lodPatchLevels[i] = vis.lodPatchSurfaces[i]->patchLodLevel;
+		}
+
+		UpdatePvsBatchedSurfaces(&vis);
 		return;
+	}
 
 	// Clear data that will be recalculated.
 	vis.portalSurfaces.clear();
 	vis.reflectiveSurfaces.clear();
 	vis.skySurfaces.clear();
 	vis.surfaces.clear();
+	vis.lodPatchSurfaces.clear();
+	vis.lodPatchLevels.clear();
 	vis.bounds.setupForAddingPoints();
 
 	// A cluster of -1 means the camera is outside the PVS - draw everything.
@@ -2062,6 +2574,13 @@ static void UpdatePvsVisibility(VisibilityId visId, vec3 cameraPosition, const u
 				}
 
 				vis.surfaces.push_back(&surface);
+
+				if (!surface.patchLodIndices.empty())
+				{
+					surface.patchLodLevel = CalculatePatchLodLevel(surface, cameraPosition);
+					vis.lodPatchSurfaces.push_back(&surface);
+					vis.lodPatchLevels.push_back(surface.patchLodLevel);
+				}
 			}
 		}
 	}
@@ -2069,30 +2588,7 @@ static void UpdatePvsVisibility(VisibilityId visId, vec3 cameraPosition, const u
 	// Sort visible surfaces.
 	std::sort(vis.surfaces.begin(), vis.surfaces.end(), SurfaceCompare);
 
-	CreateBatchedSurfaces(vis.surfaces, &vis.batchedSurfaces, vis.indices, &vis.cpuDeformVertices, &vis.cpuDeformIndices);
-
-	// Update dynamic index buffers.
-	for (size_t i = 0; i < s_world->currentGeometryBuffer + 1; i++)
-	{
-		DynamicIndexBuffer &ib = vis.indexBuffers[i];
-		std::vector<uint16_t> &indices = vis.indices[i];
-
-		if (indices.empty())
-			continue;
-
-		const bgfx::Memory *mem = bgfx::copy(indices.data(), uint32_t(indices.size() * sizeof(uint16_t)));
-
-		// Buffer is created on first use.
-		if (!bgfx::isValid(ib.handle))
-		{
-			ib.handle = bgfx::createDynamicIndexBuffer(mem, BGFX_BUFFER_ALLOW_RESIZE);
-		}
-		else				
-		{
-			bgfx::update(ib.handle, 0, mem);
-		}
-	}
-
+	UpdatePvsBatchedSurfaces(&vis);
 	s_world->duplicateSurfaceId++;
 	vis.lastCameraLeaf = cameraLeaf;
 	memcpy(vis.lastAreaMask, areaMask, sizeof(vis.lastAreaMask));
@@ -2122,28 +2618,13 @@ void UpdateVisibility(VisibilityId visId, vec3 cameraPosition, const uint8_t *ar
 	}
 }
 
-void Render(VisibilityId visId, DrawCallList *drawCallList, const mat3 &sceneRotation)
+void Render(VisibilityId visId, DrawCallList *drawCallList)
 {
 	assert(drawCallList);
 	const Visibility &vis = s_world->visibility[(int)visId];
-	const std::vector<BatchedSurface> *batchedSurfaces;
-	const std::vector<Vertex> *cpuDeformVertices;
-	const std::vector<uint16_t> *cpuDeformIndices;
+	const std::vector<BatchedSurface> &batchedSurfaces = vis.method == VisibilityMethod::PVS ? vis.batchedSurfaces : s_world->batchedSurfaces;
 
-	if (vis.method == VisibilityMethod::PVS)
-	{
-		batchedSurfaces = &vis.batchedSurfaces;
-		cpuDeformVertices = &vis.cpuDeformVertices;
-		cpuDeformIndices = &vis.cpuDeformIndices;
-	}
-	else
-	{
-		batchedSurfaces = &s_world->batchedSurfaces;
-		cpuDeformVertices = &s_world->cpuDeformVertices;
-		cpuDeformIndices = &s_world->cpuDeformIndices;
-	}
-
-	for (const BatchedSurface &surface : *batchedSurfaces)
+	for (const BatchedSurface &surface : batchedSurfaces)
 	{
 		DrawCall dc;
 		dc.flags = 0;
@@ -2154,6 +2635,11 @@ void Render(VisibilityId visId, DrawCallList *drawCallList, const mat3 &sceneRot
 		dc.fogIndex = surface.fogIndex;
 		dc.material = surface.material;
 
+		if (surface.textureArrayIndex >= 0)
+		{
+			dc.textureArray = s_world->textureArrays[surface.textureArrayIndex]->handle;
+		}
+
 		if (main::AreWaterReflectionsEnabled())
 		{
 			// If this is a back side reflective material, use the front side material if there's any reflective surfaces visible to the camera.
@@ -2163,54 +2649,25 @@ void Render(VisibilityId visId, DrawCallList *drawCallList, const mat3 &sceneRot
 			}
 		}
 
-		if (surface.material->hasAutoSpriteDeform())
-		{
-			assert(!cpuDeformVertices->empty() && !cpuDeformIndices->empty());
-			assert(surface.nVertices);
-			assert(surface.nIndices);
-
-			// Copy the CPU deform geo to a transient buffer.
-			bgfx::TransientVertexBuffer tvb;
-			bgfx::TransientIndexBuffer tib;
-
-			if (!bgfx::allocTransientBuffers(&tvb, Vertex::decl, surface.nVertices, &tib, surface.nIndices))
-			{
-				WarnOnce(WarnOnceId::TransientBuffer);
-				continue;
-			}
-				
-			memcpy(tib.data, &(*cpuDeformIndices)[surface.firstIndex], surface.nIndices * sizeof(uint16_t));
-			memcpy(tvb.data, &(*cpuDeformVertices)[surface.firstVertex], surface.nVertices * sizeof(Vertex));
-			dc.vb.type = dc.ib.type = DrawCall::BufferType::Transient;
-			dc.vb.transientHandle = tvb;
-			dc.vb.nVertices = surface.nVertices;
-			dc.ib.transientHandle = tib;
-			dc.ib.nIndices = surface.nIndices;
+		dc.vb.type = DrawCall::BufferType::Static;
+		dc.vb.staticHandle = s_world->vertexBuffers[surface.bufferIndex].handle;
+		dc.vb.nVertices = (uint32_t)s_world->vertices[surface.bufferIndex].size();
 
-			// Deform the transient buffer contents.
-			surface.material->doAutoSpriteDeform(sceneRotation, (Vertex *)tvb.data, surface.nVertices, (uint16_t *)tib.data, surface.nIndices, &dc.softSpriteDepth);
+		if (vis.method == VisibilityMethod::PVS)
+		{
+			dc.ib.type = DrawCall::BufferType::Dynamic;
+			dc.ib.dynamicHandle = vis.indexBuffers[surface.bufferIndex].handle;
 		}
 		else
 		{
-			dc.vb.type = DrawCall::BufferType::Static;
-			dc.vb.staticHandle = s_world->vertexBuffers[surface.bufferIndex].handle;
-			dc.vb.nVertices = (uint32_t)s_world->vertices[surface.bufferIndex].size();
-
-			if (vis.method == VisibilityMethod::PVS)
-			{
-				dc.ib.type = DrawCall::BufferType::Dynamic;
-				dc.ib.dynamicHandle = vis.indexBuffers[surface.bufferIndex].handle;
-			}
-			else
-			{
-				dc.ib.type = DrawCall::BufferType::Static;
-				dc.ib.staticHandle = s_world->indexBuffers[surface.bufferIndex].handle;
-			}
-
-			dc.ib.firstIndex = surface.firstIndex;
-			dc.ib.nIndices = surface.nIndices;
+			dc.ib.type = DrawCall::BufferType::Static;
+			dc.ib.staticHandle = s_world->indexBuffers[surface.bufferIndex].handle;
 		}
 
+		dc.ib.firstIndex = surface.firstIndex;
+		dc.ib.nIndices = surface.nIndices;
+		dc.softSpriteDepth = surface.softSpriteDepth;
+
 		drawCallList->push_back(dc);
 	}
 }
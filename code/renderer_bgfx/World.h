@@ -206,6 +206,28 @@ typedef struct {
 	int			patchHeight;
 } dsurface_t;
 
+#define BAKED_LIGHTMAPS_IDENT	(('M'<<24)+('L'<<16)+('K'<<8)+'B')
+// little-endian "BKLM"
+
+#define BAKED_LIGHTMAPS_VERSION	3
+
+/// @brief Header of the file the light baker writes its lightmaps to, maps/[map name].lightmaps.
+/// @remarks Followed by nLightmaps * width * height RGB9E5 encoded luxels (see util::EncodeRGB9E5). Each lightmap is an atlas, as packed by world::Load. Then lightGridSize bytes of light grid, in the same format as the BSP light grid lump.
+struct BakedLightmapsHeader
+{
+	int ident;
+	int version;
+
+	/// CRC32 of the BSP the lightmaps were baked from. The file is ignored if the BSP has been changed since.
+	uint32_t bspChecksum;
+
+	int nLightmaps;
+	int width, height;
+
+	/// 0 if the light grid wasn't baked.
+	int lightGridSize;
+};
+
 struct BatchedSurface
 {
 	Bounds bounds; // frustum culling only
@@ -214,17 +236,15 @@ struct BatchedSurface
 	int surfaceFlags;
 	int contentFlags;
 
-	/// @remarks Undefined if the material has CPU deforms.
 	size_t bufferIndex;
-
 	uint32_t firstIndex;
 	uint32_t nIndices;
 
-	/// @remarks Used by CPU deforms only.
-	uint32_t firstVertex;
+	/// The largest Surface::softSpriteDepth in the batch.
+	float softSpriteDepth = 0;
 
-	/// @remarks Used by CPU deforms only.
-	uint32_t nVertices;
+	/// Index into World::textureArrays, or -1 if the material isn't merged into a texture array.
+	int textureArrayIndex;
 };
 
 struct CullInfoType
@@ -349,21 +369,43 @@ struct Surface
 	// SurfaceType::Patch
 	Patch *patch = nullptr;
 
+	/// Patch indices for each reduced level of detail, starting at level 1. Level 0 is the full detail Surface::indices.
+	std::vector<std::vector<uint16_t>> patchLodIndices;
+
+	/// The patch level of detail to batch with.
+	/// @remarks Set at runtime before creating batched surfaces.
+	int patchLodLevel = 0;
+
 	/// Used at runtime to avoid adding duplicate visible surfaces.
 	int duplicateId = -1;
 
 	/// Used at runtime to avoid processing surfaces multiple times when adding a decal.
 	int decalDuplicateId = -1;
 
-	/// @remarks Used by CPU deforms only.
 	uint32_t firstVertex;
-
-	/// @remarks Used by CPU deforms only.
 	uint32_t nVertices;
+
+	/// @remarks Only set if the material has an autosprite deform. See Material::setAutoSpriteVertices.
+	float softSpriteDepth = 0;
+
+	/// Index into World::textureArrays, or -1 if the material isn't merged into a texture array.
+	/// @remarks The layer is stored in Vertex::textureLayer.
+	int textureArrayIndex = -1;
 };
 
 static const size_t s_maxWorldGeometryBuffers = 8;
 
+/// Diffuse textures of simple lightmapped materials, merged so surfaces with different materials can be drawn in a single batch.
+struct TextureArray
+{
+	TextureArray() { handle.idx = bgfx::kInvalidHandle; }
+	~TextureArray() { if (bgfx::isValid(handle)) bgfx::destroy(handle); }
+	bgfx::TextureHandle handle;
+
+	/// Surfaces using this texture array are batched and drawn with this material.
+	Material *material;
+};
+
 enum class VisibilityMethod
 {
 	PVS,
@@ -398,11 +440,14 @@ struct Visibility
 	/// Reflective surfaces visible to the camera.
 	std::vector<Reflective> cameraReflectiveSurfaces;
 
-	std::vector<Vertex> cpuDeformVertices;
-	std::vector<uint16_t> cpuDeformIndices;
-
 	DynamicIndexBuffer indexBuffers[s_maxWorldGeometryBuffers];
 
+	/// Visible patches with reduced levels of detail.
+	std::vector<Surface *> lodPatchSurfaces;
+
+	/// The level of detail each of lodPatchSurfaces was batched with.
+	std::vector<int> lodPatchLevels;
+
 	/// Temporary index data populated at runtime when surface visibility changes.
 	std::vector<uint16_t> indices[s_maxWorldGeometryBuffers];
 
@@ -432,6 +477,7 @@ struct World
 {
 	char name[MAX_QPATH]; // ie: maps/tim_dm2.bsp
 	char baseName[MAX_QPATH]; // ie: tim_dm2
+	uint32_t checksum; // CRC32 of the BSP file.
 
 	std::vector<char> entityString;
 	char *entityParsePoint = nullptr;
@@ -440,6 +486,7 @@ struct World
 	const int lightmapSize = 128;
 	vec2i lightmapAtlasSize; // In cells. e.g. 2x2 is 256x256 (lightmapSize).
 	std::vector<Texture *> lightmapAtlases;
+	bgfx::TextureFormat::Enum lightmapFormat = bgfx::TextureFormat::RGBA8; // RGBA8 or RGB9E5F. See world::EncodeLightmapColor.
 	int nLightmapsPerAtlas;
 	vec3 lightGridSize = { 64, 64, 128 };
 	vec3 lightGridInverseSize;
@@ -481,10 +528,10 @@ struct World
 
 	// frustum culling
 	std::vector<BatchedSurface> batchedSurfaces;
-	std::vector<Vertex> cpuDeformVertices;
-	std::vector<uint16_t> cpuDeformIndices;
 	IndexBuffer indexBuffers[s_maxWorldGeometryBuffers];
 	std::vector<SkySurface> skySurfaces;
+
+	std::vector<std::unique_ptr<TextureArray>> textureArrays;
 };
 
 extern std::unique_ptr<World> s_world;
@@ -100,11 +100,18 @@ newaction
 				end
 				
 				if renderer == "gl" then
-					command = command .. " --platform linux -p 130"
+					-- Compute shaders need GLSL 4.3.
+					if type == "compute" then
+						command = command .. " --platform linux -p 430"
+					else
+						command = command .. " --platform linux -p 130"
+					end
 				elseif renderer == "d3d9" or renderer == "d3d11" then
 					command = command .. " --platform windows"
 				
-					if type == "fragment" then
+					if type == "compute" then
+						command = command .. " -p cs_"
+					elseif type == "fragment" then
 						command = command .. " -p ps_"
 					else
 						command = command .. " -p vs_"
@@ -155,12 +162,14 @@ newaction
 		
 		local depthFragmentVariants =
 		{
-			{ "AlphaTest", "USE_ALPHA_TEST" }
+			{ "AlphaTest", "USE_ALPHA_TEST" },
+			{ "Velocity", "USE_VELOCITY" }
 		}
 		
 		local depthVertexVariants =
 		{
-			{ "AlphaTest", "USE_ALPHA_TEST" }
+			{ "AlphaTest", "USE_ALPHA_TEST" },
+			{ "Velocity", "USE_VELOCITY" }
 		}
 		
 		local genericFragmentVariants =
@@ -173,6 +182,18 @@ newaction
 		
 		local genericVertexVariants =
 		{
+			{ "SunLight", "USE_SUN_LIGHT" },
+			{ "TextureArray", "USE_TEXTURE_ARRAY" }
+		}
+		
+		local smaaNeighborhoodBlendingFragmentVariants =
+		{
+			{ "Bloom", "USE_BLOOM" }
+		}
+		
+		local textureArrayFragmentVariants =
+		{
+			{ "DynamicLights", "USE_DYNAMIC_LIGHTS" },
 			{ "SunLight", "USE_SUN_LIGHT" }
 		}
 		
@@ -181,20 +202,29 @@ newaction
 			{ "SunLight", "USE_SUN_LIGHT" }
 		}
 		
+		local computeShaders =
+		{
+			{ "BloomDownsample" },
+			{ "BloomUpsample" }
+		}
+		
 		local fragmentShaders =
 		{
 			{ "Bloom" },
+			{ "BloomDownsample" },
+			{ "BloomUpsample" },
 			{ "Color" },
 			{ "Depth", depthFragmentVariants },
 			{ "Fog" },
-			{ "GaussianBlur" },
 			{ "Generic", genericFragmentVariants },
 			{ "HemicubeDownsample" },
 			{ "HemicubeWeightedDownsample" },
 			{ "SMAABlendingWeightCalculation" },
 			{ "SMAAEdgeDetection" },
-			{ "SMAANeighborhoodBlending" },
+			{ "SMAANeighborhoodBlending", smaaNeighborhoodBlendingFragmentVariants },
+			{ "TAA" },
 			{ "Texture" },
+			{ "TextureArray", textureArrayFragmentVariants },
 			{ "TextureColor" },
 			{ "TextureDebug" },
 			{ "TextureVariation", textureVariationFragmentVariants }
@@ -221,11 +251,16 @@ newaction
 		os.remove(outputSourceFilename)
 		
 		-- Expand shader lists so each variant has a single entry.
+		local expandedComputeShaders = expandShaderVariants(computeShaders)
 		local expandedFragmentShaders = expandShaderVariants(fragmentShaders)
 		local expandedVertexShaders = expandShaderVariants(vertexShaders)
 
 		-- Compile the shaders.
 		local ok, message = pcall(function()
+			for _,v in pairs(expandedComputeShaders) do
+				compileShader(v[1], "compute", v[2], v[3], outputSourceFilename, renderers)
+			end
+			
 			for _,v in pairs(expandedFragmentShaders) do
 				compileShader(v[1], "fragment", v[2], v[3], outputSourceFilename, renderers)
 			end
@@ -298,11 +333,13 @@ newaction
 		
 		local outputHeaderFilename = "build/Shader.h"
 		local outputHeaderFile = io.open(outputHeaderFilename, "w")
+		writeShaderIds(outputHeaderFile, expandedComputeShaders, "ComputeShaderId", "s_computeShaderNames")
 		writeShaderIds(outputHeaderFile, expandedFragmentShaders, "FragmentShaderId", "s_fragmentShaderNames")
 		writeShaderIds(outputHeaderFile, expandedVertexShaders, "VertexShaderId", "s_vertexShaderNames")
 		writeShaderVariantEnum(outputHeaderFile, genericFragmentVariants, "GenericFragment")
 		writeShaderVariantEnum(outputHeaderFile, depthFragmentVariants, "DepthFragment")
 		writeShaderVariantEnum(outputHeaderFile, depthVertexVariants, "DepthVertex")
+		writeShaderVariantEnum(outputHeaderFile, textureArrayFragmentVariants, "TextureArrayFragment")
 		writeShaderVariantEnum(outputHeaderFile, textureVariationFragmentVariants, "TextureVariationFragment")
 		outputHeaderFile:close()
 
@@ -332,6 +369,7 @@ newaction
 		outputSourceFile:write("\nstruct ShaderSourceMem { const uint8_t *mem; size_t size; };\n");
 		
 		for _,renderer in pairs(renderers) do
+			writeSourceMap(outputSourceFile, expandedComputeShaders, renderer, "Compute", "compute")
 			writeSourceMap(outputSourceFile, expandedFragmentShaders, renderer, "Fragment", "fragment")
 			writeSourceMap(outputSourceFile, expandedVertexShaders, renderer, "Vertex", "vertex")
 		end
@@ -446,21 +484,34 @@ solution "renderer_bgfx"
 	configuration { "vs*", "x86_64" }
 		defines { "_WIN64", "__WIN64__" }
 		
-dofile("renderer_bgfx.lua")
-rendererProject(_OPTIONS["engine"], _OPTIONS["enable-light-baker"], path.getabsolute("."))
-
-if os.ishost("windows") then
+-- SDL comes from the engine on Windows.
+local function windowsSdl()
+	if not os.ishost("windows") then
+		return
+	end
+	
 	if _OPTIONS["engine"] == "ioq3" then
 		includedirs(path.join(IOQ3_PATH, "code/SDL2/include"))
 		configuration "x86"
 			links(path.join(IOQ3_PATH, "code/libs/win32/libSDL2"))
 		configuration "x86_64"
 			links(path.join(IOQ3_PATH, "code/libs/win64/libSDL264"))
+		configuration {}
 	elseif _OPTIONS["engine"] == "iortcw" then
 		includedirs(path.join(IORTCW_PATH, "SP/code/SDL2/include"))
 		configuration "x86"
 			links(path.join(IORTCW_PATH, "SP/code/libs/win32/libSDL2"))
 		configuration "x86_64"
 			links(path.join(IORTCW_PATH, "SP/code/libs/win64/libSDL264"))
+		configuration {}
 	end
 end
+
+dofile("renderer_bgfx.lua")
+rendererProject(_OPTIONS["engine"], _OPTIONS["enable-light-baker"], path.getabsolute("."))
+windowsSdl()
+
+if _OPTIONS["enable-light-baker"] then
+	lightBakerProject(path.getabsolute("."))
+	windowsSdl()
+end
@@ -1,25 +1,16 @@
-function rendererProject(engine, lightBakerEnabled, rendererPath)
-	project "renderer_bgfx"
-	kind "SharedLib"
+-- Settings shared by the renderer and the standalone light baker, which both compile the renderer source.
+local function commonProject(rendererPath)
 	language "C++"
 	cppdialect "C++14"
 	rtti "Off"
-	targetprefix ""
 	
 	defines
 	{
 		"__STDC_CONSTANT_MACROS",
 		"__STDC_FORMAT_MACROS",
-		"__STDC_LIMIT_MACROS",
-		"BGFX_CONFIG_RENDERER_OPENGL=32",
-		"BGFX_CONFIG_RENDERDOC_LOG_FILEPATH=\"ioq3-renderer-bgfx\"",
-		"USE_RENDERER_DLOPEN"
+		"__STDC_LIMIT_MACROS"
 	}
 	
-	if lightBakerEnabled then
-		defines { "USE_LIGHT_BAKER" }
-	end
-	
 	local bxPath = path.join(rendererPath, "code/bx")
 	local bimgPath = path.join(rendererPath, "code/bimg")
 	local bgfxPath = path.join(rendererPath, "code/bgfx")
@@ -54,10 +45,6 @@ function rendererProject(engine, lightBakerEnabled, rendererPath)
 		path.join(bgfxPath, "src/amalgamated.cpp")
 	}
 	
-	if not lightBakerEnabled then
-		excludes { path.join(rendererPath, "code/renderer_bgfx/LightBaker*") }
-	end
-	
 	includedirs
 	{
 		path.join(bxPath, "include"),
@@ -88,22 +75,6 @@ function rendererProject(engine, lightBakerEnabled, rendererPath)
 		linuxArchDefine = "ARCH_STRING=" .. os.outputof("uname -m")
 	end
 	
-	if engine == "ioq3" then
-		defines "ENGINE_IOQ3"
-		
-		configuration "x86"
-			targetname "renderer_bgfx_x86"
-		configuration "x86_64"
-			targetname "renderer_bgfx_x86_64"
-	elseif engine == "iortcw" then
-		defines "ENGINE_IORTCW"
-		
-		configuration "x86"
-			targetname "renderer_sp_bgfx_x86"
-		configuration "x86_64"
-			targetname "renderer_sp_bgfx_x86_64"
-	end
-	
 	configuration "Debug"
 		defines "BGFX_CONFIG_DEBUG=1"
 		
@@ -118,25 +89,17 @@ function rendererProject(engine, lightBakerEnabled, rendererPath)
 		links
 		{
 			"dl",
-			"GL",
 			"pthread",
 			"rt",
-			"SDL2",
-			"X11"
+			"SDL2"
 		}
 		
-		linkoptions "-Wl,--no-undefined"
-		
 	configuration "vs*"
 		buildoptions { "/wd\"4316\"", "/wd\"4351\"" } -- Silence some warnings
 		includedirs(path.join(bxPath, "include/compat/msvc"))
 		pchheader "Precompiled.h"
 		pchsource(path.join(rendererPath, "code/renderer_bgfx/Precompiled.cpp"))
 		
-	configuration "windows"
-		defines { "BGFX_CONFIG_RENDERER_DIRECT3D11=1", "BGFX_CONFIG_RENDERER_DIRECT3D12=1" }
-		links { "d3dcompiler", "gdi32", "OpenGL32", "psapi" }
-		
 	configuration { "windows", "gmake" }
 		includedirs(path.join(bxPath, "include/compat/mingw"))
 		linkoptions { "-static-libgcc", "-static-libstdc++", "-Wl,-Bstatic -lstdc++ -lpthread -Wl,-Bdynamic" }
@@ -162,3 +125,76 @@ function rendererProject(engine, lightBakerEnabled, rendererPath)
 		flags "NoPCH"
 	filter {}
 end
+
+function rendererProject(engine, lightBakerEnabled, rendererPath)
+	project "renderer_bgfx"
+	kind "SharedLib"
+	targetprefix ""
+	commonProject(rendererPath)
+	
+	defines
+	{
+		"BGFX_CONFIG_RENDERER_OPENGL=32",
+		"BGFX_CONFIG_RENDERDOC_LOG_FILEPATH=\"ioq3-renderer-bgfx\"",
+		"USE_RENDERER_DLOPEN"
+	}
+	
+	if lightBakerEnabled then
+		defines { "USE_LIGHT_BAKER" }
+	else
+		excludes { path.join(rendererPath, "code/renderer_bgfx/LightBaker*") }
+	end
+	
+	if engine == "ioq3" then
+		defines "ENGINE_IOQ3"
+		
+		configuration "x86"
+			targetname "renderer_bgfx_x86"
+		configuration "x86_64"
+			targetname "renderer_bgfx_x86_64"
+	elseif engine == "iortcw" then
+		defines "ENGINE_IORTCW"
+		
+		configuration "x86"
+			targetname "renderer_sp_bgfx_x86"
+		configuration "x86_64"
+			targetname "renderer_sp_bgfx_x86_64"
+	end
+	
+	configuration "linux"
+		links { "GL", "X11" }
+		linkoptions "-Wl,--no-undefined"
+		
+	configuration "windows"
+		defines { "BGFX_CONFIG_RENDERER_DIRECT3D11=1", "BGFX_CONFIG_RENDERER_DIRECT3D12=1" }
+		links { "d3dcompiler", "gdi32", "OpenGL32", "psapi" }
+		
+	configuration {}
+end
+
+-- Command line light baker. Runs the renderer headless on the noop backend, so none of the real backends are compiled in.
+function lightBakerProject(rendererPath)
+	project "light_baker"
+	kind "ConsoleApp"
+	commonProject(rendererPath)
+	
+	defines
+	{
+		"BGFX_CONFIG_RENDERER_OPENGL=0",
+		"ENGINE_IOQ3",
+		"USE_LIGHT_BAKER"
+	}
+	
+	files(path.join(rendererPath, "code/light_baker/*.cpp"))
+	excludes(path.join(rendererPath, "code/renderer_bgfx/Interface_*.cpp"))
+	
+	configuration "x86"
+		targetname "light_baker_x86"
+	configuration "x86_64"
+		targetname "light_baker_x86_64"
+		
+	configuration "windows"
+		links "psapi"
+		
+	configuration {}
+end
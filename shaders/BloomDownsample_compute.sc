@@ -0,0 +1,20 @@
+#include <bgfx_compute.sh>
+
+SAMPLER2D(u_TextureSampler, 0);
+IMAGE2D_WR(u_BloomOutput, rgba8, 1);
+
+uniform vec4 u_BloomFilter; // xy sample offset, zw output size
+
+#include "DualFilter.sh"
+
+NUM_THREADS(8, 8, 1)
+void main()
+{
+	ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+
+	if (coord.x >= int(u_BloomFilter.z) || coord.y >= int(u_BloomFilter.w))
+		return;
+
+	vec2 uv = (vec2(coord) + vec2_splat(0.5)) / u_BloomFilter.zw;
+	imageStore(u_BloomOutput, coord, vec4(DualFilterDownsample(uv, u_BloomFilter.xy), 1.0));
+}
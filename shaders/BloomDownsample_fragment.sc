@@ -0,0 +1,14 @@
+$input v_texcoord0
+
+#include <bgfx_shader.sh>
+
+SAMPLER2D(u_TextureSampler, 0);
+
+uniform vec4 u_BloomFilter; // only xy used
+
+#include "DualFilter.sh"
+
+void main()
+{
+	gl_FragColor = vec4(DualFilterDownsample(v_texcoord0, u_BloomFilter.xy), 1.0);
+}
@@ -1,4 +1,4 @@
-$input v_position, v_texcoord0, v_color0
+$input v_position, v_texcoord0, v_texcoord2, v_texcoord3, v_color0
 
 #include <bgfx_shader.sh>
 #include "SharedDefines.sh"
@@ -20,5 +20,10 @@ void main()
 		discard;
 #endif
 
+#if defined(USE_VELOCITY)
+	// Screen space motion since last frame, in NDC units.
+	gl_FragColor = vec4(v_texcoord2.xy / v_texcoord2.w - v_texcoord3.xy / v_texcoord3.w, 0.0, 0.0);
+#else
 	gl_FragColor = vec4_splat(0.0);
+#endif
 }
@@ -0,0 +1,15 @@
+#ifndef DRAW_PARAMS_SH
+#define DRAW_PARAMS_SH
+
+#include "SharedDefines.sh"
+
+// Per-draw state, set with a single uniform update per submit.
+uniform vec4 u_DrawParams[DRAW_NUM_PARAMS];
+
+#define u_DepthRange u_DrawParams[DRAW_DEPTH_RANGE]
+#define u_DepthRangeEnabled int(u_DrawParams[DRAW_FLAGS].x)
+#define u_FogEnabled int(u_DrawParams[DRAW_FLAGS].y)
+#define u_BloomEnabled int(u_DrawParams[DRAW_FLAGS].z)
+#define u_BloomWrite int(u_DrawParams[DRAW_FLAGS].w)
+
+#endif
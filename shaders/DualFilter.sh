@@ -0,0 +1,29 @@
+/*
+Dual filter blur from "Bandwidth-Efficient Rendering", Marius Bjørge, SIGGRAPH 2015.
+Downsampling and upsampling a chain of half size textures gives a wide blur for far fewer samples than a gaussian.
+
+The including shader declares u_TextureSampler. Both functions take the sample offset in UV units.
+*/
+
+vec3 DualFilterDownsample(vec2 uv, vec2 offset)
+{
+	vec3 sum = texture2DLod(u_TextureSampler, uv, 0.0).rgb * 4.0;
+	sum += texture2DLod(u_TextureSampler, uv - offset, 0.0).rgb;
+	sum += texture2DLod(u_TextureSampler, uv + offset, 0.0).rgb;
+	sum += texture2DLod(u_TextureSampler, uv + vec2(offset.x, -offset.y), 0.0).rgb;
+	sum += texture2DLod(u_TextureSampler, uv - vec2(offset.x, -offset.y), 0.0).rgb;
+	return sum / 8.0;
+}
+
+vec3 DualFilterUpsample(vec2 uv, vec2 offset)
+{
+	vec3 sum = texture2DLod(u_TextureSampler, uv + vec2(-offset.x * 2.0, 0.0), 0.0).rgb;
+	sum += texture2DLod(u_TextureSampler, uv + vec2(-offset.x, offset.y), 0.0).rgb * 2.0;
+	sum += texture2DLod(u_TextureSampler, uv + vec2(0.0, offset.y * 2.0), 0.0).rgb;
+	sum += texture2DLod(u_TextureSampler, uv + vec2(offset.x, offset.y), 0.0).rgb * 2.0;
+	sum += texture2DLod(u_TextureSampler, uv + vec2(offset.x * 2.0, 0.0), 0.0).rgb;
+	sum += texture2DLod(u_TextureSampler, uv + vec2(offset.x, -offset.y), 0.0).rgb * 2.0;
+	sum += texture2DLod(u_TextureSampler, uv + vec2(0.0, -offset.y * 2.0), 0.0).rgb;
+	sum += texture2DLod(u_TextureSampler, uv + vec2(-offset.x, -offset.y), 0.0).rgb * 2.0;
+	return sum / 12.0;
+}
@@ -1,10 +1,8 @@
 $input v_position, v_texcoord0
 
 #include <bgfx_shader.sh>
+#include "DrawParams.sh"
 #include "PortalClip.sh"
-
-uniform vec4 u_Bloom_Enabled_Write_Scale;
-#define u_BloomEnabled int(u_Bloom_Enabled_Write_Scale.x)
 #define v_scale v_texcoord0.x
 uniform vec4 u_Color;
 
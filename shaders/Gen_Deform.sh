@@ -4,6 +4,7 @@ uniform vec4 u_NumDeforms; // only x used
 uniform vec4 u_DeformMoveDirs[MAX_DEFORMS]; // only xyz used
 uniform vec4 u_Deform_Gen_Wave_Base_Amplitude[MAX_DEFORMS];
 uniform vec4 u_Deform_Frequency_Phase_Spread[MAX_DEFORMS];
+uniform vec4 u_AutoSpriteAxes[3]; // forward, left, up in model space. Only xyz used.
 
 void CalculateDeformSingle(inout vec3 pos, vec3 normal, const vec2 st, float time, int gen, int wave, float base, float amplitude, float freq, float phase, float spread, vec4 moveDir)
 {
@@ -54,10 +55,41 @@ void CalculateDeformSingle(inout vec3 pos, vec3 normal, const vec2 st, float tim
 	}
 }
 
-void CalculateDeform(inout vec3 pos, vec3 normal, const vec2 st, float time)
+// See Material::setAutoSpriteVertices for how the quad data is stored in the vertex position and normal.
+void CalculateAutoSprite(inout vec3 pos, inout vec3 normal, int gen)
+{
+	if (gen == DGEN_AUTOSPRITE)
+	{
+		// pos is the quad midpoint, normal.xy the corner offset along the left and up axes.
+		pos = pos + u_AutoSpriteAxes[1].xyz * normal.x + u_AutoSpriteAxes[2].xyz * normal.y;
+	}
+	else
+	{
+		// pos is the midpoint of one of the two short edges, normal the major axis scaled by the signed half length of the edge.
+		float halfLength = length(normal);
+
+		if (halfLength > 0.0)
+		{
+			pos = pos + normalize(cross(normal, u_AutoSpriteAxes[0].xyz)) * halfLength;
+		}
+	}
+
+	normal = -u_AutoSpriteAxes[0].xyz;
+}
+
+void CalculateDeform(inout vec3 pos, inout vec3 normal, const vec2 st, float time)
 {
 	for (int i = 0; i < int(u_NumDeforms.x); i++)
 	{
-		CalculateDeformSingle(pos, normal, st, time, int(u_Deform_Gen_Wave_Base_Amplitude[i].x), int(u_Deform_Gen_Wave_Base_Amplitude[i].y), u_Deform_Gen_Wave_Base_Amplitude[i].z, u_Deform_Gen_Wave_Base_Amplitude[i].w, u_Deform_Frequency_Phase_Spread[i].x, u_Deform_Frequency_Phase_Spread[i].y, u_Deform_Frequency_Phase_Spread[i].z, u_DeformMoveDirs[i]);
+		int gen = int(u_Deform_Gen_Wave_Base_Amplitude[i].x);
+
+		if (gen == DGEN_AUTOSPRITE || gen == DGEN_AUTOSPRITE2)
+		{
+			CalculateAutoSprite(pos, normal, gen);
+		}
+		else
+		{
+			CalculateDeformSingle(pos, normal, st, time, gen, int(u_Deform_Gen_Wave_Base_Amplitude[i].y), u_Deform_Gen_Wave_Base_Amplitude[i].z, u_Deform_Gen_Wave_Base_Amplitude[i].w, u_Deform_Frequency_Phase_Spread[i].x, u_Deform_Frequency_Phase_Spread[i].y, u_Deform_Frequency_Phase_Spread[i].z, u_DeformMoveDirs[i]);
+		}
 	}
 }
@@ -4,8 +4,10 @@ $input v_position, v_projPosition, v_shadowPosition, v_texcoord0, v_texcoord1, v
 #include "Common.sh"
 #include "SharedDefines.sh"
 #include "AlphaTest.sh"
+#include "DrawParams.sh"
 #include "DynamicLight.sh"
 #include "PortalClip.sh"
+#include "StageParams.sh"
 #include "SunLight.sh"
 
 SAMPLER2D(u_DiffuseSampler, 0); // TU_DIFFUSE
@@ -15,30 +17,17 @@ SAMPLER2D(u_LightSampler, 2); // TU_LIGHT
 #if defined(USE_SOFT_SPRITE)
 SAMPLER2D(u_DepthSampler, 3); // TU_DEPTH
 
-uniform vec4 u_DepthRange;
 uniform vec4 u_SoftSprite_Depth_UseAlpha; // only x and y used
 #endif
 
-uniform vec4 u_Bloom_Enabled_Write_Scale;
-#define u_BloomEnabled int(u_Bloom_Enabled_Write_Scale.x)
-#define u_BloomWrite int(u_Bloom_Enabled_Write_Scale.y)
-
-uniform vec4 u_Animation_Enabled_Fraction; // only x and y used
 uniform vec4 u_RenderMode; // only x used
 uniform vec4 u_ViewOrigin;
 
-uniform vec4 u_Generators;
-#define u_TexCoordGen int(u_Generators[GEN_TEXCOORD])
-#define u_ColorGen int(u_Generators[GEN_COLOR])
-#define u_AlphaGen int(u_Generators[GEN_ALPHA])
-
 // light vector
 uniform vec4 u_LightDirection;
 uniform vec4 u_DirectedLight;
 uniform vec4 u_AmbientLight;
 
-uniform vec4 u_LightType; // only x used
-
 void main()
 {
 	if (PortalClipped(v_position))
@@ -46,17 +35,17 @@ void main()
 
 	vec2 texCoord0 = v_texcoord0;
 
-	if (u_TexCoordGen == TCGEN_FRAGMENT)
+	if (u_TCGen0 == TCGEN_FRAGMENT)
 	{
 		texCoord0 = gl_FragCoord.xy * u_viewTexel.xy;
 	}
 
 	vec4 diffuse = texture2D(u_DiffuseSampler, texCoord0);
 
-	if (int(u_Animation_Enabled_Fraction.x) != 0)
+	if (u_AnimationEnabled != 0)
 	{
 		vec4 diffuse2 = texture2D(u_DiffuseSampler2, texCoord0);
-		diffuse = mix(diffuse, diffuse2, u_Animation_Enabled_Fraction.y);
+		diffuse = mix(diffuse, diffuse2, u_AnimationFraction);
 	}
 
 	diffuse.rgb = ToLinear(diffuse.rgb);
@@ -108,7 +97,7 @@ void main()
 
 	vec3 vertexColor = v_color0.rgb;
 	vec3 diffuseLight = vec3_splat(1.0);
-	int lightType = int(u_LightType.x);
+	int lightType = u_LightType;
 
 	if (lightType == LIGHT_MAP)
 	{
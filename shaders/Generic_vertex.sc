@@ -1,5 +1,5 @@
-$input a_position, a_normal, a_tangent, a_texcoord0, a_color0
-$output v_position, v_projPosition, v_shadowPosition, v_texcoord0, v_texcoord1, v_normal, v_color0
+$input a_position, a_normal, a_tangent, a_texcoord0, a_texcoord1, a_color0
+$output v_position, v_projPosition, v_shadowPosition, v_texcoord0, v_texcoord1, v_texcoord2, v_normal, v_color0
 
 /*
 ===========================================================================
@@ -25,39 +25,17 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <bgfx_shader.sh>
 #include "Common.sh"
+#include "DrawParams.sh"
 #include "Gen_Deform.sh"
 #include "Gen_Tex.sh"
 #include "SharedDefines.sh"
+#include "StageParams.sh"
 #include "SunLight.sh"
 
-uniform vec4 u_DepthRangeEnabled; // only x used
-uniform vec4 u_DepthRange;
-uniform vec4 u_BaseColor;
-uniform vec4 u_VertColor;
-uniform vec4 u_LightType; // only x used
 uniform vec4 u_ViewOrigin;
 uniform vec4 u_ViewUp;
 uniform vec4 u_LocalViewOrigin;
 uniform vec4 u_Time; // only x used
-
-uniform vec4 u_Generators;
-#define u_TCGen0 int(u_Generators[GEN_TEXCOORD])
-#define u_ColorGen int(u_Generators[GEN_COLOR])
-#define u_AlphaGen int(u_Generators[GEN_ALPHA])
-
-// tcgen
-uniform vec4 u_TCGen0Vector0;
-uniform vec4 u_TCGen0Vector1;
-
-// tcmod
-uniform vec4 u_DiffuseTexMatrix;
-uniform vec4 u_DiffuseTexOffTurb;
-
-// colorgen and alphagen
-uniform vec4 u_PortalRange;
-
-uniform vec4 u_FogEnabled; // only x used
-uniform vec4 u_FogColorMask;
 uniform vec4 u_FogDepth;
 uniform vec4 u_FogDistance;
 uniform vec4 u_FogEyeT; // only x used
@@ -101,7 +79,7 @@ vec4 CalcColor(vec4 vertColor, vec4 baseColor, vec4 colorAttrib, vec3 position,
 	}
 	else if (u_AlphaGen == AGEN_PORTAL)
 	{
-		color.a = saturate(length(viewer) / u_PortalRange.x);
+		color.a = saturate(length(viewer) / u_PortalRange);
 	}
 	
 	return color;
@@ -127,7 +105,7 @@ void main()
 		v_texcoord0 = a_texcoord0.xy;
 	}
 
-	if ((u_ColorGen != CGEN_IDENTITY || u_AlphaGen != AGEN_IDENTITY) && int(u_LightType.x) == LIGHT_NONE)
+	if ((u_ColorGen != CGEN_IDENTITY || u_AlphaGen != AGEN_IDENTITY) && u_LightType == LIGHT_NONE)
 	{
 		v_color0 = CalcColor(u_VertColor, u_BaseColor, a_color0, position, normal);
 	}
@@ -136,17 +114,22 @@ void main()
 		v_color0 = u_VertColor * a_color0 + u_BaseColor;
 	}
 
-	if (int(u_FogEnabled.x) != 0)
+	if (u_FogEnabled != 0)
 	{
 		v_color0 *= vec4_splat(1.0) - u_FogColorMask * sqrt(saturate(CalcFog(position, u_FogDepth, u_FogDistance, u_FogEyeT.x)));
 	}
 
 	vec3 wsPosition = mul(u_model[0], vec4(position, 1.0)).xyz;
 	v_texcoord1 = a_texcoord0.zw;
+#if defined(USE_TEXTURE_ARRAY)
+	v_texcoord2 = vec4(a_texcoord1, 0.0, 0.0, 0.0);
+#else
+	v_texcoord2 = vec4_splat(0.0);
+#endif
 	v_position = wsPosition;
 	v_normal = mul(u_model[0], vec4(normal, 0.0));
 	v_projPosition = mul(u_viewProj, vec4(v_position, 1.0));
-	if (int(u_DepthRangeEnabled.x) != 0)
+	if (u_DepthRangeEnabled != 0)
 		v_projPosition = ApplyDepthRange(v_projPosition, u_DepthRange.x, u_DepthRange.y);
 #if defined(USE_SUN_LIGHT)
 	v_shadowPosition = mul(u_LightModelViewProj, vec4(mul(u_model[0], vec4(a_position, 1.0)).xyz + v_normal.xyz * u_ShadowMapNormalBias, 1.0));
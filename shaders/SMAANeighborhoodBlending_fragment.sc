@@ -9,11 +9,24 @@ $input v_texcoord0, v_texcoord2
 SAMPLER2D(u_SmaaColorSampler, 0);
 SAMPLER2D(u_SmaaBlendSampler, 1);
 
+#if defined(USE_BLOOM)
+SAMPLER2D(u_BloomSampler, 2);
+
+uniform vec4 u_BloomScale; // only x used
+#endif
+
 void main()
 {
 #if BGFX_SHADER_LANGUAGE_HLSL
-	gl_FragColor = SMAANeighborhoodBlendingPS(v_texcoord0, v_texcoord2, u_SmaaColorSampler.m_texture, u_SmaaBlendSampler.m_texture);
+	vec4 color = SMAANeighborhoodBlendingPS(v_texcoord0, v_texcoord2, u_SmaaColorSampler.m_texture, u_SmaaBlendSampler.m_texture);
 #else
-	gl_FragColor = SMAANeighborhoodBlendingPS(v_texcoord0, v_texcoord2, u_SmaaColorSampler, u_SmaaBlendSampler);
+	vec4 color = SMAANeighborhoodBlendingPS(v_texcoord0, v_texcoord2, u_SmaaColorSampler, u_SmaaBlendSampler);
 #endif
+
+#if defined(USE_BLOOM)
+	// Composite bloom here instead of in a separate pass, saving a full screen write and read.
+	color.rgb += texture2D(u_BloomSampler, v_texcoord0).rgb * u_BloomScale.x;
+#endif
+
+	gl_FragColor = color;
 }
@@ -16,6 +16,8 @@
 #define DGEN_BULGE       1
 #define DGEN_MOVE        2
 #define DGEN_WAVE        3
+#define DGEN_AUTOSPRITE  4
+#define DGEN_AUTOSPRITE2 5
 
 #define DGEN_WAVE_NONE             0
 #define DGEN_WAVE_SIN              1
@@ -24,6 +26,11 @@
 #define DGEN_WAVE_SAWTOOTH         4
 #define DGEN_WAVE_INVERSE_SAWTOOTH 5
 
+// Indices into u_DrawParams.
+#define DRAW_DEPTH_RANGE 0 // x is offset, y is scale, z is near z, w is far z
+#define DRAW_FLAGS       1 // x is depth range enabled, y is fog enabled, z is bloom enabled, w is bloom write
+#define DRAW_NUM_PARAMS  2
+
 #define DLIGHT_CAPSULE 0
 #define DLIGHT_POINT   1
 
@@ -44,6 +51,18 @@
 
 #define RGBM_MAX_RANGE 8.0
 
+// Indices into u_StageParams.
+#define STAGE_GENERATORS     0 // indexed by GEN_*, w is light type
+#define STAGE_BASE_COLOR     1
+#define STAGE_VERTEX_COLOR   2
+#define STAGE_TEX_MATRIX     3
+#define STAGE_TEX_OFF_TURB   4
+#define STAGE_TCGEN_VECTOR0  5 // w is alpha test
+#define STAGE_TCGEN_VECTOR1  6 // w is portal range
+#define STAGE_FOG_COLOR_MASK 7
+#define STAGE_ANIMATION      8 // x is enabled, y is fraction
+#define STAGE_NUM_PARAMS     9
+
 #define TCGEN_NONE               0
 #define TCGEN_ENVIRONMENT_MAPPED 1
 #define TCGEN_FOG                2
@@ -57,6 +76,7 @@
 #define TEXTURE_DEBUG_B    2
 #define TEXTURE_DEBUG_RG   3
 #define TEXTURE_DEBUG_LINEAR_DEPTH 4
+#define TEXTURE_DEBUG_VELOCITY 5
 
 #define TU_DIFFUSE               0
 #define TU_DIFFUSE2              1
@@ -0,0 +1,26 @@
+#ifndef STAGE_PARAMS_SH
+#define STAGE_PARAMS_SH
+
+#include "SharedDefines.sh"
+
+// Material stage state. See MaterialStage::setShaderUniforms.
+uniform vec4 u_StageParams[STAGE_NUM_PARAMS];
+
+#define u_Generators u_StageParams[STAGE_GENERATORS]
+#define u_TCGen0 int(u_Generators[GEN_TEXCOORD])
+#define u_ColorGen int(u_Generators[GEN_COLOR])
+#define u_AlphaGen int(u_Generators[GEN_ALPHA])
+#define u_LightType int(u_Generators.w)
+#define u_BaseColor u_StageParams[STAGE_BASE_COLOR]
+#define u_VertColor u_StageParams[STAGE_VERTEX_COLOR]
+#define u_DiffuseTexMatrix u_StageParams[STAGE_TEX_MATRIX]
+#define u_DiffuseTexOffTurb u_StageParams[STAGE_TEX_OFF_TURB]
+#define u_TCGen0Vector0 u_StageParams[STAGE_TCGEN_VECTOR0]
+#define u_TCGen0Vector1 u_StageParams[STAGE_TCGEN_VECTOR1]
+#define u_AlphaTest int(u_StageParams[STAGE_TCGEN_VECTOR0].w)
+#define u_PortalRange u_StageParams[STAGE_TCGEN_VECTOR1].w
+#define u_FogColorMask u_StageParams[STAGE_FOG_COLOR_MASK]
+#define u_AnimationEnabled int(u_StageParams[STAGE_ANIMATION].x)
+#define u_AnimationFraction u_StageParams[STAGE_ANIMATION].y
+
+#endif
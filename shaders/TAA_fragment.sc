@@ -0,0 +1,39 @@
+$input v_texcoord0
+
+#include <bgfx_shader.sh>
+
+SAMPLER2D(u_TextureSampler, 0);
+SAMPLER2D(u_TaaHistorySampler, 1);
+SAMPLER2D(u_TaaVelocitySampler, 2);
+
+uniform vec4 u_TaaParams; // x is the history weight, y converts velocity y to texture coordinates, z is 1 if the history is valid
+
+void main()
+{
+	vec3 current = texture2D(u_TextureSampler, v_texcoord0).rgb;
+
+	// Clamp the history to the range of the current neighborhood. Rejects history that no longer matches, e.g. disoccluded surfaces and moving geometry without motion vectors.
+	vec3 minColor = current;
+	vec3 maxColor = current;
+
+	for (int y = -1; y <= 1; y++)
+	{
+		for (int x = -1; x <= 1; x++)
+		{
+			vec3 neighbor = texture2D(u_TextureSampler, v_texcoord0 + vec2(float(x), float(y)) * u_viewTexel.xy).rgb;
+			minColor = min(minColor, neighbor);
+			maxColor = max(maxColor, neighbor);
+		}
+	}
+
+	vec2 velocity = texture2D(u_TaaVelocitySampler, v_texcoord0).xy * vec2(0.5, u_TaaParams.y);
+	vec2 historyTexCoord = v_texcoord0 - velocity;
+	vec3 history = clamp(texture2D(u_TaaHistorySampler, historyTexCoord).rgb, minColor, maxColor);
+	float weight = u_TaaParams.x * u_TaaParams.z;
+
+	// Reproject off screen, no history.
+	if (historyTexCoord.x < 0.0 || historyTexCoord.y < 0.0 || historyTexCoord.x > 1.0 || historyTexCoord.y > 1.0)
+		weight = 0.0;
+
+	gl_FragColor = vec4(mix(current, history, weight), 1.0);
+}
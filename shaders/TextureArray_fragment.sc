@@ -0,0 +1,55 @@
+$input v_position, v_projPosition, v_shadowPosition, v_texcoord0, v_texcoord1, v_texcoord2, v_normal, v_color0
+
+#include <bgfx_shader.sh>
+#include "Common.sh"
+#include "SharedDefines.sh"
+#include "DrawParams.sh"
+#include "DynamicLight.sh"
+#include "PortalClip.sh"
+#include "SunLight.sh"
+
+SAMPLER2DARRAY(u_DiffuseSampler, 0); // TU_DIFFUSE
+SAMPLER2D(u_LightSampler, 2); // TU_LIGHT
+
+uniform vec4 u_RenderMode; // only x used
+
+#define v_textureLayer v_texcoord2.x
+
+// Simple lightmapped world materials merged into a texture array. See world::CreateTextureArrays.
+void main()
+{
+	if (PortalClipped(v_position))
+		discard;
+
+	vec4 diffuse = texture2DArray(u_DiffuseSampler, vec3(v_texcoord0, v_textureLayer));
+	diffuse.rgb = ToLinear(diffuse.rgb);
+	float alpha = diffuse.a * v_color0.a;
+	vec3 vertexColor = v_color0.rgb;
+	vec3 diffuseLight = ToLinear(texture2D(u_LightSampler, v_texcoord1).rgb);
+#if defined(USE_DYNAMIC_LIGHTS)
+	diffuseLight += CalculateDynamicLight(v_position, v_normal.xyz);
+#endif
+#if defined(USE_SUN_LIGHT)
+	diffuseLight += CalculateSunLight(v_position, v_normal.xyz, v_shadowPosition);
+#endif
+	vec4 fragColor = vec4(ToGamma(diffuse.rgb * vertexColor * diffuseLight), alpha);
+
+	if (int(u_RenderMode.x) == RENDER_MODE_LIGHTMAP)
+	{
+		fragColor = vec4(texture2D(u_LightSampler, v_texcoord1).rgb, alpha);
+	}
+
+	gl_FragData[0] = fragColor;
+
+	if (u_BloomEnabled != 0)
+	{
+		if (u_BloomWrite != 0)
+		{
+			gl_FragData[1] = fragColor;
+		}
+		else
+		{
+			gl_FragData[1] = vec4(0.0, 0.0, 0.0, fragColor.a);
+		}
+	}
+}
@@ -2,10 +2,10 @@ $input v_texcoord0
 
 #include <bgfx_shader.sh>
 #include "Common.sh"
+#include "DrawParams.sh"
 
 SAMPLER2D(u_TextureSampler, 0);
 
-uniform vec4 u_DepthRange;
 uniform vec4 u_TextureDebug; // only x used.
 
 void main()
@@ -33,6 +33,11 @@ void main()
 	{
 		gl_FragColor = vec4(vec3_splat(ToLinearDepth(tex.r, u_DepthRange.z, u_DepthRange.w)), 1.0);
 	}
+	else if (debug == TEXTURE_DEBUG_VELOCITY)
+	{
+		// Velocity is in NDC units per frame. Scale it up so small motion is visible, with no motion as mid gray.
+		gl_FragColor = vec4(saturate(0.5 + tex.rg * 16.0), 0.5, 1.0);
+	}
 	else
 	{
 		gl_FragColor = tex;
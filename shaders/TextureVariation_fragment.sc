@@ -3,23 +3,18 @@ $input v_position, v_projPosition, v_shadowPosition, v_texcoord0, v_texcoord1, v
 #include <bgfx_shader.sh>
 #include "Common.sh"
 #include "SharedDefines.sh"
+#include "DrawParams.sh"
 #define USE_DYNAMIC_LIGHTS
 #include "DynamicLight.sh"
 #include "PortalClip.sh"
+#include "StageParams.sh"
 #include "SunLight.sh"
 
 SAMPLER2D(u_DiffuseSampler, 0); // TU_DIFFUSE
 SAMPLER2D(u_LightSampler, 2); // TU_LIGHT
 
-uniform vec4 u_Bloom_Enabled_Write_Scale;
-#define u_BloomEnabled int(u_Bloom_Enabled_Write_Scale.x)
-#define u_BloomWrite int(u_Bloom_Enabled_Write_Scale.y)
-
 uniform vec4 u_RenderMode; // only x used
 
-uniform vec4 u_Generators;
-#define u_TexCoordGen int(u_Generators[GEN_TEXCOORD])
-
 
 // https://www.shadertoy.com/view/4tyGWK
 // http://www.iquilezles.org/www/articles/texturerepetition/texturerepetition.htm
@@ -70,7 +65,7 @@ void main()
 
 	vec2 texCoord0 = v_texcoord0;
 
-	if (u_TexCoordGen == TCGEN_FRAGMENT)
+	if (u_TCGen0 == TCGEN_FRAGMENT)
 	{
 		texCoord0 = gl_FragCoord.xy * u_viewTexel.xy;
 	}
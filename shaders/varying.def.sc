@@ -14,4 +14,5 @@ vec4 v_color0          : COLOR0    = vec4(1.0, 1.0, 1.0, 1.0);
 vec3 a_position   : POSITION;
 vec3 a_normal     : NORMAL;
 vec4 a_texcoord0  : TEXCOORD0;
+float a_texcoord1 : TEXCOORD1;
 vec4 a_color0     : COLOR0;